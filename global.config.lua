@@ -75,7 +75,6 @@ Life = require "life"
 Stack = require "stack"
 keymap = require "keymap"
 Progress = require "progress_bar"
-Hcache = require "header_cache"
 Threader = require "threader"
 
 --
@@ -470,10 +469,6 @@ do
 
   -- Restore to the previous mode
   function previous_mode ()
-    if Config:get("global.mode") == "index" then
-      -- Write the header cache of this maildir to disk
-      Hcache.save()
-    end
     local prev = mode_stack:pop()
     if prev == nil then
       prev = "maildir"
@@ -502,6 +497,11 @@ function Message.at_point ()
     -- Get the list of messages, and the current offset
     -- that'll let us find the message.
     local offset = Config.get_with_default("index.current", 0)
+
+    if virtual_messages() then
+      return Global:message_at(offset + 1)
+    end
+
     local msgs = get_messages()
 
     if not msgs then
@@ -627,7 +627,21 @@ function sort_messages (input)
       -- If there is record the time, do the sort, and record the time again
       --
       local t_start = os.time()
-      table.sort(input, _G[func])
+
+      --
+      -- The built-in methods are sorted natively, unless their
+      -- comparison function has been replaced.
+      --
+      local sorted = nil
+      if _G[func] == builtin_comparators[method] then
+        sorted = Global:sort(method, nil, input)
+      end
+
+      if sorted then
+        input = sorted
+      else
+        table.sort(input, _G[func])
+      end
       local t_end = os.time()
 
       -- Now show how long it took.
@@ -722,7 +736,7 @@ end
 function compare_by_from (a, b)
   Progress:step "Sorting messages"
 
-  return (a:header("From") < b:header("From"))
+  return (a:header("From"):lower() < b:header("From"):lower())
 end
 
 --
@@ -733,9 +747,32 @@ end
 function compare_by_subject (a, b)
   Progress:step "Sorting messages"
 
-  return (a:header("Subject") < b:header("Subject"))
+  return (a:header("Subject"):lower() < b:header("Subject"):lower())
+end
+
+--
+-- Compare two messages, based upon the size of their files.
+--
+-- Invoked when `index.sort` is set to `size`.
+--
+function compare_by_size (a, b)
+  Progress:step "Sorting messages"
+
+  return (File:stat(a:path())['size'] < File:stat(b:path())['size'])
 end
 
+--
+-- The comparison functions above are implemented natively, by
+-- `Global:sort`, which is used in their place unless they're redefined.
+--
+builtin_comparators = {
+  date = compare_by_date,
+  file = compare_by_file,
+  from = compare_by_from,
+  size = compare_by_size,
+  subject = compare_by_subject,
+}
+
 
 --
 -- Utility method to change the sorting method, and flush our caches
@@ -827,6 +864,31 @@ function maildirs (limit)
   return ret
 end
 
+--
+-- This function is called by the core when messages are added to, or
+-- removed from, the currently selected maildir - for example when new
+-- mail is delivered.
+--
+-- We flush our cached message-list, so that it will be rebuilt.
+--
+function on_messages_changed ()
+  global_msgs = nil
+end
+
+
+--
+-- Can we show the messages straight from the core, without building
+-- the list via `get_messages()`?  This is the case if every message is
+-- visible, in the order the core found them.
+--
+function virtual_messages ()
+  local limit = Config.get_with_default("index.limit", "all")
+  local sort = Config.get_with_default("index.sort", "file")
+
+  return (limit == "all") and (sort == "none")
+end
+
+
 --
 -- Return the appropriate set of messages:
 --
@@ -868,79 +930,18 @@ function get_messages ()
   --   All      -> All messages.
   --   New      -> All messages which are unread.
   --   Today    -> Show messages arrived today.
+  --   Attach   -> Messages which have attachments.
+  --  "query"   -> Messages matching a query, see `Global:filter`.
   --  "pattern" -> All messages matching the given pattern.
   --
+  -- Everything except a pattern is handled natively by `Global:filter`.
+  --
   local limit = Config.get_with_default("index.limit", "all")
 
-  if limit == "all" then
-    --
-    -- "All"
-    --
-    --  This could be simplified to the following:
-    --     global_msgs = msgs
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      table.insert(global_msgs, o)
-    end
-  elseif limit == "new" then
-    --
-    -- "New"
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- If the message is new add it.
-      if o:is_new() then
-        table.insert(global_msgs, o)
-      end
-    end
-
-  elseif limit == "attach" then
-
-    --
-    -- Messages with attachments.
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- If there are attachments add the message.
-      if Message.count_attachments(o) > 0 then
-        table.insert(global_msgs, o)
-      end
-    end
-
-  elseif limit == "today" then
-    --
-    -- "Today"
-    --
-    local time = os.time()
-    local today = time - (60 * 60 * 24)
-
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- get the creation-date of the message
-      local ctime = o:to_ctime()
+  local filtered = Global:filter(limit, msgs)
 
-      -- if it was within the past 24 hours then add it
-      if ctime > today then
-        table.insert(global_msgs, o)
-      end
-    end
+  if filtered then
+    global_msgs = filtered
   else
     --
     -- "Pattern"
@@ -1020,27 +1021,6 @@ function mimeparts2table (msg)
 end
 
 
---
--- Simple utility function to test if the given message is
--- new, or unread.
---
-function Message:is_new ()
-  local flags = self:flags()
-
-  -- If it has the [N]ew-flag then it is new.
-  if string.find(flags, "N") then
-    return true
-  end
-
-  -- If it has the [S]een-flag then it is not new.
-  if not string.find(flags, "S") then
-    return true
-  end
-
-  return false
-end
-
-
 --
 -- Return a suitable signature to use for the outgoing mail.
 --
@@ -2014,15 +1994,9 @@ function Maildir.select (desired, change_mode_too)
     local path = object:path()
     if string.ends(path, desired) then
 
-      -- Save the header cache of the previous selected maildir if possible.
-      Hcache.save()
-
       -- Select the maildir, to make it current.
       Global:select_maildir(object)
 
-      -- Load the header cache of the new selected maildir.
-      Hcache.load()
-
       -- And update the current selection.
       Config:set("maildir.current", index - 1)
 
@@ -2425,73 +2399,51 @@ end
 
 
 --
--- This function displays the screen when in `index`-mode.
+-- Index-mode is drawn by asking for the number of messages, via
+-- `index_view_count()`, and then formatting only the messages which are
+-- visible, via `index_view_range()`.
 --
--- It fetches the list of current messages, and calls `Message:format()`
--- on each one.
+-- If every message is visible, in the order the core found them, the
+-- message-objects are only created by the core as we ask for them - so
+-- a large folder is cheap to open.  Otherwise the messages come from
+-- `get_messages()`, which caches its result.
 --
--- As an optimization, primarily useful for large Maildirs, or when
--- using IMAP we can instead elect to only format the visible messages
--- if the setting `index.fast` is enabled.
---
-function index_view ()
-  local result = {}
-
-  -- Get the available messages.
-  local messages = get_messages()
-
-  if (messages == nil) or (#messages == 0) then
-    Screen:draw(10, 10, "There are no visible messages.")
-    return result
+function index_view_count ()
+  if virtual_messages() then
+    return Global:message_count()
   end
 
-  -- Get the current offset
-  local mode = Config:get "global.mode"
-  local cur = tonumber(Config.get_with_default("index.current", 0))
-
-  --
-  -- If the current line is bigger than the count of messages
-  -- then something has gone wrong.
-  --
-  if cur >= #messages then
-    cur = #messages - 1
-  end
-
-  -- Find the height of the screen.
-  local height = Screen:height()
+  return #get_messages()
+end
 
-  -- The minimum message number we're going to format
-  local min = cur - height
-  if min < 0 then
-    min = 0
-  end
 
-  -- The maximum message-number we're going to format.
-  local max = cur + height
+--
+-- Format the `count` messages which start at offset `first`.
+--
+function index_view_range (first, count)
+  local result = {}
+  local messages = nil
 
-  -- Are we optimizing?
-  local fast = Config.get_with_default("index.fast", 0)
-  for offset, object in ipairs(messages) do
+  if virtual_messages() then
+    messages = Global:message_range(first + 1, first + count)
+  else
+    messages = {}
 
-    local str = "INVISIBLE"
+    local all = get_messages()
+    for i = first + 1, math.min(first + count, #all) do
+      table.insert(messages, all[i])
+    end
+  end
 
-    -- If optimizing
-    if fast ~= 0 then
+  if (first == 0) and (#messages == 0) then
+    Screen:draw(10, 10, "There are no visible messages.")
+    return result
+  end
 
-      --
-      -- Only show the message if it will fit on the screen
-      --
-      if (offset >= min) and (offset < max) then
-        str = object:format(threads_indentation[object], offset)
-      else
-        str = "INVISIBLE - Outside the viewport!"
-      end
-    else
-      -- Else format all entries
-      str = object:format(threads_indentation[object], offset)
-    end
+  local indentation = threads_indentation or {}
 
-    table.insert(result, str)
+  for i, object in ipairs(messages) do
+    table.insert(result, object:format(indentation[object], first + i))
   end
 
   --
@@ -2502,6 +2454,14 @@ function index_view ()
 end
 
 
+--
+-- Return every line of index-mode.
+--
+function index_view ()
+  return index_view_range(0, index_view_count())
+end
+
+
 --
 -- This function shows our keybindings, both globally and for each mode.
 --
@@ -2825,41 +2785,66 @@ end
 
 
 --
--- This method returns the text which is displayed in maildir-view
+-- Maildir-mode is drawn by asking for the number of maildirs, via
+-- `maildir_view_count()`, and then formatting only the maildirs which
+-- are visible, via `maildir_view_range()`.
 --
--- It retrieves the list of Maildirs, and calls `Maildir:format` on
--- each one.
---
-function maildir_view ()
-  local result = {}
+do
 
-  -- Get the maildirs
-  local folders = maildirs()
+  --
+  -- The maildirs found by `maildir_view_count`, which are used for the
+  -- range which follows - so that they are only found once per frame.
+  --
+  local folders = nil
 
-  -- If we had an old selection in-place then try to
-  -- preserve that.
-  if prev_maildir then
-    info_msg("Trying to select " .. prev_maildir)
-    Maildir.select(prev_maildir, false)
-    prev_maildir = nil
-  end
+  function maildir_view_count ()
 
-  if (folders == nil) or (#folders == 0) then
-    Screen:draw(10, 10, "There are no visible folders.")
-    return result
-  end
+    -- Get the maildirs
+    folders = maildirs()
 
-  -- For each one add the output
-  for index, object in ipairs(folders) do
-    local str = object:format(index)
-    table.insert(result, str)
+    -- If we had an old selection in-place then try to
+    -- preserve that.
+    if prev_maildir then
+      info_msg("Trying to select " .. prev_maildir)
+      Maildir.select(prev_maildir, false)
+      prev_maildir = nil
+    end
+
+    return #folders
   end
 
   --
-  -- Update the colours
+  -- Format the `count` maildirs which start at offset `first`.
   --
-  result = add_colours(result, 'maildir')
-  return result
+  function maildir_view_range (first, count)
+    local result = {}
+
+    local all = folders or maildirs()
+    folders = nil
+
+    if #all == 0 then
+      Screen:draw(10, 10, "There are no visible folders.")
+      return result
+    end
+
+    for index = first + 1, math.min(first + count, #all) do
+      table.insert(result, all[index]:format(index))
+    end
+
+    --
+    -- Update the colours
+    --
+    result = add_colours(result, 'maildir')
+    return result
+  end
+end
+
+
+--
+-- Return every line of maildir-mode.
+--
+function maildir_view ()
+  return maildir_view_range(0, maildir_view_count())
 end
 
 
@@ -3171,7 +3156,13 @@ function select ()
       --
       -- Just show the folder we selected and the number of messages.
       --
-      local size = #get_messages()
+      local size = 0
+      if virtual_messages() then
+        size = Global:message_count()
+      else
+        size = #get_messages()
+      end
+
       if size == 1 then
         info_msg("Selected " .. folder:path() .. " with 1 message.")
       else
@@ -3179,9 +3170,6 @@ function select ()
       end
     end
 
-    -- Populate the header cache for this maildir
-    Hcache.load()
-
     --
     -- Change to the index-mode, so we can see the messages in
     -- the folder.
@@ -3192,14 +3180,15 @@ function select ()
 
   if mode == "index" then
     --
-    -- Get the messages
+    -- Get the message at the current offset.
     --
-    local msgs = get_messages()
+    local msg = nil
 
-    --
-    -- Get the current offset.
-    --
-    local msg = msgs[cur + 1]
+    if virtual_messages() then
+      msg = Global:message_at(cur + 1)
+    else
+      msg = get_messages()[cur + 1]
+    end
 
     if msg == nil then
       info_msg "There is nothing to select!"
@@ -3333,6 +3322,138 @@ do
   --
   local search_text = ''
 
+  --
+  -- The character-classes of Lua patterns, as PCRE writes them inside
+  -- a set.  The upper-case forms are their complements.
+  --
+  local pattern_classes = {
+    a = "[:alpha:]", c = "[:cntrl:]", d = "[:digit:]", g = "[:graph:]",
+    l = "[:lower:]", p = "[:punct:]", s = "[:space:]", u = "[:upper:]",
+    w = "[:alnum:]", x = "[:xdigit:]", z = "\\x00"
+  }
+
+  --
+  -- Translate the given Lua pattern into the equivalent PCRE regular
+  -- expression, so that the native search matches what the line search
+  -- would.
+  --
+  -- Returns nil for the few things PCRE can't express the same way -
+  -- `%b`, `%f`, and complemented classes inside a set - so those are
+  -- left to the line search.
+  --
+  local function pattern_to_regex (pattern)
+    local out = {}
+    local i = 1
+    local len = #pattern
+
+    -- Is there a single character-class for a quantifier to follow?
+    local item = false
+
+    while i <= len do
+      local c = pattern:sub(i, i)
+
+      if c == "%" then
+        local n = pattern:sub(i + 1, i + 1)
+        local class = pattern_classes[n:lower()]
+
+        if n == "" or n == "b" or n == "f" then
+          return nil
+        elseif class and n == n:lower() then
+          table.insert(out, "[" .. class .. "]")
+        elseif class then
+          table.insert(out, "[^" .. class .. "]")
+        elseif n:match("%d") then
+          table.insert(out, "\\" .. n)
+        elseif n:match("%w") then
+          table.insert(out, n)
+        else
+          table.insert(out, "\\" .. n)
+        end
+        item = true
+        i = i + 2
+
+      elseif c == "[" then
+        local set = { "[" }
+        i = i + 1
+
+        if pattern:sub(i, i) == "^" then
+          table.insert(set, "^")
+          i = i + 1
+        end
+
+        -- A leading "]" is a member of the set.
+        local first = true
+
+        while true do
+          local s = pattern:sub(i, i)
+
+          if s == "" then
+            return nil
+          elseif s == "]" and not first then
+            break
+          elseif s == "%" then
+            local n = pattern:sub(i + 1, i + 1)
+            local class = pattern_classes[n:lower()]
+
+            if n == "" or (class and n ~= n:lower()) then
+              return nil
+            elseif class then
+              table.insert(set, class)
+            elseif n:match("%w") then
+              table.insert(set, n)
+            else
+              table.insert(set, "\\" .. n)
+            end
+            i = i + 1
+          elseif s == "\\" or s == "[" or s == "]" then
+            table.insert(set, "\\" .. s)
+          else
+            table.insert(set, s)
+          end
+
+          first = false
+          i = i + 1
+        end
+
+        table.insert(out, table.concat(set) .. "]")
+        item = true
+        i = i + 1
+
+      elseif item and (c == "*" or c == "+" or c == "?" or c == "-") then
+        table.insert(out, (c == "-") and "*?" or c)
+        item = false
+        i = i + 1
+
+      elseif (c == "^" and i == 1) or (c == "$" and i == len) then
+        table.insert(out, c)
+        item = false
+        i = i + 1
+
+      elseif c == "(" or c == ")" then
+        table.insert(out, c)
+        item = false
+        i = i + 1
+
+      elseif c == "." then
+        table.insert(out, c)
+        item = true
+        i = i + 1
+
+      else
+        -- Anything else is literal in a Lua pattern.
+        if c:match("%p") then
+          table.insert(out, "\\" .. c)
+        else
+          table.insert(out, c)
+        end
+        item = true
+        i = i + 1
+      end
+    end
+
+    return table.concat(out)
+  end
+
   function find (offset)
 
     -- Get the search pattern.
@@ -3353,7 +3474,40 @@ do
     -- Get the global mode.
     local mode = Config:get "global.mode"
 
-    -- Use that to get the lines we're currently displaying
+    --
+    -- In index, maildir, and message modes we search natively, in the
+    -- background, and the selection moves once a match is found.  Any
+    -- keypress cancels the search, while repeating it uses the matches
+    -- found already.
+    --
+    -- The pattern is a Lua pattern, as it always was, which is
+    -- translated into a regular expression for the native search.  In
+    -- index mode it is matched against the From, To, Cc, and Subject
+    -- headers of each message, rather than its formatted line; maildirs
+    -- match by their path, and messages by their lines.
+    --
+    local lines = nil
+
+    if mode == "index" then
+      if not virtual_messages() then
+        lines = get_messages()
+      end
+    elseif mode == "maildir" then
+      lines = maildirs()
+    elseif mode == "message" then
+      lines = strip_colour(message_view())
+    end
+
+    local regex = pattern_to_regex(pattern)
+
+    if regex and (mode == "index" or lines) and Global:find(regex, offset, lines) then
+      return
+    end
+
+    --
+    -- Otherwise, or if the pattern couldn't be translated,
+    -- get the lines we're currently displaying and search those.
+    --
     loadstring("out = " .. mode .. "_view()")()
 
     --
@@ -3649,7 +3803,7 @@ end
 function mark_all_read ()
   local msgs = get_messages()
   if msgs and #msgs > 0 then
-    Fun.object_map('mark_read', msgs)
+    Global:current_maildir():update_flags(msgs, "S", "N")
   else
     warning_msg "There are no messages"
   end
@@ -3661,7 +3815,7 @@ end
 function mark_all_new ()
   local msgs = get_messages()
   if msgs and #msgs > 0 then
-    Fun.object_map('mark_unread', msgs)
+    Global:current_maildir():update_flags(msgs, "", "S")
   else
     warning_msg "There are no messages"
   end
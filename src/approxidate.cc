@@ -27,6 +27,13 @@ struct atm
     int tm_wday;
     int tm_yday;
     int tm_isdst;
+
+    /*
+     * Room for any fields which follow those above in the system's
+     * struct tm, such as tm_gmtoff, since we're cast to one.
+     */
+    char tm_extra[sizeof(struct tm) - (9 * sizeof(int))];
+
     long tm_usec;
 };
 
@@ -87,6 +87,19 @@ void CBasicView::draw()
     if (m_name.empty())
         return;
 
+    /*
+     * If the view can tell us how many lines it holds then we only ask
+     * it for those which are visible.
+     */
+    CLua *lua = CLua::instance();
+    int total = 0;
+
+    if (lua->function2count(m_function + "_count", total))
+    {
+        draw_range(total);
+        return;
+    }
+
     /*
      * Get the text we're supposed to display, by invoking our
      * lua function.
@@ -142,6 +155,48 @@ void CBasicView::draw()
 }
 
 
+/*
+ * Draw the given number of lines, fetching only those which are visible
+ * from our Lua function.
+ */
+void CBasicView::draw_range(int max)
+{
+    CConfig *config = CConfig::instance();
+    config->set(m_name + ".max", max, false);
+
+    int cur = config->get_integer(m_name + ".current");
+
+    /*
+     * Ensure our highlight isn't outside reasonable bounds.
+     */
+    if (cur >= max)
+        cur = max - 1;
+
+    if (cur < 0)
+        cur = 0;
+
+    if (cur != config->get_integer(m_name + ".current"))
+        config->set(m_name + ".current", cur, false);
+
+    /*
+     * Fetch the lines which will be drawn - the view is asked even if
+     * it is empty, so that it may say so.
+     */
+    CScreen *screen = CScreen::instance();
+
+    int count = 0;
+    int first = screen->visible_lines(cur, max, m_simple, count);
+
+    std::vector<std::string> lines;
+    CLua *lua = CLua::instance();
+
+    if ((! lua->function2range(m_function + "_range", first, count, lines)) || (max < 1))
+        return;
+
+    screen->draw_text_lines(lines, cur, max, m_simple, first);
+}
+
+
 /*
  * Called when things are idle.  NOP.
  */
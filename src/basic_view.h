@@ -40,6 +40,13 @@
  * we draw the text, and in complex-modes we draw a highlight over
  * the current line.
  *
+ * If the Lua functions `$function_count` and `$function_range` are
+ * defined they are used instead of `$function`: the first returns the
+ * number of lines, and the second is given the (zero-based) offset of
+ * the first visible line and the number of rows on screen, returning
+ * only those lines - so the cost of drawing a view doesn't grow with
+ * the number of lines it holds.
+ *
  * Simple modes also allow line-wrapping, wheras the complex ones do not
  * (because that would involve breaking the assumption that a single line
  * can be highlighted, and that line is literally one line).
@@ -88,6 +95,12 @@ private:
      */
     std::vector<std::string> get_text(std::string function);
 
+    /**
+     * Draw a view of the given number of lines, fetching only those which
+     * are visible via `$function_range`.
+     */
+    void draw_range(int max);
+
     /**
      * The name of this mode.  e.g. "lua", "index", etc.
      */
@@ -0,0 +1,206 @@
+/*
+ * benchmark.cc - Time the expensive parts of lumail against a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <gmime/gmime.h>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark.h"
+#include "directory.h"
+#include "header_scanner.h"
+#include "message.h"
+
+
+/*
+ * The number of times each benchmark is repeated - the fastest run is
+ * reported.
+ */
+#define BENCHMARK_RUNS 5
+
+
+/*
+ * Read every message of the given maildir into memory.
+ */
+static void load_corpus(std::string maildir, std::vector<std::string> &corpus)
+{
+    std::string dirs[] = { "/cur", "/new" };
+
+    for (std::string dir : dirs)
+    {
+        CDirectoryListing listing;
+
+        if (! CDirectory::files(maildir + dir, listing))
+            continue;
+
+        for (size_t i = 0; i < listing.names.size(); i++)
+        {
+            std::ifstream in(listing.path(i), std::ios::in | std::ios::binary);
+            std::stringstream contents;
+            contents << in.rdbuf();
+
+            corpus.push_back(contents.str());
+        }
+    }
+}
+
+
+/*
+ * Parse the headers of a message the way we did before we had a
+ * scanner - by having GMime construct the whole message.
+ */
+static size_t gmime_headers(const std::string &message)
+{
+    GMimeStream *stream = g_mime_stream_mem_new_with_buffer(message.data(), message.size());
+    GMimeParser *parser = g_mime_parser_new_with_stream(stream);
+    g_object_unref(stream);
+
+    GMimeMessage *msg = g_mime_parser_construct_message(parser);
+    g_object_unref(parser);
+
+    if (msg == NULL)
+        return 0;
+
+    std::unordered_map<std::string, std::string> headers;
+
+    GMimeHeaderList *ls   = GMIME_OBJECT(msg)->headers;
+    GMimeHeaderIter *iter = g_mime_header_iter_new();
+
+    if (g_mime_header_list_get_iter(ls, iter) && g_mime_header_iter_first(iter))
+    {
+        while (g_mime_header_iter_is_valid(iter))
+        {
+            std::string name = g_mime_header_iter_get_name(iter);
+
+            for (char &c : name)
+                c = tolower(c);
+
+            char *decoded = g_mime_utils_header_decode_text(g_mime_header_iter_get_value(iter));
+            headers[name] = decoded;
+            free(decoded);
+
+            if (!g_mime_header_iter_next(iter))
+                break;
+        }
+    }
+
+    g_mime_header_iter_free(iter);
+    g_object_unref(msg);
+
+    return (headers.size());
+}
+
+
+/*
+ * Parse the headers of a message with our scanner.
+ */
+static size_t scanned_headers(const std::string &message)
+{
+    size_t end = CHeaderScanner::header_end(message.data(), message.size());
+
+    std::string block = (end == std::string::npos) ? message : message.substr(0, end);
+
+    CHeaderArena headers;
+    CMessage::parse_headers(block, headers);
+
+    return (headers.size());
+}
+
+
+/*
+ * Time the given parser across the whole corpus, and report the fastest
+ * of several runs.
+ */
+static void time_parser(const std::string &label, const std::vector<std::string> &corpus,
+                        size_t bytes, std::function<size_t(const std::string &)> parser)
+{
+    double best = 0;
+    size_t found = 0;
+
+    for (int run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        found = 0;
+
+        for (const std::string &message : corpus)
+            found += parser(message);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if ((run == 0) || (elapsed.count() < best))
+            best = elapsed.count();
+    }
+
+    printf("%-24s %10.3f ms %10.1f MB/s %10zu headers\n",
+           label.c_str(), best * 1000, (best > 0) ? (bytes / best / (1024 * 1024)) : 0, found);
+}
+
+
+/*
+ * Run our benchmarks.
+ */
+bool run_benchmarks(std::string maildir)
+{
+    std::vector<std::string> corpus;
+    load_corpus(maildir, corpus);
+
+    if (corpus.empty())
+    {
+        std::cerr << "No messages found beneath " << maildir << std::endl;
+        return false;
+    }
+
+    size_t bytes = 0;
+
+    for (const std::string &message : corpus)
+        bytes += message.size();
+
+    printf("%zu messages, %zu bytes\n\n", corpus.size(), bytes);
+
+    /*
+     * Header extraction.
+     */
+    time_parser("headers: gmime", corpus, bytes, gmime_headers);
+
+    CHeaderScanner::CImplementation original = CHeaderScanner::implementation();
+
+    CHeaderScanner::CImplementation all[] = { CHeaderScanner::SCALAR,
+                                              CHeaderScanner::SSE2,
+                                              CHeaderScanner::AVX2
+                                            };
+
+    for (CHeaderScanner::CImplementation impl : all)
+    {
+        if (! CHeaderScanner::set_implementation(impl))
+            continue;
+
+        time_parser(std::string("headers: ") + CHeaderScanner::implementation_name(impl),
+                    corpus, bytes, scanned_headers);
+    }
+
+    CHeaderScanner::set_implementation(original);
+    return true;
+}
@@ -0,0 +1,32 @@
+/*
+ * benchmark.h - Time the expensive parts of lumail against a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <string>
+
+
+/**
+ * Run our benchmarks against the messages of the given maildir, writing
+ * the results to STDOUT.
+ *
+ * This is invoked via `lumail2 --benchmark ~/Maildir/foo`, and returns
+ * false if the maildir contains no messages.
+ */
+bool run_benchmarks(std::string maildir);
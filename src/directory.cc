@@ -17,8 +17,17 @@
  */
 
 
+#include <algorithm>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "directory.h"
 #include "util.h"
@@ -44,34 +53,221 @@ std::vector < std::string > CDirectory::entries(std::string prefix)
 {
     std::vector < std::string > result;
 
-    dirent *de;
-    DIR *dp;
+    int fd = open(prefix.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-    if ((dp = opendir(prefix.c_str())) != NULL)
+    if (fd != -1)
     {
+        std::vector<CDirectoryEntry> found;
+        read_entries(fd, found);
+        close(fd);
+
+        result.reserve(found.size() + 1);
         result.push_back(prefix);
 
-        while ((de = readdir(dp)) != NULL)
+        for (const CDirectoryEntry &entry : found)
         {
             /*
              * Build up a string - removing duplicate "/" characters.
              */
-            std::string r = prefix + "/" + de->d_name;
+            std::string r = prefix + "/" + entry.name;
             r.erase(std::unique(r.begin(), r.end(), both_slashes()), r.end());
 
-
             result.push_back(r);
         }
     }
 
-    closedir(dp);
-
     std::sort(result.begin(), result.end());
 
     return result;
 }
 
 
+/*
+ * Find the files within the given directory.
+ */
+bool CDirectory::files(std::string path, CDirectoryListing &result, bool sorted)
+{
+    /*
+     * Setup the prefix, once, removing duplicate "/" characters.
+     */
+    result.prefix = path + "/";
+    result.prefix.erase(std::unique(result.prefix.begin(), result.prefix.end(), both_slashes()),
+                        result.prefix.end());
+    result.names.clear();
+    result.inodes.clear();
+
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    std::vector<CDirectoryEntry> found;
+    bool ret = read_entries(fd, found);
+
+    std::vector<const CDirectoryEntry *> files;
+    files.reserve(found.size());
+
+    for (const CDirectoryEntry &entry : found)
+    {
+        /*
+         * Symlinks are followed, so they're excluded only if they
+         * point to a directory.
+         */
+        if (entry.type == DT_LNK)
+        {
+            struct stat sb;
+
+            if ((fstatat(fd, entry.name.c_str(), &sb, 0) == 0) && S_ISDIR(sb.st_mode))
+                continue;
+        }
+        else if (is_directory(fd, entry))
+        {
+            continue;
+        }
+
+        files.push_back(&entry);
+    }
+
+    close(fd);
+
+    if (sorted)
+    {
+        std::sort(files.begin(), files.end(),
+                  [](const CDirectoryEntry * a, const CDirectoryEntry * b)
+        {
+            return (a->name < b->name);
+        });
+    }
+
+    result.names.reserve(files.size());
+    result.inodes.reserve(files.size());
+
+    for (const CDirectoryEntry *entry : files)
+    {
+        result.names.push_back(entry->name);
+        result.inodes.push_back(entry->inode);
+    }
+
+    return (ret);
+}
+
+
+#ifdef __linux__
+
+/*
+ * The structure returned by the getdents64 system-call, which glibc
+ * doesn't define for us.
+ */
+struct linux_dirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+#endif
+
+
+/*
+ * Read all the entries from the given directory-handle.
+ */
+bool CDirectory::read_entries(int fd, std::vector<CDirectoryEntry> &result)
+{
+    /*
+     * Always start from the beginning.
+     */
+    if (lseek(fd, 0, SEEK_SET) == -1)
+        return false;
+
+#ifdef __linux__
+
+    char buf[32768] __attribute__((aligned(8)));
+
+    while (true)
+    {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+
+        if (n < 0)
+            return false;
+
+        if (n == 0)
+            break;
+
+        long offset = 0;
+
+        while (offset < n)
+        {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + offset);
+
+            CDirectoryEntry entry;
+            entry.name  = de->d_name;
+            entry.type  = de->d_type;
+            entry.inode = de->d_ino;
+            result.push_back(entry);
+
+            offset += de->d_reclen;
+        }
+    }
+
+    return true;
+#else
+
+    /*
+     * Elsewhere we use readdir() upon a copy of the handle, because
+     * closedir() will close the descriptor it was given.
+     */
+    int copy = dup(fd);
+
+    if (copy == -1)
+        return false;
+
+    DIR *dp = fdopendir(copy);
+
+    if (dp == NULL)
+    {
+        close(copy);
+        return false;
+    }
+
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        CDirectoryEntry entry;
+        entry.name  = de->d_name;
+        entry.type  = de->d_type;
+        entry.inode = de->d_ino;
+        result.push_back(entry);
+    }
+
+    closedir(dp);
+    return true;
+#endif
+}
+
+
+/*
+ * Is the given entry a directory?
+ */
+bool CDirectory::is_directory(int fd, const CDirectoryEntry &entry)
+{
+    if (entry.type == DT_DIR)
+        return true;
+
+    if (entry.type != DT_UNKNOWN)
+        return false;
+
+    struct stat sb;
+
+    if (fstatat(fd, entry.name.c_str(), &sb, 0) != 0)
+        return false;
+
+    return (S_ISDIR(sb.st_mode));
+}
+
+
 /*
  * Make the directory, including any parents.
  */
@@ -20,9 +20,69 @@
 #pragma once
 
 
+#include <stdint.h>
 #include <vector>
 #include <string>
 
+
+/**
+ * A single entry read from a directory, via `CDirectory::read_entries()`.
+ */
+struct CDirectoryEntry
+{
+    /**
+     * The name of the entry, relative to the directory.
+     */
+    std::string name;
+
+    /**
+     * The type of the entry, as one of the `DT_` constants.
+     *
+     * This will be `DT_UNKNOWN` on filesystems which don't report
+     * the type when a directory is read.
+     */
+    unsigned char type;
+
+    /**
+     * The inode-number of the entry.
+     */
+    uint64_t inode;
+};
+
+
+/**
+ * The files found within a single directory, via `CDirectory::files()`.
+ *
+ * Rather than storing the complete path of each file we store the
+ * path of the directory once, and the names relative to it.
+ */
+struct CDirectoryListing
+{
+    /**
+     * The directory, including a trailing "/".
+     */
+    std::string prefix;
+
+    /**
+     * The names of the files within it.
+     */
+    std::vector<std::string> names;
+
+    /**
+     * The inode-number of each file, in the same order as the names.
+     */
+    std::vector<uint64_t> inodes;
+
+    /**
+     * Return the complete path of the given entry.
+     */
+    std::string path(size_t offset) const
+    {
+        return (prefix + names.at(offset));
+    }
+};
+
+
 /**
  *
  * A collection of directory utility primitives.
@@ -51,4 +111,32 @@ public:
      */
     static void mkdir_p(std::string path);
 
+    /**
+     * Find the files, i.e. all entries except directories, within the
+     * given directory.
+     *
+     * Unlike `entries()` this doesn't `stat()` each entry - unless the
+     * filesystem doesn't tell us the type of the entry - nor build a
+     * complete path for each.  The names are returned in the order the
+     * filesystem returns them, unless `sorted` is true.
+     */
+    static bool files(std::string path, CDirectoryListing &result, bool sorted = false);
+
+    /**
+     * Read all of the entries from the open directory `fd`, including
+     * "." and "..", in the order the filesystem returns them.
+     *
+     * Upon Linux this uses `getdents64` directly, which avoids the
+     * allocation of a `DIR` handle, and reads many entries per call.
+     */
+    static bool read_entries(int fd, std::vector<CDirectoryEntry> &result);
+
+    /**
+     * Is the given entry, beneath the open directory `fd`, a directory?
+     *
+     * This trusts the type of the entry, and only resorts to `fstatat()`
+     * if that is unknown.
+     */
+    static bool is_directory(int fd, const CDirectoryEntry &entry);
+
 };
@@ -20,6 +20,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -64,6 +65,62 @@ void TestDirectoryEntries(CuTest * tc)
 }
 
 
+/**
+ * Test CDirectory::files()
+ */
+void TestDirectoryFiles(CuTest * tc)
+{
+    char tmpl[] = "/tmp/files.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+    std::string p = std::string(tmpl);
+
+    /*
+     * Create some files, and a sub-directory.
+     */
+    const char *names[] = { "c", "a", "b:2,S" };
+
+    for (const char *name : names)
+    {
+        std::ofstream out(p + "/" + name);
+        out << "test\n";
+        out.close();
+    }
+
+    CDirectory::mkdir_p(p + "/subdir");
+
+    /*
+     * Only the files are returned, relative to the prefix, and
+     * in order if we ask for that.
+     */
+    CDirectoryListing listing;
+    CuAssertTrue(tc, CDirectory::files(p + "//", listing, true));
+
+    CuAssertStrEquals(tc, std::string(p + "/").c_str(), listing.prefix.c_str());
+    CuAssertIntEquals(tc, 3, listing.names.size());
+    CuAssertStrEquals(tc, "a", listing.names.at(0).c_str());
+    CuAssertStrEquals(tc, "b:2,S", listing.names.at(1).c_str());
+    CuAssertStrEquals(tc, "c", listing.names.at(2).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/c").c_str(), listing.path(2).c_str());
+
+    /*
+     * A missing directory is an error.
+     */
+    CDirectoryListing missing;
+    CuAssertTrue(tc, ! CDirectory::files(p + "/missing", missing));
+    CuAssertIntEquals(tc, 0, missing.names.size());
+
+    /*
+     * Cleanup.
+     */
+    for (const char *name : names)
+        unlink(std::string(p + "/" + name).c_str());
+
+    rmdir(std::string(p + "/subdir").c_str());
+    rmdir(p.c_str());
+    CuAssertTrue(tc, ! CDirectory::exists(p));
+}
+
+
 /**
  * Test CDirectory::exists()
  */
@@ -168,6 +225,7 @@ directory_getsuite()
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestDirectoryEntries);
     SUITE_ADD_TEST(suite, TestDirectoryExists);
+    SUITE_ADD_TEST(suite, TestDirectoryFiles);
     SUITE_ADD_TEST(suite, TestDirectoryMkdir);
     return suite;
 }
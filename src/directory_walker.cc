@@ -0,0 +1,241 @@
+/*
+ * directory_walker.cc - Walk directory trees in parallel.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+#include "directory.h"
+#include "directory_walker.h"
+
+
+/*
+ * The most threads we'll use, regardless of the number of CPUs.
+ */
+#define MAX_WALKER_THREADS 8
+
+
+/*
+ * Close a directory-handle.
+ */
+CDirectoryWalker::CHandle::~CHandle()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+
+/*
+ * Constructor.
+ */
+CDirectoryWalker::CDirectoryWalker(int threads)
+{
+    if (threads <= 0)
+    {
+        threads = std::thread::hardware_concurrency();
+
+        if (threads > MAX_WALKER_THREADS)
+            threads = MAX_WALKER_THREADS;
+    }
+
+    if (threads < 1)
+        threads = 1;
+
+    m_threads = threads;
+    m_pending = 0;
+}
+
+
+/*
+ * Walk each of the given roots.
+ */
+void CDirectoryWalker::walk(std::vector<std::string> roots, CVisitor visitor)
+{
+    m_visitor = visitor;
+
+    m_queues.clear();
+
+    for (int i = 0; i < m_threads; i++)
+        m_queues.push_back(std::unique_ptr<CQueue>(new CQueue));
+
+    /*
+     * Deal the roots out amongst the threads.
+     */
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        CTask task;
+        task.path  = roots.at(i);
+        task.root  = i;
+        task.depth = 0;
+
+        m_pending += 1;
+        m_queues.at(i % m_threads)->tasks.push_back(task);
+    }
+
+    /*
+     * The calling thread does its share of the work too.
+     */
+    std::vector<std::thread> threads;
+
+    for (int i = 1; i < m_threads; i++)
+        threads.push_back(std::thread(&CDirectoryWalker::worker, this, i));
+
+    worker(0);
+
+    for (std::thread &t : threads)
+        t.join();
+
+    m_queues.clear();
+}
+
+
+/*
+ * The main-loop of each thread.
+ */
+void CDirectoryWalker::worker(size_t id)
+{
+    /*
+     * We keep going until every task is complete, not merely until our
+     * own queue is empty, since a task in progress elsewhere might
+     * queue more work for us to steal.
+     */
+    while (m_pending > 0)
+    {
+        CTask task;
+
+        if (next_task(id, task))
+        {
+            process(id, task);
+            m_pending -= 1;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+/*
+ * Find the next task for the given thread.
+ */
+bool CDirectoryWalker::next_task(size_t id, CTask &task)
+{
+    /*
+     * Our own work comes from the back of our queue, depth-first.
+     */
+    {
+        CQueue *own = m_queues.at(id).get();
+        std::lock_guard<std::mutex> guard(own->lock);
+
+        if (! own->tasks.empty())
+        {
+            task = own->tasks.back();
+            own->tasks.pop_back();
+            return true;
+        }
+    }
+
+    /*
+     * Otherwise steal from the front of somebody else's, which is where
+     * the directories nearest to the root will be.
+     */
+    for (size_t i = 1; i < m_queues.size(); i++)
+    {
+        CQueue *other = m_queues.at((id + i) % m_queues.size()).get();
+        std::lock_guard<std::mutex> guard(other->lock);
+
+        if (! other->tasks.empty())
+        {
+            task = other->tasks.front();
+            other->tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Visit a directory, queuing its children.
+ */
+void CDirectoryWalker::process(size_t id, CTask &task)
+{
+    int fd;
+
+    if (task.parent)
+        fd = openat(task.parent->fd, task.name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    else
+        fd = open(task.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    /*
+     * Once we've opened the directory we don't need our parent, which
+     * will be closed once all its children have been opened.
+     */
+    task.parent.reset();
+
+    if (fd == -1)
+        return;
+
+    std::shared_ptr<CHandle> handle = std::make_shared<CHandle>(fd);
+
+    std::vector<CDirectoryEntry> entries;
+
+    if (! CDirectory::read_entries(fd, entries))
+        return;
+
+    /*
+     * Find the sub-directories.
+     */
+    std::vector<std::string> subdirs;
+
+    for (const CDirectoryEntry &entry : entries)
+    {
+        if ((entry.name == ".") || (entry.name == ".."))
+            continue;
+
+        if (CDirectory::is_directory(fd, entry))
+            subdirs.push_back(entry.name);
+    }
+
+    m_visitor(task.root, task.path, task.depth, subdirs);
+
+    if (subdirs.empty())
+        return;
+
+    /*
+     * Queue the children which the visitor wants us to descend into.
+     */
+    CQueue *own = m_queues.at(id).get();
+    std::lock_guard<std::mutex> guard(own->lock);
+
+    for (std::string name : subdirs)
+    {
+        CTask child;
+        child.parent = handle;
+        child.name   = name;
+        child.path   = task.path + "/" + name;
+        child.root   = task.root;
+        child.depth  = task.depth + 1;
+
+        m_pending += 1;
+        own->tasks.push_back(child);
+    }
+}
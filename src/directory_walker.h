@@ -0,0 +1,161 @@
+/*
+ * directory_walker.h - Walk directory trees in parallel.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * This class walks one or more directory trees, using a pool of threads.
+ *
+ * Each thread has its own queue of directories to visit, which it works
+ * through depth-first.  A thread which runs out of work steals from the
+ * other end of another thread's queue, so that large sub-trees are spread
+ * across the pool.
+ *
+ * Sub-directories are opened with `openat()`, relative to a handle upon
+ * their parent, and read with `CDirectory::read_entries()` - so there is
+ * no path resolution, nor `stat()`, for each directory visited.
+ *
+ */
+class CDirectoryWalker
+{
+public:
+
+    /**
+     * The function invoked for each directory visited.
+     *
+     * It receives the index of the root the directory was found beneath,
+     * the path of the directory, its depth beneath that root, and the names
+     * of its sub-directories.  Any names left in `subdirs` are descended into.
+     *
+     * **NOTE**: This is invoked from several threads at once.
+     */
+    typedef std::function<void(size_t root, const std::string &path, int depth,
+                               std::vector<std::string> &subdirs)> CVisitor;
+
+    /**
+     * Constructor.  If `threads` is zero we use one thread per CPU,
+     * up to a sensible limit.
+     */
+    CDirectoryWalker(int threads = 0);
+
+    /**
+     * Walk each of the given roots, invoking the visitor for every
+     * directory beneath them.  This returns once the walk is complete.
+     */
+    void walk(std::vector<std::string> roots, CVisitor visitor);
+
+private:
+
+    /**
+     * An open directory-handle, which is closed once the last of the
+     * sub-directories which refer to it have been opened.
+     */
+    struct CHandle
+    {
+        CHandle(int f) : fd(f) {}
+        ~CHandle();
+        int fd;
+    };
+
+    /**
+     * A directory which is waiting to be visited.
+     */
+    struct CTask
+    {
+        /**
+         * The handle of the parent directory, or NULL for a root.
+         */
+        std::shared_ptr<CHandle> parent;
+
+        /**
+         * The name of this directory, relative to the parent.
+         */
+        std::string name;
+
+        /**
+         * The complete path of this directory.
+         */
+        std::string path;
+
+        /**
+         * The root this directory is beneath.
+         */
+        size_t root;
+
+        /**
+         * The depth of this directory beneath that root.
+         */
+        int depth;
+    };
+
+    /**
+     * The queue of tasks belonging to a single thread.
+     */
+    struct CQueue
+    {
+        std::mutex lock;
+        std::deque<CTask> tasks;
+    };
+
+    /**
+     * The main-loop of each thread.
+     */
+    void worker(size_t id);
+
+    /**
+     * Find the next task for the given thread, stealing if we must.
+     */
+    bool next_task(size_t id, CTask &task);
+
+    /**
+     * Visit the directory a task refers to, queuing its children.
+     */
+    void process(size_t id, CTask &task);
+
+private:
+
+    /**
+     * The number of threads we use.
+     */
+    int m_threads;
+
+    /**
+     * The per-thread queues.
+     */
+    std::vector<std::unique_ptr<CQueue> > m_queues;
+
+    /**
+     * The number of tasks which are queued, or in progress.
+     */
+    std::atomic<int> m_pending;
+
+    /**
+     * The function invoked for each directory.
+     */
+    CVisitor m_visitor;
+};
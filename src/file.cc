@@ -25,9 +25,11 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <mutex>
 #include <unistd.h>
 #include <wordexp.h>
 
+#include "directory_walker.h"
 #include "file.h"
 
 
@@ -146,66 +148,106 @@ int CFile::size(std::string path)
 }
 
 
+/*
+ * Return the modification-time of a stat-buffer, in nanoseconds.
+ */
+int64_t CFile::mtime_ns(const struct stat &sb)
+{
+#ifdef __APPLE__
+    return ((int64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec);
+#else
+    return ((int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec);
+#endif
+}
+
+
 /*
  * Return a sorted list of maildirs beneath the given prefix.
  */
 std::vector < std::string > CFile::get_all_maildirs(std::string prefix)
 {
-    std::vector < std::string > result;
+    std::vector<std::string> prefixes;
+    prefixes.push_back(prefix);
 
-    dirent *de;
-    DIR *dp;
+    return (get_all_maildirs(prefixes));
+}
 
-    dp = opendir(prefix.c_str());
 
-    if (dp)
+/*
+ * Return the maildirs beneath each of the given prefixes.
+ */
+std::vector < std::string > CFile::get_all_maildirs(std::vector<std::string> prefixes,
+        std::vector<std::string> *directories)
+{
+    /*
+     * The maildirs found beneath each prefix.
+     */
+    std::vector < std::vector < std::string > > found(prefixes.size());
+    std::mutex lock;
+
+    CDirectoryWalker walker;
+    walker.walk(prefixes, [&](size_t root, const std::string & path, int depth,
+                              std::vector<std::string> &subdirs)
     {
-        if (CFile::is_maildir(prefix))
-            result.push_back(prefix);
+        /*
+         * We can tell if this is a maildir from the names of its
+         * sub-directories, without stat()ing them again.
+         */
+        bool cur = false, tmp = false, nw = false;
 
-        while (true)
+        for (const std::string &name : subdirs)
         {
-            de = readdir(dp);
-
-            if (de == NULL)
-                break;
-
-            if ((strcmp(de->d_name, ".") != 0) &&
-                    (strcmp(de->d_name, "..") != 0) &&
-                    ((de->d_type == DT_UNKNOWN) || (de->d_type == DT_DIR)))
-            {
-                std::string subdir_name = std::string(de->d_name);
-                std::string subdir_path =
-                    std::string(prefix + "/" + subdir_name);
-
-                if (CFile::is_maildir(subdir_path))
-                    result.push_back(subdir_path);
-                else
-                {
-                    if (subdir_name != "." && subdir_name != "..")
-                    {
-                        DIR *sdp = opendir(subdir_path.c_str());
-
-                        if (sdp)
-                        {
-                            closedir(sdp);
-                            std::vector < std::string > sub_maildirs;
-                            sub_maildirs = CFile::get_all_maildirs(subdir_path);
-
-                            for (std::string sub_maildir : sub_maildirs)
-                            {
-                                result.push_back(sub_maildir);
-                            }
-                        }
-                    }
-                }
-            }
+            if (name == "cur")
+                cur = true;
+            else if (name == "tmp")
+                tmp = true;
+            else if (name == "new")
+                nw = true;
         }
 
-        closedir(dp);
-        std::sort(result.begin(), result.end());
+        bool maildir = (cur && tmp && nw);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            if (maildir)
+                found.at(root).push_back(path);
+
+            if (directories && ((! maildir) || (depth == 0)))
+                directories->push_back(path);
+        }
+
+        if (! maildir)
+            return;
+
+        /*
+         * We don't look for maildirs inside maildirs, unless the
+         * maildir is the prefix itself - as with Maildir++ folders.
+         */
+        if (depth > 0)
+        {
+            subdirs.clear();
+            return;
+        }
+
+        subdirs.erase(std::remove_if(subdirs.begin(), subdirs.end(),
+                                     [](const std::string & name)
+        {
+            return ((name == "cur") || (name == "tmp") || (name == "new"));
+        }), subdirs.end());
+    });
+
+    std::vector < std::string > result;
+
+    for (std::vector < std::string > &maildirs : found)
+    {
+        std::sort(maildirs.begin(), maildirs.end());
+        result.insert(result.end(), maildirs.begin(), maildirs.end());
     }
 
+    if (directories)
+        std::sort(directories->begin(), directories->end());
+
     return result;
 }
 
@@ -20,8 +20,10 @@
 #pragma once
 
 
-#include <vector>
+#include <stdint.h>
 #include <string>
+#include <sys/stat.h>
+#include <vector>
 
 
 /**
@@ -83,10 +85,28 @@ public:
      */
     static int size(std::string path);
 
+    /**
+     * Return the modification-time of a stat-buffer, in nanoseconds.
+     */
+    static int64_t mtime_ns(const struct stat &sb);
+
 
     /**
      * Return a sorted list of maildirs beneath the given prefix.
      */
     static std::vector < std::string > get_all_maildirs(std::string prefix);
 
+    /**
+     * Return the maildirs beneath each of the given prefixes.
+     *
+     * The prefixes are walked in parallel.  The result holds the
+     * maildirs of each prefix in turn, each set being sorted.
+     *
+     * If `directories` is given then it receives the sorted paths of the
+     * other directories which were searched - each prefix, and the plain
+     * directories beneath it - in which new maildirs might appear.
+     */
+    static std::vector < std::string > get_all_maildirs(std::vector<std::string> prefixes,
+            std::vector<std::string> *directories = NULL);
+
 };
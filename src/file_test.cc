@@ -18,8 +18,10 @@
 
 
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -428,6 +430,88 @@ void TestFileMaildir(CuTest * tc)
 }
 
 
+/**
+ * Test CFile::get_all_maildirs()
+ */
+void TestFileAllMaildirs(CuTest * tc)
+{
+    char tmpl[] = "/tmp/maildirs.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+    std::string p = std::string(tmpl);
+
+    /*
+     * The prefix is a maildir, with Maildir++ folders beneath it,
+     * and there are more maildirs nested in plain directories.
+     */
+    std::vector < std::string > maildirs;
+    maildirs.push_back(p);
+    maildirs.push_back(p + "/.Sent");
+    maildirs.push_back(p + "/lists/debian");
+    maildirs.push_back(p + "/lists/misc/lua");
+
+    for (std::string maildir : maildirs)
+    {
+        CDirectory::mkdir_p(maildir + "/cur");
+        CDirectory::mkdir_p(maildir + "/new");
+        CDirectory::mkdir_p(maildir + "/tmp");
+    }
+
+    /*
+     * A maildir inside a maildir isn't found, and neither is a
+     * directory which is only partially a maildir.
+     */
+    CDirectory::mkdir_p(p + "/.Sent/inner/cur");
+    CDirectory::mkdir_p(p + "/.Sent/inner/new");
+    CDirectory::mkdir_p(p + "/.Sent/inner/tmp");
+    CDirectory::mkdir_p(p + "/lists/broken/cur");
+
+    std::vector < std::string > found = CFile::get_all_maildirs(p);
+    CuAssertIntEquals(tc, 4, found.size());
+
+    std::sort(maildirs.begin(), maildirs.end());
+
+    for (size_t i = 0; i < maildirs.size(); i++)
+        CuAssertStrEquals(tc, maildirs.at(i).c_str(), found.at(i).c_str());
+
+    /*
+     * The directories searched are the prefix, and the plain directories
+     * beneath it - not the maildirs beneath it, nor their contents.
+     */
+    std::vector < std::string > prefix;
+    prefix.push_back(p);
+
+    std::vector < std::string > searched;
+    CFile::get_all_maildirs(prefix, &searched);
+    CuAssertIntEquals(tc, 5, searched.size());
+    CuAssertStrEquals(tc, p.c_str(), searched.at(0).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/lists").c_str(), searched.at(1).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/lists/broken").c_str(), searched.at(2).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/lists/broken/cur").c_str(), searched.at(3).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/lists/misc").c_str(), searched.at(4).c_str());
+
+    /*
+     * Multiple prefixes are returned in order.  Since `.Sent` is now
+     * a prefix the maildir inside it is found.
+     */
+    std::vector < std::string > prefixes;
+    prefixes.push_back(p + "/lists");
+    prefixes.push_back(p + "/.Sent");
+
+    found = CFile::get_all_maildirs(prefixes);
+    CuAssertIntEquals(tc, 4, found.size());
+    CuAssertStrEquals(tc, std::string(p + "/lists/debian").c_str(), found.at(0).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/lists/misc/lua").c_str(), found.at(1).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/.Sent").c_str(), found.at(2).c_str());
+    CuAssertStrEquals(tc, std::string(p + "/.Sent/inner").c_str(), found.at(3).c_str());
+
+    /*
+     * Cleanup.
+     */
+    std::string cmd = "rm -rf " + p;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
 /**
  * Test CFile::expand_path()
  */
@@ -474,6 +558,7 @@ CuSuite *
 file_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFileAllMaildirs);
     SUITE_ADD_TEST(suite, TestFileBasename);
     SUITE_ADD_TEST(suite, TestFileCopy);
     SUITE_ADD_TEST(suite, TestFileDirectory);
@@ -0,0 +1,470 @@
+/*
+ * finder.cc - Search the lines of a mode in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <pcrecpp.h>
+
+#include "config.h"
+#include "finder.h"
+#include "header_arena.h"
+#include "message.h"
+#include "message_table.h"
+#include "statuspanel.h"
+
+
+/*
+ * The most threads we'll use, regardless of the number of CPUs.
+ */
+#define MAX_FINDER_THREADS 4
+
+
+/*
+ * The number of lines in each block of a search.
+ *
+ * The selection only moves once every block before the match has been
+ * searched, so these are small enough that the first is quick.
+ */
+#define FIND_BLOCK_SIZE 256
+
+
+/*
+ * The options of our regular expressions.
+ *
+ * The text of a message is several headers, each upon its own line, so
+ * `^` and `$` match at the start and end of each.
+ */
+static pcrecpp::RE_Options find_options()
+{
+    pcrecpp::RE_Options opt;
+    opt.set_caseless(true);
+    opt.set_multiline(true);
+    return (opt);
+}
+
+
+/*
+ * Append a header-value to the text of a message, upon its own line.
+ */
+static void append_header(std::string &text, const char *value)
+{
+    if (value == NULL)
+        return;
+
+    if (! text.empty())
+        text += "\n";
+
+    text += value;
+}
+
+
+/*
+ * Constructor.
+ */
+CFinder::CFinder()
+{
+    m_origin     = 0;
+    m_direction  = 1;
+    m_claimed    = 0;
+    m_generation = 0;
+    m_stopping   = false;
+    m_collected  = 0;
+    m_position   = 0;
+    m_selected   = false;
+    m_waiting    = false;
+    m_active     = false;
+    m_cancelled  = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CFinder::~CFinder()
+{
+    stop_threads();
+}
+
+
+/*
+ * Start our threads.
+ */
+void CFinder::start_threads()
+{
+    if (! m_threads.empty())
+        return;
+
+    int threads = (int)std::thread::hardware_concurrency() - 1;
+
+    if (threads > MAX_FINDER_THREADS)
+        threads = MAX_FINDER_THREADS;
+
+    if (threads < 1)
+        threads = 1;
+
+    for (int i = 0; i < threads; i++)
+        m_threads.push_back(std::thread(&CFinder::worker, this));
+}
+
+
+/*
+ * Stop our threads.
+ */
+void CFinder::stop_threads()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+        m_generation++;
+    }
+
+    m_wake.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+
+    m_threads.clear();
+    m_stopping = false;
+}
+
+
+/*
+ * Return the text of a message which we match.
+ */
+std::string CFinder::message_text(uint32_t row)
+{
+    CMessageTable *table = CMessageTable::instance();
+    std::string text;
+
+    append_header(text, table->header_data(row, CMessageTable::HEADER_FROM));
+    append_header(text, table->header_data(row, CMessageTable::HEADER_TO));
+    append_header(text, table->header_data(row, CMessageTable::HEADER_CC));
+    append_header(text, table->header_data(row, CMessageTable::HEADER_SUBJECT));
+
+    return (text);
+}
+
+
+/*
+ * Start a search.
+ */
+bool CFinder::start(const std::string &mode, const std::string &pattern, int direction,
+                    std::vector<CFindItem> &items, const std::vector<uint64_t> &identity)
+{
+    pcrecpp::RE re(pattern, find_options());
+
+    if (! re.error().empty())
+        return false;
+
+    CConfig *config = CConfig::instance();
+    int current = config->get_integer(mode + ".current", 0);
+
+    if ((current < 0) || (items.empty()))
+        current = 0;
+    else if ((size_t)current >= items.size())
+        current = items.size() - 1;
+
+    size_t blocks = (items.size() + FIND_BLOCK_SIZE - 1) / FIND_BLOCK_SIZE;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        m_items     = std::make_shared<const std::vector<CFindItem>>(std::move(items));
+        m_pattern   = pattern;
+        m_origin    = current;
+        m_direction = (direction < 0) ? -1 : 1;
+
+        m_blocks.assign(blocks, CFindBlock());
+        m_claimed = 0;
+        m_generation++;
+    }
+
+    m_mode      = mode;
+    m_identity  = identity;
+    m_hits.clear();
+    m_collected = 0;
+    m_position  = 0;
+    m_selected  = false;
+    m_waiting   = true;
+    m_active    = true;
+    m_cancelled = false;
+
+    if (blocks > 0)
+    {
+        start_threads();
+        m_wake.notify_all();
+    }
+
+    return true;
+}
+
+
+/*
+ * Repeat the last search, if we can.
+ */
+bool CFinder::repeat(const std::string &mode, const std::string &pattern, int direction,
+                     const std::vector<uint64_t> &identity)
+{
+    if ((! m_selected) || (mode != m_mode) || (pattern != m_pattern) ||
+            (((direction < 0) ? -1 : 1) != m_direction) || (identity != m_identity))
+        return false;
+
+    /*
+     * If the selection has been moved we must search from where it is.
+     */
+    CConfig *config = CConfig::instance();
+    int current = config->get_integer(mode + ".current", 0);
+
+    if ((current < 0) || ((size_t)current != m_hits[m_position]))
+        return false;
+
+    collect();
+
+    if (m_position + 1 < m_hits.size())
+    {
+        select(m_position + 1);
+        return true;
+    }
+
+    /*
+     * We don't know what lies beyond the blocks which were searched.
+     */
+    if (m_cancelled)
+        return false;
+
+    if (m_active)
+    {
+        m_waiting = true;
+        return true;
+    }
+
+    /*
+     * Every line was searched, so we wrap around.
+     */
+    select(0);
+    return true;
+}
+
+
+/*
+ * Stop searching.
+ */
+void CFinder::cancel()
+{
+    if (! m_active)
+        return;
+
+    collect();
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    /*
+     * The blocks our threads are searching are discarded, and no more
+     * are claimed.
+     */
+    m_claimed = m_blocks.size();
+    m_generation++;
+
+    if (m_collected < m_blocks.size())
+        m_cancelled = true;
+
+    m_active  = false;
+    m_waiting = false;
+}
+
+
+/*
+ * Is a search still running?
+ */
+bool CFinder::running()
+{
+    return (m_active);
+}
+
+
+/*
+ * Move the selection to the given match.
+ */
+void CFinder::select(size_t hit)
+{
+    m_position = hit;
+    m_selected = true;
+    m_waiting  = false;
+
+    CConfig *config = CConfig::instance();
+    config->set(m_mode + ".current", (int)m_hits[hit]);
+}
+
+
+/*
+ * Collect the blocks which have been searched, in order.
+ *
+ * A block which finished early must wait for those before it, since
+ * their matches are nearer.
+ */
+void CFinder::collect()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    while ((m_collected < m_blocks.size()) && (m_blocks[m_collected].done))
+    {
+        std::vector<size_t> &hits = m_blocks[m_collected].hits;
+        m_hits.insert(m_hits.end(), hits.begin(), hits.end());
+        hits.clear();
+
+        m_collected += 1;
+    }
+}
+
+
+/*
+ * Collect the results of our threads.
+ */
+bool CFinder::publish()
+{
+    if (! m_active)
+        return false;
+
+    collect();
+
+    size_t next = m_selected ? m_position + 1 : 0;
+    bool moved  = false;
+
+    if ((m_waiting) && (next < m_hits.size()))
+    {
+        select(next);
+        moved = true;
+    }
+
+    if (m_collected < m_blocks.size())
+        return (moved);
+
+    /*
+     * The search is over.
+     */
+    m_active = false;
+
+    if (m_hits.empty())
+    {
+        CStatusPanel *panel = CStatusPanel::instance();
+        panel->add_text("$[RED]WARNING:$[WHITE] No match found for $[WHITE|BOLD]" + m_pattern);
+    }
+    else if (m_waiting)
+    {
+        select(0);
+        moved = true;
+    }
+
+    m_waiting = false;
+    return (moved);
+}
+
+
+/*
+ * The main-loop of each thread.
+ */
+void CFinder::worker()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    /*
+     * Each thread compiles its own copy of the expression.
+     */
+    std::unique_ptr<pcrecpp::RE> re;
+
+    while (true)
+    {
+        m_wake.wait(lock, [this]
+        {
+            return (m_stopping || (m_claimed < m_blocks.size()));
+        });
+
+        if (m_stopping)
+            return;
+
+        size_t block = m_claimed++;
+        uint64_t generation = m_generation;
+
+        std::shared_ptr<const std::vector<CFindItem>> items = m_items;
+        size_t origin = m_origin;
+        int direction = m_direction;
+
+        if ((! re) || (re->pattern() != m_pattern))
+            re.reset(new pcrecpp::RE(m_pattern, find_options()));
+
+        lock.unlock();
+
+        /*
+         * The lines are numbered from the one after the selection, in the
+         * direction of the search, and the selection itself comes last.
+         */
+        size_t count = items->size();
+        size_t first = (block * FIND_BLOCK_SIZE) + 1;
+        size_t last  = std::min(first + FIND_BLOCK_SIZE - 1, count);
+
+        std::vector<size_t> hits;
+
+        for (size_t n = first; n <= last; n++)
+        {
+            if (m_generation != generation)
+                break;
+
+            size_t offset = (direction > 0) ? (origin + n) % count :
+                            (origin + count - (n % count)) % count;
+
+            const CFindItem &item = (*items)[offset];
+
+            if (item.path.empty())
+            {
+                if (re->PartialMatch(item.text))
+                    hits.push_back(offset);
+
+                continue;
+            }
+
+            /*
+             * We can't use the message-table, so we read the headers of
+             * the message ourselves.
+             */
+            std::string header;
+
+            if (! CMessage::read_header_block(item.path, header))
+                continue;
+
+            CHeaderArena headers;
+            CMessage::parse_headers(header, headers);
+
+            std::string text;
+            append_header(text, headers.find("from"));
+            append_header(text, headers.find("to"));
+            append_header(text, headers.find("cc"));
+            append_header(text, headers.find("subject"));
+
+            if (re->PartialMatch(text))
+                hits.push_back(offset);
+        }
+
+        lock.lock();
+
+        if (m_generation == generation)
+        {
+            m_blocks[block].hits.swap(hits);
+            m_blocks[block].done = true;
+        }
+    }
+}
@@ -0,0 +1,241 @@
+/*
+ * finder.h - Search the lines of a mode in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * Something which the user may search for - a line of the display.
+ */
+struct CFindItem
+{
+    /**
+     * The text to match, which may be made of several lines.
+     */
+    std::string text;
+
+    /**
+     * If this isn't empty it is the path of a message whose headers
+     * haven't been read, and the text is taken from its `From:`, `To:`,
+     * `Cc:` and `Subject:` headers once they have been.
+     */
+    std::string path;
+};
+
+
+/**
+ * The CFinder class is a singleton which searches the lines of the
+ * current mode for a regular expression, using a small pool of threads,
+ * so that the user-interface is never blocked by a search.
+ *
+ * The lines are searched in the direction of the search, starting from
+ * the selected one and wrapping around, a block at a time.  As soon as
+ * the nearest match is known the selection is moved to it, while the
+ * remaining blocks are searched - and those matches are used when the
+ * search is repeated.
+ *
+ * The threads only match text, and read the headers of messages we don't
+ * have.  Their results are collected by `publish()`, which is called from
+ * the main-loop.  Any keypress cancels a search which is still running.
+ *
+ */
+class CFinder : public Singleton<CFinder>
+{
+public:
+
+    /**
+     * Constructor.  Our threads are started when they're first needed.
+     */
+    CFinder();
+
+    /**
+     * Destructor - stop our threads.
+     */
+    ~CFinder();
+
+public:
+
+    /**
+     * Search the given lines of the given mode, whose selection is
+     * `$mode.current`, for the regular expression - without regard to
+     * case - forwards if `direction` is positive, otherwise backwards.
+     *
+     * The identity is a value for each line which changes if the line
+     * does, and is used to tell if a search may be repeated.
+     *
+     * Returns false if the expression is invalid.
+     */
+    bool start(const std::string &mode, const std::string &pattern, int direction,
+               std::vector<CFindItem> &items, const std::vector<uint64_t> &identity);
+
+    /**
+     * If the last search was for the same expression, in the same lines
+     * and direction, and the selection is still upon its latest match,
+     * then move the selection to the next match - or arrange that it is
+     * moved when one is found.
+     *
+     * Returns false if a new search must be started instead.
+     */
+    bool repeat(const std::string &mode, const std::string &pattern, int direction,
+                const std::vector<uint64_t> &identity);
+
+    /**
+     * Stop searching, keeping the matches found so far.
+     */
+    void cancel();
+
+    /**
+     * Is a search still running?
+     */
+    bool running();
+
+    /**
+     * Collect the blocks which have been searched since we were last
+     * called, moving the selection if we've found the match it was
+     * waiting for.  Returns true if the selection moved.
+     */
+    bool publish();
+
+    /**
+     * Return the text of a message which we match - its `From:`, `To:`,
+     * `Cc:` and `Subject:` headers, each upon a line.
+     */
+    static std::string message_text(uint32_t row);
+
+private:
+
+    /**
+     * The matches found in a block of lines, by their offset.
+     */
+    struct CFindBlock
+    {
+        bool done;
+        std::vector<size_t> hits;
+    };
+
+    /**
+     * The main-loop of each thread.
+     */
+    void worker();
+
+    /**
+     * Move the selection to the given match.
+     */
+    void select(size_t hit);
+
+    /**
+     * Collect the blocks which have been searched, in order.
+     */
+    void collect();
+
+    /**
+     * Start our threads, if they're not running.
+     */
+    void start_threads();
+
+    /**
+     * Stop our threads, waiting for them to finish.
+     */
+    void stop_threads();
+
+private:
+
+    /**
+     * Protects everything below, to `m_threads`, which is shared with
+     * our threads.
+     */
+    std::mutex m_lock;
+
+    /**
+     * Signalled when there is work to do, or we're stopping.
+     */
+    std::condition_variable m_wake;
+
+    /**
+     * The lines being searched, which the threads share, the expression,
+     * and the offset we search from - in which direction.
+     */
+    std::shared_ptr<const std::vector<CFindItem>> m_items;
+    std::string m_pattern;
+    size_t m_origin;
+    int m_direction;
+
+    /**
+     * The blocks of the search, and the number of them which have been
+     * claimed by a thread.
+     */
+    std::vector<CFindBlock> m_blocks;
+    size_t m_claimed;
+
+    /**
+     * Increased each time a search is started or cancelled, so that our
+     * threads may notice that the block they're searching is no longer
+     * wanted.
+     */
+    std::atomic<uint64_t> m_generation;
+
+    /**
+     * Are we stopping?
+     */
+    bool m_stopping;
+
+    /**
+     * Our threads.
+     */
+    std::vector<std::thread> m_threads;
+
+    /**
+     * The mode, and the identity of its lines, which were searched.
+     */
+    std::string m_mode;
+    std::vector<uint64_t> m_identity;
+
+    /**
+     * The matches found in the blocks we've collected, in the order
+     * they were searched, and the number of blocks collected.
+     */
+    std::vector<size_t> m_hits;
+    size_t m_collected;
+
+    /**
+     * The match which was last selected, if `m_selected` is true, and
+     * whether the selection should move to the next match we find.
+     */
+    size_t m_position;
+    bool m_selected;
+    bool m_waiting;
+
+    /**
+     * Are there blocks we've yet to collect, and was the search
+     * cancelled before they were searched?
+     */
+    bool m_active;
+    bool m_cancelled;
+};
@@ -0,0 +1,207 @@
+/*
+ * finder_test.cc - Test-cases for our background searches.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <functional>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "finder.h"
+#include "statuspanel.h"
+#include "CuTest.h"
+
+
+/**
+ * Build the given number of lines, with matches at the given offsets.
+ */
+static std::vector<CFindItem> finder_lines(size_t count, std::vector<uint64_t> &identity)
+{
+    std::vector<CFindItem> items(count);
+
+    identity.clear();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        items[i].text = "Line " + std::to_string(i);
+
+        if ((i == 100) || (i == 900))
+            items[i].text += " needle";
+
+        if (i == 700)
+            items[i].text += " NEEDLE";
+
+        identity.push_back(std::hash<std::string>()(items[i].text));
+    }
+
+    return (items);
+}
+
+
+/**
+ * Wait for the current search to finish, returning the selection.
+ */
+static int finder_wait(CFinder *finder)
+{
+    for (int wait = 0; (wait < 5000) && (finder->running()); wait++)
+    {
+        finder->publish();
+        usleep(1000);
+    }
+
+    return (CConfig::instance()->get_integer("finder.current", -1));
+}
+
+
+/**
+ * Test that lines are searched in either direction, and that the search
+ * may be repeated.
+ */
+void TestFinderLines(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    CFinder *finder = CFinder::instance();
+
+    std::vector<uint64_t> identity;
+    std::vector<CFindItem> items = finder_lines(1000, identity);
+
+    /*
+     * The nearest match after the selection is found first, and then
+     * the others in turn - wrapping around.
+     */
+    config->set("finder.current", 800, false);
+    CuAssertTrue(tc, finder->start("finder", "needle", 1, items, identity));
+    CuAssertIntEquals(tc, 900, finder_wait(finder));
+
+    CuAssertTrue(tc, finder->repeat("finder", "needle", 1, identity));
+    CuAssertIntEquals(tc, 100, config->get_integer("finder.current"));
+    CuAssertTrue(tc, finder->repeat("finder", "needle", 1, identity));
+    CuAssertIntEquals(tc, 700, config->get_integer("finder.current"));
+    CuAssertTrue(tc, finder->repeat("finder", "needle", 1, identity));
+    CuAssertIntEquals(tc, 900, config->get_integer("finder.current"));
+
+    /*
+     * A search in the other direction, for another expression, in other
+     * lines, or from somewhere else, must be started afresh.
+     */
+    CuAssertTrue(tc, ! finder->repeat("finder", "needle", -1, identity));
+    CuAssertTrue(tc, ! finder->repeat("finder", "line", 1, identity));
+
+    std::vector<uint64_t> other(identity);
+    other[0] += 1;
+    CuAssertTrue(tc, ! finder->repeat("finder", "needle", 1, other));
+
+    config->set("finder.current", 899, false);
+    CuAssertTrue(tc, ! finder->repeat("finder", "needle", 1, identity));
+
+    items = finder_lines(1000, identity);
+    CuAssertTrue(tc, finder->start("finder", "needle", -1, items, identity));
+    CuAssertIntEquals(tc, 700, finder_wait(finder));
+
+    /*
+     * Anchors match at the start of each line of the text.
+     */
+    items = finder_lines(1000, identity);
+    CuAssertTrue(tc, finder->start("finder", "^line 12$", 1, items, identity));
+    CuAssertIntEquals(tc, 12, finder_wait(finder));
+
+    /*
+     * Invalid expressions are rejected.
+     */
+    items = finder_lines(1000, identity);
+    CuAssertTrue(tc, ! finder->start("finder", "needle(", 1, items, identity));
+
+    /*
+     * A cancelled search stops at once.
+     */
+    items = finder_lines(1000, identity);
+    CuAssertTrue(tc, finder->start("finder", "needle", 1, items, identity));
+    finder->cancel();
+    CuAssertTrue(tc, ! finder->running());
+}
+
+
+/**
+ * Test that the headers of messages are read, and that the user is
+ * told if nothing matches.
+ */
+void TestFinderMessages(CuTest * tc)
+{
+    char tmpl[] = "/tmp/finder.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string path = std::string(tmpl) + "/1.test:2,S";
+
+    std::ofstream out(path);
+    out << "From: Steve Kemp <steve@example.com>\n";
+    out << "Subject: Re: Lunch\n\nFriday?\n";
+    out.close();
+
+    CConfig *config = CConfig::instance();
+    CFinder *finder = CFinder::instance();
+
+    std::vector<CFindItem> items(3);
+    items[0].text = "Nothing here";
+    items[1].path = path;
+    items[2].text = "Lunch";
+
+    std::vector<uint64_t> identity(3, 0);
+
+    config->set("finder.current", 0, false);
+    CuAssertTrue(tc, finder->start("finder", "^re: lunch$", 1, items, identity));
+    CuAssertIntEquals(tc, 1, finder_wait(finder));
+
+    /*
+     * The body isn't searched.
+     */
+    CStatusPanel *panel = CStatusPanel::instance();
+    std::vector<std::string> previous = panel->get_text();
+
+    std::vector<CFindItem> fewer(2);
+    fewer[0].text = "Nothing here";
+    fewer[1].path = path;
+
+    identity.resize(2);
+
+    config->set("finder.current", 0, false);
+    CuAssertTrue(tc, finder->start("finder", "friday", 1, fewer, identity));
+    CuAssertIntEquals(tc, 0, finder_wait(finder));
+    CuAssertIntEquals(tc, previous.size() + 1, panel->get_text().size());
+
+    panel->reset();
+
+    for (const std::string &line : previous)
+        panel->add_text(line);
+
+    unlink(path.c_str());
+    rmdir(tmpl);
+}
+
+
+
+CuSuite *
+finder_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFinderLines);
+    SUITE_ADD_TEST(suite, TestFinderMessages);
+    return suite;
+}
@@ -16,21 +16,30 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <algorithm>
+#include <math.h>
+#include <pcrecpp.h>
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
 
 
 #include "config.h"
 #include "directory.h"
 #include "file.h"
+#include "finder.h"
 #include "global_state.h"
+#include "header_prefetch.h"
 #include "history.h"
 #include "imap_proxy.h"
 #include "json/json.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_watcher.h"
 #include "message.h"
+#include "message_table.h"
+#include "search_index.h"
 #include "util.h"
 
 /*
@@ -39,6 +48,7 @@
 CGlobalState::CGlobalState() : Observer(CConfig::instance())
 {
     m_messages = NULL;
+    m_source   = NULL;
     m_current_message = NULL;
     update_messages();
     update_maildirs();
@@ -219,10 +229,65 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
  */
 CMessageList * CGlobalState::get_messages()
 {
+    /*
+     * If the messages come from a local folder we only create the
+     * complete list when somebody asks for it.
+     */
+    if ((m_source) && (m_messages->size() != m_source->message_count()))
+    {
+        m_messages->clear();
+
+        for (size_t i = 0; i < m_source->message_count(); i++)
+            m_messages->push_back(m_source->message_at(i));
+    }
+
     return (m_messages);
 }
 
 
+/*
+ * Get the number of messages in the currently selected folder.
+ */
+size_t CGlobalState::message_count()
+{
+    if (m_source)
+        return (m_source->message_count());
+
+    return (m_messages->size());
+}
+
+
+/*
+ * Get a single message from the currently selected folder.
+ */
+std::shared_ptr<CMessage> CGlobalState::message_at(size_t offset)
+{
+    if (m_source)
+        return (m_source->message_at(offset));
+
+    if (offset >= m_messages->size())
+        return (NULL);
+
+    return (m_messages->at(offset));
+}
+
+
+/*
+ * Get a range of messages from the currently selected folder.
+ */
+CMessageList CGlobalState::message_range(size_t offset, size_t count)
+{
+    CMessageList result;
+
+    size_t max = message_count();
+
+    for (size_t i = offset; (i < max) && (i - offset < count); i++)
+        result.push_back(message_at(i));
+
+    return (result);
+}
+
+
 /*
  * Get the available maildirs.
  */
@@ -232,11 +297,65 @@ std::vector<std::shared_ptr<CMaildir>> CGlobalState::get_maildirs()
 }
 
 
+/*
+ * Remove duplicate and trailing "/" characters from the given path.
+ */
+static std::string normalise_path(std::string path)
+{
+    path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+    while ((path.size() > 1) && (path.back() == '/'))
+        path.pop_back();
+
+    return (path);
+}
+
+
+/*
+ * Find the local maildir with the given path.
+ */
+std::shared_ptr<CMaildir> CGlobalState::find_maildir(std::string path)
+{
+    path = normalise_path(path);
+
+    std::vector<std::shared_ptr<CMaildir> > candidates;
+
+    if (m_current_maildir)
+        candidates.push_back(m_current_maildir);
+
+    candidates.insert(candidates.end(), m_maildirs.begin(), m_maildirs.end());
+
+    for (std::shared_ptr<CMaildir> maildir : candidates)
+    {
+        if (! maildir->is_maildir())
+            continue;
+
+        if (normalise_path(maildir->path()) == path)
+            return (maildir);
+    }
+
+    return (NULL);
+}
+
+
 /*
  * Update our cached maildir-list.
  */
 void CGlobalState::update_maildirs()
 {
+    /*
+     * Keep hold of the maildirs we already have, so that we can reuse
+     * them.  This preserves their cached message-counts, and the state
+     * of their most recent scan.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CMaildir> > previous;
+
+    for (std::shared_ptr<CMaildir> existing : m_maildirs)
+    {
+        if (existing->is_maildir())
+            previous[existing->path()] = existing;
+    }
+
     /*
      * If we have items already then remove them.
      */
@@ -319,27 +438,45 @@ void CGlobalState::update_maildirs()
 
 
     /*
-     * For each prefix add in the Maildirs.
+     * The watcher keeps local maildirs current, without polling.
+     */
+    CMaildirWatcher *watcher = CMaildirWatcher::instance();
+
+    /*
+     * Watch each prefix for folders being created/removed.
      */
     for (auto it = prefixes.begin(); it != prefixes.end(); ++it)
+        watcher->watch_prefix(*it);
+
+    /*
+     * Find the Maildirs beneath all the prefixes, in parallel.
+     */
+    std::vector<std::string> directories;
+    std::vector<std::string> folders = CFile::get_all_maildirs(prefixes, &directories);
+
+    /*
+     * Folders may be created anywhere beneath a prefix, so watch the
+     * plain directories we searched too.
+     */
+    for (const std::string &directory : directories)
+        watcher->watch_prefix(directory);
+
+    /*
+     * Construct the Maildir object.
+     */
+    for (std::string path : folders)
     {
-        std::string prefix = *it;
+        std::shared_ptr<CMaildir> m;
 
-        /*
-         * We'll store each maildir here.
-         */
-        std::vector<std::string> folders;
-        folders = CFile::get_all_maildirs(prefix);
+        auto old = previous.find(path);
 
-        /*
-         * Construct the Maildir object.
-         */
-        for (std::string path : folders)
-        {
-            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path));
+        if (old != previous.end())
+            m = old->second;
+        else
+            m = std::shared_ptr<CMaildir>(new CMaildir(path));
 
-            m_maildirs.push_back(m);
-        }
+        watcher->watch(m);
+        m_maildirs.push_back(m);
     }
 
     /*
@@ -402,6 +539,13 @@ void CGlobalState::update_messages(bool force)
      * create a new store.
      */
     m_messages = new CMessageList;
+    m_source   = NULL;
+
+    /*
+     * Stop parsing the headers of the folder we're leaving.
+     */
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::instance();
+    prefetch->cancel();
 
     /*
      *
@@ -562,17 +706,52 @@ void CGlobalState::update_messages(bool force)
     if (current)
     {
         logger->log("maildir", "%s", "Fetching messages.");
-        CMessageList contents = current->getMessages();
 
-        for (std::shared_ptr<CMessage> content : contents)
+        if ((current->is_watched()) && (force == false))
         {
-            m_messages->push_back(content) ;
+            /*
+             * The watcher keeps the folder's list current, so there
+             * is no need to read the directories.
+             */
+            current->refresh();
         }
+        else
+        {
+            /*
+             * Rescan the folder - messages we've seen before will be
+             * reused, rather than created and parsed again.
+             */
+            CMaildirChanges changes;
+            current->scan(&changes);
+
+            logger->log("maildir", "Rescan found %d new, %d removed, and %d renamed message(s).",
+                        (int)changes.added.size(), (int)changes.removed.size(),
+                        (int)changes.renamed.size());
+        }
+
+        /*
+         * The message-objects are created only as they're needed, via
+         * `message_at()`, or when `get_messages()` is called.
+         */
+        m_source = current;
+
+        /*
+         * Parse the headers of the messages which haven't been read
+         * yet in the background, nearest the selection first.
+         */
+        prefetch->schedule(current);
+
+        /*
+         * Then read the messages which are new to its full-text index,
+         * unless the user would rather we didn't.
+         */
+        if (config->get_integer("search.index", 1) != 0)
+            prefetch->index(current);
     }
 
-    logger->log("maildir", "Found %d message(s).", m_messages->size());
+    logger->log("maildir", "Found %d message(s).", (int)message_count());
 
-    config->set("index.max", m_messages->size());
+    config->set("index.max", (int)message_count());
 }
 
 
@@ -591,8 +770,21 @@ std::shared_ptr<CMaildir>CGlobalState::current_maildir()
  */
 void CGlobalState::set_maildir(std::shared_ptr<CMaildir> updated)
 {
+    /*
+     * Record what we've learned about the folder we're leaving.
+     */
+    if (m_current_maildir && (m_current_maildir != updated))
+        m_current_maildir->save_summary();
+
     m_current_maildir = updated;
 
+    /*
+     * Ensure the selected folder is watched, even if it isn't beneath
+     * one of our prefixes.
+     */
+    if (updated && updated->is_maildir())
+        CMaildirWatcher::instance()->watch(updated);
+
     update_messages();
 
     /*
@@ -609,3 +801,297 @@ void CGlobalState::set_maildir(std::shared_ptr<CMaildir> updated)
     int max = config->get_integer("index.max");
     config->set("index.current", max > 0 ? max - 1 : 0, false);
 }
+
+
+/*
+ * Save the summary-index of each local maildir.
+ */
+void CGlobalState::save_summaries()
+{
+    for (std::shared_ptr<CMaildir> folder : m_maildirs)
+        folder->save_summary();
+
+    /*
+     * The current folder might not be one we found beneath a prefix.
+     */
+    if (m_current_maildir &&
+            (std::find(m_maildirs.begin(), m_maildirs.end(), m_current_maildir) == m_maildirs.end()))
+        m_current_maildir->save_summary();
+}
+
+
+/*
+ * Search the full-text index of every local maildir.
+ *
+ * Messages are ranked by BM25, with the statistics of all of the
+ * indexes, so that the best matches of every folder are interleaved.
+ */
+CMessageList CGlobalState::search(const std::string &query, size_t limit)
+{
+    CMessageList results;
+
+    /*
+     * Each term need only be searched for once.
+     */
+    std::vector<std::string> terms = CSearchIndex::terms(query);
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    if (terms.empty())
+        return (results);
+
+    std::vector<CSearchHit> hits;
+    std::vector<std::shared_ptr<CMaildir>> owners;
+    std::vector<uint64_t> documents(terms.size(), 0);
+
+    uint64_t messages = 0;
+    uint64_t length   = 0;
+
+    for (std::shared_ptr<CMaildir> folder : m_maildirs)
+    {
+        CSearchIndex *index = folder->search_index();
+
+        if (index == NULL)
+            continue;
+
+        messages += index->rows();
+        length   += index->length();
+
+        index->search(terms, hits, documents);
+        owners.resize(hits.size(), folder);
+    }
+
+    if (hits.empty())
+        return (results);
+
+    /*
+     * Score each hit.
+     */
+    const double k1 = 1.2;
+    const double b  = 0.75;
+    double average = (double)length / (double)messages;
+
+    std::vector<double> idf(terms.size());
+
+    for (size_t t = 0; t < terms.size(); t++)
+    {
+        double df = (double)std::min(documents[t], messages);
+        idf[t] = log(1.0 + ((double)messages - df + 0.5) / (df + 0.5));
+    }
+
+    std::vector<double> scores(hits.size(), 0);
+
+    for (size_t i = 0; i < hits.size(); i++)
+    {
+        double norm = k1 * (1.0 - b + b * (double)hits[i].length / std::max(average, 1.0));
+
+        for (size_t t = 0; t < terms.size(); t++)
+        {
+            double tf = hits[i].frequency[t];
+            scores[i] += idf[t] * (tf * (k1 + 1.0)) / (tf + norm);
+        }
+    }
+
+    std::vector<size_t> order(hits.size());
+
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [&scores](size_t x, size_t y)
+    {
+        return (scores[x] > scores[y]);
+    });
+
+    /*
+     * Messages which have been removed since they were indexed are still
+     * found, so we skip them.
+     */
+    for (size_t i : order)
+    {
+        if ((limit > 0) && (results.size() >= limit))
+            break;
+
+        std::shared_ptr<CMessage> msg = owners[i]->find_message(hits[i].id);
+
+        if (msg)
+            results.push_back(msg);
+    }
+
+    return (results);
+}
+
+
+/*
+ * Queue the messages which aren't in the full-text index of each local
+ * maildir, to be read in the background.
+ */
+size_t CGlobalState::update_search(size_t limit)
+{
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::instance();
+    size_t queued = 0;
+
+    for (std::shared_ptr<CMaildir> folder : m_maildirs)
+    {
+        if ((limit > 0) && (queued >= limit))
+            break;
+
+        queued += prefetch->index(folder, (limit > 0) ? (limit - queued) : 0);
+    }
+
+    return (queued);
+}
+
+
+/*
+ * Find the messages whose key headers match the given expression.
+ *
+ * The trigram index of the current folder gives us the rows which might
+ * match, and only those are given to PCRE - along with any rows the
+ * index doesn't cover, such as those whose headers are still unread.
+ */
+bool CGlobalState::find_messages(const std::string &pattern, std::vector<size_t> &found,
+                                 CMessageList *messages)
+{
+    pcrecpp::RE_Options opt;
+    opt.set_caseless(true);
+
+    pcrecpp::RE re(pattern, opt);
+
+    if (! re.error().empty())
+        return false;
+
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The rows we're searching, in order.
+     */
+    std::vector<uint32_t> rows;
+    message_rows(messages, rows);
+
+    CTrigramIndex *index = m_current_maildir ? m_current_maildir->trigrams() : NULL;
+
+    std::vector<uint32_t> candidates;
+    bool narrowed = (index != NULL) && index->candidates(pattern, candidates);
+
+    static const CMessageTable::CKeyHeader keys[] =
+    {
+        CMessageTable::HEADER_FROM,
+        CMessageTable::HEADER_TO,
+        CMessageTable::HEADER_CC,
+        CMessageTable::HEADER_SUBJECT
+    };
+
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        uint32_t row = rows[i];
+
+        if (narrowed && index->covers(row) &&
+                (! std::binary_search(candidates.begin(), candidates.end(), row)))
+            continue;
+
+        /*
+         * The rows of a local folder needn't have objects, but those of
+         * an IMAP folder must read their headers through theirs.
+         */
+        if (!(table->state(row) & CMessageTable::STATE_HEADERS))
+        {
+            if (messages != NULL)
+                messages->at(i)->find_header("date");
+            else
+                CMessage(row).find_header("date");
+        }
+
+        for (CMessageTable::CKeyHeader key : keys)
+        {
+            const char *value = table->header_data(row, key);
+
+            if ((value != NULL) && re.PartialMatch(value))
+            {
+                found.push_back(i);
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Search the key headers of the messages in the background.
+ *
+ * The lines given to the finder are the text of those messages which
+ * might match, according to the trigram index, and the path of those
+ * whose headers haven't been read - so that the threads may read them.
+ */
+bool CGlobalState::find(const std::string &mode, const std::string &pattern, int direction,
+                        CMessageList *messages)
+{
+    std::vector<uint32_t> rows;
+    message_rows(messages, rows);
+
+    std::vector<uint64_t> identity(rows.begin(), rows.end());
+
+    CFinder *finder = CFinder::instance();
+
+    if (finder->repeat(mode, pattern, direction, identity))
+        return true;
+
+    CMessageTable *table = CMessageTable::instance();
+
+    CTrigramIndex *index = m_current_maildir ? m_current_maildir->trigrams() : NULL;
+
+    std::vector<uint32_t> candidates;
+    bool narrowed = (index != NULL) && index->candidates(pattern, candidates);
+    bool local    = (m_current_maildir) && (m_current_maildir->is_maildir());
+
+    std::vector<CFindItem> items(rows.size());
+
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        uint32_t row = rows[i];
+
+        if (narrowed && index->covers(row) &&
+                (! std::binary_search(candidates.begin(), candidates.end(), row)))
+            continue;
+
+        if (!(table->state(row) & CMessageTable::STATE_HEADERS))
+        {
+            if (local)
+            {
+                items[i].path = table->path(row);
+                continue;
+            }
+
+            if (messages != NULL)
+                messages->at(i)->find_header("date");
+            else
+                CMessage(row).find_header("date");
+        }
+
+        items[i].text = CFinder::message_text(row);
+    }
+
+    return (finder->start(mode, pattern, direction, items, identity));
+}
+
+
+/*
+ * Store the rows of the given messages, or of the current folder.
+ */
+void CGlobalState::message_rows(CMessageList *&messages, std::vector<uint32_t> &rows)
+{
+    if ((messages == NULL) && (! m_source))
+        messages = m_messages;
+
+    if (messages != NULL)
+    {
+        for (std::shared_ptr<CMessage> msg : *messages)
+            rows.push_back(msg->row());
+    }
+    else if (m_source)
+    {
+        for (size_t i = 0; i < m_source->message_count(); i++)
+            rows.push_back(m_source->row_at(i));
+    }
+}
@@ -59,11 +59,37 @@ public:
      */
     std::vector<std::shared_ptr<CMaildir>> get_maildirs();
 
+    /**
+     * Find the local maildir with the given path, amongst those we know
+     * about - returning NULL if there is none.
+     */
+    std::shared_ptr<CMaildir> find_maildir(std::string path);
+
     /**
      * Get the messages in the currently-selected folder.
      */
     std::vector<std::shared_ptr<CMessage> > *get_messages();
 
+    /**
+     * Get the number of messages in the currently-selected folder.
+     */
+    size_t message_count();
+
+    /**
+     * Get the message at the given offset in the currently-selected
+     * folder, or NULL if the offset is out of range.
+     *
+     * For a local folder only the messages requested like this are
+     * created, so a view which shows a handful of messages from a large
+     * folder need never call `get_messages()`.
+     */
+    std::shared_ptr<CMessage> message_at(size_t offset);
+
+    /**
+     * Get up to `count` messages, starting from the given offset.
+     */
+    CMessageList message_range(size_t offset, size_t count);
+
     /**
      * Get the currently selected message.
      */
@@ -85,6 +111,48 @@ public:
      */
     void set_maildir(std::shared_ptr<CMaildir >  folder);
 
+    /**
+     * Save the summary-index of each local maildir, such that the
+     * headers we've read needn't be read again when we're next launched.
+     */
+    void save_summaries();
+
+    /**
+     * Search the full-text index of every local maildir for messages
+     * containing all of the words of the given query, returning up to
+     * `limit` of them - the best matches first.
+     */
+    CMessageList search(const std::string &query, size_t limit);
+
+    /**
+     * Queue up to `limit` messages which aren't in the full-text index of
+     * each local maildir to be read, and added to it, in the background -
+     * returning the number queued.  A limit of zero queues them all.
+     */
+    size_t update_search(size_t limit = 0);
+
+    /**
+     * Find the messages whose `From:`, `To:`, `Cc:` or `Subject:` header
+     * matches the given regular expression, without regard to case,
+     * storing their offsets in the given list - or in the currently
+     * selected folder.
+     *
+     * Returns false if the expression is invalid.
+     */
+    bool find_messages(const std::string &pattern, std::vector<size_t> &found,
+                       CMessageList *messages = NULL);
+
+    /**
+     * Search the given messages, or those of the currently selected
+     * folder, for the regular expression in the background - as for
+     * `find_messages` - moving the selection of the given mode to the
+     * next match in the given direction, once it is found.
+     *
+     * Returns false if the expression is invalid.
+     */
+    bool find(const std::string &mode, const std::string &pattern, int direction,
+              CMessageList *messages = NULL);
+
 public:
 
     /**
@@ -104,6 +172,15 @@ public:
      */
     void update(std::string key_name, CConfigEntry *old);
 
+private:
+
+    /**
+     * Store the rows of the given messages, in order, or those of the
+     * current folder - in which case `messages` is set to the list they
+     * came from, if they didn't come from the folder itself.
+     */
+    void message_rows(CMessageList *&messages, std::vector<uint32_t> &rows);
+
 private:
 
     /**
@@ -121,6 +198,12 @@ private:
      */
     std::vector<std::shared_ptr<CMessage> > *m_messages;
 
+    /**
+     * The local folder our messages come from, which creates them on
+     * demand.  This is NULL if the messages came from IMAP.
+     */
+    std::shared_ptr<CMaildir> m_source;
+
     /**
      * The currently selected message.
      */
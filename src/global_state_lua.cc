@@ -18,12 +18,16 @@
 
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
 
 #include "config.h"
+#include "finder.h"
 #include "global_state.h"
 #include "maildir_lua.h"
+#include "message_filter.h"
 #include "message_lua.h"
+#include "message_sorter.h"
 #include "lua.h"
 #include "screen.h"
 
@@ -144,6 +148,82 @@ int l_CGlobalState_current_messages(lua_State * l)
 
 
 
+/**
+ * Implementation of `Global:message_count`.
+ */
+int l_CGlobalState_message_count(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_message_count");
+
+    CGlobalState *global = CGlobalState::instance();
+    lua_pushinteger(l, global->message_count());
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:message_at`.
+ *
+ * The offset is 1-based, as is usual in Lua.
+ */
+int l_CGlobalState_message_at(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_message_at");
+
+    int offset = luaL_checkinteger(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    std::shared_ptr<CMessage> m;
+
+    if (offset >= 1)
+        m = global->message_at(offset - 1);
+
+    if (m)
+        push_cmessage(l, m);
+    else
+        lua_pushnil(l);
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:message_range`.
+ *
+ * Return the messages from `first` to `last`, inclusive, along with the
+ * total number of messages.
+ */
+int l_CGlobalState_message_range(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_message_range");
+
+    int first = luaL_checkinteger(l, 2);
+    int last  = luaL_checkinteger(l, 3);
+
+    if (first < 1)
+        first = 1;
+
+    CGlobalState *global = CGlobalState::instance();
+    CMessageList msgs;
+
+    if (last >= first)
+        msgs = global->message_range(first - 1, last - first + 1);
+
+    lua_createtable(l, msgs.size(), 0);
+    int i = 0;
+
+    for (std::shared_ptr<CMessage> m : msgs)
+    {
+        push_cmessage(l, m);
+        lua_rawseti(l, -2, i + 1);
+        i++;
+    }
+
+    lua_pushinteger(l, global->message_count());
+    return 2;
+}
+
+
 /**
  * Return all the registered view-modes to the caller.
  */
@@ -186,6 +266,285 @@ int l_CGlobalState_select_message(lua_State * l)
 }
 
 
+/**
+ * Implementation of `Global:filter`.
+ *
+ * Return those messages which match the given query, as a new table.
+ * The messages are those given, or else those of the current maildir.
+ *
+ * If the query isn't one we understand we return nil, and the caller
+ * should filter the messages itself.
+ */
+int l_CGlobalState_filter(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_filter");
+
+    const char *query = luaL_checkstring(l, 2);
+
+    CMessageFilter filter;
+
+    if (! filter.compile(query))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    if (! lua_istable(l, 3))
+    {
+        lua_settop(l, 2);
+        l_CGlobalState_current_messages(l);
+    }
+
+    CMessageList messages;
+
+    for (int i = 1; ; i++)
+    {
+        lua_rawgeti(l, 3, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    std::vector<size_t> found = filter.filter(messages);
+
+    lua_createtable(l, found.size(), 0);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        lua_rawgeti(l, 3, found[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:find_messages`.
+ *
+ * Return the offsets of the messages, in the given table or else the
+ * current maildir, whose key headers match the regular expression.
+ *
+ * If the expression is invalid we return nil.
+ */
+int l_CGlobalState_find_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_find_messages");
+
+    const char *pattern = luaL_checkstring(l, 2);
+
+    CMessageList messages;
+    bool given = lua_istable(l, 3);
+
+    for (int i = 1; given; i++)
+    {
+        lua_rawgeti(l, 3, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    std::vector<size_t> found;
+    CGlobalState *global = CGlobalState::instance();
+
+    if (! global->find_messages(pattern, found, given ? &messages : NULL))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    lua_createtable(l, found.size(), 0);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        lua_pushinteger(l, found[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Is the given value a userdata with the named metatable?
+ */
+static bool is_udata(lua_State * l, int n, const char *name)
+{
+    if (! lua_getmetatable(l, n))
+        return false;
+
+    luaL_getmetatable(l, name);
+    bool same = lua_rawequal(l, -1, -2);
+    lua_pop(l, 2);
+
+    return (same);
+}
+
+
+/**
+ * Implementation of `Global:find`.
+ *
+ * Search the lines of the current mode for a regular expression in the
+ * background, moving the selection to the next match in the given
+ * direction once it is found.  The lines are the given table of strings,
+ * maildirs, or messages - or else the messages of the current maildir.
+ *
+ * If the expression is invalid we return nil.
+ */
+int l_CGlobalState_find(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_find");
+
+    const char *pattern = luaL_checkstring(l, 2);
+    int direction = luaL_checkinteger(l, 3);
+
+    CConfig *config  = CConfig::instance();
+    std::string mode = config->get_string("global.mode", "maildir");
+
+    CMessageList messages;
+    std::vector<CFindItem> items;
+    std::vector<uint64_t> identity;
+    std::hash<std::string> hash;
+
+    bool given = lua_istable(l, 4);
+
+    for (int i = 1; given; i++)
+    {
+        lua_rawgeti(l, 4, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        /*
+         * Maildirs are matched by their path, and messages by their
+         * key headers.
+         */
+        if ((lua_type(l, -1) == LUA_TSTRING) || is_udata(l, -1, "luaL_CMaildir"))
+        {
+            CFindItem item;
+
+            if (lua_type(l, -1) == LUA_TSTRING)
+                item.text = lua_tostring(l, -1);
+            else
+                item.text = l_CheckCMaildir(l, -1)->path();
+
+            identity.push_back(hash(item.text));
+            items.push_back(item);
+        }
+        else
+        {
+            messages.push_back(l_CheckCMessage(l, -1));
+        }
+
+        lua_pop(l, 1);
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    bool valid;
+
+    if ((! given) || (! messages.empty()))
+    {
+        valid = global->find(mode, pattern, direction, given ? &messages : NULL);
+    }
+    else
+    {
+        CFinder *finder = CFinder::instance();
+
+        valid = finder->repeat(mode, pattern, direction, identity) ||
+                finder->start(mode, pattern, direction, items, identity);
+    }
+
+    if (valid)
+        lua_pushboolean(l, 1);
+    else
+        lua_pushnil(l);
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:sort`.
+ *
+ * Sort messages by one of the built-in methods, and optionally by a
+ * second to break ties, returning them as a new table.  The messages
+ * are those given, or else those of the current maildir.
+ *
+ * If either method isn't built-in we return nil, and the caller should
+ * sort via its own comparison function.
+ */
+int l_CGlobalState_sort(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_sort");
+
+    const char *name   = luaL_checkstring(l, 2);
+    const char *second = lua_isstring(l, 3) ? lua_tostring(l, 3) : NULL;
+
+    CMessageSorter::CSortMethod primary, secondary;
+
+    if ((! CMessageSorter::method(name, primary)) ||
+            ((second != NULL) && (! CMessageSorter::method(second, secondary))))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    if (! lua_istable(l, 4))
+    {
+        lua_settop(l, 3);
+        l_CGlobalState_current_messages(l);
+    }
+
+    CMessageList messages;
+
+    for (int i = 1; ; i++)
+    {
+        lua_rawgeti(l, 4, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    std::vector<size_t> order;
+
+    if (second != NULL)
+        order = CMessageSorter(messages, primary, secondary).sort();
+    else
+        order = CMessageSorter(messages, primary).sort();
+
+    lua_createtable(l, order.size(), 0);
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        lua_rawgeti(l, 4, order[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
 /**
  * Register the global `Global` object to the Lua environment,
  * and setup our public methods upon which the user may operate.
@@ -197,10 +556,17 @@ void InitGlobalState(lua_State * l)
         {"current_maildir", l_CGlobalState_current_maildir},
         {"current_message", l_CGlobalState_current_message},
         {"current_messages", l_CGlobalState_current_messages},
+        {"filter", l_CGlobalState_filter},
+        {"find", l_CGlobalState_find},
+        {"find_messages", l_CGlobalState_find_messages},
         {"maildirs", l_CGlobalState_maildirs},
+        {"message_at", l_CGlobalState_message_at},
+        {"message_count", l_CGlobalState_message_count},
+        {"message_range", l_CGlobalState_message_range},
         {"modes", l_CGlobalState_modes},
         {"select_maildir", l_CGlobalState_select_maildir},
         {"select_message", l_CGlobalState_select_message},
+        {"sort", l_CGlobalState_sort},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CGlobalState");
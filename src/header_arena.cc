@@ -0,0 +1,277 @@
+/*
+ * header_arena.cc - Compact storage for the headers of a message.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+#include <unordered_map>
+
+#include "header_arena.h"
+
+
+/*
+ * The names of the headers which most messages have, which are numbered
+ * by their position here.
+ *
+ * Any other name is stored by the arena which holds it, rather than being
+ * added here, so that the names of unusual headers don't accumulate for
+ * the life of the process - and so that this table may be read by any
+ * thread without locking.
+ */
+static const char *const known_names[] =
+{
+    "from",
+    "to",
+    "cc",
+    "subject",
+    "date",
+    "message-id",
+    "in-reply-to",
+    "references",
+    "bcc",
+    "reply-to",
+    "sender",
+    "return-path",
+    "delivered-to",
+    "received",
+    "mime-version",
+    "content-type",
+    "content-transfer-encoding",
+    "content-disposition",
+    "list-id",
+    "list-unsubscribe",
+    "user-agent",
+    "x-mailer",
+    "x-original-to",
+    "dkim-signature",
+    "authentication-results",
+};
+
+
+/*
+ * The flag we set upon a name stored in the arena.
+ */
+const uint32_t CHeaderArena::LOCAL_NAME;
+
+
+/*
+ * Constructor.
+ */
+CHeaderArena::CHeaderArena()
+{
+}
+
+
+/*
+ * Remove all headers.
+ */
+void CHeaderArena::clear()
+{
+    m_entries.clear();
+    m_values.clear();
+}
+
+
+/*
+ * The number of headers we hold.
+ */
+size_t CHeaderArena::size() const
+{
+    return (m_entries.size());
+}
+
+
+/*
+ * Store a header, replacing any previous value.
+ */
+void CHeaderArena::set(const std::string &name, const char *value, size_t len)
+{
+    int i = index(name);
+
+    CHeaderEntry entry;
+
+    if (i >= 0)
+    {
+        entry.name = m_entries[i].name;
+    }
+    else if (! known(name, entry.name))
+    {
+        entry.name = LOCAL_NAME | m_values.size();
+
+        m_values.insert(m_values.end(), name.begin(), name.end());
+        m_values.push_back('\0');
+    }
+
+    /*
+     * A replaced value is left in the buffer, since headers are rarely
+     * repeated.
+     */
+    entry.offset = m_values.size();
+    entry.length = len;
+
+    m_values.insert(m_values.end(), value, value + len);
+    m_values.push_back('\0');
+
+    if (i < 0)
+        m_entries.push_back(entry);
+    else
+        m_entries[i] = entry;
+}
+
+
+/*
+ * Store a header, replacing any previous value.
+ */
+void CHeaderArena::set(const std::string &name, const std::string &value)
+{
+    set(name, value.data(), value.size());
+}
+
+
+/*
+ * Remove a header.
+ */
+void CHeaderArena::erase(const std::string &name)
+{
+    int i = index(name);
+
+    if (i >= 0)
+        m_entries.erase(m_entries.begin() + i);
+}
+
+
+/*
+ * Find the value of a header.
+ */
+const char *CHeaderArena::find(const std::string &name, size_t *len) const
+{
+    int i = index(name);
+
+    if (i < 0)
+        return NULL;
+
+    if (len != NULL)
+        *len = m_entries[i].length;
+
+    return (&m_values[m_entries[i].offset]);
+}
+
+
+/*
+ * The name of the given header.
+ */
+std::string CHeaderArena::name(size_t i) const
+{
+    uint32_t id = m_entries.at(i).name;
+
+    if (id & LOCAL_NAME)
+        return (&m_values[id & ~LOCAL_NAME]);
+
+    return (known_name(id));
+}
+
+
+/*
+ * The value of the given header.
+ */
+const char *CHeaderArena::value(size_t i) const
+{
+    return (&m_values[m_entries.at(i).offset]);
+}
+
+
+/*
+ * The length of the value of the given header.
+ */
+size_t CHeaderArena::value_size(size_t i) const
+{
+    return (m_entries.at(i).length);
+}
+
+
+/*
+ * Find the header with the given name.
+ *
+ * A message has a few dozen headers at most, so we search them rather
+ * than index them.
+ */
+int CHeaderArena::index(const std::string &name) const
+{
+    uint32_t id;
+
+    if (known(name, id))
+    {
+        for (size_t i = 0; i < m_entries.size(); i++)
+        {
+            if (m_entries[i].name == id)
+                return (i);
+        }
+
+        return (-1);
+    }
+
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        uint32_t local = m_entries[i].name;
+
+        if ((local & LOCAL_NAME) && (strcmp(&m_values[local & ~LOCAL_NAME], name.c_str()) == 0))
+            return (i);
+    }
+
+    return (-1);
+}
+
+
+/*
+ * Find the number of a well-known header-name.
+ */
+bool CHeaderArena::known(const std::string &name, uint32_t &id)
+{
+    /*
+     * This is built once, by whichever thread is first, and never
+     * changed afterwards.
+     */
+    static const std::unordered_map<std::string, uint32_t> ids = []()
+    {
+        std::unordered_map<std::string, uint32_t> result;
+
+        for (size_t i = 0; i < sizeof(known_names) / sizeof(known_names[0]); i++)
+            result[known_names[i]] = i;
+
+        return (result);
+    }();
+
+    auto it = ids.find(name);
+
+    if (it == ids.end())
+        return false;
+
+    id = it->second;
+    return true;
+}
+
+
+/*
+ * The well-known header-name with the given number.
+ */
+const char *CHeaderArena::known_name(uint32_t id)
+{
+    if (id >= sizeof(known_names) / sizeof(known_names[0]))
+        return "";
+
+    return (known_names[id]);
+}
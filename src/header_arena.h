@@ -0,0 +1,152 @@
+/*
+ * header_arena.h - Compact storage for the headers of a message.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * The CHeaderArena class holds the decoded headers of a single message.
+ *
+ * The values are stored, NUL-terminated, in a single buffer, and each
+ * header refers to its value by offset.  Header names are lower-cased.
+ * The names of well-known headers are numbered from a fixed table, so a
+ * message stores only a small number for each and finding one compares
+ * numbers rather than strings - any other name is stored in the arena,
+ * alongside its value.
+ *
+ * Lookups return pointers into the arena, rather than copies, which
+ * remain valid until the arena is next changed.
+ *
+ * The table of names never changes, so it is shared between threads
+ * without locking, and an arena may be filled by one thread and then
+ * handed to another.
+ *
+ */
+class CHeaderArena
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CHeaderArena();
+
+public:
+
+    /**
+     * Remove all headers.
+     */
+    void clear();
+
+    /**
+     * The number of headers we hold.
+     */
+    size_t size() const;
+
+    /**
+     * Store a header, with the given lower-case name.  If we hold the
+     * header already its value is replaced.
+     */
+    void set(const std::string &name, const char *value, size_t len);
+    void set(const std::string &name, const std::string &value);
+
+    /**
+     * Remove the header with the given lower-case name, if we hold it.
+     */
+    void erase(const std::string &name);
+
+    /**
+     * Find the value of the header with the given lower-case name,
+     * returning NULL if we don't hold it.  If `len` is given the length
+     * of the value is stored there.
+     */
+    const char *find(const std::string &name, size_t *len = NULL) const;
+
+    /**
+     * The name of the given header.
+     */
+    std::string name(size_t i) const;
+
+    /**
+     * The value of the given header, and its length.
+     */
+    const char *value(size_t i) const;
+    size_t value_size(size_t i) const;
+
+public:
+
+    /**
+     * Find the number of the given lower-case header-name, returning
+     * false if it isn't one of the well-known names.
+     */
+    static bool known(const std::string &name, uint32_t &id);
+
+    /**
+     * The well-known header-name with the given number.
+     */
+    static const char *known_name(uint32_t id);
+
+private:
+
+    /**
+     * Find the header with the given lower-case name, or -1.
+     */
+    int index(const std::string &name) const;
+
+private:
+
+    /**
+     * A header we hold.
+     */
+    struct CHeaderEntry
+    {
+        /**
+         * The number of a well-known header-name, or else `LOCAL_NAME`
+         * and the offset of the name in our buffer.
+         */
+        uint32_t name;
+
+        /**
+         * The offset of the value in our buffer, and its length.
+         */
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    /**
+     * Set upon the name of a header which isn't well-known.
+     */
+    static const uint32_t LOCAL_NAME = 0x80000000;
+
+    /**
+     * The headers we hold, in the order they were first set.
+     */
+    std::vector<CHeaderEntry> m_entries;
+
+    /**
+     * The values of our headers, and the names which aren't well-known,
+     * each NUL-terminated.
+     */
+    std::vector<char> m_values;
+};
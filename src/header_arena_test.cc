@@ -0,0 +1,108 @@
+/*
+ * header_arena_test.cc - Test-cases for our header storage.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+
+#include "header_arena.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that headers are stored, replaced, found, and removed.
+ */
+void TestHeaderArenaSet(CuTest * tc)
+{
+    CHeaderArena headers;
+    CuAssertIntEquals(tc, 0, headers.size());
+    CuAssertPtrEquals(tc, NULL, (void *)headers.find("subject"));
+
+    headers.set("subject", "Hello");
+    headers.set("x-mailer", "lumail");
+    CuAssertIntEquals(tc, 2, headers.size());
+
+    size_t len = 0;
+    CuAssertStrEquals(tc, "Hello", headers.find("subject", &len));
+    CuAssertIntEquals(tc, 5, len);
+    CuAssertStrEquals(tc, "x-mailer", headers.name(1).c_str());
+
+    /*
+     * A repeated header replaces the value, but keeps its place.
+     */
+    headers.set("subject", "Goodbye");
+    CuAssertIntEquals(tc, 2, headers.size());
+    CuAssertStrEquals(tc, "subject", headers.name(0).c_str());
+    CuAssertStrEquals(tc, "Goodbye", headers.value(0));
+    CuAssertIntEquals(tc, 7, headers.value_size(0));
+
+    /*
+     * Values may contain NUL bytes.
+     */
+    headers.set("x-binary", std::string("a\0b", 3));
+    CuAssertIntEquals(tc, 3, headers.value_size(2));
+    CuAssertStrEquals(tc, "x-binary", headers.name(2).c_str());
+
+    headers.set("x-binary", "c");
+    CuAssertIntEquals(tc, 3, headers.size());
+    CuAssertStrEquals(tc, "x-binary", headers.name(2).c_str());
+    CuAssertStrEquals(tc, "c", headers.find("x-binary"));
+
+    headers.erase("subject");
+    headers.erase("never-seen-before");
+    CuAssertIntEquals(tc, 2, headers.size());
+    CuAssertPtrEquals(tc, NULL, (void *)headers.find("subject"));
+    CuAssertStrEquals(tc, "lumail", headers.find("x-mailer"));
+
+    headers.clear();
+    CuAssertIntEquals(tc, 0, headers.size());
+}
+
+
+/**
+ * Test that well-known header-names are numbered, and that others are
+ * kept apart in each arena.
+ */
+void TestHeaderArenaNames(CuTest * tc)
+{
+    uint32_t id = 0;
+    CuAssertTrue(tc, CHeaderArena::known("subject", id));
+    CuAssertStrEquals(tc, "subject", CHeaderArena::known_name(id));
+    CuAssertTrue(tc, ! CHeaderArena::known("x-arena-test", id));
+
+    CHeaderArena one;
+    CHeaderArena two;
+
+    one.set("x-arena-test", "one");
+    two.set("x-arena-other", "two");
+
+    CuAssertStrEquals(tc, "one", one.find("x-arena-test"));
+    CuAssertPtrEquals(tc, NULL, (void *)one.find("x-arena-other"));
+    CuAssertPtrEquals(tc, NULL, (void *)two.find("x-arena-test"));
+    CuAssertStrEquals(tc, "x-arena-other", two.name(0).c_str());
+    CuAssertTrue(tc, ! CHeaderArena::known("x-arena-test", id));
+}
+
+
+CuSuite *
+header_arena_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestHeaderArenaSet);
+    SUITE_ADD_TEST(suite, TestHeaderArenaNames);
+    return suite;
+}
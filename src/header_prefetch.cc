@@ -0,0 +1,505 @@
+/*
+ * header_prefetch.cc - Parse the headers of messages in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "header_prefetch.h"
+#include "maildir.h"
+#include "message.h"
+#include "message_table.h"
+
+
+/*
+ * The most threads we'll use, regardless of the number of CPUs.
+ *
+ * We leave one CPU for the user-interface, and reading files is as much
+ * a matter of I/O as of processing.
+ */
+#define MAX_PREFETCH_THREADS 4
+
+
+/*
+ * The texts read for a full-text index are added to it once they're all
+ * published, or once this many are waiting - so that a large folder is
+ * neither held in memory, nor written as a great many small segments.
+ */
+#define INDEX_BATCH 1000
+
+
+/*
+ * Constructor.
+ */
+CHeaderPrefetch::CHeaderPrefetch()
+{
+    m_taken    = 0;
+    m_center   = 0;
+    m_above    = 0;
+    m_below    = 0;
+    m_running  = 0;
+    m_stopping = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CHeaderPrefetch::~CHeaderPrefetch()
+{
+    stop();
+    cancel();
+
+    /*
+     * Discard anything we didn't publish.
+     */
+    CMessageTable *table = CMessageTable::instance();
+
+    for (CPrefetchResult &result : m_results)
+        table->release(result.row);
+
+    m_results.clear();
+
+    /*
+     * Texts which weren't added to an index will be read again.
+     */
+    m_index_jobs.clear();
+    m_index_results.clear();
+    m_batches.clear();
+}
+
+
+/*
+ * Start our threads.
+ */
+void CHeaderPrefetch::start()
+{
+    if (! m_threads.empty())
+        return;
+
+    int threads = (int)std::thread::hardware_concurrency() - 1;
+
+    if (threads > MAX_PREFETCH_THREADS)
+        threads = MAX_PREFETCH_THREADS;
+
+    if (threads < 1)
+        threads = 1;
+
+    for (int i = 0; i < threads; i++)
+        m_threads.push_back(std::thread(&CHeaderPrefetch::worker, this));
+}
+
+
+/*
+ * Stop our threads.
+ */
+void CHeaderPrefetch::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+
+    m_wake.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+
+    m_threads.clear();
+    m_stopping = false;
+}
+
+
+/*
+ * Queue the messages of the given folder whose headers we don't have.
+ */
+void CHeaderPrefetch::schedule(std::shared_ptr<CMaildir> folder)
+{
+    cancel();
+
+    if ((! folder) || (! folder->is_maildir()))
+        return;
+
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * Our threads can't use the table, so they're given the path of
+     * each message - and the row is kept alive until we publish.
+     */
+    std::vector<CPrefetchJob> jobs;
+    size_t count = folder->message_count();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t row = folder->row_at(i);
+
+        if (table->state(row) & CMessageTable::STATE_HEADERS)
+            continue;
+
+        table->acquire(row);
+
+        CPrefetchJob job;
+        job.row    = row;
+        job.offset = i;
+        job.path   = table->path(row);
+        jobs.push_back(job);
+    }
+
+    if (jobs.empty())
+        return;
+
+    start();
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        m_jobs.swap(jobs);
+        m_claimed.assign(m_jobs.size(), false);
+        m_taken = 0;
+
+        m_above = std::lower_bound(m_jobs.begin(), m_jobs.end(), m_center,
+                                   [](const CPrefetchJob & job, size_t offset)
+        {
+            return (job.offset < offset);
+        }) - m_jobs.begin();
+        m_below = m_above;
+    }
+
+    m_wake.notify_all();
+}
+
+
+/*
+ * Forget the messages which are still queued.
+ */
+void CHeaderPrefetch::cancel()
+{
+    std::vector<uint32_t> rows;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        /*
+         * The rows of claimed jobs are released when their results
+         * are published.
+         */
+        for (size_t i = 0; i < m_jobs.size(); i++)
+        {
+            if (! m_claimed[i])
+                rows.push_back(m_jobs[i].row);
+        }
+
+        m_jobs.clear();
+        m_claimed.clear();
+        m_taken = 0;
+        m_above = 0;
+        m_below = 0;
+    }
+
+    CMessageTable *table = CMessageTable::instance();
+
+    for (uint32_t row : rows)
+        table->release(row);
+}
+
+
+/*
+ * Queue the messages of the given folder which aren't in its index.
+ */
+size_t CHeaderPrefetch::index(std::shared_ptr<CMaildir> folder, size_t limit)
+{
+    if ((! folder) || (! folder->is_maildir()))
+        return 0;
+
+    /*
+     * A batch which is still being read would give us the same messages
+     * again.
+     */
+    auto it = m_batches.find(folder.get());
+
+    if (it != m_batches.end())
+        return 0;
+
+    std::vector<CSearchEntry> entries = folder->unindexed_search();
+
+    if ((limit > 0) && (entries.size() > limit))
+        entries.resize(limit);
+
+    if (entries.empty())
+        return 0;
+
+    CMessageTable *table = CMessageTable::instance();
+
+    std::vector<CIndexJob> jobs;
+    jobs.reserve(entries.size());
+
+    for (const CSearchEntry &entry : entries)
+    {
+        CIndexJob job;
+        job.folder = folder.get();
+        job.entry  = entry;
+        job.path   = table->path(entry.row);
+        jobs.push_back(job);
+    }
+
+    CIndexBatch &batch = m_batches[folder.get()];
+    batch.folder      = folder;
+    batch.outstanding = jobs.size();
+
+    start();
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_index_jobs.insert(m_index_jobs.end(), jobs.begin(), jobs.end());
+    }
+
+    m_wake.notify_all();
+
+    return (jobs.size());
+}
+
+
+/*
+ * Parse the messages nearest the given offset first.
+ */
+void CHeaderPrefetch::prioritise(size_t offset)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    if (offset == m_center)
+        return;
+
+    m_center = offset;
+
+    /*
+     * Search outwards from the new position - the jobs we've claimed
+     * already will be skipped.
+     */
+    m_above = std::lower_bound(m_jobs.begin(), m_jobs.end(), m_center,
+                               [](const CPrefetchJob & job, size_t offset)
+    {
+        return (job.offset < offset);
+    }) - m_jobs.begin();
+    m_below = m_above;
+}
+
+
+/*
+ * Claim the queued job nearest to the selection.
+ */
+bool CHeaderPrefetch::next_job(CPrefetchJob &job)
+{
+    while ((m_above < m_jobs.size()) || (m_below > 0))
+    {
+        size_t pick;
+
+        if ((m_above < m_jobs.size()) && (m_below > 0))
+        {
+            size_t up   = m_jobs[m_above].offset - m_center;
+            size_t down = m_center - m_jobs[m_below - 1].offset;
+
+            pick = (up <= down) ? m_above++ : --m_below;
+        }
+        else if (m_above < m_jobs.size())
+        {
+            pick = m_above++;
+        }
+        else
+        {
+            pick = --m_below;
+        }
+
+        if (m_claimed[pick])
+            continue;
+
+        m_claimed[pick] = true;
+        m_taken += 1;
+
+        job = m_jobs[pick];
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * The main-loop of each thread.
+ */
+void CHeaderPrefetch::worker()
+{
+#ifdef __linux__
+
+    /*
+     * We'd rather not compete with the user-interface.
+     */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+#endif
+
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (true)
+    {
+        m_wake.wait(lock, [this]
+        {
+            return (m_stopping || (m_taken < m_jobs.size()) || (! m_index_jobs.empty()));
+        });
+
+        if (m_stopping)
+            return;
+
+        CPrefetchJob job;
+
+        if (! next_job(job))
+        {
+            /*
+             * With no headers left to parse we read messages for the
+             * full-text indexes.
+             */
+            if (m_index_jobs.empty())
+                continue;
+
+            CIndexJob index = m_index_jobs.front();
+            m_index_jobs.pop_front();
+
+            m_running += 1;
+            lock.unlock();
+
+            CIndexResult result;
+            result.folder = index.folder;
+            result.found  = CSearchIndex::read(index.path, index.entry, result.text);
+
+            lock.lock();
+            m_running -= 1;
+            m_index_results.push_back(std::move(result));
+            continue;
+        }
+
+        m_running += 1;
+        lock.unlock();
+
+        CPrefetchResult result;
+        result.row = job.row;
+
+        std::string block;
+        result.found = CMessage::read_header_block(job.path, block);
+
+        if (result.found)
+            CMessage::parse_headers(block, result.headers);
+
+        lock.lock();
+        m_running -= 1;
+        m_results.push_back(std::move(result));
+    }
+}
+
+
+/*
+ * Store the headers which have been parsed.
+ */
+size_t CHeaderPrefetch::publish()
+{
+    std::vector<CPrefetchResult> results;
+    std::vector<CIndexResult> texts;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        results.swap(m_results);
+        texts.swap(m_index_results);
+    }
+
+    CMessageTable *table = CMessageTable::instance();
+    size_t count = 0;
+
+    for (CPrefetchResult &result : results)
+    {
+        /*
+         * The message might have been drawn, and so parsed, while it was
+         * queued.  If it was renamed before we read it we found nothing,
+         * and it will be parsed when it is next needed.
+         */
+        if ((result.found) && !(table->state(result.row) & CMessageTable::STATE_HEADERS))
+        {
+            CMessage::store_headers(result.row, result.headers);
+            count += 1;
+        }
+
+        table->release(result.row);
+    }
+
+    for (CIndexResult &result : texts)
+    {
+        auto it = m_batches.find(result.folder);
+
+        if (it == m_batches.end())
+            continue;
+
+        CIndexBatch &batch = it->second;
+        batch.outstanding -= 1;
+
+        /*
+         * A message which was renamed before we read it will be read
+         * again, under its new name, once this batch is done.
+         */
+        if (result.found)
+        {
+            batch.texts.push_back(std::move(result.text));
+            count += 1;
+        }
+
+        if ((batch.outstanding == 0) || (batch.texts.size() >= INDEX_BATCH))
+            write_batch(batch);
+
+        if (batch.outstanding == 0)
+            m_batches.erase(it);
+    }
+
+    return (count);
+}
+
+
+/*
+ * Add the texts of the given batch to the index of its folder.
+ */
+void CHeaderPrefetch::write_batch(CIndexBatch &batch)
+{
+    std::shared_ptr<CMaildir> folder = batch.folder.lock();
+
+    if (folder && (! batch.texts.empty()))
+        folder->add_search(batch.texts);
+
+    batch.texts.clear();
+}
+
+
+/*
+ * The number of messages which have yet to be published.
+ */
+size_t CHeaderPrefetch::pending()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    return ((m_jobs.size() - m_taken) + m_running + m_results.size() +
+            m_index_jobs.size() + m_index_results.size());
+}
@@ -0,0 +1,291 @@
+/*
+ * header_prefetch.h - Parse the headers of messages in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "header_arena.h"
+#include "search_index.h"
+#include "singleton.h"
+
+
+class CMaildir;
+
+
+/**
+ * The CHeaderPrefetch class is a singleton which parses the headers of
+ * the messages in the current folder, using a small pool of threads, so
+ * that scrolling into a region of the index which hasn't been drawn yet
+ * doesn't stall while each message is read.
+ *
+ * The messages nearest the selected one are parsed first, and each time
+ * the selection moves the remainder of the queue is re-ordered.
+ *
+ * Once there are no headers left to parse the threads read the text of
+ * the messages which aren't in the full-text index of their folder.
+ *
+ * The threads only read and parse files.  Their results are collected,
+ * and stored in the message-table or the index by `publish()` - which is
+ * called from the main-loop - since neither the table, the index, nor
+ * Lua are thread-safe.
+ *
+ */
+class CHeaderPrefetch : public Singleton<CHeaderPrefetch>
+{
+public:
+
+    /**
+     * Constructor.  Our threads are started when they're first needed.
+     */
+    CHeaderPrefetch();
+
+    /**
+     * Destructor - stop our threads.
+     */
+    ~CHeaderPrefetch();
+
+public:
+
+    /**
+     * Replace the queue with those messages of the given folder whose
+     * headers haven't been stored, in directory-order.
+     */
+    void schedule(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * Forget the messages which are still queued.
+     */
+    void cancel();
+
+    /**
+     * Parse the messages nearest the given offset, in directory-order,
+     * before any others.
+     */
+    void prioritise(size_t offset);
+
+    /**
+     * Queue up to `limit` of the messages of the given folder which
+     * aren't in its full-text index, or all of them if the limit is zero,
+     * returning the number queued.
+     *
+     * Nothing is queued while a previous batch of the folder is still
+     * being read.
+     */
+    size_t index(std::shared_ptr<CMaildir> folder, size_t limit = 0);
+
+    /**
+     * Store the headers which have been parsed since we were last
+     * called, and add the text which has been read to the full-text
+     * indexes, returning the number of messages updated.
+     */
+    size_t publish();
+
+    /**
+     * The number of messages which have yet to be published.
+     */
+    size_t pending();
+
+private:
+
+    /**
+     * A message whose headers should be parsed.
+     */
+    struct CPrefetchJob
+    {
+        /**
+         * The row of the message-table, which we hold a reference to.
+         */
+        uint32_t row;
+
+        /**
+         * The offset of the message in its folder.
+         */
+        size_t offset;
+
+        /**
+         * The path of the message-file.
+         */
+        std::string path;
+    };
+
+    /**
+     * The outcome of parsing a single message.
+     */
+    struct CPrefetchResult
+    {
+        uint32_t row;
+        bool found;
+        CHeaderArena headers;
+    };
+
+    /**
+     * A message whose text should be read for the full-text index.
+     */
+    struct CIndexJob
+    {
+        /**
+         * The folder the message belongs to, which only identifies its
+         * batch.
+         */
+        CMaildir *folder;
+
+        /**
+         * The message, and the path of its file.
+         */
+        CSearchEntry entry;
+        std::string path;
+    };
+
+    /**
+     * The outcome of reading a single message for the index.
+     */
+    struct CIndexResult
+    {
+        CMaildir *folder;
+        bool found;
+        CSearchText text;
+    };
+
+    /**
+     * The messages of a folder which are being read for its index.
+     *
+     * This is only used by the main thread.
+     */
+    struct CIndexBatch
+    {
+        std::weak_ptr<CMaildir> folder;
+
+        /**
+         * The number of messages which haven't been published.
+         */
+        size_t outstanding;
+
+        /**
+         * The texts which have been published, but not yet added to the
+         * index.
+         */
+        std::vector<CSearchText> texts;
+    };
+
+    /**
+     * Add the texts of the given batch to the index of its folder.
+     */
+    void write_batch(CIndexBatch &batch);
+
+    /**
+     * The main-loop of each thread.
+     */
+    void worker();
+
+    /**
+     * Claim the queued job nearest to the selection, returning false if
+     * there is none.
+     *
+     * **NOTE**: This must be called with `m_lock` held.
+     */
+    bool next_job(CPrefetchJob &job);
+
+    /**
+     * Start our threads, if they're not running.
+     */
+    void start();
+
+    /**
+     * Stop our threads, waiting for them to finish.
+     */
+    void stop();
+
+private:
+
+    /**
+     * Protects everything below, which is shared with our threads.
+     */
+    std::mutex m_lock;
+
+    /**
+     * Signalled when there is work to do, or we're stopping.
+     */
+    std::condition_variable m_wake;
+
+    /**
+     * The queue, ordered by offset, and whether each entry has been
+     * claimed by a thread.
+     */
+    std::vector<CPrefetchJob> m_jobs;
+    std::vector<bool> m_claimed;
+
+    /**
+     * The number of jobs which have been claimed.
+     */
+    size_t m_taken;
+
+    /**
+     * The offset of the selection, and the position in the queue from
+     * which we search outwards - upwards from `m_above`, and downwards
+     * from `m_below - 1`.
+     */
+    size_t m_center;
+    size_t m_above;
+    size_t m_below;
+
+    /**
+     * The number of jobs claimed by a thread, but not yet finished.
+     */
+    size_t m_running;
+
+    /**
+     * The results which haven't been published.
+     */
+    std::vector<CPrefetchResult> m_results;
+
+    /**
+     * The messages to read for the full-text indexes, once there are no
+     * headers left to parse, and the results which haven't been
+     * published.
+     */
+    std::deque<CIndexJob> m_index_jobs;
+    std::vector<CIndexResult> m_index_results;
+
+    /**
+     * Are we stopping?
+     */
+    bool m_stopping;
+
+    /**
+     * Our threads.
+     */
+    std::vector<std::thread> m_threads;
+
+    /**
+     * The folders whose messages are being read for their indexes.
+     *
+     * This is only used by the main thread, and so isn't protected by
+     * `m_lock`.
+     */
+    std::unordered_map<CMaildir *, CIndexBatch> m_batches;
+};
@@ -0,0 +1,224 @@
+/*
+ * header_prefetch_test.cc - Test-cases for our background header-parser.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "header_prefetch.h"
+#include "maildir.h"
+#include "message_table.h"
+#include "search_index.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that the headers of a folder are parsed, and published.
+ */
+void TestHeaderPrefetchPublish(CuTest * tc)
+{
+    char tmpl[] = "/tmp/prefetch.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string path(tmpl);
+    CDirectory::mkdir_p(path + "/cur");
+    CDirectory::mkdir_p(path + "/new");
+    CDirectory::mkdir_p(path + "/tmp");
+
+    int count = 50;
+
+    for (int i = 0; i < count; i++)
+    {
+        std::ofstream out(path + "/cur/" + std::to_string(i) + ".test:2,S");
+        out << "Subject: Message " << i << "\n";
+        out << "From: steve@example.com\n\nBody\n";
+        out.close();
+    }
+
+    std::shared_ptr<CMaildir> maildir = std::shared_ptr<CMaildir>(new CMaildir(path));
+    maildir->scan();
+    CuAssertIntEquals(tc, count, maildir->message_count());
+
+    /*
+     * Parse everything, starting from the middle of the folder, and
+     * publish the results as they arrive.
+     */
+    CMessageTable *table = CMessageTable::instance();
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::instance();
+
+    prefetch->prioritise(count / 2);
+    prefetch->schedule(maildir);
+
+    size_t published = 0;
+
+    for (int wait = 0; (wait < 1000) && (prefetch->pending() > 0); wait++)
+    {
+        published += prefetch->publish();
+        usleep(5000);
+    }
+
+    published += prefetch->publish();
+
+    CuAssertIntEquals(tc, 0, prefetch->pending());
+    CuAssertIntEquals(tc, count, published);
+
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t row = maildir->row_at(i);
+
+        CuAssertTrue(tc, table->state(row) & CMessageTable::STATE_HEADERS);
+        CuAssertStrEquals(tc, "steve@example.com",
+                          table->header(row, CMessageTable::HEADER_FROM).c_str());
+    }
+
+    /*
+     * There is nothing left to do for the same folder.
+     */
+    prefetch->schedule(maildir);
+    CuAssertIntEquals(tc, 0, prefetch->pending());
+
+    maildir = NULL;
+    prefetch->destroy_instance();
+
+    for (int i = 0; i < count; i++)
+        CFile::delete_file(path + "/cur/" + std::to_string(i) + ".test:2,S");
+
+    rmdir((path + "/cur").c_str());
+    rmdir((path + "/new").c_str());
+    rmdir((path + "/tmp").c_str());
+    rmdir(path.c_str());
+}
+
+
+/**
+ * Test that the messages of a folder are read, and indexed, in the
+ * background.
+ */
+void TestHeaderPrefetchIndex(CuTest * tc)
+{
+    char tmpl[] = "/tmp/prefetch.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    CConfig *config = CConfig::instance();
+    std::string previous = config->get_string("cache.prefix");
+    config->set("cache.prefix", std::string(tmpl), false);
+
+    std::string path(tmpl);
+    CDirectory::mkdir_p(path + "/cur");
+    CDirectory::mkdir_p(path + "/new");
+    CDirectory::mkdir_p(path + "/tmp");
+
+    int count = 50;
+
+    for (int i = 0; i < count; i++)
+    {
+        std::ofstream out(path + "/cur/" + std::to_string(i) + ".test:2,S");
+        out << "Subject: Message " << i << "\n";
+        out << "From: steve@example.com\n";
+        out << "Content-Type: text/plain\n\n";
+        out << ((i == 7) ? "Lunch on Friday?\n" : "Body\n");
+        out.close();
+    }
+
+    std::shared_ptr<CMaildir> maildir = std::shared_ptr<CMaildir>(new CMaildir(path));
+    maildir->scan();
+    CuAssertIntEquals(tc, count, maildir->message_count());
+
+    /*
+     * Queue a few, and then the rest - a folder isn't queued twice while
+     * it is being read.
+     */
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::instance();
+
+    CuAssertIntEquals(tc, 10, prefetch->index(maildir, 10));
+    CuAssertIntEquals(tc, 0, prefetch->index(maildir));
+
+    for (int wait = 0; (wait < 1000) && (prefetch->pending() > 0); wait++)
+    {
+        prefetch->publish();
+        usleep(5000);
+    }
+
+    prefetch->publish();
+
+    CuAssertIntEquals(tc, 0, prefetch->pending());
+    CuAssertIntEquals(tc, count - 10, prefetch->index(maildir));
+
+    size_t published = 0;
+
+    for (int wait = 0; (wait < 1000) && (prefetch->pending() > 0); wait++)
+    {
+        published += prefetch->publish();
+        usleep(5000);
+    }
+
+    published += prefetch->publish();
+
+    CuAssertIntEquals(tc, 0, prefetch->pending());
+    CuAssertIntEquals(tc, count - 10, published);
+
+    CSearchIndex *index = maildir->search_index();
+    CuAssertPtrNotNull(tc, index);
+    CuAssertIntEquals(tc, count, index->rows());
+
+    std::vector<std::string> terms = CSearchIndex::terms("lunch friday");
+    std::vector<uint64_t> documents(terms.size(), 0);
+    std::vector<CSearchHit> hits;
+    index->search(terms, hits, documents);
+
+    CuAssertIntEquals(tc, 1, hits.size());
+    CuAssertStrEquals(tc, "7.test", hits[0].id.c_str());
+
+    /*
+     * There is nothing left to read.
+     */
+    CuAssertIntEquals(tc, 0, prefetch->index(maildir));
+
+    index->close();
+    maildir = NULL;
+    prefetch->destroy_instance();
+
+    for (int i = 0; i < count; i++)
+        CFile::delete_file(path + "/cur/" + std::to_string(i) + ".test:2,S");
+
+    CFile::delete_file(CSearchIndex::filename(path));
+
+    rmdir((path + "/search").c_str());
+    rmdir((path + "/cur").c_str());
+    rmdir((path + "/new").c_str());
+    rmdir((path + "/tmp").c_str());
+    rmdir(path.c_str());
+
+    config->set("cache.prefix", previous, false);
+}
+
+
+CuSuite *
+header_prefetch_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestHeaderPrefetchPublish);
+    SUITE_ADD_TEST(suite, TestHeaderPrefetchIndex);
+    return suite;
+}
@@ -0,0 +1,517 @@
+/*
+ * header_scanner.cc - Locate the headers of a message, in bulk.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "header_scanner.h"
+
+
+/*
+ * SSE2 is part of every x86-64 CPU, and AVX2 is detected at runtime.
+ */
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Append the offset of every newline and colon in the range [pos, len)
+ * of the buffer to the vector, in order.
+ *
+ * These are all the characters the scanner needs to find - everything
+ * else is tested at one of these offsets, or at the start of a line.
+ */
+typedef void (*mark_function)(const char *buf, size_t pos, size_t len, std::vector<size_t> &marks);
+
+/*
+ * Test whether a buffer is entirely 7-bit.
+ */
+typedef bool (*ascii_function)(const char *buf, size_t len);
+
+
+static void mark_scalar(const char *buf, size_t pos, size_t len, std::vector<size_t> &marks)
+{
+    for (; pos < len; pos++)
+    {
+        if ((buf[pos] == '\n') || (buf[pos] == ':'))
+            marks.push_back(pos);
+    }
+}
+
+
+static bool ascii_scalar(const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if ((unsigned char)buf[i] & 0x80)
+            return false;
+    }
+
+    return true;
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Append the offset of each bit set in the mask, counting from base.
+ */
+static inline void mark_bits(uint64_t mask, size_t base, std::vector<size_t> &marks)
+{
+    while (mask != 0)
+    {
+        marks.push_back(base + __builtin_ctzll(mask));
+        mask &= mask - 1;
+    }
+}
+
+
+/*
+ * Build a mask of the newlines and colons in sixty-four bytes at a time,
+ * then walk its bits.
+ */
+static void mark_sse2(const char *buf, size_t pos, size_t len, std::vector<size_t> &marks)
+{
+    __m128i nl    = _mm_set1_epi8('\n');
+    __m128i colon = _mm_set1_epi8(':');
+
+    for (; pos + 64 <= len; pos += 64)
+    {
+        uint64_t mask = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + pos + i * 16));
+            __m128i found = _mm_or_si128(_mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, colon));
+
+            mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(found) << (i * 16);
+        }
+
+        mark_bits(mask, pos, marks);
+    }
+
+    mark_scalar(buf, pos, len, marks);
+}
+
+
+static bool ascii_sse2(const char *buf, size_t len)
+{
+    size_t pos = 0;
+    __m128i bits = _mm_setzero_si128();
+
+    for (; pos + 16 <= len; pos += 16)
+        bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i *)(buf + pos)));
+
+    /*
+     * The mask has a bit set for each byte with its top bit set.
+     */
+    if (_mm_movemask_epi8(bits) != 0)
+        return false;
+
+    return (ascii_scalar(buf + pos, len - pos));
+}
+
+
+__attribute__((target("avx2")))
+static void mark_avx2(const char *buf, size_t pos, size_t len, std::vector<size_t> &marks)
+{
+    __m256i nl    = _mm256_set1_epi8('\n');
+    __m256i colon = _mm256_set1_epi8(':');
+
+    for (; pos + 64 <= len; pos += 64)
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(buf + pos));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(buf + pos + 32));
+
+        lo = _mm256_or_si256(_mm256_cmpeq_epi8(lo, nl), _mm256_cmpeq_epi8(lo, colon));
+        hi = _mm256_or_si256(_mm256_cmpeq_epi8(hi, nl), _mm256_cmpeq_epi8(hi, colon));
+
+        uint64_t mask = (uint64_t)(uint32_t)_mm256_movemask_epi8(lo) |
+                        ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32);
+
+        mark_bits(mask, pos, marks);
+    }
+
+    mark_sse2(buf, pos, len, marks);
+}
+
+
+__attribute__((target("avx2")))
+static bool ascii_avx2(const char *buf, size_t len)
+{
+    size_t pos = 0;
+    __m256i bits = _mm256_setzero_si256();
+
+    for (; pos + 32 <= len; pos += 32)
+        bits = _mm256_or_si256(bits, _mm256_loadu_si256((const __m256i *)(buf + pos)));
+
+    if (_mm256_movemask_epi8(bits) != 0)
+        return false;
+
+    return (ascii_sse2(buf + pos, len - pos));
+}
+
+#endif
+
+
+/*
+ * The implementation in use.
+ */
+static CHeaderScanner::CImplementation g_implementation = CHeaderScanner::SCALAR;
+static mark_function g_mark   = mark_scalar;
+static ascii_function g_ascii = ascii_scalar;
+
+
+/*
+ * Switch to the given implementation, if we can.
+ */
+static bool use_implementation(CHeaderScanner::CImplementation impl)
+{
+    switch (impl)
+    {
+    case CHeaderScanner::SCALAR:
+        g_mark  = mark_scalar;
+        g_ascii = ascii_scalar;
+        break;
+
+#ifdef HAVE_X86_SIMD
+
+    case CHeaderScanner::SSE2:
+        g_mark  = mark_sse2;
+        g_ascii = ascii_sse2;
+        break;
+
+    case CHeaderScanner::AVX2:
+        if (! __builtin_cpu_supports("avx2"))
+            return false;
+
+        g_mark  = mark_avx2;
+        g_ascii = ascii_avx2;
+        break;
+#endif
+
+    default:
+        return false;
+    }
+
+    g_implementation = impl;
+    return true;
+}
+
+
+/*
+ * Use the best implementation this CPU supports.
+ */
+static bool choose_best()
+{
+    if (! use_implementation(CHeaderScanner::AVX2))
+        use_implementation(CHeaderScanner::SSE2);
+
+    return true;
+}
+
+
+/*
+ * Ensure an implementation has been chosen, which happens once - in a
+ * thread-safe way.
+ */
+static void choose()
+{
+    static bool chosen = choose_best();
+    (void)chosen;
+}
+
+
+/*
+ * Walk the newlines and colons of a buffer, in order.
+ *
+ * They're marked a block at a time, so a search which stops early - as
+ * header_end() usually does - doesn't mark the whole of a large buffer.
+ */
+class CMarks
+{
+public:
+    CMarks(const char *buf, size_t len, size_t from) :
+        m_buf(buf), m_len(len), m_marked(from), m_next(0)
+    {
+    }
+
+    /*
+     * Get the offset of the next newline or colon, returning false once
+     * there are no more.
+     */
+    bool next(size_t &offset)
+    {
+        while (m_next == m_marks.size())
+        {
+            if (m_marked >= m_len)
+                return false;
+
+            size_t end = std::min(m_len, m_marked + BLOCK);
+
+            m_marks.clear();
+            m_next = 0;
+            g_mark(m_buf, m_marked, end, m_marks);
+            m_marked = end;
+        }
+
+        offset = m_marks[m_next++];
+        return true;
+    }
+
+private:
+    static const size_t BLOCK = 1024;
+
+    const char *m_buf;
+    size_t m_len;
+    size_t m_marked;
+    std::vector<size_t> m_marks;
+    size_t m_next;
+};
+
+const size_t CMarks::BLOCK;
+
+
+/*
+ * The implementation which is in use.
+ */
+CHeaderScanner::CImplementation CHeaderScanner::implementation()
+{
+    choose();
+    return (g_implementation);
+}
+
+
+/*
+ * Use the given implementation, if we can.
+ */
+bool CHeaderScanner::set_implementation(CImplementation impl)
+{
+    choose();
+    return (use_implementation(impl));
+}
+
+
+/*
+ * The name of the given implementation.
+ */
+const char *CHeaderScanner::implementation_name(CImplementation impl)
+{
+    switch (impl)
+    {
+    case SSE2:
+        return "sse2";
+
+    case AVX2:
+        return "avx2";
+
+    default:
+        return "scalar";
+    }
+}
+
+
+/*
+ * Find the empty line which ends the headers.
+ */
+size_t CHeaderScanner::header_end(const char *buf, size_t len, size_t from)
+{
+    choose();
+
+    /*
+     * A message might have no headers at all.
+     */
+    if ((from == 0) && (len > 0) && (buf[0] == '\n'))
+        return 0;
+
+    if ((from == 0) && (len > 1) && (buf[0] == '\r') && (buf[1] == '\n'))
+        return 0;
+
+    CMarks marks(buf, len, from);
+    size_t nl;
+
+    while (marks.next(nl))
+    {
+        if (buf[nl] != '\n')
+            continue;
+
+        if ((nl + 1 < len) && (buf[nl + 1] == '\n'))
+            return (nl + 1);
+
+        if ((nl + 2 < len) && (buf[nl + 1] == '\r') && (buf[nl + 2] == '\n'))
+            return (nl + 1);
+    }
+
+    return (std::string::npos);
+}
+
+
+/*
+ * Find each header in the given header-block.
+ */
+size_t CHeaderScanner::scan(const char *buf, size_t len, std::vector<CHeaderSpan> &spans)
+{
+    choose();
+
+    /*
+     * Can a continuation-line extend the last span we added?
+     */
+    bool current = false;
+
+    CMarks marks(buf, len, 0);
+    size_t mark;
+    bool more = marks.next(mark);
+
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        /*
+         * The first colon on this line, if any, then its end.
+         */
+        size_t colon = std::string::npos;
+
+        while (more && (buf[mark] == ':'))
+        {
+            if (colon == std::string::npos)
+                colon = mark;
+
+            more = marks.next(mark);
+        }
+
+        size_t eol = len;
+
+        if (more)
+        {
+            eol  = mark;
+            more = marks.next(mark);
+        }
+
+        size_t end = eol;
+
+        if ((end > pos) && (buf[end - 1] == '\r'))
+            end -= 1;
+
+        /*
+         * The empty line which ends the headers.
+         */
+        if (end == pos)
+            return (std::min(eol + 1, len));
+
+        /*
+         * A line starting with whitespace continues the previous header.
+         */
+        if ((buf[pos] == ' ') || (buf[pos] == '\t'))
+        {
+            if (current)
+            {
+                CHeaderSpan &span = spans.back();
+                span.value_len = end - span.value;
+                span.folded    = true;
+            }
+
+            pos = eol + 1;
+            continue;
+        }
+
+        current = false;
+
+        if ((colon != std::string::npos) && (colon > pos))
+        {
+            /*
+             * Whitespace is allowed before the colon, but not within
+             * the name.
+             */
+            size_t name_end = colon;
+
+            while ((name_end > pos) && ((buf[name_end - 1] == ' ') || (buf[name_end - 1] == '\t')))
+                name_end -= 1;
+
+            size_t space = pos;
+
+            while ((space < name_end) && (buf[space] != ' ') && (buf[space] != '\t'))
+                space += 1;
+
+            if ((name_end > pos) && (space == name_end))
+            {
+                CHeaderSpan span;
+                span.name      = pos;
+                span.name_len  = name_end - pos;
+                span.value     = colon + 1;
+                span.value_len = end - colon - 1;
+                span.folded    = false;
+
+                spans.push_back(span);
+                current = true;
+            }
+        }
+
+        pos = eol + 1;
+    }
+
+    return (len);
+}
+
+
+/*
+ * Return the value of the given header, unfolded.
+ */
+std::string CHeaderScanner::value(const char *buf, const CHeaderSpan &span)
+{
+    const char *start = buf + span.value;
+    const char *end   = start + span.value_len;
+
+    std::string result;
+
+    if (span.folded)
+    {
+        result.reserve(span.value_len);
+
+        for (const char *p = start; p < end; p++)
+        {
+            if ((*p != '\r') && (*p != '\n'))
+                result += *p;
+        }
+    }
+    else
+    {
+        result.assign(start, end);
+    }
+
+    size_t first = result.find_first_not_of(" \t");
+
+    if (first == std::string::npos)
+        return "";
+
+    size_t last = result.find_last_not_of(" \t");
+
+    return (result.substr(first, last - first + 1));
+}
+
+
+/*
+ * Is the given text entirely 7-bit?
+ */
+bool CHeaderScanner::is_ascii(const char *buf, size_t len)
+{
+    choose();
+    return (g_ascii(buf, len));
+}
@@ -0,0 +1,125 @@
+/*
+ * header_scanner.h - Locate the headers of a message, in bulk.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * The location of a single header within a block of headers.
+ */
+struct CHeaderSpan
+{
+    /**
+     * The offset and length of the name, without any whitespace which
+     * preceded the colon.
+     */
+    size_t name;
+    size_t name_len;
+
+    /**
+     * The offset and length of the value, which runs from the colon to
+     * the end of the header's last line - excluding the line-ending.
+     */
+    size_t value;
+    size_t value_len;
+
+    /**
+     * Does the value continue onto further lines?
+     */
+    bool folded;
+};
+
+
+/**
+ * The CHeaderScanner class finds the headers in the header-block of a
+ * message, as described by RFC 5322, without copying anything.
+ *
+ * A single pass over each block of the buffer marks every line-ending,
+ * and every colon which might separate a name from its value, by building
+ * a bitmask of them sixty-four bytes at a time using SSE2 or AVX2 where
+ * the CPU has them, or a byte at a time otherwise.  The headers are then
+ * found by walking those marks.  The implementation is chosen when the
+ * scanner is first used.
+ *
+ */
+class CHeaderScanner
+{
+public:
+
+    /**
+     * The implementations we might use.
+     */
+    enum CImplementation
+    {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    /**
+     * The implementation which is in use.
+     */
+    static CImplementation implementation();
+
+    /**
+     * Use the given implementation, returning false if this CPU, or
+     * this build, doesn't support it.
+     */
+    static bool set_implementation(CImplementation impl);
+
+    /**
+     * The name of the given implementation.
+     */
+    static const char *implementation_name(CImplementation impl);
+
+    /**
+     * Find the end of the header-block in the given buffer, searching
+     * from the given offset.
+     *
+     * The result is the offset of the empty line which separates the
+     * headers from the body, or `std::string::npos` if the buffer doesn't
+     * contain one - in which case more data should be read and the search
+     * resumed a couple of bytes before the previous end.
+     */
+    static size_t header_end(const char *buf, size_t len, size_t from = 0);
+
+    /**
+     * Find each header in the given header-block, appending their spans
+     * to the vector, and return the offset at which the body starts.
+     *
+     * Lines which aren't headers, such as an mbox "From " line, are
+     * skipped.
+     */
+    static size_t scan(const char *buf, size_t len, std::vector<CHeaderSpan> &spans);
+
+    /**
+     * Return the value of the given header, unfolded onto a single line
+     * and without leading or trailing whitespace.
+     */
+    static std::string value(const char *buf, const CHeaderSpan &span);
+
+    /**
+     * Is the given text entirely 7-bit?
+     */
+    static bool is_ascii(const char *buf, size_t len);
+};
@@ -0,0 +1,237 @@
+/*
+ * header_scanner_test.cc - Test-cases for our header-scanner.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <string>
+#include <vector>
+
+#include "header_scanner.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Return each implementation this CPU supports.
+ */
+static std::vector<CHeaderScanner::CImplementation> scanner_implementations()
+{
+    std::vector<CHeaderScanner::CImplementation> result;
+
+    CHeaderScanner::CImplementation all[] = { CHeaderScanner::SCALAR,
+                                              CHeaderScanner::SSE2,
+                                              CHeaderScanner::AVX2
+                                            };
+
+    for (CHeaderScanner::CImplementation impl : all)
+    {
+        if (CHeaderScanner::set_implementation(impl))
+            result.push_back(impl);
+    }
+
+    return (result);
+}
+
+
+/**
+ * Scan the given block, returning the headers as "name=value" lines.
+ */
+static std::string scan_block(const std::string &block, size_t *body = NULL)
+{
+    std::vector<CHeaderSpan> spans;
+    size_t offset = CHeaderScanner::scan(block.data(), block.size(), spans);
+
+    if (body)
+        *body = offset;
+
+    std::string result;
+
+    for (const CHeaderSpan &span : spans)
+    {
+        result += block.substr(span.name, span.name_len);
+        result += "=";
+        result += CHeaderScanner::value(block.data(), span);
+        result += "\n";
+    }
+
+    return (result);
+}
+
+
+/**
+ * Test that the end of the headers is found, whatever the line-endings,
+ * and wherever the terminator falls relative to a vector.
+ */
+void TestHeaderScannerEnd(CuTest * tc)
+{
+    CHeaderScanner::CImplementation original = CHeaderScanner::implementation();
+
+    for (CHeaderScanner::CImplementation impl : scanner_implementations())
+    {
+        CHeaderScanner::set_implementation(impl);
+
+        CuAssertIntEquals(tc, 0, CHeaderScanner::header_end("\nbody", 5));
+        CuAssertIntEquals(tc, 0, CHeaderScanner::header_end("\r\nbody", 6));
+        CuAssertTrue(tc, CHeaderScanner::header_end("", 0) == std::string::npos);
+        CuAssertTrue(tc, CHeaderScanner::header_end("To: x\n", 6) == std::string::npos);
+
+        /*
+         * Move the terminator across the sixty-four byte boundaries of
+         * the masks, with both kinds of line-ending.
+         */
+        for (size_t pad = 0; pad < 140; pad++)
+        {
+            std::string name = "X-Padding: " + std::string(pad, 'x');
+
+            std::string lf = name + "\nTo: steve\n\nbody\n\n";
+            CuAssertIntEquals(tc, name.size() + 11, CHeaderScanner::header_end(lf.data(), lf.size()));
+
+            std::string crlf = name + "\r\nTo: steve\r\n\r\nbody\r\n\r\n";
+            CuAssertIntEquals(tc, name.size() + 13, CHeaderScanner::header_end(crlf.data(), crlf.size()));
+
+            /*
+             * Resuming the search a couple of bytes before the end of a
+             * previous read still finds a terminator which straddled it.
+             */
+            size_t split = name.size() + 11;
+            CuAssertTrue(tc, CHeaderScanner::header_end(lf.data(), split) == std::string::npos);
+            CuAssertIntEquals(tc, split, CHeaderScanner::header_end(lf.data(), lf.size(), split - 2));
+        }
+    }
+
+    CHeaderScanner::set_implementation(original);
+}
+
+
+/**
+ * Test that headers are found, and unfolded.
+ */
+void TestHeaderScannerScan(CuTest * tc)
+{
+    CHeaderScanner::CImplementation original = CHeaderScanner::implementation();
+
+    for (CHeaderScanner::CImplementation impl : scanner_implementations())
+    {
+        CHeaderScanner::set_implementation(impl);
+
+        size_t body = 0;
+
+        /*
+         * Simple headers, with the body following.
+         */
+        std::string block = "To: steve@example.com\nSubject:  Hello  \n\nBody: text\n";
+        CuAssertStrEquals(tc, "To=steve@example.com\nSubject=Hello\n", scan_block(block, &body).c_str());
+        CuAssertIntEquals(tc, block.find("Body"), body);
+
+        /*
+         * Folded headers, and CRLF line-endings.
+         */
+        block = "Subject: one\r\n two\r\n\tthree\r\nTo: steve\r\n\r\n";
+        CuAssertStrEquals(tc, "Subject=one two\tthree\nTo=steve\n", scan_block(block, &body).c_str());
+        CuAssertIntEquals(tc, block.size(), body);
+
+        /*
+         * An mbox "From " line, a continuation with nothing to continue,
+         * whitespace before a colon, and names which aren't names.
+         */
+        block = "From steve Mon Jan 1 00:00:00 2016\n"
+                " orphan\n"
+                "X-Spaced : value\n"
+                "Bad Name: value\n"
+                ": empty\n"
+                "no colon at all\n"
+                "Empty:\n";
+        CuAssertStrEquals(tc, "X-Spaced=value\nEmpty=\n", scan_block(block, &body).c_str());
+        CuAssertIntEquals(tc, block.size(), body);
+
+        /*
+         * A header whose colon is beyond the first vector.
+         */
+        std::string name = "X-" + std::string(40, 'n');
+        block = name + ": " + std::string(40, 'v') + "\n";
+        CuAssertStrEquals(tc, (name + "=" + std::string(40, 'v') + "\n").c_str(), scan_block(block).c_str());
+
+        /*
+         * Headers with colons in their values, and a block longer than
+         * the blocks which are marked at once - so some header straddles
+         * the boundary between them.
+         */
+        block.clear();
+        std::string expected;
+
+        for (int i = 0; i < 100; i++)
+        {
+            std::string value = "Mon, 1 Jan 2016 00:" + std::to_string(i % 60) + ":00";
+            block    += "X-Date-" + std::to_string(i) + ": " + value + "\n";
+            expected += "X-Date-" + std::to_string(i) + "=" + value + "\n";
+        }
+
+        CuAssertStrEquals(tc, expected.c_str(), scan_block(block + "\nbody: text\n", &body).c_str());
+        CuAssertIntEquals(tc, block.size() + 1, body);
+
+        /*
+         * A block without a trailing newline.
+         */
+        CuAssertStrEquals(tc, "To=steve\n", scan_block("To: steve").c_str());
+    }
+
+    CHeaderScanner::set_implementation(original);
+}
+
+
+/**
+ * Test that 8-bit text is detected, wherever it appears.
+ */
+void TestHeaderScannerASCII(CuTest * tc)
+{
+    CHeaderScanner::CImplementation original = CHeaderScanner::implementation();
+
+    for (CHeaderScanner::CImplementation impl : scanner_implementations())
+    {
+        CHeaderScanner::set_implementation(impl);
+
+        CuAssertTrue(tc, CHeaderScanner::is_ascii("", 0));
+
+        for (size_t len = 1; len < 70; len++)
+        {
+            std::string text(len, 'a');
+            CuAssertTrue(tc, CHeaderScanner::is_ascii(text.data(), text.size()));
+
+            for (size_t i = 0; i < len; i++)
+            {
+                text[i] = (char)0xC3;
+                CuAssertTrue(tc, ! CHeaderScanner::is_ascii(text.data(), text.size()));
+                text[i] = 'a';
+            }
+        }
+    }
+
+    CHeaderScanner::set_implementation(original);
+}
+
+
+
+CuSuite *
+header_scanner_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestHeaderScannerEnd);
+    SUITE_ADD_TEST(suite, TestHeaderScannerScan);
+    SUITE_ADD_TEST(suite, TestHeaderScannerASCII);
+    return suite;
+}
@@ -17,6 +17,7 @@
  */
 
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <string.h>
@@ -43,6 +44,8 @@ extern void InitNet(lua_State * l);
 extern void InitPanel(lua_State * l);
 extern void InitRegexp(lua_State * l);
 extern void InitScreen(lua_State * l);
+extern void InitSearch(lua_State * l);
+extern void InitThreads(lua_State * l);
 extern void InitUtf(lua_State * l);
 
 
@@ -109,6 +112,8 @@ CLua::CLua() : Observer(CConfig::instance())
     InitMIME(m_lua);
     InitRegexp(m_lua);
     InitScreen(m_lua);
+    InitSearch(m_lua);
+    InitThreads(m_lua);
     InitUtf(m_lua);
 }
 
@@ -528,6 +533,165 @@ std::vector<std::string> CLua::functiona2table(std::string function, std::string
 }
 
 
+/*
+ * Call a Lua function which will return the number of lines of text a
+ * view holds.
+ *
+ * It may return `nil` to indicate that it cannot, in which case we
+ * return false.
+ */
+bool CLua::function2count(std::string function, int &count)
+{
+    CLuaLog("function2count(" + function + ")");
+
+    count = 0;
+
+    /*
+     * Get the function - if it doesn't exist we're done.
+     */
+    lua_getglobal(m_lua, function.c_str());
+
+    if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return false;
+    }
+
+    int ret = lua_pcall(m_lua, 0, 1, 0);
+
+    /*
+     * Handle any error that might have raised.
+     */
+    if (ret != 0)
+    {
+        fprintf(stderr, "FAILED  - Error in %s\n", function.c_str());
+
+        if (lua_isstring(m_lua, -1))
+        {
+            /*
+             * The error message will be on the stack..
+             */
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+
+            /*
+             * Avoid a leak.
+             */
+            free(err);
+        }
+
+        return false;
+    }
+
+    bool found = lua_isnumber(m_lua, -1);
+
+    if (found)
+        count = lua_tointeger(m_lua, -1);
+
+    lua_pop(m_lua, 1);
+    return (found);
+}
+
+
+/*
+ * Call a Lua function which will return a range of lines of text.
+ *
+ * The function is given the (zero-based) offset of the first line we
+ * want, and the number of lines.  It may return `nil` to indicate that
+ * it cannot produce a range, in which case we return false.
+ */
+bool CLua::function2range(std::string function, int first, int count, std::vector<std::string> &lines)
+{
+    CLuaLog("function2range(" + function + ")");
+
+    lines.clear();
+
+    /*
+     * Get the function - if it doesn't exist we're done.
+     */
+    lua_getglobal(m_lua, function.c_str());
+
+    if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return false;
+    }
+
+    /*
+     * Call the function passing in the range.
+     */
+    lua_pushinteger(m_lua, first);
+    lua_pushinteger(m_lua, count);
+
+    int ret = lua_pcall(m_lua, 2, 1, 0);
+
+    /*
+     * Handle any error that might have raised.
+     */
+    if (ret != 0)
+    {
+        fprintf(stderr, "FAILED  - Error in %s\n", function.c_str());
+
+        if (lua_isstring(m_lua, -1))
+        {
+            /*
+             * The error message will be on the stack..
+             */
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+
+            /*
+             * Avoid a leak.
+             */
+            free(err);
+        }
+
+        return false;
+    }
+
+    if (! lua_istable(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return false;
+    }
+
+    /*
+     * We never return more lines than we asked for.
+     */
+    lines.resize(count > 0 ? count : 0);
+
+    int found = 0;
+
+    lua_pushnil(m_lua);
+
+    while (lua_next(m_lua, -2))
+    {
+        /*
+         * The keys are 1-based, and might arrive in any order.
+         */
+        int key = lua_tointeger(m_lua, -2) - 1;
+        const char *entry = lua_tostring(m_lua, -1);
+
+        if ((key >= 0) && (key < (int)lines.size()) && (entry != NULL))
+        {
+            lines[key] = entry;
+            found = std::max(found, key + 1);
+        }
+
+        lua_pop(m_lua, 1);
+    }
+
+    lines.resize(found);
+
+    lua_pop(m_lua, 1);
+    return true;
+}
+
+
 /*
  * Return the (string) contents of a variable.
  * Used for our test suite only.
@@ -110,6 +110,22 @@ public:
      */
     std::vector<std::string> functiona2table(std::string function, std::string arugment);
 
+    /**
+     * Call a Lua function which will return the number of lines of text
+     * a view holds.
+     *
+     * Returns false if the function doesn't exist, or returned `nil`.
+     */
+    bool function2count(std::string function, int &count);
+
+    /**
+     * Call a Lua function which will return, at most, `count` lines of
+     * text starting from line `first`.
+     *
+     * Returns false if the function doesn't exist, or returned `nil`.
+     */
+    bool function2range(std::string function, int first, int count, std::vector<std::string> &lines);
+
     /**
      * Call the user "on_error" function with given error message.
      */
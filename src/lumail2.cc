@@ -21,15 +21,19 @@
 #include <gmime/gmime.h>
 #include <getopt.h>
 
+#include "benchmark.h"
 #include "config.h"
 #include "file.h"
+#include "finder.h"
 #include "global_state.h"
+#include "header_prefetch.h"
 #include "history.h"
 #include "imap_proxy.h"
 #include "input_queue.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_counts.h"
 #include "message.h"
 #include "message_part.h"
 #include "mime.h"
@@ -53,10 +57,23 @@ void run_all_tests()
     CuSuiteAddSuite(suite, config_getsuite());
     CuSuiteAddSuite(suite, directory_getsuite());
     CuSuiteAddSuite(suite, file_getsuite());
+    CuSuiteAddSuite(suite, finder_getsuite());
+    CuSuiteAddSuite(suite, header_arena_getsuite());
+    CuSuiteAddSuite(suite, header_prefetch_getsuite());
+    CuSuiteAddSuite(suite, header_scanner_getsuite());
     CuSuiteAddSuite(suite, history_getsuite());
     CuSuiteAddSuite(suite, input_queue_getsuite());
     CuSuiteAddSuite(suite, lua_getsuite());
+    CuSuiteAddSuite(suite, maildir_getsuite());
+    CuSuiteAddSuite(suite, message_filter_getsuite());
+    CuSuiteAddSuite(suite, message_part_getsuite());
+    CuSuiteAddSuite(suite, message_sorter_getsuite());
+    CuSuiteAddSuite(suite, message_table_getsuite());
+    CuSuiteAddSuite(suite, search_index_getsuite());
     CuSuiteAddSuite(suite, statuspanel_getsuite());
+    CuSuiteAddSuite(suite, summary_index_getsuite());
+    CuSuiteAddSuite(suite, threader_getsuite());
+    CuSuiteAddSuite(suite, trigram_index_getsuite());
     CuSuiteAddSuite(suite, util_getsuite());
 
     CuSuiteRun(suite);
@@ -120,6 +137,7 @@ int main(int argc, char *argv[])
 
         static struct option long_options[] =
         {
+            {"benchmark", required_argument, 0, 'b'},
             {"no-curses", no_argument, 0, 'c'},
             {"no-defaults", no_argument, 0, 'd'},
             {"load-file", required_argument, 0, 'l'},
@@ -132,7 +150,7 @@ int main(int argc, char *argv[])
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "l:p:cdtv", long_options, &option_index);
+        c = getopt_long(argc, argv, "b:l:p:cdtv", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1)
@@ -140,6 +158,10 @@ int main(int argc, char *argv[])
 
         switch (c)
         {
+        case 'b':
+            return (run_benchmarks(optarg) ? 0 : -1);
+            break;
+
         case 'c':
             curses = false;
             break;
@@ -241,6 +263,18 @@ int main(int argc, char *argv[])
     }
 
 
+    /*
+     * Cleanup: Persist our cached maildir-counts, while we still
+     * know the `cache.prefix`.
+     */
+    CMaildirCounts *counts = CMaildirCounts::instance();
+    counts->save();
+
+    /*
+     * Cleanup: Persist the summaries of the maildirs we've read.
+     */
+    CGlobalState::instance()->save_summaries();
+
     /*
      * Cleanup: Delete the config-values.
      */
@@ -261,6 +295,8 @@ int main(int argc, char *argv[])
     config->destroy_instance();
     proxy->destroy_instance();
 
+    CFinder::instance()->destroy_instance();
+    CHeaderPrefetch::instance()->destroy_instance();
     CHistory::instance()->destroy_instance();
     CGlobalState::instance()->destroy_instance();
     CInputQueue::instance()->destroy_instance();
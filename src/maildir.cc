@@ -20,6 +20,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
@@ -39,8 +40,11 @@
 #include "directory.h"
 #include "file.h"
 #include "imap_proxy.h"
+#include "logger.h"
 #include "maildir.h"
+#include "maildir_counts.h"
 #include "message.h"
+#include "message_table.h"
 #include "util.h"
 
 
@@ -60,199 +64,1131 @@ CMaildir::CMaildir(const std::string name, bool is_local)
      * Default cache-time.
      */
     m_modified = -1;
+    m_unread   = 0;
+    m_total    = 0;
+
+    /*
+     * We're not watched, and have no cached state.
+     */
+    m_watched = false;
+    m_scanned = false;
+    m_counted = false;
+    m_seen    = false;
+
+    m_seen_modified = -1;
+
+    m_threads_loaded = false;
+    m_removed = 0;
+
+    /*
+     * Our directories are opened when they are first needed.
+     */
+    m_cur_fd = -1;
+    m_new_fd = -1;
+}
+
+
+/*
+ * Return the path we represent - NOTE: This might be a local
+ * maildir-location, or a remote IMAP path.
+ *
+ * Use "is_imap" or "is_maildir" to tell the difference.
+ */
+std::string CMaildir::path()
+{
+    return (m_path);
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildir::~CMaildir()
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    for (CMaildirRow &row : m_rows)
+    {
+        if (row.row != REMOVED_ROW)
+            table->release(row.row);
+    }
+
+    close_directories();
+}
+
+
+/**
+ * Is this maildir a local one?
+ */
+bool CMaildir::is_maildir()
+{
+    return (! m_imap);
+}
+
+
+/*
+ * Is this maildir an IMAP path?
+ */
+bool CMaildir::is_imap()
+{
+    return (m_imap);
+
+}
+
+
+/*
+ * The number of new messages for this maildir.
+ */
+int CMaildir::unread_messages()
+{
+    update_cache();
+    return (m_unread);
+}
+
+
+/*
+ * The total number of messages for this maildir.
+ */
+int CMaildir::total_messages()
+{
+    update_cache();
+    return (m_total);
+}
+
+
+
+/*
+ * Update the cached total/unread message counts.
+ */
+void CMaildir::update_cache()
+{
+    if (m_imap)
+        return;
+
+    /*
+     * If we're being watched then the counts are updated as the
+     * watcher reports changes, so we only need to count once.
+     */
+    if ((m_watched) && (m_counted))
+        return;
+
+    /*
+     * If our directories are unchanged since we last counted then
+     * we need do nothing.
+     */
+    CMaildirStamp stamp;
+    bool valid = CMaildirCounts::stamp(m_path, stamp);
+
+    if ((m_counted) && (valid) && (stamp == m_stamp))
+        return;
+
+    /*
+     * Otherwise see if we counted them with this stamp on a previous
+     * run, and only read the directories if not.
+     */
+    CMaildirCounts *cache = CMaildirCounts::instance();
+
+    if (!valid || !cache->lookup(m_path, stamp, m_total, m_unread))
+    {
+        count_files(m_total, m_unread);
+
+        if (valid)
+            cache->store(m_path, stamp, m_total, m_unread);
+    }
+
+    m_stamp = stamp;
+
+    /*
+     * A directory which was changed very recently might change again
+     * without its stamp changing, so we'll count it again next time.
+     */
+    m_counted = m_watched || (valid && !CMaildirCounts::is_recent(stamp));
+}
+
+
+/*
+ * Count the messages in our directories, without creating
+ * message-objects.
+ */
+void CMaildir::count_files(int &total, int &unread)
+{
+    total  = 0;
+    unread = 0;
+
+    CDirectoryListing listing;
+
+    if (CDirectory::files(m_path + "/cur", listing))
+    {
+        for (const std::string &name : listing.names)
+        {
+            total += 1;
+
+            if (is_unread_name(name, false))
+                unread += 1;
+        }
+    }
+
+    /*
+     * Everything in new/ is unread.
+     */
+    if (CDirectory::files(m_path + "/new", listing))
+    {
+        total  += listing.names.size();
+        unread += listing.names.size();
+    }
+}
+
+/*
+ * Return the last modified time for this Maildir.
+ */
+time_t CMaildir::last_modified()
+{
+    /*
+     * IMAP folders have a fake time, which is bumped as they are
+     * changed - and watched folders are bumped as events arrive.
+     */
+    if ((m_imap) || (m_watched))
+    {
+        return (m_modified);
+    }
+
+    CMaildirStamp stamp;
+
+    if (! CMaildirCounts::stamp(m_path, stamp))
+    {
+        m_seen = false;
+        return (directory_mtime());
+    }
+
+    /*
+     * While our directories are as we last saw them, or as we left them
+     * after `update_flags()`, we return the time we returned before.
+     */
+    if ((! m_seen) || !(stamp == m_seen_stamp))
+    {
+        m_seen_stamp    = stamp;
+        m_seen_modified = std::max(stamp.cur_mtime, stamp.new_mtime) / 1000000000;
+        m_seen          = true;
+    }
+
+    return (m_seen_modified);
+}
+
+
+/*
+ * Return the most recent modification-time of cur/ + new/.
+ */
+time_t CMaildir::directory_mtime()
+{
+    time_t last = 0;
+    struct stat st_buf;
+
+    std::string p = path();
+
+    /*
+     * The two directories we care about: new/ + cur/
+     */
+    std::vector < std::string > dirs;
+    dirs.push_back(p + "/cur");
+    dirs.push_back(p + "/new");
+
+    /*
+     * See which was the most recently modified.
+     */
+    for (std::string dir : dirs)
+    {
+        /*
+         * If we can stat() the dir and it is more recent
+         * than the current value - update it.
+         */
+        if (!stat(dir.c_str(), &st_buf))
+            if (st_buf.st_mtime > last)
+                last = st_buf.st_mtime;
+    }
+
+    return (last);
+}
+
+/*
+ * Get each messages in the folder.
+ *
+ * These are heap-allocated and will be persistent until the folder
+ * selection is changed.
+ *
+ * The return value is *all possible messages*, no attention to `index_limit`
+ * is paid.
+ *
+ */
+CMessageList CMaildir::getMessages()
+{
+    refresh();
+    compact_rows();
+
+    CMessageList result;
+    result.reserve(m_rows.size());
+
+    for (size_t i = 0; i < m_rows.size(); i++)
+        result.push_back(message_at(i));
+
+    return (result);
+}
+
+
+/*
+ * Rescan the folder, reusing the message-objects which were found by
+ * the previous scan.
+ */
+CMessageList CMaildir::rescan(CMaildirChanges *changes)
+{
+    scan(changes, true);
+
+    CMessageList result;
+    result.reserve(m_rows.size());
+
+    for (CMaildirRow &row : m_rows)
+        result.push_back(row.message);
+
+    return result;
+}
+
+
+/*
+ * Bring our list of messages up to date, unless the watcher is
+ * keeping it current for us.
+ */
+void CMaildir::refresh()
+{
+    if ((m_watched) && (m_scanned))
+        return;
+
+    scan();
+}
+
+
+/*
+ * The number of messages found by our most recent scan.
+ */
+size_t CMaildir::message_count()
+{
+    compact_rows();
+    return (m_rows.size());
+}
+
+
+/*
+ * Return the message at the given offset, creating the object if
+ * this is the first time it has been requested.
+ */
+std::shared_ptr<CMessage> CMaildir::message_at(size_t offset)
+{
+    compact_rows();
+
+    if (offset >= m_rows.size())
+        return (NULL);
+
+    CMaildirRow &row = m_rows.at(offset);
+
+    if (! row.message)
+        row.message = std::shared_ptr<CMessage>(new CMessage(row.row));
+
+    return (row.message);
+}
+
+
+/*
+ * Return the row of the message at the given offset.
+ */
+uint32_t CMaildir::row_at(size_t offset)
+{
+    compact_rows();
+    return (m_rows.at(offset).row);
+}
+
+
+/*
+ * Thread the messages in the given rows.
+ */
+std::vector<CThreader::CThreadEntry> CMaildir::thread(const std::vector<uint32_t> &rows,
+        CThreader::CCompare compare)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * Our forest is only updated as our own rows come and go, so it
+     * mustn't be given anybody else's.
+     */
+    bool ours = (! m_imap);
+
+    if (ours)
+    {
+        /*
+         * The directories must be named as `scan()` names them.
+         */
+        std::string cur_path = m_path + "/cur";
+        std::string new_path = m_path + "/new";
+        cur_path.erase(std::unique(cur_path.begin(), cur_path.end(), both_slashes()), cur_path.end());
+        new_path.erase(std::unique(new_path.begin(), new_path.end(), both_slashes()), new_path.end());
+
+        uint32_t cur = table->directory_id(cur_path);
+        uint32_t neu = table->directory_id(new_path);
+
+        for (uint32_t row : rows)
+        {
+            uint32_t dir = table->directory(row);
+
+            if ((dir != cur) && (dir != neu))
+            {
+                ours = false;
+                break;
+            }
+        }
+    }
+
+    if (! ours)
+    {
+        CThreader threader;
+        return (threader.thread(rows, compare));
+    }
+
+    if (! m_threads_loaded)
+    {
+        std::string threads = CSummaryIndex::filename(m_path);
+
+        if (! threads.empty())
+            m_threads.load(threads + ".threads");
+
+        m_threads_loaded = true;
+    }
+
+    return (m_threads.thread(rows, compare));
+}
+
+
+/*
+ * Scan the folder, reusing the rows - and any message-objects - which
+ * were found by the previous scan.
+ */
+void CMaildir::scan(CMaildirChanges *changes, bool create)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The rows we find on this scan - which will replace the
+     * ones we found last time - and their index.
+     */
+    std::vector<CMaildirRow> rows;
+    std::unordered_map<std::string, size_t> found;
+
+    /*
+     * Messages we've not seen before might have been summarised when
+     * we were last launched.
+     */
+    bool indexed = m_summary.open(m_path);
+
+    /*
+     * Directories we search.
+     */
+    std::vector < std::string > dirs;
+    dirs.push_back(m_path + "/cur");
+    dirs.push_back(m_path + "/new");
+
+    /*
+     * For each directory.
+     */
+    for (std::string path : dirs)
+    {
+        /*
+         * Get the files in the directory - which trusts the type the
+         * filesystem reports, rather than stat()ing each entry.
+         *
+         * We ask for them in order, since the order in which we return
+         * messages is visible if `index.sort` is `none`.
+         */
+        CDirectoryListing listing;
+        CDirectory::files(path, listing, true);
+
+        /*
+         * The rows of the message-table refer to the directory by ID.
+         */
+        uint32_t dir = table->directory_id(listing.prefix.substr(0, listing.prefix.size() - 1));
+
+        rows.reserve(rows.size() + listing.names.size());
+
+        for (size_t i = 0; i < listing.names.size(); i++)
+        {
+            const std::string &name = listing.names[i];
+
+            std::string key = unique_name(name);
+            bool unique = true;
+
+            /*
+             * Two files sharing a unique-name is a broken maildir, but
+             * we shouldn't lose either of them.
+             */
+            if (found.find(key) != found.end())
+            {
+                key = listing.prefix + name;
+                unique = false;
+            }
+
+            CMaildirRow row;
+            auto old = m_entries.find(key);
+
+            if (old != m_entries.end())
+            {
+                /*
+                 * We've seen this message before, so we reuse the
+                 * existing row and object - updating the path if the
+                 * file has been renamed.
+                 */
+                row = m_rows.at(old->second);
+                m_entries.erase(old);
+
+                if ((table->directory(row.row) != dir) || (name != table->name(row.row)))
+                {
+                    table->set_path(row.row, dir, name);
+
+                    if ((row.message) && (changes != NULL))
+                        changes->renamed.push_back(row.message);
+                }
+            }
+            else
+            {
+                row.row = table->insert(dir, name);
+
+                if ((indexed) && (unique))
+                    m_summary.apply(key, listing.inodes[i], row.row);
+
+                m_trigrams.add(row.row);
+            }
+
+            row.inode = listing.inodes[i];
+
+            /*
+             * Otherwise the object is created when it is first needed,
+             * unless our caller wants them all now.
+             */
+            if ((create) && (! row.message))
+            {
+                row.message = std::shared_ptr<CMessage>(new CMessage(row.row));
+
+                if (changes != NULL)
+                    changes->added.push_back(row.message);
+            }
+
+            found[key] = rows.size();
+            rows.push_back(row);
+        }
+    }
+
+    /*
+     * Anything left over from the previous scan has been removed.
+     */
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        CMaildirRow &row = m_rows.at(it->second);
+
+        if ((row.message) && (changes != NULL))
+            changes->removed.push_back(row.message);
+
+        m_threads.remove(row.row);
+        m_trigrams.remove(row.row);
+        table->release(row.row);
+    }
+
+    m_entries.swap(found);
+    m_rows.swap(rows);
+    m_removed = 0;
+
+    m_scanned = true;
+}
+
+
+/*
+ * Return the current path of the message in the given row.
+ *
+ * The message-object shares the row, so this reflects any change
+ * it has made, such as to the flags of the message.
+ */
+std::string CMaildir::row_path(CMaildirRow &row)
+{
+    return (CMessageTable::instance()->path(row.row));
+}
+
+
+/*
+ * Return the unique-name of the given message-file.
+ *
+ * Maildir filenames have the form "unique:2,flags", so the unique-name
+ * is the part of the basename before the colon.
+ */
+std::string CMaildir::unique_name(const std::string &file)
+{
+    std::string name = CFile::basename(file);
+
+    size_t offset = name.find(':');
+
+    if (offset != std::string::npos)
+        name = name.substr(0, offset);
+
+    return (name);
+}
+
+
+/*
+ * Is the given message-file unread?
+ */
+bool CMaildir::is_unread_file(const std::string &file)
+{
+    if (file.find("/new/") != std::string::npos)
+        return true;
+
+    return (is_unread_name(CFile::basename(file), false));
+}
+
+
+/*
+ * Is the message-file with the given name unread?
+ *
+ * This matches `CMessage::is_new()`, but works from the name alone: a
+ * message is unread if it is in new/, has the flag "N", or does not
+ * have the flag "S".
+ */
+bool CMaildir::is_unread_name(const std::string &name, bool in_new)
+{
+    if (in_new)
+        return true;
+
+    size_t offset = name.find(":2,");
+
+    if (offset == std::string::npos)
+        return true;
+
+    bool seen = false;
+
+    for (size_t i = offset + 3; i < name.size(); i++)
+    {
+        if (name[i] == 'N')
+            return true;
+
+        if (name[i] == 'S')
+            seen = true;
+    }
+
+    return (! seen);
+}
+
+
+/*
+ * Is this maildir being kept up to date by the watcher?
+ */
+bool CMaildir::is_watched()
+{
+    return (m_watched);
+}
+
+
+/*
+ * Mark this maildir as being watched, or not.
+ */
+void CMaildir::set_watched(bool watched)
+{
+    if (m_imap)
+        return;
+
+    m_watched = watched;
+
+    /*
+     * Changes might have been made before the watch was established,
+     * so we must count and scan afresh either way.
+     */
+    m_scanned = false;
+    m_counted = false;
+    m_seen    = false;
+
+    m_pending.clear();
+
+    /*
+     * Our modification-time is now maintained by `touch()`, so we start
+     * with the real one.  If we're no longer watched then `update_cache()`
+     * will compare against that again.
+     */
+    if (watched)
+        m_modified = std::max(directory_mtime(), m_modified + 1);
+    else
+        m_modified = -1;
+}
+
+
+/*
+ * Bump our modification-time, after a change has been reported.
+ *
+ * We can't wait for the clock to tick over, as the directory-mtime
+ * would, so we always increase the value.
+ */
+void CMaildir::touch()
+{
+    m_modified = std::max(time(NULL), m_modified + 1);
+}
+
+
+/*
+ * Record that the given message-file has appeared.
+ */
+void CMaildir::file_added(const std::string &file)
+{
+    /*
+     * If we created the file ourselves then we know about it already.
+     */
+    if (m_pending.erase(file) > 0)
+        return;
+
+    touch();
+    entry_added(file, m_counted);
+}
+
+
+/*
+ * Record that the given message-file has been removed.
+ */
+void CMaildir::file_removed(const std::string &file)
+{
+    if (m_pending.erase(file) > 0)
+        return;
+
+    touch();
+    entry_removed(file, m_counted);
+}
+
+
+/*
+ * Record that the given message-file has been renamed.
+ */
+void CMaildir::file_renamed(const std::string &from, const std::string &to)
+{
+    if (m_pending.erase(to) > 0)
+        return;
+
+    touch();
+    entry_renamed(from, to, m_counted);
+}
+
+
+/*
+ * Update our list of messages, and optionally our counts, to include
+ * the given message-file.
+ */
+void CMaildir::entry_added(const std::string &file, bool count)
+{
+    /*
+     * If we've scanned already then update our list of messages.
+     */
+    if (m_scanned)
+    {
+        std::string key = unique_name(file);
+
+        auto it = m_entries.find(key);
+
+        if (it != m_entries.end())
+        {
+            /*
+             * We know about this message already, because a rescan found
+             * it before the event arrived - so at most we've a rename.
+             */
+            std::string known = row_path(m_rows.at(it->second));
+
+            if (known != file)
+                entry_renamed(known, file, count);
+
+            return;
+        }
+
+        /*
+         * The message-object will be created when it is first needed.
+         */
+        CMaildirRow row;
+        row.row   = CMessageTable::instance()->insert(file);
+        row.inode = 0;
+
+        m_trigrams.add(row.row);
+
+        m_entries[key] = m_rows.size();
+        m_rows.push_back(row);
+    }
+
+    if (count)
+    {
+        m_total += 1;
+
+        if (is_unread_file(file))
+            m_unread += 1;
+    }
+}
+
+
+/*
+ * Update our list of messages, and optionally our counts, to exclude
+ * the given message-file.
+ */
+void CMaildir::entry_removed(const std::string &file, bool count)
+{
+    if (m_scanned)
+    {
+        auto it = m_entries.find(unique_name(file));
+
+        /*
+         * If the message we know by this name lives elsewhere now then
+         * this is a stale event, which we can ignore.
+         */
+        if ((it == m_entries.end()) || (row_path(m_rows.at(it->second)) != file))
+            return;
+
+        CMaildirRow &row = m_rows.at(it->second);
+
+        m_threads.remove(row.row);
+        m_trigrams.remove(row.row);
+        CMessageTable::instance()->release(row.row);
+
+        /*
+         * The entry is only marked, since a batch of removals would
+         * otherwise close the gap each leaves in turn - it is dropped
+         * when our rows are next wanted.
+         */
+        row.row = REMOVED_ROW;
+        row.message.reset();
+        m_removed += 1;
+
+        m_entries.erase(it);
+    }
+
+    if (count)
+    {
+        m_total -= 1;
+
+        if (is_unread_file(file))
+            m_unread -= 1;
+    }
+}
+
+
+/*
+ * Update our list of messages, and optionally our counts, after the
+ * given message-file was renamed.
+ */
+void CMaildir::entry_renamed(const std::string &from, const std::string &to, bool count)
+{
+    /*
+     * A rename which changes the unique-name isn't a flag-change, so we
+     * treat it as the removal of one message and the arrival of another.
+     */
+    if (unique_name(from) != unique_name(to))
+    {
+        entry_removed(from, count);
+        entry_added(to, count);
+        return;
+    }
+
+    if (m_scanned)
+    {
+        auto it = m_entries.find(unique_name(to));
+
+        if (it == m_entries.end())
+        {
+            entry_added(to, count);
+            return;
+        }
+
+        /*
+         * If the message renamed the file itself it will have the new
+         * path already, but the counts still need updating.
+         */
+        CMaildirRow &row = m_rows.at(it->second);
+
+        if (row_path(row) != to)
+            CMessageTable::instance()->set_path(row.row, to);
+    }
+
+    if (count)
+    {
+        if (is_unread_file(from))
+            m_unread -= 1;
+
+        if (is_unread_file(to))
+            m_unread += 1;
+    }
 }
 
 
 /*
- * Return the path we represent - NOTE: This might be a local
- * maildir-location, or a remote IMAP path.
- *
- * Use "is_imap" or "is_maildir" to tell the difference.
+ * Rename one of our message-files, on behalf of a message.
  */
-std::string CMaildir::path()
+bool CMaildir::rename_file(const std::string &from, const std::string &to)
 {
-    return (m_path);
+    CMaildirStamp before;
+    bool valid   = CMaildirCounts::stamp(m_path, before);
+    bool counted = own_counts(before, valid);
+
+    if (rename(from.c_str(), to.c_str()) != 0)
+        return false;
+
+    entry_renamed(from, to, counted);
+
+    if (m_watched)
+        m_pending.insert(to);
+
+    own_changes_done(before, valid, counted);
+    return true;
 }
 
 
 /*
- * Destructor.
+ * Remove one of our message-files, on behalf of a message.
  */
-CMaildir::~CMaildir()
+bool CMaildir::remove_file(const std::string &file)
 {
+    CMaildirStamp before;
+    bool valid   = CMaildirCounts::stamp(m_path, before);
+    bool counted = own_counts(before, valid);
+
+    if (::unlink(file.c_str()) != 0)
+        return false;
+
+    entry_removed(file, counted);
+
+    if (m_watched)
+        m_pending.insert(file);
+
+    own_changes_done(before, valid, counted);
+    return true;
 }
 
 
-/**
- * Is this maildir a local one?
+/*
+ * Should the changes we're about to make ourselves update our counts?
+ *
+ * Only if nothing else has changed our directories since we counted
+ * them, otherwise we must count them again anyway.
  */
-bool CMaildir::is_maildir()
+bool CMaildir::own_counts(const CMaildirStamp &before, bool valid)
 {
-    return (! m_imap);
+    if (m_watched)
+        return (m_counted);
+
+    return ((m_counted) && (valid) && (before == m_stamp));
 }
 
 
 /*
- * Is this maildir an IMAP path?
+ * Record the stamp our directories have after changes we made ourselves,
+ * such that we neither count nor rescan them again.
+ *
+ * The watcher bumps our modification-time as it sees events, instead,
+ * so watched folders need only have their events ignored.
  */
-bool CMaildir::is_imap()
+void CMaildir::own_changes_done(const CMaildirStamp &before, bool valid, bool counted)
 {
-    return (m_imap);
+    CMaildirStamp after;
 
+    if ((m_watched) || (! valid) || (! CMaildirCounts::stamp(m_path, after)))
+        return;
+
+    if (counted)
+        m_stamp = after;
+
+    /*
+     * If `last_modified()` has already reported the state we started
+     * from then it may as well report the same time for our changes.
+     */
+    if ((m_seen) && (before == m_seen_stamp))
+        m_seen_stamp = after;
 }
 
 
 /*
- * The number of new messages for this maildir.
+ * Drop the entries which have been removed, in a single pass.
  */
-int CMaildir::unread_messages()
+void CMaildir::compact_rows()
 {
-    update_cache();
-    return (m_unread);
+    if (m_removed == 0)
+        return;
+
+    /*
+     * The new offset of each entry, by its old one.
+     */
+    std::vector<size_t> moved(m_rows.size());
+    size_t used = 0;
+
+    for (size_t i = 0; i < m_rows.size(); i++)
+    {
+        moved[i] = used;
+
+        if (m_rows[i].row == REMOVED_ROW)
+            continue;
+
+        if (used != i)
+            m_rows[used] = std::move(m_rows[i]);
+
+        used += 1;
+    }
+
+    m_rows.resize(used);
+    m_removed = 0;
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        it->second = moved[it->second];
 }
 
 
 /*
- * The total number of messages for this maildir.
+ * Discard our cached state.
  */
-int CMaildir::total_messages()
+void CMaildir::invalidate()
 {
-    update_cache();
-    return (m_total);
-}
+    m_scanned = false;
+    m_counted = false;
+    m_seen    = false;
 
+    m_pending.clear();
+    touch();
+}
 
 
 /*
- * Update the cached total/unread message counts.
+ * Record the summary of each message whose headers have been read.
  */
-void CMaildir::update_cache()
+void CMaildir::save_summary()
 {
-    if (m_imap)
+    if ((m_imap) || (! m_scanned))
         return;
 
-    /*
-     * If the cached date isn't different then we need do nothing.
-     */
-    time_t last_mod = last_modified();
+    std::vector<CSummaryEntry> entries;
+    entries.reserve(m_rows.size());
 
-    if (last_mod == m_modified)
-        return;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        /*
+         * Files which share a unique-name are keyed by path, and can't
+         * be told apart in the index.
+         */
+        if (it->first.find('/') != std::string::npos)
+            continue;
 
-    /*
-     * Otherwise update the last modified time.
-     */
-    m_modified = last_mod;
+        const CMaildirRow &row = m_rows.at(it->second);
 
-    /*
-     * Get all messages, and update the total
-     */
-    CMessageList all = getMessages();
-    m_total = all.size();
+        CSummaryEntry entry;
+        entry.id    = it->first;
+        entry.inode = row.inode;
+        entry.row   = row.row;
+        entries.push_back(entry);
+    }
 
+    m_summary.update(m_path, entries);
 
-    /*
-      * Now update the unread count.
-      */
-    m_unread = 0;
+    std::string threads = CSummaryIndex::filename(m_path);
 
-    for (std::shared_ptr < CMessage > message : all)
-    {
-        if (message->is_new())
-            m_unread++;
-    }
+    if ((m_threads_loaded) && (! threads.empty()))
+        m_threads.save(threads + ".threads");
 }
 
+
 /*
- * Return the last modified time for this Maildir.
+ * Return the messages which aren't in our full-text index.
  */
-time_t CMaildir::last_modified()
+std::vector<CSearchEntry> CMaildir::unindexed_search()
 {
+    if (m_imap)
+        return (std::vector<CSearchEntry>());
+
+    refresh();
+
+    return (m_search.unindexed(m_path, search_entries()));
+}
+
 
+/*
+ * Add the texts read in the background to our full-text index.
+ */
+size_t CMaildir::add_search(const std::vector<CSearchText> &texts)
+{
     if (m_imap)
-    {
-        return (m_modified);
-    }
+        return 0;
 
-    time_t last = 0;
-    struct stat st_buf;
+    refresh();
 
-    std::string p = path();
+    return (m_search.add(m_path, search_entries(), texts));
+}
 
-    /*
-     * The two directories we care about: new/ + cur/
-     */
-    std::vector < std::string > dirs;
-    dirs.push_back(p + "/cur");
-    dirs.push_back(p + "/new");
 
-    /*
-     * See which was the most recently modified.
-     */
-    for (std::string dir : dirs)
+/*
+ * Describe our messages for the full-text index.
+ */
+std::vector<CSearchEntry> CMaildir::search_entries()
+{
+    std::vector<CSearchEntry> entries;
+    entries.reserve(m_rows.size());
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
     {
         /*
-         * If we can stat() the dir and it is more recent
-         * than the current value - update it.
+         * As with the summary, files which share a unique-name can't be
+         * told apart in the index.
          */
-        if (!stat(dir.c_str(), &st_buf))
-            if (st_buf.st_mtime > last)
-                last = st_buf.st_mtime;
+        if (it->first.find('/') != std::string::npos)
+            continue;
+
+        const CMaildirRow &row = m_rows.at(it->second);
+
+        CSearchEntry entry;
+        entry.id    = it->first;
+        entry.inode = row.inode;
+        entry.row   = row.row;
+        entries.push_back(entry);
     }
 
-    return (last);
+    return (entries);
 }
 
+
 /*
- * Get each messages in the folder.
- *
- * These are heap-allocated and will be persistent until the folder
- * selection is changed.
- *
- * The return value is *all possible messages*, no attention to `index_limit`
- * is paid.
- *
+ * Return our full-text index.
  */
-CMessageList CMaildir::getMessages()
+CSearchIndex *CMaildir::search_index()
 {
-    CMessageList result;
+    if ((m_imap) || (! m_search.open(m_path)))
+        return NULL;
 
-    /*
-     * Directories we search.
-     */
-    std::vector < std::string > dirs;
-    dirs.push_back(m_path + "/cur/");
-    dirs.push_back(m_path + "/new/");
+    return (&m_search);
+}
 
-    /*
-     * For each directory.
-     */
-    for (std::string path : dirs)
-    {
 
-        /*
-         * Get the entries in the directory
-         */
-        std::vector<std::string> entries = CDirectory::entries(path);
+/*
+ * Return the message with the given unique-name.
+ */
+std::shared_ptr<CMessage> CMaildir::find_message(const std::string &id)
+{
+    if (m_imap)
+        return (NULL);
 
-        /*
-         * For each one - if it isn't a dirrectory create a message
-         * using the path.
-         *
-         * This test is required because `CDirectory::entries` will return
-         * both the prefix, and the children "." + "..".
-         */
-        for (std::string file : entries)
-        {
-            if (! CFile::is_directory(file))
-            {
-                std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(std::string(file)));
-                result.push_back(t);
-            }
-        }
-    }
+    refresh();
 
-    return result;
+    auto it = m_entries.find(id);
+
+    if (it == m_entries.end())
+        return (NULL);
+
+    return (message_at(it->second));
+}
+
+
+/*
+ * Return the index of the trigrams of our messages' key headers.
+ */
+CTrigramIndex *CMaildir::trigrams()
+{
+    if (m_imap)
+        return NULL;
+
+    return (&m_trigrams);
 }
 
 
@@ -304,9 +1240,29 @@ bool CMaildir::saveMessage(std::shared_ptr <CMessage > msg)
     }
     else
     {
+        CMaildirStamp before;
+        bool valid   = CMaildirCounts::stamp(m_path, before);
+        bool counted = own_counts(before, valid);
+
+        /*
+         * The path must match those the watcher reports.
+         */
         std::string path = generate_filename(false);
+        path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+        if (! CFile::copy(msg->path(), path))
+            return false;
+
+        /*
+         * We know about the new message without needing to rescan.
+         */
+        entry_added(path, counted);
+
+        if (m_watched)
+            m_pending.insert(path);
 
-        return (CFile::copy(msg->path(), path));
+        own_changes_done(before, valid, counted);
+        return true;
     }
 }
 
@@ -379,6 +1335,176 @@ std::string CMaildir::generate_filename(bool is_new)
 }
 
 
+/*
+ * Add and remove flags from each of the given messages.
+ */
+int CMaildir::update_flags(CMessageList messages, std::string add, std::string remove)
+{
+    uint64_t add_mask    = CMessageTable::flags_to_mask(add);
+    uint64_t remove_mask = CMessageTable::flags_to_mask(remove);
+    uint64_t seen        = CMessageTable::flag_bit('S');
+    uint64_t unseen      = CMessageTable::flag_bit('N');
+
+    int count = 0;
+
+    /*
+     * The IMAP-proxy only knows how to mark messages as read or unread,
+     * which we have to do one by one.
+     */
+    if (m_imap)
+    {
+        for (std::shared_ptr<CMessage> msg : messages)
+        {
+            if ((! msg) || (! msg->is_imap()))
+                continue;
+
+            uint64_t mask = msg->flag_mask();
+
+            if ((add_mask & seen) && !(mask & seen))
+                msg->mark_read();
+            else if ((remove_mask & seen) && (mask & seen))
+                msg->mark_unread();
+            else
+                continue;
+
+            count += 1;
+        }
+
+        return (count);
+    }
+
+    CLogger *logger = CLogger::instance();
+
+    /*
+     * If our directories have changed since we last counted them, or
+     * since `last_modified()` was called, then those changes must still
+     * be noticed after ours.
+     */
+    CMaildirStamp before;
+
+    if ((! CMaildirCounts::stamp(m_path, before)) || (! open_directories(before)))
+    {
+        logger->log("maildir", "Failed to open %s to update flags.", m_path.c_str());
+        return 0;
+    }
+
+    bool counted = own_counts(before, true);
+
+    /*
+     * The directories, as our rows name them.
+     */
+    std::string cur = m_path + "/cur";
+    std::string nw  = m_path + "/new";
+    cur.erase(std::unique(cur.begin(), cur.end(), both_slashes()), cur.end());
+    nw.erase(std::unique(nw.begin(), nw.end(), both_slashes()), nw.end());
+
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t cur_id = table->directory_id(cur);
+    uint32_t new_id = table->directory_id(nw);
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if ((! msg) || (msg->is_imap()))
+            continue;
+
+        uint32_t row = msg->row();
+        uint32_t dir = table->directory(row);
+
+        if ((dir != cur_id) && (dir != new_id))
+            continue;
+
+        uint64_t mask   = table->flags(row);
+        uint64_t result = (mask | add_mask) & ~remove_mask;
+
+        if (result == mask)
+            continue;
+
+        /*
+         * A message stays in `new/` until it loses the flag `N`, which
+         * its directory implies.
+         */
+        bool in_new = (dir == new_id);
+        bool to_new = in_new && (result & unseen);
+
+        if (to_new)
+            result &= ~unseen;
+
+        std::string name   = table->name(row);
+        std::string target = CMessage::flags_path(name, CMessageTable::mask_to_flags(result));
+
+        if ((in_new == to_new) && (name == target))
+            continue;
+
+        if (renameat(in_new ? m_new_fd : m_cur_fd, name.c_str(),
+                     to_new ? m_new_fd : m_cur_fd, target.c_str()) != 0)
+        {
+            logger->log("maildir", "Failed to rename %s: %s", name.c_str(), strerror(errno));
+            continue;
+        }
+
+        std::string from = table->path(row);
+        table->set_path(row, to_new ? new_id : cur_id, target);
+
+        std::string to = table->path(row);
+        entry_renamed(from, to, counted);
+
+        if (m_watched)
+            m_pending.insert(to);
+
+        count += 1;
+    }
+
+    if (count == 0)
+        return (count);
+
+    own_changes_done(before, true, counted);
+
+    logger->log("maildir", "Updated the flags of %d message(s) in %s.", count, m_path.c_str());
+    return (count);
+}
+
+
+/*
+ * Ensure our directories are open.
+ *
+ * If either has been replaced since we opened it then we open it again.
+ */
+bool CMaildir::open_directories(const CMaildirStamp &stamp)
+{
+    struct stat sb;
+
+    if ((m_cur_fd >= 0) && ((fstat(m_cur_fd, &sb) != 0) || (sb.st_ino != stamp.cur_inode)))
+        close_directories();
+
+    if ((m_new_fd >= 0) && ((fstat(m_new_fd, &sb) != 0) || (sb.st_ino != stamp.new_inode)))
+        close_directories();
+
+    if (m_cur_fd < 0)
+        m_cur_fd = open((m_path + "/cur").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (m_new_fd < 0)
+        m_new_fd = open((m_path + "/new").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    return ((m_cur_fd >= 0) && (m_new_fd >= 0));
+}
+
+
+/*
+ * Close our directories.
+ */
+void CMaildir::close_directories()
+{
+    if (m_cur_fd >= 0)
+        close(m_cur_fd);
+
+    if (m_new_fd >= 0)
+        close(m_new_fd);
+
+    m_cur_fd = -1;
+    m_new_fd = -1;
+}
+
+
 /*
  * Bump the modification-time of this maildir artificially
  * which is used solely for IMAP-based messages.
@@ -23,9 +23,42 @@
 #pragma once
 
 
+#include <unordered_map>
+#include <unordered_set>
+
+#include "maildir_counts.h"
 #include "message.h"
+#include "search_index.h"
+#include "summary_index.h"
+#include "threader.h"
+#include "trigram_index.h"
+
+
+
+/**
+ * The changes discovered by an incremental rescan of a maildir.
+ *
+ * A message which has been renamed, for example because its flags
+ * were changed or because it was moved from `new/` to `cur/`, is
+ * reported as renamed rather than as a removal and an addition.
+ */
+struct CMaildirChanges
+{
+    /**
+     * Messages which were not present at the time of the previous scan.
+     */
+    CMessageList added;
 
+    /**
+     * Messages which were present in the previous scan, but are now gone.
+     */
+    CMessageList removed;
 
+    /**
+     * Messages which are still present, but beneath a different filename.
+     */
+    CMessageList renamed;
+};
 
 
 /**
@@ -131,10 +164,82 @@ public:
 
     /**
       * Get all of the messages in this maildir.
+      *
+      * Messages which were seen previously are returned as the same
+      * objects.  If the maildir is being watched, and has been scanned
+      * already, then the list maintained by the watcher is returned
+      * without any disk access.
       */
     CMessageList getMessages();
 
 
+    /**
+     * Rescan the maildir, returning all of the messages within it.
+     *
+     * The result of the previous scan is kept, keyed by the unique-name
+     * of each message, such that the message-objects of entries which
+     * are still present are reused rather than being created afresh -
+     * along with any headers and MIME-parts they have already parsed.
+     *
+     * If `changes` is non-NULL it is populated with the entries which
+     * were added, removed, or renamed since the previous scan.
+     */
+    CMessageList rescan(CMaildirChanges *changes = NULL);
+
+
+    /**
+     * Rescan the maildir, as `rescan()` does, but without creating a
+     * message-object for any file we've not seen before.
+     *
+     * Those are created on demand by `message_at()`, such that a large
+     * folder costs no more than its filenames until its messages are
+     * displayed.  Only messages which already had objects are reported
+     * in `changes`, since nobody else can hold a reference to the rest.
+     *
+     * If `create` is true every row is given an object.
+     */
+    void scan(CMaildirChanges *changes = NULL, bool create = false);
+
+
+    /**
+     * Scan the maildir, unless the watcher is keeping us current.
+     */
+    void refresh();
+
+
+    /**
+     * The number of messages found by the most recent scan.
+     */
+    size_t message_count();
+
+
+    /**
+     * Return the message at the given offset, in directory-order, creating
+     * the object if it doesn't already exist.  Returns NULL if the offset
+     * is out of range.
+     */
+    std::shared_ptr<CMessage> message_at(size_t offset);
+
+
+    /**
+     * Return the row of the message-table which describes the message
+     * at the given offset, without creating a message-object.
+     */
+    uint32_t row_at(size_t offset);
+
+
+    /**
+     * Thread the messages in the given rows, via the forest of threads
+     * we keep for our messages - which is loaded alongside our summary
+     * the first time it is needed.
+     *
+     * If any of the rows isn't one of our messages they're threaded
+     * from scratch instead.
+     */
+    std::vector<CThreader::CThreadEntry> thread(const std::vector<uint32_t> &rows,
+            CThreader::CCompare compare = nullptr);
+
+
     /**
      * Save the given message in this maildir.
      *
@@ -144,6 +249,37 @@ public:
     bool saveMessage(std::shared_ptr <CMessage > msg);
 
 
+    /**
+     * Add and remove flags from each of the given messages, such as
+     * adding `S` and removing `N` to mark them as read, returning the
+     * number of messages which were changed.
+     *
+     * The files are renamed relative to our `cur/` and `new/` directories,
+     * which we keep open, and the paths of the messages are updated as we
+     * go.  A message which loses the flag `N` moves from `new/` to `cur/`.
+     *
+     * The unread-count is adjusted once, and the renames are remembered
+     * such that neither the watcher nor `last_modified()` treats them as
+     * a change which requires the folder to be rescanned.
+     *
+     * Messages which are not in this maildir are ignored.  For IMAP
+     * folders only the flag `S` may be changed, one message at a time.
+     */
+    int update_flags(CMessageList messages, std::string add, std::string remove);
+
+
+    /**
+     * Rename or remove one of our message-files, on behalf of a message,
+     * returning false on failure.
+     *
+     * Our list of messages and our counts are updated in place, and the
+     * change isn't treated as a modification of the maildir - in the same
+     * way as changes made by `update_flags()` and `saveMessage()`.
+     */
+    bool rename_file(const std::string &from, const std::string &to);
+    bool remove_file(const std::string &file);
+
+
     /**
      * Bump the modification-time of this maildir artificially.
      *
@@ -157,10 +293,109 @@ public:
      * Return the last modified time for this Maildir, which is
      * used to determine if we need to update our cache.
      *
+     * Changes made by `update_flags()` don't count as modifications.
+     *
      * **NOTE**: This result is faked for IMAP-folders, via `bump_mtime()`.
      */
     time_t last_modified();
 
+
+    /**
+     * Is this maildir being kept up to date by the `CMaildirWatcher`?
+     */
+    bool is_watched();
+
+
+    /**
+     * Mark this maildir as being watched, or not.
+     *
+     * A watched maildir has its message-list and message-counts
+     * updated in-place, via the `file_added()`, `file_removed()`, and
+     * `file_renamed()` methods, rather than by comparing the
+     * modification-times of its `cur/` and `new/` directories.
+     */
+    void set_watched(bool watched);
+
+
+    /**
+     * Record that the given message-file has appeared in this maildir.
+     */
+    void file_added(const std::string &file);
+
+
+    /**
+     * Record that the given message-file has been removed from this maildir.
+     */
+    void file_removed(const std::string &file);
+
+
+    /**
+     * Record that the given message-file has been renamed, within
+     * this maildir.
+     */
+    void file_renamed(const std::string &from, const std::string &to);
+
+
+    /**
+     * Discard our cached state, such that the counts are recalculated
+     * and the messages rescanned on next access.
+     *
+     * This is used if the watcher has missed events.
+     */
+    void invalidate();
+
+
+    /**
+     * Record the summary of each message whose headers have been read
+     * in our index, such that they needn't be read again - along with
+     * the threads of our messages.
+     *
+     * This is called when another folder is selected, and when we exit.
+     *
+     * **NOTE**: This is a NOP for IMAP folders.
+     */
+    void save_summary();
+
+
+    /**
+     * Return our messages which aren't in our full-text index, so that
+     * they may be read in the background.
+     *
+     * **NOTE**: IMAP folders have no index.
+     */
+    std::vector<CSearchEntry> unindexed_search();
+
+
+    /**
+     * Add the given texts, read in the background, to our full-text
+     * index - returning the number added.
+     *
+     * **NOTE**: This is a NOP for IMAP folders.
+     */
+    size_t add_search(const std::vector<CSearchText> &texts);
+
+
+    /**
+     * Return our full-text index, mapped, or NULL if we have none.
+     *
+     * **NOTE**: IMAP folders have no index.
+     */
+    CSearchIndex *search_index();
+
+
+    /**
+     * Return the message with the given unique-name, or NULL if there
+     * is no such message.
+     */
+    std::shared_ptr<CMessage> find_message(const std::string &id);
+
+
+    /**
+     * Return the index of the trigrams of our messages' key headers,
+     * which narrows searches of them, or NULL for an IMAP folder.
+     */
+    CTrigramIndex *trigrams();
+
 private:
 
     /**
@@ -191,6 +426,22 @@ private:
      */
     int m_total;
 
+    /**
+     * Are we being kept current by the watcher?
+     */
+    bool m_watched;
+
+    /**
+     * Has `scan()` been called since we were last invalidated?
+     */
+    bool m_scanned;
+
+    /**
+     * Have our message-counts been calculated since we were last
+     * invalidated?
+     */
+    bool m_counted;
+
     /**
      * Update the cached total/unread message counts.
      *
@@ -198,11 +449,202 @@ private:
      */
     void update_cache();
 
+    /**
+     * Count the total and unread messages in our directories, from
+     * their filenames alone.
+     */
+    void count_files(int &total, int &unread);
+
+    /**
+     * Return the most recent modification-time of our `cur/` and
+     * `new/` directories.
+     */
+    time_t directory_mtime();
+
+    /**
+     * Bump our modification-time, after the watcher has reported a change.
+     */
+    void touch();
+
+    /**
+     * Is the given message-file unread, judging from its name alone?
+     */
+    static bool is_unread_file(const std::string &file);
+
+    /**
+     * Is the message-file with the given name, found in new/ or cur/,
+     * unread?
+     */
+    static bool is_unread_name(const std::string &name, bool in_new);
+
+    /**
+     * The stamp of our directories when we last counted them.
+     */
+    CMaildirStamp m_stamp;
+
+    /**
+     * The stamp of our directories, and the modification-time we
+     * returned for it, when `last_modified()` was last called.
+     *
+     * **NOTE**: This does not apply to IMAP or watched folders.
+     */
+    CMaildirStamp m_seen_stamp;
+    time_t m_seen_modified;
+    bool m_seen;
+
+    /**
+     * Descriptors of our open `cur/` and `new/` directories, or -1.
+     */
+    int m_cur_fd;
+    int m_new_fd;
+
+    /**
+     * Ensure our directories are open, and are the ones described by
+     * the given stamp.
+     */
+    bool open_directories(const CMaildirStamp &stamp);
+
+    /**
+     * Close our directories, if they are open.
+     */
+    void close_directories();
+
+    /**
+     * Update our list of messages for a file which has been added,
+     * removed, or renamed - and our counts too if `count` is true.
+     */
+    void entry_added(const std::string &file, bool count);
+    void entry_removed(const std::string &file, bool count);
+    void entry_renamed(const std::string &from, const std::string &to, bool count);
+
+    /**
+     * Should changes we make ourselves, from a state with the given
+     * stamp, update our counts in place?
+     */
+    bool own_counts(const CMaildirStamp &before, bool valid);
+
+    /**
+     * Record that we've finished making changes ourselves, such that
+     * they won't cause us to be counted or scanned again.
+     */
+    void own_changes_done(const CMaildirStamp &before, bool valid, bool counted);
+
+    /**
+     * The paths of the files we've created, removed, or renamed
+     * ourselves, whose events the watcher has not yet reported.
+     */
+    std::unordered_set<std::string> m_pending;
+
     /**
      * Generate a filename for saving a message into.
      */
     std::string generate_filename(bool is_new);
 
+    /**
+     * Return the unique-name of the given message-file, which is the
+     * part of the basename before the `:2,` flag-suffix.
+     */
+    static std::string unique_name(const std::string &file);
+
+    /**
+     * A single message found by a scan.
+     */
+    struct CMaildirRow
+    {
+        /**
+         * The row of the message-table which describes the file.
+         */
+        uint32_t row;
+
+        /**
+         * The message-object, which is NULL until it is first needed.
+         */
+        std::shared_ptr<CMessage> message;
+
+        /**
+         * The inode-number of the file, or zero if it was added without
+         * a scan.
+         */
+        uint64_t inode;
+    };
+
+    /**
+     * The row of an entry in `m_rows` which has been removed, but not
+     * yet compacted away.
+     */
+    static const uint32_t REMOVED_ROW = 0xFFFFFFFF;
+
+    /**
+     * Return the current path of the message in the given row.
+     */
+    static std::string row_path(CMaildirRow &row);
+
+    /**
+     * Drop the entries of `m_rows` which have been removed, updating the
+     * offsets in `m_entries` to match.
+     */
+    void compact_rows();
+
+    /**
+     * Describe our messages for the full-text index.
+     */
+    std::vector<CSearchEntry> search_entries();
+
+    /**
+     * The messages found by the previous scan, in directory-order.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    std::vector<CMaildirRow> m_rows;
+
+    /**
+     * The offset of each entry in `m_rows`, keyed by unique-name.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    std::unordered_map<std::string, size_t> m_entries;
+
+    /**
+     * The number of entries in `m_rows` which have been removed since
+     * it was last compacted.
+     *
+     * Removals arrive from the watcher a file at a time, so rather than
+     * closing the gap each leaves we compact once they've all been seen.
+     */
+    size_t m_removed;
+
+    /**
+     * The persistent summary of our messages, which saves them being
+     * parsed each time we're launched.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    CSummaryIndex m_summary;
+
+    /**
+     * The persistent full-text index of our messages.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    CSearchIndex m_search;
+
+    /**
+     * The threads of our messages, and whether they've been loaded
+     * from beside our summary.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    CThreader m_threads;
+    bool m_threads_loaded;
+
+    /**
+     * The trigrams of the key headers of our messages, which are kept
+     * alongside our list of them.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    CTrigramIndex m_trigrams;
+
 };
 
 
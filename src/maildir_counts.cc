@@ -0,0 +1,225 @@
+/*
+ * maildir_counts.cc - A persistent cache of maildir message-counts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "maildir_counts.h"
+
+
+/*
+ * Constructor.
+ */
+CMaildirCounts::CMaildirCounts()
+{
+    m_loaded = false;
+    m_dirty  = false;
+}
+
+
+/*
+ * Get the current stamp of the given maildir.
+ */
+bool CMaildirCounts::stamp(std::string path, CMaildirStamp &result)
+{
+    struct stat sb;
+
+    if (stat((path + "/cur").c_str(), &sb) != 0)
+        return false;
+
+    result.cur_inode = sb.st_ino;
+    result.cur_mtime = CFile::mtime_ns(sb);
+
+    if (stat((path + "/new").c_str(), &sb) != 0)
+        return false;
+
+    result.new_inode = sb.st_ino;
+    result.new_mtime = CFile::mtime_ns(sb);
+
+    return true;
+}
+
+
+/*
+ * Was the stamp taken from directories which were modified recently?
+ *
+ * If a directory was modified within the last second then it might be
+ * modified again without its mtime visibly changing, depending on the
+ * resolution of the filesystem's timestamps.
+ */
+bool CMaildirCounts::is_recent(const CMaildirStamp &stamp)
+{
+    int64_t recent = ((int64_t)time(NULL) - 1) * 1000000000;
+
+    return ((stamp.cur_mtime >= recent) || (stamp.new_mtime >= recent));
+}
+
+
+/*
+ * Lookup the counts of the given maildir.
+ */
+bool CMaildirCounts::lookup(std::string path, const CMaildirStamp &stamp, int &total, int &unread)
+{
+    load();
+
+    auto it = m_counts.find(path);
+
+    if ((it == m_counts.end()) || !(it->second.stamp == stamp))
+        return false;
+
+    total  = it->second.total;
+    unread = it->second.unread;
+    return true;
+}
+
+
+/*
+ * Record the counts of the given maildir.
+ */
+void CMaildirCounts::store(std::string path, const CMaildirStamp &stamp, int total, int unread)
+{
+    load();
+
+    /*
+     * We can't trust a recent stamp to tell us about later changes.
+     */
+    if (is_recent(stamp))
+    {
+        m_counts.erase(path);
+        return;
+    }
+
+    CCount &entry = m_counts[path];
+    entry.stamp  = stamp;
+    entry.total  = total;
+    entry.unread = unread;
+
+    m_dirty = true;
+}
+
+
+/*
+ * The path to our cache-file.
+ */
+std::string CMaildirCounts::filename()
+{
+    CConfig *config = CConfig::instance();
+    std::string prefix = config->get_string("cache.prefix");
+
+    if (prefix.empty())
+        return "";
+
+    return (prefix + "/maildir.counts");
+}
+
+
+/*
+ * Load the cache from disk.
+ *
+ * Each line contains the stamp, the counts, and then the path - which
+ * is last because it might contain spaces.
+ */
+void CMaildirCounts::load()
+{
+    if (m_loaded)
+        return;
+
+    /*
+     * If there is no cache-prefix configured yet we'll try again
+     * next time.
+     */
+    std::string path = filename();
+
+    if (path.empty())
+        return;
+
+    m_loaded = true;
+
+    std::ifstream in(path);
+
+    for (std::string line; getline(in, line);)
+    {
+        std::istringstream fields(line);
+        CCount entry;
+        std::string name;
+
+        if (!(fields >> entry.stamp.cur_inode >> entry.stamp.cur_mtime
+                >> entry.stamp.new_inode >> entry.stamp.new_mtime
+                >> entry.total >> entry.unread))
+            continue;
+
+        fields.get();
+        getline(fields, name);
+
+        /*
+         * Entries we've already counted, before loading, win.
+         */
+        if (!name.empty() && (m_counts.find(name) == m_counts.end()))
+            m_counts[name] = entry;
+    }
+}
+
+
+/*
+ * Save the cache, if it has changed.
+ */
+void CMaildirCounts::save()
+{
+    if (! m_dirty)
+        return;
+
+    std::string path = filename();
+
+    if (path.empty())
+        return;
+
+    /*
+     * Merge in anything we've not loaded yet, so we don't lose it.
+     */
+    load();
+
+    CDirectory::mkdir_p(CConfig::instance()->get_string("cache.prefix"));
+
+    /*
+     * Write to a temporary file, then rename into place, so that an
+     * interrupted save doesn't leave us with a truncated cache.
+     */
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp);
+
+    for (auto it = m_counts.begin(); it != m_counts.end(); ++it)
+    {
+        const CCount &entry = it->second;
+
+        out << entry.stamp.cur_inode << " " << entry.stamp.cur_mtime << " "
+            << entry.stamp.new_inode << " " << entry.stamp.new_mtime << " "
+            << entry.total << " " << entry.unread << " " << it->first << "\n";
+    }
+
+    out.close();
+
+    if (out.good() && (rename(tmp.c_str(), path.c_str()) == 0))
+        m_dirty = false;
+}
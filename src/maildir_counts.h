@@ -0,0 +1,141 @@
+/*
+ * maildir_counts.h - A persistent cache of maildir message-counts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include "singleton.h"
+
+
+/**
+ * The identity of a maildir's `cur/` and `new/` directories at a
+ * particular moment.
+ *
+ * If either directory has an entry added, removed, or renamed then its
+ * modification-time will change, and if it is replaced then its inode
+ * will - so while the stamp is unchanged the counts are too.
+ */
+struct CMaildirStamp
+{
+    uint64_t cur_inode;
+    int64_t  cur_mtime;
+    uint64_t new_inode;
+    int64_t  new_mtime;
+
+    /**
+     * Compare two stamps.
+     */
+    bool operator==(const CMaildirStamp &other) const
+    {
+        return ((cur_inode == other.cur_inode) && (cur_mtime == other.cur_mtime) &&
+                (new_inode == other.new_inode) && (new_mtime == other.new_mtime));
+    }
+};
+
+
+/**
+ * The CMaildirCounts class is a singleton which remembers the total and
+ * unread message-counts of each maildir, along with the stamp of the
+ * maildir at the time they were counted.
+ *
+ * The cache is persisted beneath `cache.prefix`, such that when we're
+ * next launched a folder whose directories are unchanged need not be
+ * read at all.
+ *
+ */
+class CMaildirCounts : public Singleton<CMaildirCounts>
+{
+public:
+    /**
+     * Constructor.
+     */
+    CMaildirCounts();
+
+public:
+
+    /**
+     * Get the current stamp of the given maildir, returning false
+     * if either of its directories cannot be examined.
+     */
+    static bool stamp(std::string path, CMaildirStamp &result);
+
+    /**
+     * Was either directory in the stamp modified so recently that it
+     * might be modified again without the stamp changing?
+     */
+    static bool is_recent(const CMaildirStamp &stamp);
+
+    /**
+     * Lookup the counts of the given maildir, which are only returned
+     * if they were recorded with the same stamp.
+     */
+    bool lookup(std::string path, const CMaildirStamp &stamp, int &total, int &unread);
+
+    /**
+     * Record the counts of the given maildir.
+     */
+    void store(std::string path, const CMaildirStamp &stamp, int total, int unread);
+
+    /**
+     * Save the cache, if it has changed.
+     */
+    void save();
+
+private:
+
+    /**
+     * A single cached entry.
+     */
+    struct CCount
+    {
+        CMaildirStamp stamp;
+        int total;
+        int unread;
+    };
+
+    /**
+     * Load the cache from disk, if we've not already done so.
+     */
+    void load();
+
+    /**
+     * The path of our cache-file, or "" if `cache.prefix` is unset.
+     */
+    std::string filename();
+
+private:
+
+    /**
+     * The cached counts, keyed by maildir path.
+     */
+    std::unordered_map<std::string, CCount> m_counts;
+
+    /**
+     * Have we loaded the cache from disk?
+     */
+    bool m_loaded;
+
+    /**
+     * Have we changed since we were loaded?
+     */
+    bool m_dirty;
+};
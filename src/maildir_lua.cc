@@ -105,7 +105,17 @@ int l_CMaildir_constructor(lua_State * l)
 
     const char *path = luaL_checkstring(l, 1);
 
-    push_cmaildir(l, std::shared_ptr<CMaildir>(new CMaildir(path)));
+    /*
+     * If we know of this maildir already we return the same object,
+     * such that changes made through it - such as saving a message -
+     * update the state we've cached.
+     */
+    std::shared_ptr<CMaildir> existing = CGlobalState::instance()->find_maildir(path);
+
+    if (existing)
+        push_cmaildir(l, existing);
+    else
+        push_cmaildir(l, std::shared_ptr<CMaildir>(new CMaildir(path)));
 
     return 1;
 }
@@ -218,6 +228,37 @@ int l_CMaildir_total_messages(lua_State * l)
 
 
 
+/**
+ * Implementation of Maildir:update_flags()
+ *
+ * Add and remove flags from each message in the given table, returning
+ * the number which were changed.
+ */
+int l_CMaildir_update_flags(lua_State * l)
+{
+    CLuaLog("l_CMaildir_update_flags");
+
+    std::shared_ptr<CMaildir> foo = l_CheckCMaildir(l, 1);
+    luaL_checktype(l, 2, LUA_TTABLE);
+
+    const char *add    = luaL_optstring(l, 3, "");
+    const char *remove = luaL_optstring(l, 4, "");
+
+    CMessageList messages;
+
+    lua_pushnil(l);
+
+    while (lua_next(l, 2))
+    {
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    lua_pushinteger(l, foo->update_flags(messages, add, remove));
+    return 1;
+}
+
+
 /**
  * Implementation of Maildir:unread_messages()
  */
@@ -342,6 +383,7 @@ void InitMaildir(lua_State * l)
         {"save_message", l_CMaildir_save_message},
         {"total_messages", l_CMaildir_total_messages},
         {"unread_messages", l_CMaildir_unread_messages},
+        {"update_flags", l_CMaildir_update_flags},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CMaildir");
@@ -0,0 +1,519 @@
+/*
+ * maildir_test.cc - Test-cases for our CMaildir class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "file.h"
+#include "maildir.h"
+#include "maildir_counts.h"
+#include "CuTest.h"
+
+
+/*
+ * Create a temporary maildir, returning its path.
+ */
+static std::string create_test_maildir()
+{
+    char tmpl[] = "/tmp/maildir.XXXXXX";
+
+    if (mkdtemp(tmpl) == NULL)
+        return "";
+
+    std::string path(tmpl);
+
+    CDirectory::mkdir_p(path + "/cur");
+    CDirectory::mkdir_p(path + "/new");
+    CDirectory::mkdir_p(path + "/tmp");
+
+    return (path);
+}
+
+
+/*
+ * Create a message-file with trivial contents.
+ */
+static void create_test_message(std::string path)
+{
+    std::ofstream out(path);
+    out << "Subject: test\n\nBody\n";
+    out.close();
+}
+
+
+/*
+ * Remove a temporary maildir, and the messages within it.
+ */
+static void remove_test_maildir(std::string path)
+{
+    std::vector<std::string> dirs;
+    dirs.push_back(path + "/cur");
+    dirs.push_back(path + "/new");
+    dirs.push_back(path + "/tmp");
+
+    for (std::string dir : dirs)
+    {
+        for (std::string file : CDirectory::entries(dir))
+        {
+            if (! CFile::is_directory(file))
+                CFile::delete_file(file);
+        }
+
+        rmdir(dir.c_str());
+    }
+
+    rmdir(path.c_str());
+}
+
+
+/**
+ * Test that CMaildir::rescan() reuses message-objects, and reports changes.
+ */
+void TestMaildirRescan(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+    CuAssertTrue(tc, CFile::is_maildir(path));
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/cur/2.two:2,");
+    create_test_message(path + "/new/3.three");
+
+    CMaildir maildir(path);
+
+    /*
+     * The initial scan finds everything as new.
+     */
+    CMaildirChanges first;
+    CMessageList all = maildir.rescan(&first);
+    CuAssertIntEquals(tc, 3, all.size());
+    CuAssertIntEquals(tc, 3, first.added.size());
+    CuAssertIntEquals(tc, 0, first.removed.size());
+    CuAssertIntEquals(tc, 0, first.renamed.size());
+
+    /*
+     * Rename one message, remove another, and add a third.
+     */
+    std::shared_ptr<CMessage> one = all.at(0);
+    CuAssertStrEquals(tc, std::string(path + "/cur/1.one:2,S").c_str(), one->path().c_str());
+
+    CFile::move(path + "/cur/1.one:2,S", path + "/cur/1.one:2,RS");
+    CFile::delete_file(path + "/cur/2.two:2,");
+    create_test_message(path + "/new/4.four");
+
+    CMaildirChanges second;
+    all = maildir.rescan(&second);
+    CuAssertIntEquals(tc, 3, all.size());
+    CuAssertIntEquals(tc, 1, second.added.size());
+    CuAssertIntEquals(tc, 1, second.removed.size());
+    CuAssertIntEquals(tc, 1, second.renamed.size());
+
+    /*
+     * The renamed message is the same object we had before, but
+     * with its path updated.
+     */
+    CuAssertTrue(tc, second.renamed.at(0) == one);
+    CuAssertStrEquals(tc, std::string(path + "/cur/1.one:2,RS").c_str(), one->path().c_str());
+
+    /*
+     * A further scan sees no changes at all.
+     */
+    CMaildirChanges third;
+    all = maildir.rescan(&third);
+    CuAssertIntEquals(tc, 3, all.size());
+    CuAssertIntEquals(tc, 0, third.added.size());
+    CuAssertIntEquals(tc, 0, third.removed.size());
+    CuAssertIntEquals(tc, 0, third.renamed.size());
+
+    remove_test_maildir(path);
+}
+
+
+/**
+ * Test that message objects are only created for the rows which are
+ * requested.
+ */
+void TestMaildirLazyMessages(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+    CuAssertTrue(tc, CFile::is_maildir(path));
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/cur/2.two:2,");
+    create_test_message(path + "/new/3.three");
+
+    CMaildir maildir(path);
+
+    /*
+     * Scanning finds the messages, but creates no objects.
+     */
+    CMaildirChanges first;
+    maildir.scan(&first);
+    CuAssertIntEquals(tc, 3, maildir.message_count());
+    CuAssertIntEquals(tc, 0, first.added.size());
+
+    /*
+     * Objects are created on demand, and are then persistent.
+     */
+    std::shared_ptr<CMessage> two = maildir.message_at(1);
+    CuAssertTrue(tc, two != NULL);
+    CuAssertStrEquals(tc, std::string(path + "/cur/2.two:2,").c_str(), two->path().c_str());
+    CuAssertTrue(tc, maildir.message_at(1) == two);
+    CuAssertTrue(tc, maildir.message_at(3) == NULL);
+
+    /*
+     * Only the message we've created an object for is reported
+     * as renamed.
+     */
+    CFile::move(path + "/cur/1.one:2,S", path + "/cur/1.one:2,RS");
+    CFile::move(path + "/cur/2.two:2,", path + "/cur/2.two:2,S");
+
+    CMaildirChanges second;
+    maildir.scan(&second);
+    CuAssertIntEquals(tc, 3, maildir.message_count());
+    CuAssertIntEquals(tc, 1, second.renamed.size());
+    CuAssertTrue(tc, second.renamed.at(0) == two);
+    CuAssertStrEquals(tc, std::string(path + "/cur/2.two:2,S").c_str(), two->path().c_str());
+
+    /*
+     * An object created after the rename sees the new path.
+     */
+    std::shared_ptr<CMessage> one = maildir.message_at(0);
+    CuAssertStrEquals(tc, std::string(path + "/cur/1.one:2,RS").c_str(), one->path().c_str());
+
+    /*
+     * Getting all messages returns the objects we already have.
+     */
+    CMessageList all = maildir.getMessages();
+    CuAssertIntEquals(tc, 3, all.size());
+    CuAssertTrue(tc, all.at(0) == one);
+    CuAssertTrue(tc, all.at(1) == two);
+
+    remove_test_maildir(path);
+}
+
+
+/**
+ * Test that a watched CMaildir applies reported changes in-place.
+ */
+void TestMaildirWatchedUpdates(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/new/2.two");
+
+    CMaildir maildir(path);
+    maildir.set_watched(true);
+    CuAssertTrue(tc, maildir.is_watched());
+
+    CuAssertIntEquals(tc, 2, maildir.total_messages());
+    CuAssertIntEquals(tc, 1, maildir.unread_messages());
+
+    time_t before = maildir.last_modified();
+
+    /*
+     * Deliver a new message, and report it.
+     */
+    create_test_message(path + "/new/3.three");
+    maildir.file_added(path + "/new/3.three");
+
+    CuAssertTrue(tc, maildir.last_modified() > before);
+    CuAssertIntEquals(tc, 3, maildir.total_messages());
+    CuAssertIntEquals(tc, 2, maildir.unread_messages());
+    CuAssertIntEquals(tc, 3, maildir.getMessages().size());
+
+    /*
+     * Reporting the same file twice changes nothing.
+     */
+    maildir.file_added(path + "/new/3.three");
+    CuAssertIntEquals(tc, 3, maildir.total_messages());
+
+    /*
+     * Mark a message as read, by moving it to cur/.
+     */
+    CFile::move(path + "/new/2.two", path + "/cur/2.two:2,S");
+    maildir.file_renamed(path + "/new/2.two", path + "/cur/2.two:2,S");
+
+    CuAssertIntEquals(tc, 3, maildir.total_messages());
+    CuAssertIntEquals(tc, 1, maildir.unread_messages());
+
+    /*
+     * Remove a message.
+     */
+    CFile::delete_file(path + "/cur/1.one:2,S");
+    maildir.file_removed(path + "/cur/1.one:2,S");
+
+    CuAssertIntEquals(tc, 2, maildir.total_messages());
+    CuAssertIntEquals(tc, 1, maildir.unread_messages());
+
+    /*
+     * The in-memory list matches what a full scan finds.
+     */
+    CMessageList all = maildir.getMessages();
+    CuAssertIntEquals(tc, 2, all.size());
+
+    CMaildirChanges changes;
+    maildir.rescan(&changes);
+    CuAssertIntEquals(tc, 0, changes.added.size());
+    CuAssertIntEquals(tc, 0, changes.removed.size());
+    CuAssertIntEquals(tc, 0, changes.renamed.size());
+
+    /*
+     * A batch of removals, and a rename amongst them, leaves the
+     * remaining messages where they should be.
+     */
+    create_test_message(path + "/new/4.four");
+    maildir.file_added(path + "/new/4.four");
+
+    CFile::delete_file(path + "/cur/2.two:2,S");
+    maildir.file_removed(path + "/cur/2.two:2,S");
+
+    CFile::move(path + "/new/4.four", path + "/cur/4.four:2,S");
+    maildir.file_renamed(path + "/new/4.four", path + "/cur/4.four:2,S");
+
+    CFile::delete_file(path + "/new/3.three");
+    maildir.file_removed(path + "/new/3.three");
+
+    CuAssertIntEquals(tc, 1, maildir.total_messages());
+    CuAssertIntEquals(tc, 0, maildir.unread_messages());
+    CuAssertIntEquals(tc, 1, maildir.message_count());
+    CuAssertStrEquals(tc, std::string(path + "/cur/4.four:2,S").c_str(),
+                      maildir.message_at(0)->path().c_str());
+    CuAssertTrue(tc, maildir.find_message("4.four") == maildir.message_at(0));
+
+    maildir.rescan(&changes);
+    CuAssertIntEquals(tc, 0, changes.added.size());
+    CuAssertIntEquals(tc, 0, changes.removed.size());
+
+    remove_test_maildir(path);
+}
+
+
+/**
+ * Test that message-counts come from filenames, and are cached by stamp.
+ */
+void TestMaildirCounts(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/cur/2.two:2,");
+    create_test_message(path + "/cur/3.three:2,NS");
+    create_test_message(path + "/cur/4.four:2,RS");
+    create_test_message(path + "/new/5.five");
+
+    /*
+     * Backdate the directories, so that their stamps may be cached.
+     */
+    struct timeval old[2];
+    old[0].tv_sec  = old[1].tv_sec  = time(NULL) - 3600;
+    old[0].tv_usec = old[1].tv_usec = 0;
+    utimes(std::string(path + "/cur").c_str(), old);
+    utimes(std::string(path + "/new").c_str(), old);
+
+    CMaildir maildir(path);
+    CuAssertIntEquals(tc, 5, maildir.total_messages());
+    CuAssertIntEquals(tc, 3, maildir.unread_messages());
+
+    /*
+     * The counts are recorded against the current stamp.
+     */
+    CMaildirStamp stamp;
+    CuAssertTrue(tc, CMaildirCounts::stamp(path, stamp));
+
+    int total = 0, unread = 0;
+    CMaildirCounts *counts = CMaildirCounts::instance();
+    CuAssertTrue(tc, counts->lookup(path, stamp, total, unread));
+    CuAssertIntEquals(tc, 5, total);
+    CuAssertIntEquals(tc, 3, unread);
+
+    /*
+     * Once the directory changes the stamp does too, and we count again.
+     */
+    create_test_message(path + "/new/6.six");
+
+    CMaildirStamp changed;
+    CuAssertTrue(tc, CMaildirCounts::stamp(path, changed));
+    CuAssertTrue(tc, !(stamp == changed));
+    CuAssertTrue(tc, !counts->lookup(path, changed, total, unread));
+
+    CuAssertIntEquals(tc, 6, maildir.total_messages());
+    CuAssertIntEquals(tc, 4, maildir.unread_messages());
+
+    remove_test_maildir(path);
+}
+
+
+/**
+ * Test that flags may be changed in bulk, without the maildir
+ * appearing to have been modified.
+ */
+void TestMaildirUpdateFlags(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/cur/2.two:2,");
+    create_test_message(path + "/new/3.three");
+
+    struct timeval old[2];
+    old[0].tv_sec  = old[1].tv_sec  = time(NULL) - 3600;
+    old[0].tv_usec = old[1].tv_usec = 0;
+    utimes(std::string(path + "/cur").c_str(), old);
+    utimes(std::string(path + "/new").c_str(), old);
+
+    CMaildir maildir(path);
+    CuAssertIntEquals(tc, 2, maildir.unread_messages());
+
+    time_t before = maildir.last_modified();
+    CMessageList all = maildir.getMessages();
+
+    /*
+     * Mark everything as read, which moves the new message to cur/.
+     */
+    CuAssertIntEquals(tc, 2, maildir.update_flags(all, "S", "N"));
+    CuAssertIntEquals(tc, 0, maildir.unread_messages());
+    CuAssertIntEquals(tc, 3, maildir.total_messages());
+
+    CuAssertTrue(tc, CFile::exists(path + "/cur/2.two:2,S"));
+    CuAssertTrue(tc, CFile::exists(path + "/cur/3.three:2,S"));
+    CuAssertStrEquals(tc, std::string(path + "/cur/3.three:2,S").c_str(), all.at(2)->path().c_str());
+
+    /*
+     * We made the change, so there's nothing to rescan.
+     */
+    CuAssertIntEquals(tc, before, maildir.last_modified());
+
+    /*
+     * Doing it again changes nothing.
+     */
+    CuAssertIntEquals(tc, 0, maildir.update_flags(all, "S", "N"));
+
+    /*
+     * Mark everything as unread, whilst being watched.
+     */
+    maildir.set_watched(true);
+    CuAssertIntEquals(tc, 0, maildir.unread_messages());
+
+    before = maildir.last_modified();
+
+    CuAssertIntEquals(tc, 3, maildir.update_flags(all, "", "S"));
+    CuAssertIntEquals(tc, 3, maildir.unread_messages());
+    CuAssertTrue(tc, CFile::exists(path + "/cur/1.one:2,"));
+
+    /*
+     * The watcher reports our own rename, which is already accounted for.
+     */
+    maildir.file_renamed(path + "/cur/1.one:2,S", path + "/cur/1.one:2,");
+    CuAssertIntEquals(tc, 3, maildir.unread_messages());
+    CuAssertIntEquals(tc, before, maildir.last_modified());
+
+    CMaildirChanges changes;
+    maildir.rescan(&changes);
+    CuAssertIntEquals(tc, 0, changes.added.size());
+    CuAssertIntEquals(tc, 0, changes.removed.size());
+    CuAssertIntEquals(tc, 0, changes.renamed.size());
+
+    remove_test_maildir(path);
+}
+
+
+/**
+ * Test that the changes we make ourselves are applied in place, without
+ * the maildir appearing to have been modified.
+ */
+void TestMaildirOwnChanges(CuTest * tc)
+{
+    std::string path = create_test_maildir();
+
+    create_test_message(path + "/cur/1.one:2,S");
+    create_test_message(path + "/new/2.two");
+    create_test_message(path + "/new/3.three");
+
+    struct timeval old[2];
+    old[0].tv_sec  = old[1].tv_sec  = time(NULL) - 3600;
+    old[0].tv_usec = old[1].tv_usec = 0;
+    utimes(std::string(path + "/cur").c_str(), old);
+    utimes(std::string(path + "/new").c_str(), old);
+
+    CMaildir maildir(path);
+    CuAssertIntEquals(tc, 2, maildir.unread_messages());
+    CuAssertIntEquals(tc, 3, maildir.getMessages().size());
+
+    time_t before = maildir.last_modified();
+
+    /*
+     * Mark a message as read.
+     */
+    CuAssertTrue(tc, maildir.rename_file(path + "/new/2.two", path + "/cur/2.two:2,S"));
+    CuAssertIntEquals(tc, 1, maildir.unread_messages());
+    CuAssertStrEquals(tc, std::string(path + "/cur/2.two:2,S").c_str(),
+                      maildir.message_at(1)->path().c_str());
+
+    /*
+     * Delete a message.
+     */
+    CuAssertTrue(tc, maildir.remove_file(path + "/cur/1.one:2,S"));
+    CuAssertIntEquals(tc, 2, maildir.total_messages());
+    CuAssertIntEquals(tc, 2, maildir.message_count());
+
+    /*
+     * Save a copy of a message.
+     */
+    std::shared_ptr<CMessage> copy = maildir.message_at(1);
+    CuAssertTrue(tc, maildir.saveMessage(copy));
+    CuAssertIntEquals(tc, 3, maildir.total_messages());
+    CuAssertIntEquals(tc, 1, maildir.unread_messages());
+    CuAssertIntEquals(tc, 3, maildir.message_count());
+
+    /*
+     * None of which needs a rescan, which would find the same.
+     */
+    CuAssertIntEquals(tc, before, maildir.last_modified());
+
+    CMaildirChanges changes;
+    maildir.scan(&changes);
+    CuAssertIntEquals(tc, 0, changes.added.size());
+    CuAssertIntEquals(tc, 0, changes.removed.size());
+    CuAssertIntEquals(tc, 0, changes.renamed.size());
+    CuAssertIntEquals(tc, 3, maildir.message_count());
+
+    remove_test_maildir(path);
+}
+
+
+CuSuite *
+maildir_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirCounts);
+    SUITE_ADD_TEST(suite, TestMaildirRescan);
+    SUITE_ADD_TEST(suite, TestMaildirLazyMessages);
+    SUITE_ADD_TEST(suite, TestMaildirWatchedUpdates);
+    SUITE_ADD_TEST(suite, TestMaildirUpdateFlags);
+    SUITE_ADD_TEST(suite, TestMaildirOwnChanges);
+    return suite;
+}
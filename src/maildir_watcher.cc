@@ -0,0 +1,501 @@
+/*
+ * maildir_watcher.cc - Watch local maildirs for changes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+
+#include "global_state.h"
+#include "logger.h"
+#include "lua.h"
+#include "maildir.h"
+#include "maildir_watcher.h"
+#include "util.h"
+
+
+/*
+ * Constructor - create our inotify handle.
+ */
+CMaildirWatcher::CMaildirWatcher()
+{
+    m_fd = -1;
+
+#ifdef __linux__
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_fd < 0)
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("maildir", "inotify_init1 failed: %s", strerror(errno));
+    }
+
+#endif
+}
+
+
+/*
+ * Destructor - close our inotify handle.
+ */
+CMaildirWatcher::~CMaildirWatcher()
+{
+    if (m_fd != -1)
+        close(m_fd);
+
+    m_fd = -1;
+}
+
+
+/*
+ * Start watching the given local maildir.
+ */
+bool CMaildirWatcher::watch(std::shared_ptr<CMaildir> folder)
+{
+    if ((m_fd < 0) || (! folder) || (! folder->is_maildir()))
+        return false;
+
+    /*
+     * If we're already watching this object we're done.
+     */
+    if (folder->is_watched())
+        return true;
+
+    std::string path = folder->path();
+
+    int cur = add_watch(folder, path + "/cur");
+
+    if (cur < 0)
+        return false;
+
+    /*
+     * Don't leave half a maildir watched.
+     */
+    if (add_watch(folder, path + "/new") < 0)
+    {
+        remove_watch(folder, cur);
+        return false;
+    }
+
+    folder->set_watched(true);
+    return true;
+}
+
+
+/*
+ * Watch the given directory of a prefix tree for folders being created
+ * or removed beneath it.
+ */
+bool CMaildirWatcher::watch_prefix(std::string path)
+{
+#ifdef __linux__
+
+    if ((m_fd < 0) || path.empty())
+        return false;
+
+    int wd = inotify_add_watch(m_fd, path.c_str(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_ONLYDIR);
+
+    if (wd < 0)
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("maildir", "Failed to watch %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    /*
+     * A directory we're watching as part of a maildir stays that way.
+     */
+    auto existing = m_watches.find(wd);
+
+    if ((existing != m_watches.end()) && (! existing->second.prefix))
+        return true;
+
+    CWatch &watch = m_watches[wd];
+    watch.path   = path;
+    watch.prefix = true;
+    watch.maildirs.clear();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*
+ * Add a watch upon the given sub-directory of a maildir.
+ */
+int CMaildirWatcher::add_watch(std::shared_ptr<CMaildir> folder, std::string path)
+{
+#ifdef __linux__
+
+    /*
+     * Remove any duplicate "/" characters, such that the paths we build
+     * match those which `CMaildir::rescan()` finds.
+     */
+    path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+    int wd = inotify_add_watch(m_fd, path.c_str(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_ONLYDIR);
+
+    if (wd < 0)
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("maildir", "Failed to watch %s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Adding a watch to a path we're already watching returns the
+     * existing descriptor, in which case we add this object to it.
+     */
+    CWatch &watch = m_watches[wd];
+    watch.path   = path;
+    watch.prefix = false;
+    watch.maildirs.push_back(folder);
+
+    return (wd);
+#else
+    (void)folder;
+    (void)path;
+    return -1;
+#endif
+}
+
+
+/*
+ * Stop telling the given maildir about changes seen by a watch, removing
+ * the watch once nothing else is told of them.
+ */
+void CMaildirWatcher::remove_watch(std::shared_ptr<CMaildir> folder, int wd)
+{
+    auto it = m_watches.find(wd);
+
+    if (it == m_watches.end())
+        return;
+
+    std::vector<std::weak_ptr<CMaildir> > &watchers = it->second.maildirs;
+
+    for (auto ptr = watchers.begin(); ptr != watchers.end(); ++ptr)
+    {
+        if (ptr->lock() == folder)
+        {
+            watchers.erase(ptr);
+            break;
+        }
+    }
+
+    if (! maildirs(wd).empty())
+        return;
+
+#ifdef __linux__
+    inotify_rm_watch(m_fd, wd);
+#endif
+    m_watches.erase(wd);
+}
+
+
+/*
+ * Return the still-living maildirs associated with a watch.
+ */
+std::vector<std::shared_ptr<CMaildir> > CMaildirWatcher::maildirs(int wd)
+{
+    std::vector<std::shared_ptr<CMaildir> > result;
+
+    auto it = m_watches.find(wd);
+
+    if (it == m_watches.end())
+        return (result);
+
+    std::vector<std::weak_ptr<CMaildir> > alive;
+
+    for (std::weak_ptr<CMaildir> ptr : it->second.maildirs)
+    {
+        std::shared_ptr<CMaildir> folder = ptr.lock();
+
+        if (folder)
+        {
+            result.push_back(folder);
+            alive.push_back(ptr);
+        }
+    }
+
+    it->second.maildirs.swap(alive);
+    return (result);
+}
+
+
+/*
+ * Read all pending events, and apply them to the maildirs they concern.
+ */
+int CMaildirWatcher::process_events()
+{
+    int count = 0;
+
+#ifdef __linux__
+
+    if (m_fd < 0)
+        return (count);
+
+    /*
+     * The maildirs we've changed, and the subset of those whose list of
+     * messages has changed - rather than merely being renamed.
+     */
+    std::vector<std::shared_ptr<CMaildir> > changed;
+    std::vector<std::shared_ptr<CMaildir> > resized;
+
+    /*
+     * Did we lose events, or see folders come and go?
+     */
+    bool overflow = false;
+    bool folders  = false;
+
+    /*
+     * A rename generates a pair of events which share a cookie, so we
+     * hold on to the first half until we see the second - which might
+     * not be read until our next call.
+     */
+    std::unordered_map<uint32_t, std::pair<int, std::string> > moves;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true)
+    {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+
+        /*
+         * Our descriptor is non-blocking, so we stop when there is
+         * nothing more to read.
+         */
+        if (len <= 0)
+            break;
+
+        char *ptr = buf;
+
+        while (ptr < buf + len)
+        {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            count += 1;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+
+            auto it = m_watches.find(event->wd);
+
+            if (it == m_watches.end())
+                continue;
+
+            /*
+             * The watched directory has gone away.
+             */
+            if (event->mask & IN_IGNORED)
+            {
+                m_watches.erase(it);
+                continue;
+            }
+
+            if (it->second.prefix)
+            {
+                if (! (event->mask & IN_ISDIR))
+                    continue;
+
+                folders = true;
+
+                /*
+                 * Watch a new directory straight away, so that nothing
+                 * created beneath it before we reload the maildirs is
+                 * missed.  The sub-directories of a maildir are watched
+                 * along with it instead.
+                 */
+                std::string name = (event->len > 0) ? event->name : "";
+
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (! name.empty()) &&
+                        (name != "cur") && (name != "new") && (name != "tmp"))
+                    watch_prefix(it->second.path + "/" + name);
+
+                continue;
+            }
+
+            if ((event->mask & IN_ISDIR) || (event->len == 0))
+                continue;
+
+            std::string file = it->second.path + "/" + event->name;
+
+            if (event->mask & IN_MOVED_FROM)
+            {
+                moves[event->cookie] = std::make_pair(event->wd, file);
+                continue;
+            }
+
+            std::vector<std::shared_ptr<CMaildir> > targets = maildirs(event->wd);
+
+            if (event->mask & IN_MOVED_TO)
+            {
+                std::unordered_map<uint32_t, std::pair<int, std::string> > &pending =
+                    (moves.find(event->cookie) != moves.end()) ? moves : m_moves;
+
+                auto from = pending.find(event->cookie);
+
+                if (from != pending.end())
+                {
+                    /*
+                     * A rename within a maildir, such as a flag-change, or
+                     * a move from one maildir to another.
+                     */
+                    std::vector<std::shared_ptr<CMaildir> > sources = maildirs(from->second.first);
+
+                    for (std::shared_ptr<CMaildir> source : sources)
+                    {
+                        if (std::find(targets.begin(), targets.end(), source) != targets.end())
+                        {
+                            source->file_renamed(from->second.second, file);
+                        }
+                        else
+                        {
+                            source->file_removed(from->second.second);
+                            resized.push_back(source);
+                        }
+
+                        changed.push_back(source);
+                    }
+
+                    for (std::shared_ptr<CMaildir> target : targets)
+                    {
+                        if (std::find(sources.begin(), sources.end(), target) == sources.end())
+                        {
+                            target->file_added(file);
+                            changed.push_back(target);
+                            resized.push_back(target);
+                        }
+                    }
+
+                    pending.erase(from);
+                    continue;
+                }
+            }
+
+            for (std::shared_ptr<CMaildir> target : targets)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    target->file_added(file);
+
+                if (event->mask & IN_DELETE)
+                    target->file_removed(file);
+
+                changed.push_back(target);
+                resized.push_back(target);
+            }
+        }
+    }
+
+    /*
+     * Anything moved away before our last call, without arriving in a
+     * watched directory since, is gone as far as we're concerned.  What
+     * was moved away during this call gets until the next one.
+     */
+    for (auto it = m_moves.begin(); it != m_moves.end(); ++it)
+    {
+        for (std::shared_ptr<CMaildir> source : maildirs(it->second.first))
+        {
+            source->file_removed(it->second.second);
+            changed.push_back(source);
+            resized.push_back(source);
+        }
+    }
+
+    m_moves.swap(moves);
+
+    /*
+     * If the kernel dropped events we can't trust anything we know.
+     */
+    if (overflow)
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("maildir", "inotify queue overflowed, invalidating all maildirs.");
+
+        m_moves.clear();
+
+        std::vector<int> descriptors;
+
+        for (auto it = m_watches.begin(); it != m_watches.end(); ++it)
+            descriptors.push_back(it->first);
+
+        for (int wd : descriptors)
+        {
+            for (std::shared_ptr<CMaildir> folder : maildirs(wd))
+            {
+                folder->invalidate();
+                changed.push_back(folder);
+                resized.push_back(folder);
+            }
+        }
+    }
+
+    if ((count == 0) && changed.empty())
+        return (count);
+
+    CLogger *logger = CLogger::instance();
+    logger->log("maildir", "Processed %d inotify event(s).", count);
+
+    CGlobalState *global = CGlobalState::instance();
+
+    /*
+     * If folders were created or removed then reload the list of maildirs.
+     */
+    if (folders)
+        global->update_maildirs();
+
+    /*
+     * If the selected maildir changed then update the list of messages.
+     */
+    std::shared_ptr<CMaildir> current = global->current_maildir();
+
+    if (current && (std::find(changed.begin(), changed.end(), current) != changed.end()))
+    {
+        global->update_messages();
+
+        /*
+         * Messages coming or going invalidates any list the Lua side
+         * has built, so let it know.
+         */
+        if (std::find(resized.begin(), resized.end(), current) != resized.end())
+        {
+            CLua *lua = CLua::instance();
+
+            if (lua->function_exists("on_messages_changed"))
+                lua->execute("on_messages_changed()");
+        }
+    }
+
+#endif
+
+    return (count);
+}
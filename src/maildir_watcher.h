@@ -0,0 +1,155 @@
+/*
+ * maildir_watcher.h - Watch local maildirs for changes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "maildir.h"
+#include "singleton.h"
+
+
+/**
+ * The CMaildirWatcher class is a singleton which uses inotify to watch
+ * the `cur/` and `new/` directories of local maildirs.
+ *
+ * As messages are delivered, removed, or renamed the events are applied
+ * to the watched CMaildir objects directly - updating their counts and
+ * message-lists in-place - rather than having them poll the modification
+ * time of their directories.
+ *
+ * The directories of each `maildir.prefix` tree which aren't maildirs
+ * themselves may be watched too - including those created later - such
+ * that the creation or removal of folders anywhere beneath is noticed.
+ *
+ * **NOTE**: On systems without inotify this class does nothing, and all
+ * maildirs continue to be updated by polling.
+ *
+ */
+class CMaildirWatcher : public Singleton<CMaildirWatcher>
+{
+public:
+    /**
+     * Constructor.
+     */
+    CMaildirWatcher();
+
+    /**
+     * Destructor - close our inotify handle.
+     */
+    ~CMaildirWatcher();
+
+public:
+
+    /**
+     * Start watching the given local maildir.
+     *
+     * Returns false if the maildir cannot be watched, for example
+     * because the inotify watch-limit has been reached, in which case
+     * the maildir will continue to be polled.
+     */
+    bool watch(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * Watch the given directory of a prefix tree for folders being
+     * created or removed directly beneath it.
+     *
+     * Directories created beneath it are watched in turn, as they're
+     * reported.
+     */
+    bool watch_prefix(std::string path);
+
+    /**
+     * Read all pending events, and apply them to the maildirs they
+     * concern.
+     *
+     * If the currently selected maildir changed then the global list
+     * of messages is updated, and if the set of folders changed then
+     * the list of maildirs is reloaded.
+     *
+     * Returns the number of events which were processed.
+     */
+    int process_events();
+
+private:
+
+    /**
+     * The state kept for each inotify watch-descriptor.
+     */
+    struct CWatch
+    {
+        /**
+         * The directory being watched.
+         */
+        std::string path;
+
+        /**
+         * Is this a directory of a prefix tree, rather than a `cur/` or
+         * `new/` directory?
+         */
+        bool prefix;
+
+        /**
+         * The maildir objects which should be told of changes.
+         *
+         * More than one object might represent the same directory, and
+         * we don't want to keep them alive, hence the use of weak-pointers.
+         */
+        std::vector<std::weak_ptr<CMaildir> > maildirs;
+    };
+
+    /**
+     * Add a watch upon the given sub-directory of a maildir, returning
+     * its descriptor or -1 on failure.
+     */
+    int add_watch(std::shared_ptr<CMaildir> folder, std::string path);
+
+    /**
+     * Stop telling the given maildir about the changes a watch sees,
+     * removing the watch if no other maildir is told of them.
+     */
+    void remove_watch(std::shared_ptr<CMaildir> folder, int wd);
+
+    /**
+     * Return the still-living maildirs associated with a watch.
+     */
+    std::vector<std::shared_ptr<CMaildir> > maildirs(int wd);
+
+private:
+
+    /**
+     * The inotify file-descriptor, or -1 if that is unavailable.
+     */
+    int m_fd;
+
+    /**
+     * Our watches, keyed by watch-descriptor.
+     */
+    std::unordered_map<int, CWatch> m_watches;
+
+    /**
+     * The renames whose first half was read by our last call, keyed by
+     * cookie, with the watch-descriptor and path the file left.
+     */
+    std::unordered_map<uint32_t, std::pair<int, std::string> > m_moves;
+};
@@ -25,6 +25,7 @@
 #include <string.h>
 #include <string>
 #include <sstream>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -43,6 +44,8 @@
 
 #include "config.h"
 #include "file.h"
+#include "header_arena.h"
+#include "header_scanner.h"
 #include "global_state.h"
 #include "imap_proxy.h"
 #include "json/json.h"
@@ -50,6 +53,7 @@
 #include "maildir.h"
 #include "message.h"
 #include "message_part.h"
+#include "message_table.h"
 #include "mime.h"
 #include "util.h"
 
@@ -59,9 +63,33 @@
  */
 CMessage::CMessage(const std::string name, bool is_local)
 {
-    m_path = name;
-    m_time = 0;
-    m_imap = !is_local;
+    m_row     = CMessageTable::instance()->insert(name);
+    m_imap    = !is_local;
+    m_imap_id = 0;
+
+    m_headers_read = false;
+
+    /*
+     * IMAP messages have a fake modification-time, which we bump when
+     * their flags change.
+     */
+    if (m_imap)
+        CMessageTable::instance()->set_mtime(m_row, 0);
+}
+
+
+/*
+ * Constructor - create a local message from an existing row.
+ */
+CMessage::CMessage(uint32_t row)
+{
+    CMessageTable::instance()->acquire(row);
+
+    m_row     = row;
+    m_imap    = false;
+    m_imap_id = 0;
+
+    m_headers_read = false;
 }
 
 
@@ -73,7 +101,7 @@ std::string CMessage::path()
     if (m_imap)
         lazy_load();
 
-    return (m_path);
+    return (CMessageTable::instance()->path(m_row));
 }
 
 
@@ -82,7 +110,16 @@ std::string CMessage::path()
  */
 void CMessage::path(std::string new_path)
 {
-    m_path = new_path;
+    CMessageTable::instance()->set_path(m_row, new_path);
+}
+
+
+/*
+ * Return the row of the message-table which holds our details.
+ */
+uint32_t CMessage::row()
+{
+    return (m_row);
 }
 
 
@@ -91,17 +128,67 @@ void CMessage::path(std::string new_path)
  */
 std::string CMessage::header(std::string name)
 {
-    std::unordered_map < std::string, std::string > h = headers();
-
     /*
      * Lower-case the header we were given.
      */
     std::transform(name.begin(), name.end(), name.begin(), tolower);
 
+    const char *value = find_header(name);
+
+    return (value ? value : "");
+}
+
+
+/*
+ * Find the value of a given header, without copying it.
+ */
+const char *CMessage::find_header(const std::string &name)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The most commonly used headers are stored in the table.
+     */
+    CMessageTable::CKeyHeader key;
+
+    if (CMessageTable::key_header(name, key))
+    {
+        if (!(table->state(m_row) & CMessageTable::STATE_HEADERS))
+            populate_headers();
+
+        return (table->header_data(m_row, key));
+    }
+
+    if (! m_headers_read)
+        populate_headers();
+
+    return (m_headers.find(name));
+}
+
+
+/*
+ * Create a stream to read the message-file with the given descriptor.
+ */
+GMimeStream * CMessage::open_stream(int fd)
+{
+    /*
+     * We'd rather map the file, which saves copying it as it is parsed,
+     * and we'll read it from start to finish.
+     */
+    GMimeStream *stream = g_mime_stream_mmap_new(fd, PROT_READ, MAP_PRIVATE);
+
+    if (stream != NULL)
+    {
+        GMimeStreamMmap *map = GMIME_STREAM_MMAP(stream);
+        madvise(map->map, map->maplen, MADV_SEQUENTIAL);
+
+        return (stream);
+    }
+
     /*
-     * Lookup the value.
+     * An empty file can't be mapped, nor can a pipe.
      */
-    return (h[name]);
+    return (g_mime_stream_fs_new(fd));
 }
 
 
@@ -109,7 +196,7 @@ std::string CMessage::header(std::string name)
  * Parse a MIME message and return an object suitable for operating
  * upon.
  */
-GMimeMessage * CMessage::parse_message()
+GMimeMessage * CMessage::parse_message(bool &lazy)
 {
 
     /*
@@ -119,8 +206,6 @@ GMimeMessage * CMessage::parse_message()
     if (m_imap)
         lazy_load();
 
-    int result __attribute__((unused));
-
     GMimeMessage * message;
     GMimeParser *parser;
     GMimeStream *stream;
@@ -149,6 +234,8 @@ GMimeMessage * CMessage::parse_message()
         }
     }
 
+    lazy = ! replaced;
+
 
     if ((fd = open(file.c_str(), O_RDONLY, 0)) == -1)
     {
@@ -167,14 +254,17 @@ GMimeMessage * CMessage::parse_message()
         return (NULL);
     }
 
-    stream = g_mime_stream_fs_new(fd);
-    g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
+    /*
+     * The content of each part is a range of the stream, rather than a
+     * copy, so the stream owns the descriptor - it is closed once the
+     * message has been freed.
+     */
+    stream = open_stream(fd);
 
     parser = g_mime_parser_new_with_stream(stream);
-    g_mime_parser_set_persist_stream(parser, FALSE);
+    g_mime_parser_set_persist_stream(parser, TRUE);
 
     message = g_mime_parser_construct_message(parser);
-    g_object_unref(stream);
     g_object_unref(parser);
 
     /*
@@ -183,61 +273,58 @@ GMimeMessage * CMessage::parse_message()
      */
     if (message == NULL)
     {
-
-        /*
-         * Close the file and retry parsing it, by opening it and
-         * skipping two lines.
-         */
-        close(fd);
-        fd = open(file.c_str(), O_RDONLY, 0);
-
-        int newline = 2;
-        int count   = 1024;
-        char buf[2] = { '\0', '\0' };
-
         /*
-         * We're skipping two lines, but if the message
-         * is really malformed and contains a long
-         * line, etc, we'll have an infinite loop
-         * if we don't cap our attempts.
-         *
-         * `count` is the number of characters read,
-         * and we limit that to 1024 bytes.
+         * Retry parsing the file, skipping the first two lines.
          *
+         * We're skipping two lines, but if the message is really
+         * malformed and contains a long line, etc, we'll skip no more
+         * than 1024 bytes.
          */
-        while ((newline > 0) && (count > 0))
+        char buf[1024];
+        const char *start = buf;
+        ssize_t len;
+
+        if (GMIME_IS_STREAM_MMAP(stream))
         {
-            result = read(fd, buf, 1);
+            start = GMIME_STREAM_MMAP(stream)->map;
+            len   = std::min(GMIME_STREAM_MMAP(stream)->maplen, sizeof(buf));
+        }
+        else
+        {
+            len = std::max(pread(fd, buf, sizeof(buf), 0), (ssize_t)0);
+        }
 
-            if (buf[0] == '\n')
-                newline -= 1;
+        const char *end = start + len;
+        const char *line = start;
 
-            count -= 1;
+        for (int newline = 0; (newline < 2) && (line < end); newline++)
+        {
+            const char *nl = (const char *)memchr(line, '\n', end - line);
+            line = nl ? nl + 1 : end;
         }
 
         /*
-         * Rebuild - the key here is that `fd` is the file-descriptor
-         * to the open file, and we've consumed content from it already.
+         * Rebuild - the key here is that the rest of the file is a range
+         * of the same stream, so we need neither re-open nor re-read it.
          */
-        stream    = g_mime_stream_fs_new(fd);
+        GMimeStream *rest = g_mime_stream_substream(stream, line - start, -1);
 
-        parser    = g_mime_parser_new_with_stream(stream);
-        g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
-        g_mime_parser_set_persist_stream(parser, FALSE);
+        parser = g_mime_parser_new_with_stream(rest);
+        g_mime_parser_set_persist_stream(parser, TRUE);
 
         message = g_mime_parser_construct_message(parser);
-        g_object_unref(stream);
+        g_object_unref(rest);
         g_object_unref(parser);
-
     }
 
-    if (replaced == true)
-        CFile::delete_file(file);
+    g_object_unref(stream);
 
     /*
-     * We close this here explicitly to avoid a leak.
+     * A temporary file can be removed now - we still have it open.
      */
-    close(fd);
+    if (replaced == true)
+        CFile::delete_file(file);
+
     return (message);
 }
 
@@ -246,7 +333,8 @@ GMimeMessage * CMessage::parse_message()
  */
 void CMessage::populate_message() {
 
-    GMimeMessage *msg = parse_message();
+    bool lazy;
+    GMimeMessage *msg = parse_message(lazy);
 
     if (msg == NULL)
     {
@@ -255,6 +343,15 @@ void CMessage::populate_message() {
         return;
     }
 
+    /*
+     * If we've read the headers already we only need the MIME-parts.
+     */
+    if (m_headers_read)
+    {
+        populate_parts(msg, lazy);
+        return;
+    }
+
     const char *name;
     const char *value;
 
@@ -301,7 +398,7 @@ void CMessage::populate_message() {
             /*
              * Store the updated value and free the original pointer.
              */
-            m_headers[nm] = v;
+            m_headers.set(nm, v);
             free(decoded);
 
             /*
@@ -315,118 +412,399 @@ void CMessage::populate_message() {
     g_mime_header_list_clear(ls);
     g_mime_header_iter_free(iter);
 
-    /* Parse into MIME-Parts */
+    store_headers();
+    populate_parts(msg, lazy);
 
-    GMimeObject *mime_part = g_mime_message_get_mime_part(msg);
+    m_headers_read = true;
+}
 
-    if (!mime_part)
-        return;
 
-    m_parts.push_back(part2obj(mime_part));
+/*
+ * Populate the MIME-parts cache from the given message, which we free.
+ */
+void CMessage::populate_parts(GMimeMessage *msg, bool lazy)
+{
+    GMimeObject *mime_part = g_mime_message_get_mime_part(msg);
+
+    if (mime_part)
+        m_parts.push_back(part2obj(mime_part, lazy));
 
     g_object_unref(msg);
 }
 
 
 /*
- * Return all header-names, and their values.
+ * Move the key headers into the message-table, along with the parsed
+ * date, which leaves us with the rest.
  */
-std::unordered_map < std::string, std::string > CMessage::headers()
+void CMessage::store_headers()
+{
+    store_headers(m_row, m_headers);
+}
+
+
+/*
+ * Store the key headers of a message in the given row.
+ */
+void CMessage::store_headers(uint32_t row, CHeaderArena &headers)
+{
+    time_t date = 0;
+    const char *date_header = headers.find("date");
+
+    if (date_header != NULL)
+        date = g_mime_utils_header_decode_date(date_header, NULL);
+
+    const char *type = headers.find("content-type");
+    const char *disposition = headers.find("content-disposition");
+    uint32_t hints = CMessageTable::content_hints(type ? type : "", disposition ? disposition : "");
+
+    /*
+     * The values are stored straight from the arena.
+     */
+    const char *values[CMessageTable::HEADER_COUNT];
+
+    for (int i = 0; i < CMessageTable::HEADER_COUNT; i++)
+        values[i] = headers.find(CMessageTable::key_name((CMessageTable::CKeyHeader)i));
+
+    CMessageTable::instance()->set_headers(row, values, date, hints);
+
+    for (int i = 0; i < CMessageTable::HEADER_COUNT; i++)
+        headers.erase(CMessageTable::key_name((CMessageTable::CKeyHeader)i));
+}
+
+
+/*
+ * Populate the headers cache, reading only the header-block of the
+ * message.
+ *
+ * The MIME-parts are left until `get_parts()` needs them, so building
+ * the index of a folder reads a few kilobytes of each message rather
+ * than every attachment.  The `message_replace` hook only applies to
+ * the MIME-parts, since it is used to decrypt or verify bodies.
+ */
+void CMessage::populate_headers()
 {
+    if (m_imap)
+        lazy_load();
+
+    std::string block;
+
     /*
-     * If we've cached these then return that copy.
+     * Let the full parse report the error.
      */
-    if (m_headers.size() == 0)
+    if (! read_header_block(path(), block))
+    {
         populate_message();
+        return;
+    }
 
-    return (m_headers);
+    m_headers.clear();
+    parse_headers(block, m_headers);
+    store_headers();
+
+    m_headers_read = true;
 }
 
 
 /*
- * Destructor: If we've parsed any MIME-parts then free them here.
+ * Read the header-block of the given message-file.
  */
-CMessage::~CMessage()
+bool CMessage::read_header_block(const std::string &path, std::string &block)
 {
-    m_parts.clear();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    /*
+     * Read until we find the empty line which ends the headers.
+     */
+    char buf[4096];
+
+    block.clear();
+
+    while (true)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        if (n <= 0)
+            break;
+
+        /*
+         * The terminator might straddle the previous read.
+         */
+        size_t from = (block.size() > 2) ? block.size() - 2 : 0;
+        block.append(buf, n);
+
+        size_t end = CHeaderScanner::header_end(block.data(), block.size(), from);
+
+        if (end != std::string::npos)
+        {
+            block.resize(end);
+            break;
+        }
+    }
+
+    close(fd);
+    return true;
 }
 
 
 /*
- * Retrieve the current flags for this message.
+ * Read the text of the given message-file.
+ *
+ * We parse the file ourselves, rather than using `get_parts()`, since
+ * that consults Lua and the configuration - neither of which may be used
+ * away from the main thread.
  */
-std::string CMessage::get_flags()
+bool CMessage::read_text(const std::string &path, std::string &text, size_t limit)
 {
-    if (m_imap)
-        return m_imap_flags;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
 
-    std::string flags = "";
-    std::string pth = path();
+    if (fd < 0)
+        return false;
 
-    if (pth.empty())
-        return (flags);
+    /*
+     * The stream owns the descriptor.
+     */
+    GMimeStream *stream = g_mime_stream_fs_new(fd);
+    GMimeParser *parser = g_mime_parser_new_with_stream(stream);
 
-    size_t
-    offset = pth.find(":2,");
+    GMimeMessage *message = g_mime_parser_construct_message(parser);
+    g_object_unref(parser);
+    g_object_unref(stream);
 
-    if (offset != std::string::npos)
-        flags = pth.substr(offset + 3);
+    if (message == NULL)
+        return false;
 
     /*
-     * Sleazy Hack.
+     * Walk the parts depth-first, in order.
      */
-    if (pth.find("/new/") != std::string::npos)
-        flags += "N";
+    std::vector<GMimeObject *> parts;
+    GMimeObject *top = g_mime_message_get_mime_part(message);
+
+    if (top)
+        parts.push_back(top);
+
+    while ((! parts.empty()) && (text.size() < limit))
+    {
+        GMimeObject *part = parts.back();
+        parts.pop_back();
+
+        if (GMIME_IS_MULTIPART(part))
+        {
+            int n = g_mime_multipart_get_count((GMimeMultipart *) part);
+
+            for (int i = n - 1; i >= 0; i--)
+                parts.push_back(g_mime_multipart_get_part((GMimeMultipart *) part, i));
+
+            continue;
+        }
+
+        if (! GMIME_IS_PART(part))
+            continue;
+
+        GMimeContentType *ct = g_mime_object_get_content_type(part);
+
+        if (! g_mime_content_type_is_type(ct, "text", "plain"))
+            continue;
+
+        if (g_mime_object_get_content_disposition_parameter(part, "filename") ||
+                g_mime_object_get_content_type_parameter(part, "name"))
+            continue;
+
+        GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
+
+        if (content == NULL)
+            continue;
+
+        /*
+         * Writing the content decodes it.
+         */
+        GMimeStream *mem = g_mime_stream_mem_new();
+        g_mime_data_wrapper_write_to_stream(content, mem);
+
+        GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+
+        /*
+         * Words mustn't run from one part into the next.
+         */
+        if (! text.empty())
+            text += '\n';
 
+        text.append((const char *) res->data, std::min((size_t) res->len, limit - text.size()));
+
+        g_object_unref(mem);
+    }
+
+    g_object_unref(message);
+    return true;
+}
+
+
+/*
+ * Parse a block of headers, unfolding any which span several lines.
+ *
+ * If a header is repeated the last value wins.
+ */
+void CMessage::parse_headers(const std::string &block, CHeaderArena &headers)
+{
+    std::vector<CHeaderSpan> spans;
+    CHeaderScanner::scan(block.data(), block.size(), spans);
+
+    std::string name;
+
+    for (const CHeaderSpan &span : spans)
+    {
+        name.assign(block, span.name, span.name_len);
+
+        for (char &c : name)
+        {
+            if ((c >= 'A') && (c <= 'Z'))
+                c += 'a' - 'A';
+        }
+
+        std::string value = CHeaderScanner::value(block.data(), span);
+
+        /*
+         * Only encoded-words, and 8-bit text, need decoding.
+         */
+        if ((value.find("=?") != std::string::npos) ||
+                (! CHeaderScanner::is_ascii(value.data(), value.size())))
+        {
+            char *decoded = g_mime_utils_header_decode_text(value.c_str());
+
+            if (decoded)
+            {
+                value = decoded;
+                free(decoded);
+            }
+        }
+
+        headers.set(name, value);
+    }
+}
+
+
+/*
+ * Return all header-names, and their values.
+ */
+std::unordered_map < std::string, std::string > CMessage::headers()
+{
+    std::unordered_map < std::string, std::string > result;
+
+    each_header([&result](const std::string & name, const char *value, size_t len)
+    {
+        result[name] = std::string(value, len);
+    });
+
+    return (result);
+}
+
+
+/*
+ * Visit each header, and its value.
+ */
+void CMessage::each_header(std::function<void(const std::string &name, const char *value, size_t len)> fn)
+{
+    CMessageTable *table = CMessageTable::instance();
 
     /*
-     * Sort the flags, and remove duplicates
+     * If we've not cached these then read them.
      */
-    std::sort(flags.begin(), flags.end());
-    flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
+    if (! m_headers_read)
+        populate_headers();
+
+    for (size_t i = 0; i < m_headers.size(); i++)
+        fn(m_headers.name(i), m_headers.value(i), m_headers.value_size(i));
+
+    /*
+     * The key headers are stored in the table.
+     */
+    for (int i = 0; i < CMessageTable::HEADER_COUNT; i++)
+    {
+        CMessageTable::CKeyHeader key = (CMessageTable::CKeyHeader)i;
+        const char *value = table->header_data(m_row, key);
+
+        if (value != NULL)
+            fn(CMessageTable::key_name(key), value, strlen(value));
+    }
+}
+
+
+/*
+ * Destructor: If we've parsed any MIME-parts then free them here.
+ */
+CMessage::~CMessage()
+{
+    m_parts.clear();
+
+    CMessageTable::instance()->release(m_row);
+}
+
+
+/*
+ * Retrieve the current flags for this message.
+ */
+std::string CMessage::get_flags()
+{
+    return (CMessageTable::mask_to_flags(flag_mask()));
+}
+
 
-    return flags;
+/*
+ * Retrieve the current flags for this message, as a bitmask.
+ *
+ * For a local message these were parsed from the path when it was
+ * last set, and for an IMAP message they were given to us.
+ */
+uint64_t CMessage::flag_mask()
+{
+    return (CMessageTable::instance()->flags(m_row));
 }
 
 
 /*
  * Set the flags for this message.
+ *
+ * The message is renamed, and our path updated - which updates the
+ * bitmask of our flags too.
  */
 void CMessage::set_flags(std::string new_flags)
+{
+    std::string cur_path = path();
+    std::string dst_path = flags_path(cur_path, new_flags);
+
+    if (cur_path != dst_path)
+        rename_file(dst_path);
+}
+
+
+/*
+ * Return the given path, with its flags replaced.
+ */
+std::string CMessage::flags_path(std::string cur_path, std::string flags)
 {
     /*
      * Sort the flags.
      */
-    std::string flags = new_flags;
     std::sort(flags.begin(), flags.end());
     flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
 
     /*
      * Get the current ending position.
      */
-    std::string cur_path = path();
     std::string dst_path = cur_path;
 
     size_t offset = std::string::npos;
 
     if ((offset = cur_path.find(":2,")) != std::string::npos)
-    {
         dst_path = cur_path.substr(0, offset);
-        dst_path += ":2,";
-        dst_path += flags;
-    }
-    else
-    {
-        dst_path = cur_path;
-        dst_path += ":2,";
-        dst_path += flags;
-    }
 
-    if (cur_path != dst_path)
-    {
-        CFile::move(cur_path, dst_path);
-        path(dst_path);
-    }
+    dst_path += ":2,";
+    dst_path += flags;
+
+    return (dst_path);
 }
 
 
@@ -441,12 +819,12 @@ void CMessage::set_imap_flags(std::string flags)
     std::sort(flags.begin(), flags.end());
     flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
 
-    m_imap_flags = flags;
+    CMessageTable::instance()->set_flags(m_row, CMessageTable::flags_to_mask(flags));
 
     /*
      * Update our mtime so that the cache is flushed.
      */
-    m_time += 1;
+    bump_mtime();
 
     /*
      * Increase the modification time of the parent folder too.
@@ -463,17 +841,15 @@ void CMessage::set_imap_flags(std::string flags)
  */
 bool CMessage::add_flag(char c)
 {
-    std::string flags = get_flags();
-
-    size_t offset = std::string::npos;
+    uint64_t mask = flag_mask();
+    uint64_t bit  = CMessageTable::flag_bit(c);
 
     /*
      * If the flag was missing, add it.
      */
-    if ((offset = flags.find(c)) == std::string::npos)
+    if ((mask & bit) == 0)
     {
-        flags += c;
-        set_flags(flags);
+        set_flags(CMessageTable::mask_to_flags(mask | bit));
         return true;
     }
     else
@@ -491,10 +867,7 @@ bool CMessage::has_flag(char c)
      */
     c = toupper(c);
 
-    if (get_flags().find(c) != std::string::npos)
-        return true;
-    else
-        return false;
+    return ((flag_mask() & CMessageTable::flag_bit(c)) != 0);
 }
 
 /*
@@ -506,23 +879,16 @@ bool CMessage::remove_flag(char c)
 {
     c = toupper(c);
 
-    std::string current = get_flags();
+    uint64_t mask = flag_mask();
+    uint64_t bit  = CMessageTable::flag_bit(c);
 
     /*
      * If the flag is not present, return.
      */
-    if (current.find(c) == std::string::npos)
+    if ((mask & bit) == 0)
         return false;
 
-    /*
-     * Remove the flag.
-     */
-    std::string::size_type k = 0;
-
-    while ((k = current.find(c, k)) != current.npos)
-        current.erase(k, 1);
-
-    set_flags(current);
+    set_flags(CMessageTable::mask_to_flags(mask & ~bit));
 
     return true;
 }
@@ -538,7 +904,9 @@ bool CMessage::is_new()
      * It has the flag "N".
      * It does not have the flag "S".
      */
-    if ((has_flag('N')) || (!has_flag('S')))
+    uint64_t mask = flag_mask();
+
+    if ((mask & CMessageTable::flag_bit('N')) || !(mask & CMessageTable::flag_bit('S')))
         return true;
 
     return false;
@@ -579,27 +947,19 @@ void CMessage::mark_unread()
         std::string out  = proxy->read_imap_output(cmd);
 
         /*
-         * Remove `S` flag from m_imap_flags since these are
-         * not updated in real-time.
+         * Remove the `S` flag, and add the `N` flag, since our flags
+         * are not updated in real-time.
          */
-        if (m_imap_flags.find('S') != std::string::npos)
-        {
-            std::string::size_type k = 0;
+        uint64_t mask = flag_mask();
+        mask &= ~CMessageTable::flag_bit('S');
+        mask |= CMessageTable::flag_bit('N');
 
-            while ((k = m_imap_flags.find('S', k)) != m_imap_flags.npos)
-                m_imap_flags.erase(k, 1);
-        }
-
-        /*
-         * Add `N` flag, if not present.
-         */
-        if (m_imap_flags.find('N') == std::string::npos)
-            m_imap_flags += "N";
+        CMessageTable::instance()->set_flags(m_row, mask);
 
         /*
          * Update our mtime so that the cache is flushed.
          */
-        m_time += 1;
+        bump_mtime();
 
         /*
          * Increase the modification time of the parent folder too.
@@ -652,27 +1012,19 @@ void CMessage::mark_read()
         std::string out  = proxy->read_imap_output(cmd);
 
         /*
-         * Remove `N` flag from m_imap_flags since these are
-         * not updated in real-time.
+         * Remove the `N` flag, and add the `S` flag, since our flags
+         * are not updated in real-time.
          */
-        if (m_imap_flags.find('N') != std::string::npos)
-        {
-            std::string::size_type k = 0;
-
-            while ((k = m_imap_flags.find('N', k)) != m_imap_flags.npos)
-                m_imap_flags.erase(k, 1);
-        }
+        uint64_t mask = flag_mask();
+        mask &= ~CMessageTable::flag_bit('N');
+        mask |= CMessageTable::flag_bit('S');
 
-        /*
-         * Add `S` flag, if not present.
-         */
-        if (m_imap_flags.find('S') == std::string::npos)
-            m_imap_flags += "S";
+        CMessageTable::instance()->set_flags(m_row, mask);
 
         /*
          * Update our mtime so that the cache is flushed.
          */
-        m_time += 1;
+        bump_mtime();
 
         /*
          * Increase the modification time of the parent folder too.
@@ -691,17 +1043,18 @@ void CMessage::mark_read()
     }
 
     /*
-     * Get the current path, and build a new one.
+     * Get the current path, and build a new one - moving from `new/` to
+     * `cur/` and updating the flags with a single rename.
      */
     std::string c_path = path();
-    std::string n_path = "";
+    std::string n_path = c_path;
 
     size_t offset = std::string::npos;
 
     /*
      * If we find /new/ in the path then rename to be /cur/
      */
-    if ((offset = c_path.find("/new/")) != std::string::npos)
+    if ((offset = c_path.rfind("/new/")) != std::string::npos)
     {
         /*
          * Path component before /new/ + after it.
@@ -710,31 +1063,26 @@ void CMessage::mark_read()
         std::string after  = c_path.substr(offset + strlen("/new/"));
 
         n_path = before + "/cur/" + after;
-
-        if (rename(c_path.c_str(), n_path.c_str())  == 0)
-        {
-            path(n_path);
-            add_flag('S');
-        }
-    }
-    else
-    {
-        /*
-         * The file is new, but not in the new folder.
-         *
-         * That means we need to remove "N" from the flag-component of the path.
-         *
-         */
-        remove_flag('N');
-        add_flag('S');
     }
+
+    /*
+     * The file is no longer new, but has been seen.
+     */
+    uint64_t mask = flag_mask();
+    mask &= ~CMessageTable::flag_bit('N');
+    mask |= CMessageTable::flag_bit('S');
+
+    n_path = flags_path(n_path, CMessageTable::mask_to_flags(mask));
+
+    if (n_path != c_path)
+        rename_file(n_path);
 }
 
 
 /*
  * Convert a message-part from the MIME message to a CMessagePart object.
  */
-std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
+std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part, bool lazy)
 {
     /*
      * This is used to enable/disable conversion of character
@@ -764,6 +1112,95 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
     if (aname == NULL)
         aname = (char *) g_mime_object_get_content_type_parameter(part, "name");
 
+    /*
+     * We'll try to convert the text to UTF-8, but we only do that
+     * if the content is:
+     *
+     *   text/plain
+     *   not UTF-8 already.
+     */
+    std::string convert;
+
+    if ((iconv == 1) &&
+            (g_mime_content_type_is_type(ct, "text", "plain")) &&
+            (charset != NULL) &&
+            (strcmp(charset, "utf-8") != 0) &&
+            (strcmp(charset, "UTF-8") != 0))
+    {
+        convert = charset;
+    }
+
+    std::shared_ptr<CMessagePart> ret;
+
+    /*
+     * The content of a simple part is a range of our file, which we
+     * record rather than read - unless the file is a temporary one.
+     */
+    GMimeStream *range = NULL;
+
+    if (lazy && GMIME_IS_PART(part))
+    {
+        GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
+        range = g_mime_data_wrapper_get_stream(content);
+
+        if ((GMIME_IS_STREAM_MMAP(range) || GMIME_IS_STREAM_FS(range)) &&
+                (range->bound_end >= 0))
+        {
+            std::string name = aname ? aname : "";
+
+            ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, name, m_row,
+                                                 range->bound_start, range->bound_end,
+                                                 g_mime_data_wrapper_get_encoding(content),
+                                                 convert));
+        }
+    }
+
+    if (ret == nullptr)
+        ret = read_part(part, type, aname, convert);
+
+    /* If this is a multipart part, then add its children. */
+    if (GMIME_IS_MULTIPART(part))
+    {
+        /*
+         * Count the children.
+         */
+        int n = g_mime_multipart_get_count((GMimeMultipart *) part);
+
+        /*
+         * For each child .. add the part.
+         */
+        for (int i = 0; i < n; i++)
+        {
+            GMimeObject *subpart = g_mime_multipart_get_part((GMimeMultipart *) part, i);
+
+            /*
+             * Create the child - set the parent.
+             */
+            std::shared_ptr<CMessagePart> child = part2obj(subpart, lazy);
+            child->set_parent(ret);
+
+            /*
+             * Now add the child to the parent.
+             */
+            ret->add_child(child);
+        }
+    }
+
+    /*
+     * Unref the type.
+     */
+    free(type);
+
+    return ret;
+}
+
+
+/*
+ * Convert a message-part to a CMessagePart object, copying its content.
+ */
+std::shared_ptr<CMessagePart> CMessage::read_part(GMimeObject *part, const char *type,
+        const char *aname, std::string convert)
+{
     /*
      * Holder for the content
      */
@@ -822,39 +1259,24 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
     char *adata = (char *) res->data;
     size_t len = (res->len);
 
-    if (iconv == 1)
+    if (! convert.empty())
     {
-        /*
-         * Now we'll try to conver the text to UTF-8, but we
-         * only do that if the content is:
-         *
-         *   text/plain
-         *   not UTF-8 already.
-         */
+        iconv_t cv = g_mime_iconv_open("UTF-8", convert.c_str());
+        char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
 
-        if ((g_mime_content_type_is_type(ct, "text", "plain")) &&
-                (charset != NULL) &&
-                (strcmp(charset, "utf-8") != 0) &&
-                (strcmp(charset, "UTF-8") != 0))
+        if (converted != NULL)
         {
-            iconv_t cv = g_mime_iconv_open("UTF-8", charset);
-            char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
-
-            if (converted != NULL)
-            {
-                /*
-                 * If that succeeded then update our byte-array.
-                 *
-                 * This might causes problems in free.  We should check.
-                 */
-                size_t conv_len = strlen(converted);
-                adata = (char*)malloc(conv_len + 1);
-
-                memcpy(adata, converted, conv_len + 1);
-                len = (size_t)conv_len;
-                g_free(converted);
-            }
+            /*
+             * If that succeeded then update our byte-array.
+             *
+             * This might causes problems in free.  We should check.
+             */
+            size_t conv_len = strlen(converted);
+            adata = (char*)malloc(conv_len + 1);
 
+            memcpy(adata, converted, conv_len + 1);
+            len = (size_t)conv_len;
+            g_free(converted);
         }
     }
 
@@ -875,38 +1297,9 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
         ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, "", adata, len));
     }
 
-    /* If this is a multipart part, then add its children. */
-    if (GMIME_IS_MULTIPART(part))
-    {
-        /*
-         * Count the children.
-         */
-        int n = g_mime_multipart_get_count((GMimeMultipart *) part);
-
-        /*
-         * For each child .. add the part.
-         */
-        for (int i = 0; i < n; i++)
-        {
-            GMimeObject *subpart = g_mime_multipart_get_part((GMimeMultipart *) part, i);
-
-            /*
-             * Create the child - set the parent.
-             */
-            std::shared_ptr<CMessagePart> child = part2obj(subpart);
-            child->set_parent(ret);
-
-            /*
-             * Now add the child to the parent.
-             */
-            ret->add_child(child);
-        }
-    }
-
     /*
-     * Unref the memory & type.
+     * Unref the memory.
      */
-    free(type);
     g_object_unref(mem);
 
     return ret;
@@ -929,6 +1322,49 @@ std::vector<std::shared_ptr<CMessagePart> >CMessage::get_parts()
 }
 
 
+/*
+ * Does this message have an attachment?
+ */
+bool CMessage::has_attachments()
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The hints are only known once our headers are.
+     */
+    if (!(table->state(m_row) & CMessageTable::STATE_HEADERS))
+        populate_headers();
+
+    uint32_t hints = table->hints(m_row);
+
+    if (hints & CMessageTable::HINT_UNCOUNTED)
+    {
+        std::vector<std::shared_ptr<CMessagePart>> parts = get_parts();
+        bool found = false;
+
+        while ((! parts.empty()) && (! found))
+        {
+            std::shared_ptr<CMessagePart> part = parts.back();
+            parts.pop_back();
+
+            found = part->is_attachment();
+
+            std::vector<std::shared_ptr<CMessagePart>> children = part->children();
+            parts.insert(parts.end(), children.begin(), children.end());
+        }
+
+        hints &= ~CMessageTable::HINT_UNCOUNTED;
+
+        if (found)
+            hints |= CMessageTable::HINT_ATTACHMENT;
+
+        table->set_hints(m_row, hints);
+    }
+
+    return (hints & CMessageTable::HINT_ATTACHMENT);
+}
+
+
 
 /*
  * Remove this message.
@@ -975,6 +1411,15 @@ bool CMessage::unlink()
         return true;
     }
 
+    /*
+     * If our maildir removes the file it updates its list of messages
+     * in place, otherwise we must rescan.
+     */
+    std::shared_ptr<CMaildir> folder = owner();
+
+    if (folder)
+        return (folder->remove_file(path()));
+
     bool ret = CFile::delete_file(path());
 
     CGlobalState *global = CGlobalState::instance();
@@ -1018,10 +1463,10 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
     if (attachments.size() < 1)
         return;
 
-    if ((fd = open(m_path.c_str(), O_RDONLY, 0)) == -1)
+    if ((fd = open(path().c_str(), O_RDONLY, 0)) == -1)
     {
         CLua *lua = CLua::instance();
-        lua->on_error("Failed to open the message:" + m_path);
+        lua->on_error("Failed to open the message:" + path());
         return;
     }
 
@@ -1163,9 +1608,14 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
      * Now rename the temporary file over the top of the input
      * message.
      */
-    CFile::copy(tmp_file, m_path);
+    CFile::copy(tmp_file, path());
     CFile::delete_file(tmp_file);
 
+    /*
+     * The message has a new size, and modification-time.
+     */
+    CMessageTable::instance()->forget_stat(m_row);
+
     if (m_parts.size() > 0)
         m_parts.clear();
 
@@ -1174,6 +1624,51 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
 }
 
 
+/*
+ * Find the maildir which contains this local message.
+ */
+std::shared_ptr<CMaildir> CMessage::owner()
+{
+    CMessageTable *table = CMessageTable::instance();
+    std::string dir = table->directory_path(table->directory(m_row));
+
+    size_t slash = dir.rfind('/');
+
+    if (slash == std::string::npos)
+        return (NULL);
+
+    std::string leaf = dir.substr(slash + 1);
+
+    if ((leaf != "cur") && (leaf != "new"))
+        return (NULL);
+
+    return (CGlobalState::instance()->find_maildir(dir.substr(0, slash)));
+}
+
+
+/*
+ * Rename our file, via our maildir if possible, such that the change
+ * doesn't cause the maildir to be rescanned.
+ */
+bool CMessage::rename_file(std::string dst_path)
+{
+    std::string cur_path = path();
+    std::shared_ptr<CMaildir> folder = owner();
+
+    bool ret;
+
+    if (folder)
+        ret = folder->rename_file(cur_path, dst_path);
+    else
+        ret = (rename(cur_path.c_str(), dst_path.c_str()) == 0);
+
+    if (ret)
+        path(dst_path);
+
+    return (ret);
+}
+
+
 /**
  * Get the parent object.
  */
@@ -1193,22 +1688,23 @@ void CMessage::parent(std::shared_ptr<CMaildir> owner)
 
 /*
  * Retrieve the last modification time of our message.
+ *
+ * For a local message this is looked up once, and cached in the
+ * message-table.
  */
 int CMessage::get_mtime()
 {
-    if (m_imap == false)
-    {
-        std::string our_path = path();
-
-        struct stat sb;
+    return (CMessageTable::instance()->mtime(m_row));
+}
 
-        if (stat(our_path.c_str(), &sb) < 0)
-            return 1;
-        else
-            return sb.st_mtime;
-    }
 
-    return (m_time);
+/*
+ * Bump our fake modification-time, such that any cache is flushed.
+ */
+void CMessage::bump_mtime()
+{
+    CMessageTable *table = CMessageTable::instance();
+    table->set_mtime(m_row, table->mtime(m_row) + 1);
 }
 
 
@@ -1217,7 +1713,12 @@ int CMessage::get_mtime()
  */
 void CMessage::lazy_load()
 {
-    if (! CFile::exists(m_path))
+    /*
+     * NOTE: We can't call `path()` here, since that calls us.
+     */
+    std::string file = CMessageTable::instance()->path(m_row);
+
+    if (! CFile::exists(file))
     {
         /*
          * Fetch our body
@@ -1238,7 +1739,7 @@ void CMessage::lazy_load()
          * Write to disk.
          */
         std::fstream fs;
-        fs.open(m_path,  std::fstream::out | std::fstream::app);
+        fs.open(file,  std::fstream::out | std::fstream::app);
         fs << out;
         fs.close();
 
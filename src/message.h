@@ -20,12 +20,16 @@
 #pragma once
 
 
+#include <functional>
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <gmime/gmime.h>
 
+#include "header_arena.h"
+
 class CMaildir;
 
 /*
@@ -50,6 +54,12 @@ public:
      */
     CMessage(const std::string name, bool is_local = true);
 
+    /**
+     * Constructor - create a local message from an existing row of
+     * the message-table.
+     */
+    CMessage(uint32_t row);
+
     /**
      * Destructor.
      */
@@ -77,26 +87,89 @@ public:
      */
     void path(std::string new_path);
 
+    /**
+     * Get the row of the message-table which holds our details.
+     */
+    uint32_t row();
+
     /**
      * Get the value of the given header.
      */
     std::string header(std::string name);
 
+    /**
+     * Find the value of the header with the given lower-case name,
+     * without copying it - returning NULL if we don't have it.
+     *
+     * The value remains valid until our headers, or the message-table,
+     * are next changed.
+     */
+    const char *find_header(const std::string &name);
+
     /**
      * Get all headers, and their values.
      */
     std::unordered_map < std::string, std::string > headers();
 
+    /**
+     * Call the given function with the name and value of each of our
+     * headers, without copying them.
+     */
+    void each_header(std::function<void(const std::string &name, const char *value, size_t len)> fn);
+
     /**
      * Retrieve the current flags for this message.
      */
     std::string get_flags();
 
+    /**
+     * Retrieve the current flags for this message, as a bitmask - see
+     * `CMessageTable::flags_to_mask()`.
+     */
+    uint64_t flag_mask();
+
     /**
      * Set the flags for this message.
      */
     void set_flags(std::string new_flags);
 
+    /**
+     * Return the given path, with its flags replaced by the given
+     * ones - which will be sorted.
+     */
+    static std::string flags_path(std::string cur_path, std::string flags);
+
+    /**
+     * Parse the given block of headers, adding each to the arena with
+     * a lower-case name and a decoded, unfolded, value.
+     */
+    static void parse_headers(const std::string &block, CHeaderArena &headers);
+
+    /**
+     * Read the header-block of the message-file with the given path,
+     * returning false if the file cannot be opened.
+     *
+     * This touches no shared state, so it may be called from any thread.
+     */
+    static bool read_header_block(const std::string &path, std::string &block);
+
+    /**
+     * Append the decoded content of the `text/plain` parts of the given
+     * message-file which aren't attachments to `text`, up to `limit`
+     * bytes, returning false if the file cannot be parsed.
+     *
+     * Like `read_header_block()` this touches no shared state, so it may
+     * be called from any thread.
+     */
+    static bool read_text(const std::string &path, std::string &text, size_t limit);
+
+    /**
+     * Store the key headers of a message, from the complete set of its
+     * headers, in the given row of the message-table - along with its
+     * parsed date.  The headers stored are removed from the arena.
+     */
+    static void store_headers(uint32_t row, CHeaderArena &headers);
+
     /**
      * Set IMAP-flags - these are set at creation time.
      */
@@ -163,6 +236,15 @@ public:
      */
     std::vector<std::shared_ptr<CMessagePart>> get_parts();
 
+    /**
+     * Does this message have an attachment - a part, at any depth, with
+     * a filename?
+     *
+     * The hints of our row answer this without parsing the message,
+     * unless it is multipart - in which case its parts are counted once,
+     * and the hints updated.
+     */
+    bool has_attachments();
 
     /**
      * Add the named file as an attachment to this message.
@@ -200,38 +282,95 @@ private:
      */
     void lazy_load();
 
+    /**
+     * Bump our fake modification-time - used for IMAP messages.
+     */
+    void bump_mtime();
+
+    /**
+     * Find the maildir which contains this local message, such that it
+     * can record our changes to the file, or NULL if we don't know it.
+     */
+    std::shared_ptr<CMaildir> owner();
+
+    /**
+     * Rename our file, via our maildir if possible.
+     */
+    bool rename_file(std::string dst_path);
+
+    /**
+     * Create a stream to read the message-file with the given descriptor,
+     * which the stream will close.  The file is mapped where possible.
+     */
+    static GMimeStream * open_stream(int fd);
+
     /**
      * Parse a MIME message and return an object suitable for operating
      * upon.
+     *
+     * The content of each part is left in the file, rather than being
+     * copied into memory, and `lazy` is set if that file is our own -
+     * rather than a temporary one given by the `message_replace` hook.
      */
-    GMimeMessage * parse_message();
+    GMimeMessage * parse_message(bool &lazy);
 
     /**
      * Populate the headers and MIME-Parts caches.
      */
     void populate_message();
 
+    /**
+     * Populate the headers cache alone, reading no further than the
+     * end of the headers.
+     */
+    void populate_headers();
+
+    /**
+     * Populate the MIME-Parts cache from the given message, which is
+     * freed.  If `lazy` is set the content of each part is read from our
+     * file when it is needed.
+     */
+    void populate_parts(GMimeMessage *msg, bool lazy);
+
+    /**
+     * Move the key headers into the message-table.
+     */
+    void store_headers();
+
+
     /**
      * Convert a message-part from the MIME message to a CMessagePart object.
+     *
+     * If `lazy` is set the content of simple parts is read when needed.
+     */
+    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part, bool lazy);
+
+    /**
+     * Convert a message-part to a CMessagePart object, copying its content
+     * into memory.
      */
-    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part);
+    std::shared_ptr<CMessagePart> read_part(GMimeObject *part, const char *type,
+                                            const char *aname, std::string convert);
 
 private:
 
     /**
-     * The last modification time of our message.
+     * The row of the message-table which holds our path, flags,
+     * modification-time, and key headers.
      */
-    int m_time;
+    uint32_t m_row;
 
     /**
-     * The path on-disk to the message.
+     * Cached message-headers from this mail - other than those which
+     * are stored in the message-table.
      */
-    std::string m_path;
+    CHeaderArena m_headers;
 
     /**
-     * Cached message-headers from this mail.
+     * Have we read all of our headers?  The key headers might have been
+     * stored in the message-table from a summary-index, without the rest.
      */
-    std::unordered_map < std::string, std::string > m_headers;
+    bool m_headers_read;
 
     /**
      * Cached MIME-parts to this message.
@@ -243,11 +382,6 @@ private:
      */
     bool m_imap;
 
-    /**
-     * The flags retrieved from IMAP
-     */
-    std::string m_imap_flags;
-
     /**
      * The IMAP ID
      */
@@ -0,0 +1,363 @@
+/*
+ * message_filter.cc - Select messages matching a query.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <ctype.h>
+#include <pcrecpp.h>
+#include <thread>
+
+#include "approxidate.h"
+#include "message_filter.h"
+
+
+/*
+ * Lists shorter than this are filtered by a single thread.
+ */
+#define PARALLEL_FILTER_THRESHOLD 20000
+
+
+/*
+ * The most threads we'll filter with.
+ */
+#define MAX_FILTER_THREADS 8
+
+
+/*
+ * Split a query into its terms, at whitespace which isn't quoted.  The
+ * quotes themselves are removed.
+ */
+static std::vector<std::string> split_query(const std::string &query)
+{
+    std::vector<std::string> terms;
+    std::string current;
+    bool quoted = false;
+    bool found  = false;
+
+    for (char c : query)
+    {
+        if (c == '"')
+        {
+            quoted = ! quoted;
+            found  = true;
+        }
+        else if (isspace((unsigned char)c) && (! quoted))
+        {
+            if (found)
+                terms.push_back(current);
+
+            current.clear();
+            found = false;
+        }
+        else
+        {
+            current += c;
+            found    = true;
+        }
+    }
+
+    if (found)
+        terms.push_back(current);
+
+    return (terms);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageFilter::CMessageFilter()
+{
+    m_need_headers = false;
+    m_need_time    = false;
+    m_need_parts   = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CMessageFilter::~CMessageFilter()
+{
+}
+
+
+/*
+ * Compile the given query.
+ */
+bool CMessageFilter::compile(const std::string &query)
+{
+    m_terms.clear();
+    m_need_headers = false;
+    m_need_time    = false;
+    m_need_parts   = false;
+
+    std::vector<std::string> terms = split_query(query);
+
+    if (terms.empty())
+        return false;
+
+    for (const std::string &text : terms)
+    {
+        CTerm term;
+
+        if (! compile_term(text, term))
+        {
+            m_terms.clear();
+            return false;
+        }
+
+        if ((term.type == TERM_ATTACHMENT) || (term.type == TERM_HEADER))
+            m_need_headers = true;
+
+        if ((term.type == TERM_AFTER) || (term.type == TERM_BEFORE))
+            m_need_time = true;
+
+        if (term.type == TERM_ATTACHMENT)
+            m_need_parts = true;
+
+        m_terms.push_back(term);
+    }
+
+    return true;
+}
+
+
+/*
+ * Compile a single term.
+ */
+bool CMessageFilter::compile_term(const std::string &text, CTerm &term)
+{
+    std::string word = text;
+
+    term.negate = false;
+    term.flags  = 0;
+    term.when   = 0;
+    term.header = CMessageTable::HEADER_FROM;
+
+    if ((! word.empty()) && (word[0] == '!'))
+    {
+        term.negate = true;
+        word = word.substr(1);
+    }
+
+    if (word == "all")
+    {
+        term.type = TERM_ALL;
+        return true;
+    }
+
+    if (word == "new")
+    {
+        term.type = TERM_NEW;
+        return true;
+    }
+
+    if (word == "attach")
+    {
+        term.type = TERM_ATTACHMENT;
+        return true;
+    }
+
+    if (word == "today")
+    {
+        term.type = TERM_AFTER;
+        term.when = time(NULL) - (60 * 60 * 24);
+        return true;
+    }
+
+    size_t colon = word.find(':');
+
+    if ((colon == std::string::npos) || (colon == word.size() - 1))
+        return false;
+
+    std::string name  = word.substr(0, colon);
+    std::string value = word.substr(colon + 1);
+
+    if (name == "flag")
+    {
+        term.type  = TERM_FLAGS;
+        term.flags = CMessageTable::flags_to_mask(value);
+        return (term.flags != 0);
+    }
+
+    if ((name == "after") || (name == "before"))
+    {
+        struct timeval tv;
+
+        if (approxidate(value.c_str(), &tv) != 0)
+            return false;
+
+        term.type = (name == "after") ? TERM_AFTER : TERM_BEFORE;
+        term.when = tv.tv_sec;
+        return true;
+    }
+
+    if (((name == "from") || (name == "to") || (name == "subject")) &&
+            CMessageTable::key_header(name, term.header))
+    {
+        pcrecpp::RE_Options opt;
+        opt.set_caseless(true);
+
+        term.type    = TERM_HEADER;
+        term.pattern = std::make_shared<pcrecpp::RE>(value, opt);
+
+        return (term.pattern->error().empty());
+    }
+
+    return false;
+}
+
+
+/*
+ * Return the indexes of the messages which match our query.
+ */
+std::vector<size_t> CMessageFilter::filter(CMessageList &messages)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The table isn't thread-safe, so anything our terms need from it
+     * is stored before we start - after which it is only read.
+     */
+    std::vector<uint32_t> rows(messages.size());
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        std::shared_ptr<CMessage> msg = messages[i];
+        uint32_t row = msg->row();
+        time_t when;
+
+        if (!(table->state(row) & CMessageTable::STATE_HEADERS))
+        {
+            if ((m_need_headers) ||
+                    ((m_need_time) && (! CMessageTable::name_time(table->name(row), when))))
+                msg->find_header("date");
+        }
+
+        /*
+         * A multipart message must be parsed to find its attachments.
+         */
+        if ((m_need_parts) && (table->hints(row) & CMessageTable::HINT_UNCOUNTED))
+            msg->has_attachments();
+
+        rows[i] = row;
+    }
+
+    /*
+     * Each thread filters a contiguous chunk, and the chunks are joined
+     * in order.
+     */
+    size_t threads = std::thread::hardware_concurrency();
+
+    if (threads > MAX_FILTER_THREADS)
+        threads = MAX_FILTER_THREADS;
+
+    if ((rows.size() < PARALLEL_FILTER_THRESHOLD) || (threads < 2))
+        threads = 1;
+
+    std::vector<std::vector<size_t>> found(threads);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; t++)
+    {
+        size_t start = rows.size() * t / threads;
+        size_t end   = rows.size() * (t + 1) / threads;
+
+        auto work = [this, &rows, &found, t, start, end]()
+        {
+            for (size_t i = start; i < end; i++)
+            {
+                if (matches(rows[i]))
+                    found[t].push_back(i);
+            }
+        };
+
+        if (threads == 1)
+            work();
+        else
+            workers.push_back(std::thread(work));
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    std::vector<size_t> out;
+
+    for (std::vector<size_t> &chunk : found)
+        out.insert(out.end(), chunk.begin(), chunk.end());
+
+    return (out);
+}
+
+
+/*
+ * Does the message in the given row match all of our terms?
+ */
+bool CMessageFilter::matches(uint32_t row) const
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    static const uint64_t new_bit  = CMessageTable::flag_bit('N');
+    static const uint64_t seen_bit = CMessageTable::flag_bit('S');
+
+    for (const CTerm &term : m_terms)
+    {
+        bool ret = true;
+
+        switch (term.type)
+        {
+        case TERM_ALL:
+            break;
+
+        case TERM_NEW:
+        {
+            uint64_t flags = table->flags(row);
+            ret = (flags & new_bit) || !(flags & seen_bit);
+            break;
+        }
+
+        case TERM_FLAGS:
+            ret = ((table->flags(row) & term.flags) == term.flags);
+            break;
+
+        case TERM_ATTACHMENT:
+            ret = (table->hints(row) & CMessageTable::HINT_ATTACHMENT);
+            break;
+
+        case TERM_AFTER:
+            ret = (table->delivered(row) > term.when);
+            break;
+
+        case TERM_BEFORE:
+            ret = (table->delivered(row) < term.when);
+            break;
+
+        case TERM_HEADER:
+        {
+            const char *value = table->header_data(row, term.header);
+            ret = term.pattern->PartialMatch(value ? value : "");
+            break;
+        }
+        }
+
+        if (ret == term.negate)
+            return false;
+    }
+
+    return true;
+}
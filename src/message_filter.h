@@ -0,0 +1,154 @@
+/*
+ * message_filter.h - Select messages matching a query.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "message.h"
+#include "message_table.h"
+
+
+namespace pcrecpp
+{
+class RE;
+}
+
+
+/**
+ * The CMessageFilter class selects those messages which match a query,
+ * as used by `index.limit`.
+ *
+ * A query is a list of terms separated by whitespace, all of which must
+ * match.  Any term may be negated by prefixing it with `!`:
+ *
+ *  `all`           - Every message.
+ *  `new`           - Unread messages.
+ *  `today`         - Messages delivered within the past day.
+ *  `attach`        - Messages which have an attachment.
+ *  `flag:FLAGS`    - Messages which have all of the given flags.
+ *  `after:DATE`    - Messages delivered after the given date.
+ *  `before:DATE`   - Messages delivered before the given date.
+ *  `from:REGEXP`   - Messages whose header matches the regular expression,
+ *  `to:REGEXP`       which is case-insensitive.  The expression may be
+ *  `subject:REGEXP`  surrounded by double-quotes to include spaces.
+ *
+ * Dates are understood by `approxidate()`, so may be `2016-04-01` or
+ * `2.weeks.ago` for example.
+ *
+ * The query is compiled once, and then evaluated against the columns of
+ * the message-table - by several threads at once, for large lists.
+ *
+ */
+class CMessageFilter
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageFilter();
+
+    /**
+     * Destructor.
+     */
+    ~CMessageFilter();
+
+    /**
+     * Compile the given query, returning false if it isn't one we
+     * understand - in which case the caller should filter the messages
+     * itself.
+     */
+    bool compile(const std::string &query);
+
+    /**
+     * Return the indexes of the messages which match our query, in the
+     * order they were given.
+     */
+    std::vector<size_t> filter(CMessageList &messages);
+
+private:
+
+    /**
+     * The types of term we understand.
+     */
+    enum CTermType
+    {
+        TERM_ALL,
+        TERM_NEW,
+        TERM_FLAGS,
+        TERM_ATTACHMENT,
+        TERM_AFTER,
+        TERM_BEFORE,
+        TERM_HEADER
+    };
+
+    /**
+     * A compiled term of a query.
+     */
+    struct CTerm
+    {
+        CTermType type;
+        bool negate;
+
+        /**
+         * The flags, time, or header the term refers to.
+         */
+        uint64_t flags;
+        time_t when;
+        CMessageTable::CKeyHeader header;
+
+        /**
+         * The regular expression a header must match.
+         */
+        std::shared_ptr<pcrecpp::RE> pattern;
+    };
+
+private:
+
+    /**
+     * Compile a single term, returning false if it isn't valid.
+     */
+    bool compile_term(const std::string &text, CTerm &term);
+
+    /**
+     * Does the message in the given row match all of our terms?
+     */
+    bool matches(uint32_t row) const;
+
+private:
+
+    /**
+     * Our terms.
+     */
+    std::vector<CTerm> m_terms;
+
+    /**
+     * Do our terms need the key headers, delivery-time, or parts of
+     * each message?
+     */
+    bool m_need_headers;
+    bool m_need_time;
+    bool m_need_parts;
+};
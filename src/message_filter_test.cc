@@ -0,0 +1,141 @@
+/*
+ * message_filter_test.cc - Test-cases for our message-filtering.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <vector>
+
+#include "message_filter.h"
+#include "message_table.h"
+#include "test_messages.h"
+#include "CuTest.h"
+
+
+/**
+ * Return the indexes of the given messages which match the query.
+ */
+static std::string run_filter(CMessageList &messages, const char *query)
+{
+    CMessageFilter filter;
+
+    if (! filter.compile(query))
+        return "invalid";
+
+    std::string out;
+
+    for (size_t i : filter.filter(messages))
+        out += std::to_string(i);
+
+    return (out);
+}
+
+
+/**
+ * Test that queries are understood, or rejected.
+ */
+void TestMessageFilterCompile(CuTest * tc)
+{
+    CMessageFilter filter;
+
+    CuAssertTrue(tc, filter.compile("all"));
+    CuAssertTrue(tc, filter.compile(" new  !attach "));
+    CuAssertTrue(tc, filter.compile("flag:FS"));
+    CuAssertTrue(tc, filter.compile("after:2016-01-01 before:2017-01-01"));
+    CuAssertTrue(tc, filter.compile("subject:\"hello world\""));
+
+    CuAssertTrue(tc, ! filter.compile(""));
+    CuAssertTrue(tc, ! filter.compile("steve"));
+    CuAssertTrue(tc, ! filter.compile("new steve"));
+    CuAssertTrue(tc, ! filter.compile("Re:"));
+    CuAssertTrue(tc, ! filter.compile("cc:steve"));
+    CuAssertTrue(tc, ! filter.compile("flag:123"));
+}
+
+
+/**
+ * Test that messages are selected by each kind of term.
+ */
+void TestMessageFilterFilter(CuTest * tc)
+{
+    CMessageList messages;
+    messages.push_back(test_message("1451606400.a:2,S", "Steve Kemp", "Hello world", 0, 0));
+    messages.push_back(test_message("1467331200.b:2,FS", "Bob", "Re: Hello", 0, CMessageTable::HINT_ATTACHMENT));
+    messages.push_back(test_message("filter.c", "Alice", "Lunch", 1483228800, 0));
+
+    CuAssertStrEquals(tc, "012", run_filter(messages, "all").c_str());
+    CuAssertStrEquals(tc, "2", run_filter(messages, "new").c_str());
+    CuAssertStrEquals(tc, "01", run_filter(messages, "!new").c_str());
+    CuAssertStrEquals(tc, "1", run_filter(messages, "attach").c_str());
+    CuAssertStrEquals(tc, "1", run_filter(messages, "flag:F").c_str());
+    CuAssertStrEquals(tc, "01", run_filter(messages, "flag:S").c_str());
+
+    /*
+     * The delivery-time comes from the filename, or the Date: header.
+     */
+    CuAssertStrEquals(tc, "12", run_filter(messages, "after:2016-04-01").c_str());
+    CuAssertStrEquals(tc, "1", run_filter(messages, "after:2016-04-01 before:2016-10-01").c_str());
+
+    /*
+     * Headers are matched by case-insensitive regular expressions.
+     */
+    CuAssertStrEquals(tc, "0", run_filter(messages, "from:kemp").c_str());
+    CuAssertStrEquals(tc, "01", run_filter(messages, "subject:\"^(re: )?hello\"").c_str());
+    CuAssertStrEquals(tc, "0", run_filter(messages, "subject:\"hello world\"").c_str());
+    CuAssertStrEquals(tc, "1", run_filter(messages, "subject:hello !from:steve").c_str());
+    CuAssertStrEquals(tc, "", run_filter(messages, "to:anybody").c_str());
+}
+
+
+/**
+ * Test that a list large enough to be filtered in parallel keeps its
+ * order.
+ */
+void TestMessageFilterLarge(CuTest * tc)
+{
+    CMessageList messages = test_message_list(50000,
+                                              [](size_t i) { return std::string((i % 3) ? ":2,S" : ":2,"); },
+                                              [](size_t) { return 0; });
+
+    CMessageFilter filter;
+    CuAssertTrue(tc, filter.compile("new"));
+
+    std::vector<size_t> found = filter.filter(messages);
+    CuAssertIntEquals(tc, 16667, found.size());
+
+    bool ordered = true;
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        if (found[i] != i * 3)
+            ordered = false;
+    }
+
+    CuAssertTrue(tc, ordered);
+}
+
+
+
+CuSuite *
+message_filter_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageFilterCompile);
+    SUITE_ADD_TEST(suite, TestMessageFilterFilter);
+    SUITE_ADD_TEST(suite, TestMessageFilterLarge);
+    return suite;
+}
@@ -192,10 +192,22 @@ int l_CMessage_header(lua_State * l)
     /* Get the header. */
     const char *str = luaL_checkstring(l, 2);
     CLuaLog("l_CMessage_header(" + std::string(str) + ")");
-    std::string result = foo->header(str);
+    std::string name(str);
+    std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+    /*
+     * Push the value straight from where it is stored.
+     */
+    size_t len = 0;
+    const char *result = foo->find_header(name);
+
+    if (result != NULL)
+        len = strlen(result);
+    else
+        result = "";
 
     /* set the retulr */
-    lua_pushstring(l, result.c_str());
+    lua_pushlstring(l, result, len);
     return 1;
 
 }
@@ -211,28 +223,20 @@ int l_CMessage_headers(lua_State * l)
      * Get the headers.
      */
     std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
-    std::unordered_map < std::string, std::string > headers = foo->headers();
 
 
     /*
-     * Create the table.
+     * Create the table, and fill it straight from where the headers
+     * are stored.
      */
     lua_newtable(l);
 
-    for (auto it = headers.begin(); it != headers.end(); ++it)
+    foo->each_header([l](const std::string & name, const char *value, size_t len)
     {
-        std::string name = it->first;
-        std::string value = it->second;
-
-        lua_pushstring(l, name.c_str());
-
-        if (!value.empty())
-            lua_pushstring(l, value.c_str());
-        else
-            lua_pushstring(l, "");
-
+        lua_pushlstring(l, name.data(), name.size());
+        lua_pushlstring(l, value, len);
         lua_settable(l, -3);
-    }
+    });
 
     return (1);
 }
@@ -410,6 +414,52 @@ int l_CMessage_flags(lua_State * l)
     return 1;
 }
 
+/**
+ * Get the flags of a message, as a bitmask.
+ *
+ * Each of the flags `A-Z` is represented by the bits 0-25, and `a-z`
+ * by the bits 26-51.
+ */
+int l_CMessage_flag_mask(lua_State * l)
+{
+    CLuaLog("l_CMessage_flag_mask");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushinteger(l, foo->flag_mask());
+    return 1;
+}
+
+
+/**
+ * Does the message possess the given flag?
+ */
+int l_CMessage_has_flag(lua_State * l)
+{
+    CLuaLog("l_CMessage_has_flag");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+    const char *flag = luaL_checkstring(l, 2);
+
+    lua_pushboolean(l, foo->has_flag(flag[0]));
+    return 1;
+}
+
+
+/**
+ * Is the message new?
+ */
+int l_CMessage_is_new(lua_State * l)
+{
+    CLuaLog("l_CMessage_is_new");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushboolean(l, foo->is_new());
+    return 1;
+}
+
+
 /**
  * Destructor.
  */
@@ -492,10 +542,13 @@ void InitMessage(lua_State * l)
         {"__gc", l_CMessage_destructor},
         {"add_attachments", l_CMessage_add_attachments},
         {"ctime", l_CMessage_ctime},
+        {"flag_mask", l_CMessage_flag_mask},
         {"flags", l_CMessage_flags},
         {"generate_message_id", l_CMessage_generate_message_id},
         {"header", l_CMessage_header},
+        {"has_flag", l_CMessage_has_flag},
         {"headers", l_CMessage_headers},
+        {"is_new", l_CMessage_is_new},
         {"mark_read", l_CMessage_mark_read},
         {"mark_unread", l_CMessage_mark_unread},
         {"mtime", l_CMessage_mtime},
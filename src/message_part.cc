@@ -18,11 +18,16 @@
 
 
 #include <algorithm>
+#include <fcntl.h>
+#include <gmime/gmime.h>
 #include <string>
+#include <string.h>
 #include <vector>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "message_part.h"
+#include "message_table.h"
 
 
 
@@ -37,6 +42,11 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
     m_filename       = filename;
     m_content        = NULL;
     m_content_length = 0;
+    m_loaded         = true;
+    m_row            = 0;
+    m_start          = 0;
+    m_end            = 0;
+    m_encoding       = GMIME_CONTENT_ENCODING_DEFAULT;
 
     if ((content_length > 0) && (content != NULL))
     {
@@ -52,11 +62,38 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
 
 }
 
+
+/*
+ * Constructor, for content we'll read when it is needed.
+ */
+CMessagePart::CMessagePart(std::string type, std::string filename, uint32_t row,
+                           off_t start, off_t end, int encoding, std::string charset)
+{
+    m_parent         = nullptr;
+    m_type           = type;
+    m_filename       = filename;
+    m_content        = NULL;
+    m_content_length = 0;
+    m_loaded         = false;
+    m_row            = row;
+    m_start          = start;
+    m_end            = end;
+    m_encoding       = encoding;
+    m_charset        = charset;
+
+    CMessageTable::instance()->acquire(m_row);
+
+    std::transform(m_type.begin(), m_type.end(), m_type.begin(), ::tolower);
+}
+
 /*
  * Destructor.
  */
 CMessagePart::~CMessagePart()
 {
+    if (! m_loaded)
+        CMessageTable::instance()->release(m_row);
+
     if (m_content != NULL)
     {
         free(m_content);
@@ -100,6 +137,8 @@ bool CMessagePart::is_attachment()
  */
 void * CMessagePart::content()
 {
+    load();
+
     return (m_content);
 }
 
@@ -108,7 +147,149 @@ void * CMessagePart::content()
  */
 size_t CMessagePart::content_size()
 {
-    return (m_content_length);
+    if (m_loaded || (! m_charset.empty()))
+    {
+        load();
+        return (m_content_length);
+    }
+
+    /*
+     * Content which isn't encoded is the size of its range, and the
+     * size of base64 can be counted without decoding it.
+     */
+    switch (m_encoding)
+    {
+    case GMIME_CONTENT_ENCODING_BASE64:
+        return (base64_size());
+
+    case GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE:
+    case GMIME_CONTENT_ENCODING_UUENCODE:
+        load();
+        return (m_content_length);
+
+    default:
+        return (m_end - m_start);
+    }
+}
+
+
+/*
+ * Read and decode our content.
+ */
+void CMessagePart::load()
+{
+    if (m_loaded)
+        return;
+
+    m_loaded = true;
+
+    CMessageTable *table = CMessageTable::instance();
+    std::string path = table->path(m_row);
+    table->release(m_row);
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return;
+
+    /*
+     * The stream owns the descriptor, and will close it.
+     */
+    lseek(fd, m_start, SEEK_SET);
+    GMimeStream *file = g_mime_stream_fs_new_with_bounds(fd, m_start, m_end);
+
+    GMimeStream *mem = g_mime_stream_mem_new();
+    GMimeStream *filtered = g_mime_stream_filter_new(mem);
+
+    if ((m_encoding == GMIME_CONTENT_ENCODING_BASE64) ||
+            (m_encoding == GMIME_CONTENT_ENCODING_QUOTEDPRINTABLE) ||
+            (m_encoding == GMIME_CONTENT_ENCODING_UUENCODE))
+    {
+        GMimeFilter *decoder = g_mime_filter_basic_new((GMimeContentEncoding)m_encoding, FALSE);
+        g_mime_stream_filter_add(GMIME_STREAM_FILTER(filtered), decoder);
+        g_object_unref(decoder);
+    }
+
+    g_mime_stream_write_to_stream(file, filtered);
+    g_mime_stream_flush(filtered);
+
+    /*
+     * Take the data from the memory-stream, rather than copying it.
+     */
+    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+    GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+
+    m_content_length = res->len;
+    m_content = g_byte_array_free(res, FALSE);
+
+    g_object_unref(filtered);
+    g_object_unref(mem);
+    g_object_unref(file);
+
+    if (! m_charset.empty())
+    {
+        iconv_t cv = g_mime_iconv_open("UTF-8", m_charset.c_str());
+        char *converted = g_mime_iconv_strndup(cv, (const char *) m_content, m_content_length);
+        g_mime_iconv_close(cv);
+
+        if (converted != NULL)
+        {
+            free(m_content);
+
+            m_content_length = strlen(converted);
+            m_content = converted;
+        }
+    }
+
+    if (m_content_length == 0)
+    {
+        free(m_content);
+        m_content = NULL;
+    }
+}
+
+
+/*
+ * Count the size of our content, once base64 has been decoded.
+ */
+size_t CMessagePart::base64_size()
+{
+    CMessageTable *table = CMessageTable::instance();
+    int fd = open(table->path(m_row).c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return 0;
+
+    /*
+     * Every four characters of the alphabet give three bytes - and the
+     * padding, and any whitespace, give nothing.
+     */
+    size_t count = 0;
+    off_t offset = m_start;
+    char buf[65536];
+
+    while (offset < m_end)
+    {
+        size_t want = std::min((off_t)sizeof(buf), m_end - offset);
+        ssize_t n = pread(fd, buf, want, offset);
+
+        if (n <= 0)
+            break;
+
+        for (ssize_t i = 0; i < n; i++)
+        {
+            char c = buf[i];
+
+            if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) ||
+                    ((c >= '0') && (c <= '9')) || (c == '+') || (c == '/'))
+                count += 1;
+        }
+
+        offset += n;
+    }
+
+    close(fd);
+    return ((count * 3) / 4);
 }
 
 
@@ -20,12 +20,20 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 
 /**
  * This is the C++ object which represents a MIME-part from a message.
+ *
+ * The content of a part is either given to us when we're constructed,
+ * or we're told where it lives in the message-file and how it is
+ * encoded - in which case it is only read, and decoded, the first time
+ * it is requested.  This means that building the parts of a message is
+ * cheap even if it carries large attachments which are never viewed.
  */
 class CMessagePart
 {
@@ -33,10 +41,20 @@ class CMessagePart
 public:
 
     /**
-     * Constructor.
+     * Constructor, for a part whose content we already have.
      */
     CMessagePart(std::string type, std::string filename, void *content, size_t content_length);
 
+    /**
+     * Constructor, for a part whose content is the given range of the
+     * message-file described by the given row of the message-table.
+     *
+     * The encoding is a `GMimeContentEncoding`.  If a charset is given
+     * the decoded content will be converted from it to UTF-8.
+     */
+    CMessagePart(std::string type, std::string filename, uint32_t row,
+                 off_t start, off_t end, int encoding, std::string charset);
+
     /**
      * Destructor
      */
@@ -58,12 +76,15 @@ public:
     bool is_attachment();
 
     /**
-     * Get the content.
+     * Get the content, reading it if we've not done so.
      */
     void *content();
 
     /**
      * Get the length of the content.
+     *
+     * Where that can be determined without decoding the content, it is
+     * not read.
      */
     size_t content_size();
 
@@ -88,6 +109,19 @@ public:
     std::shared_ptr<CMessagePart> get_parent();
 
 
+private:
+
+    /**
+     * Read and decode our content, if we've not done so.
+     */
+    void load();
+
+    /**
+     * Count the bytes our base64-encoded content will decode to, without
+     * decoding it.
+     */
+    size_t base64_size();
+
 private:
 
     /**
@@ -111,6 +145,34 @@ private:
      */
     size_t m_content_length;
 
+    /**
+     * Have we got our content?
+     */
+    bool m_loaded;
+
+    /**
+     * The row of the message-table which gives the path of our message,
+     * which we hold a reference to until we're loaded.  We don't store
+     * the path itself since the message might be renamed in the meantime.
+     */
+    uint32_t m_row;
+
+    /**
+     * The range of the message-file which holds our encoded content.
+     */
+    off_t m_start;
+    off_t m_end;
+
+    /**
+     * The transfer-encoding of our content.
+     */
+    int m_encoding;
+
+    /**
+     * The charset to convert our content from, if any.
+     */
+    std::string m_charset;
+
     /**
      * Children of this part.
      */
@@ -0,0 +1,106 @@
+/*
+ * message_part_test.cc - Test-cases for our MIME-part class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <gmime/gmime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "file.h"
+#include "message_part.h"
+#include "message_table.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that the content of a part is only read when it is needed, and
+ * from wherever the message has been moved to.
+ */
+void TestMessagePartLazyContent(CuTest * tc)
+{
+    char tmpl[] = "/tmp/part.XXXXXX";
+    int fd = mkstemp(tmpl);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    std::string path(tmpl);
+    std::string head = "Content-Type: text/plain\nContent-Transfer-Encoding: base64\n\n";
+    std::string body = "SGVsbG8s\nIFdvcmxkIQ==\n";
+    std::string tail = "--boundary--\n";
+
+    std::ofstream out(path);
+    out << head << body << tail;
+    out.close();
+
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t row = table->insert(path);
+
+    off_t start = head.size();
+    off_t end   = head.size() + body.size();
+
+    CMessagePart *part = new CMessagePart("TEXT/PLAIN", "", row, start, end,
+                                          GMIME_CONTENT_ENCODING_BASE64, "");
+    CuAssertStrEquals(tc, "text/plain", part->type().c_str());
+    CuAssertTrue(tc, ! part->is_attachment());
+
+    /*
+     * The size is counted, rather than decoded.
+     */
+    CuAssertIntEquals(tc, 13, part->content_size());
+
+    /*
+     * Move the message before its content is read.
+     */
+    std::string moved = path + ".moved";
+    CuAssertTrue(tc, CFile::move(path, moved));
+    table->set_path(row, moved);
+
+    CuAssertIntEquals(tc, 13, part->content_size());
+    CuAssertTrue(tc, memcmp(part->content(), "Hello, World!", 13) == 0);
+    CuAssertIntEquals(tc, 13, part->content_size());
+
+    delete(part);
+
+    /*
+     * Content which isn't encoded is read as-is.
+     */
+    part = new CMessagePart("text/plain", "body.txt", row, start, end,
+                            GMIME_CONTENT_ENCODING_7BIT, "");
+    CuAssertTrue(tc, part->is_attachment());
+    CuAssertIntEquals(tc, (int)body.size(), part->content_size());
+    CuAssertTrue(tc, memcmp(part->content(), body.c_str(), body.size()) == 0);
+
+    delete(part);
+
+    table->release(row);
+    CFile::delete_file(moved);
+}
+
+
+
+CuSuite *
+message_part_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessagePartLazyContent);
+    return suite;
+}
@@ -0,0 +1,264 @@
+/*
+ * message_sorter.cc - Sort messages by precomputed keys.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <thread>
+
+#include "message_sorter.h"
+#include "message_table.h"
+
+
+/*
+ * Lists shorter than this are sorted by a single thread.
+ */
+#define PARALLEL_SORT_THRESHOLD 20000
+
+
+/*
+ * The most threads we'll sort with.
+ */
+#define MAX_SORT_THREADS 8
+
+
+/*
+ * Sort the given indexes, stably.
+ *
+ * Large lists are split into a run for each thread, which are sorted in
+ * parallel and then merged - neighbours at a time, and also in parallel -
+ * until one run is left.
+ */
+template <typename Less>
+static void parallel_sort(std::vector<size_t> &order, Less less)
+{
+    size_t threads = std::thread::hardware_concurrency();
+
+    if (threads > MAX_SORT_THREADS)
+        threads = MAX_SORT_THREADS;
+
+    if ((order.size() < PARALLEL_SORT_THRESHOLD) || (threads < 2))
+    {
+        std::stable_sort(order.begin(), order.end(), less);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+
+    for (size_t i = 0; i <= threads; i++)
+        bounds.push_back(order.size() * i / threads);
+
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers.push_back(std::thread([&, i]()
+        {
+            std::stable_sort(order.begin() + bounds[i], order.begin() + bounds[i + 1], less);
+        }));
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    for (size_t width = 1; width < threads; width *= 2)
+    {
+        workers.clear();
+
+        for (size_t i = 0; i + width < threads; i += 2 * width)
+        {
+            size_t end = std::min(i + 2 * width, threads);
+
+            workers.push_back(std::thread([&, i, width, end]()
+            {
+                std::inplace_merge(order.begin() + bounds[i],
+                                   order.begin() + bounds[i + width],
+                                   order.begin() + bounds[end], less);
+            }));
+        }
+
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+}
+
+
+/*
+ * Lower-case the given header-value, for comparison.
+ */
+static void fold(const char *value, std::string &text)
+{
+    text.clear();
+
+    if (value == NULL)
+        return;
+
+    for (; *value; value++)
+        text += (char)tolower((unsigned char)*value);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageSorter::CMessageSorter(CMessageList &messages, CSortMethod primary)
+{
+    m_primary       = primary;
+    m_secondary     = primary;
+    m_has_secondary = false;
+
+    compute(messages, m_primary, m_primary_keys);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageSorter::CMessageSorter(CMessageList &messages, CSortMethod primary, CSortMethod secondary)
+{
+    m_primary       = primary;
+    m_secondary     = secondary;
+    m_has_secondary = true;
+
+    compute(messages, m_primary, m_primary_keys);
+    compute(messages, m_secondary, m_secondary_keys);
+}
+
+
+/*
+ * Should the first message be sorted before the second?
+ */
+bool CMessageSorter::less(size_t a, size_t b) const
+{
+    int ret = compare(m_primary_keys, m_primary, a, b);
+
+    if ((ret == 0) && (m_has_secondary))
+        ret = compare(m_secondary_keys, m_secondary, a, b);
+
+    return (ret < 0);
+}
+
+
+/*
+ * Return the indexes of our messages, in sorted order.
+ */
+std::vector<size_t> CMessageSorter::sort() const
+{
+    std::vector<size_t> order(m_primary_keys.size());
+
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    parallel_sort(order, [this](size_t a, size_t b)
+    {
+        return (less(a, b));
+    });
+
+    return (order);
+}
+
+
+/*
+ * Lookup a sort-method by its name.
+ */
+bool CMessageSorter::method(const std::string &name, CSortMethod &method)
+{
+    if (name == "date")
+        method = SORT_DATE;
+    else if (name == "file")
+        method = SORT_FILE;
+    else if (name == "from")
+        method = SORT_FROM;
+    else if (name == "size")
+        method = SORT_SIZE;
+    else if (name == "subject")
+        method = SORT_SUBJECT;
+    else
+        return false;
+
+    return true;
+}
+
+
+/*
+ * Compute the keys of the given messages, for the given method.
+ *
+ * Finding a header stores the key headers of a message, if they haven't
+ * been already.
+ */
+void CMessageSorter::compute(CMessageList &messages, CSortMethod method, std::vector<CSortKey> &keys)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    keys.resize(messages.size());
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        std::shared_ptr<CMessage> msg = messages[i];
+        uint32_t row = msg->row();
+
+        time_t when;
+
+        CSortKey &key = keys[i];
+        key.number = 0;
+
+        switch (method)
+        {
+        case SORT_DATE:
+            if (! CMessageTable::name_time(table->name(row), when))
+                msg->find_header("date");
+
+            key.number = table->delivered(row);
+            break;
+
+        case SORT_FILE:
+            key.number = table->mtime(row);
+            break;
+
+        case SORT_FROM:
+            fold(msg->find_header("from"), key.text);
+            break;
+
+        case SORT_SIZE:
+            key.number = table->size(row);
+            break;
+
+        case SORT_SUBJECT:
+            fold(msg->find_header("subject"), key.text);
+            break;
+        }
+    }
+}
+
+
+/*
+ * Compare the keys of two messages.
+ */
+int CMessageSorter::compare(const std::vector<CSortKey> &keys, CSortMethod method, size_t a, size_t b)
+{
+    if ((method == SORT_FROM) || (method == SORT_SUBJECT))
+        return (keys[a].text.compare(keys[b].text));
+
+    if (keys[a].number < keys[b].number)
+        return -1;
+
+    if (keys[a].number > keys[b].number)
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * message_sorter.h - Sort messages by precomputed keys.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "message.h"
+
+
+/**
+ * The CMessageSorter class sorts a list of messages by one of the built-in
+ * sort-methods, and optionally by a second method to break ties.
+ *
+ * The key of each message is computed once, when the sorter is created,
+ * rather than upon every comparison - so comparing two messages never
+ * touches their headers or files.  Large lists are sorted by several
+ * threads at once.
+ *
+ * The sort is stable, so messages which compare equal keep the order
+ * they were given in.
+ *
+ */
+class CMessageSorter
+{
+public:
+
+    /**
+     * The methods we can sort by.
+     */
+    enum CSortMethod
+    {
+        /**
+         * The date the message was delivered, from its filename - or its
+         * `Date:` header if the filename doesn't contain it.
+         */
+        SORT_DATE,
+
+        /**
+         * The modification-time of the message-file.
+         */
+        SORT_FILE,
+
+        /**
+         * The `From:` header, ignoring case.
+         */
+        SORT_FROM,
+
+        /**
+         * The size of the message-file.
+         */
+        SORT_SIZE,
+
+        /**
+         * The `Subject:` header, ignoring case.
+         */
+        SORT_SUBJECT
+    };
+
+public:
+
+    /**
+     * Constructor.  Compute the keys of the given messages.
+     */
+    CMessageSorter(CMessageList &messages, CSortMethod primary);
+    CMessageSorter(CMessageList &messages, CSortMethod primary, CSortMethod secondary);
+
+    /**
+     * Should the first message, given by its index in our input, be
+     * sorted before the second?
+     */
+    bool less(size_t a, size_t b) const;
+
+    /**
+     * Return the indexes of our messages, in sorted order.
+     */
+    std::vector<size_t> sort() const;
+
+    /**
+     * Lookup a sort-method by its name, as used by `index.sort`,
+     * returning false if it isn't one of ours.
+     */
+    static bool method(const std::string &name, CSortMethod &method);
+
+private:
+
+    /**
+     * The key of a message, which is a number or some text depending
+     * upon the method.
+     */
+    struct CSortKey
+    {
+        int64_t number;
+        std::string text;
+    };
+
+    /**
+     * Compute the keys of the given messages, for the given method.
+     */
+    static void compute(CMessageList &messages, CSortMethod method, std::vector<CSortKey> &keys);
+
+    /**
+     * Compare the keys of two messages - returning less than, equal to,
+     * or greater than zero.
+     */
+    static int compare(const std::vector<CSortKey> &keys, CSortMethod method, size_t a, size_t b);
+
+private:
+
+    /**
+     * Our methods, and the keys of each message for them.
+     */
+    CSortMethod m_primary;
+    CSortMethod m_secondary;
+    bool m_has_secondary;
+
+    std::vector<CSortKey> m_primary_keys;
+    std::vector<CSortKey> m_secondary_keys;
+};
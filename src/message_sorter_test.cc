@@ -0,0 +1,130 @@
+/*
+ * message_sorter_test.cc - Test-cases for our message-sorting.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <vector>
+
+#include "message_sorter.h"
+#include "message_table.h"
+#include "test_messages.h"
+#include "CuTest.h"
+
+
+/**
+ * Test the lookup of sort-methods by name.
+ */
+void TestMessageSorterMethod(CuTest * tc)
+{
+    CMessageSorter::CSortMethod method;
+
+    CuAssertTrue(tc, CMessageSorter::method("date", method));
+    CuAssertIntEquals(tc, CMessageSorter::SORT_DATE, method);
+    CuAssertTrue(tc, CMessageSorter::method("size", method));
+    CuAssertIntEquals(tc, CMessageSorter::SORT_SIZE, method);
+    CuAssertTrue(tc, ! CMessageSorter::method("threads", method));
+    CuAssertTrue(tc, ! CMessageSorter::method("", method));
+}
+
+
+/**
+ * Test sorting by the built-in methods.
+ */
+void TestMessageSorterSort(CuTest * tc)
+{
+    CMessageList messages;
+    messages.push_back(test_message("300.a", "Bob", "beta", 30, 0, 10));
+    messages.push_back(test_message("sorter.b", "alice", "Alpha", 10, 0, 20));
+    messages.push_back(test_message("200.c", "Carol", "gamma", 20, 0, 10));
+
+    /*
+     * The date comes from the filename, or the Date: header.
+     */
+    std::vector<size_t> order = CMessageSorter(messages, CMessageSorter::SORT_DATE).sort();
+    CuAssertIntEquals(tc, 3, order.size());
+    CuAssertIntEquals(tc, 1, order[0]);
+    CuAssertIntEquals(tc, 2, order[1]);
+    CuAssertIntEquals(tc, 0, order[2]);
+
+    /*
+     * Headers are compared regardless of case.
+     */
+    order = CMessageSorter(messages, CMessageSorter::SORT_FROM).sort();
+    CuAssertIntEquals(tc, 1, order[0]);
+    CuAssertIntEquals(tc, 0, order[1]);
+    CuAssertIntEquals(tc, 2, order[2]);
+
+    order = CMessageSorter(messages, CMessageSorter::SORT_SUBJECT).sort();
+    CuAssertIntEquals(tc, 1, order[0]);
+    CuAssertIntEquals(tc, 0, order[1]);
+    CuAssertIntEquals(tc, 2, order[2]);
+
+    /*
+     * Equal sizes keep their order, unless a second method breaks the tie.
+     */
+    order = CMessageSorter(messages, CMessageSorter::SORT_SIZE).sort();
+    CuAssertIntEquals(tc, 0, order[0]);
+    CuAssertIntEquals(tc, 2, order[1]);
+    CuAssertIntEquals(tc, 1, order[2]);
+
+    order = CMessageSorter(messages, CMessageSorter::SORT_SIZE, CMessageSorter::SORT_FILE).sort();
+    CuAssertIntEquals(tc, 2, order[0]);
+    CuAssertIntEquals(tc, 0, order[1]);
+    CuAssertIntEquals(tc, 1, order[2]);
+}
+
+
+/**
+ * Test that a list large enough to be sorted in parallel is sorted, and
+ * sorted stably.
+ */
+void TestMessageSorterLarge(CuTest * tc)
+{
+    CMessageList messages = test_message_list(50000,
+                                              [](size_t) { return std::string(); },
+                                              [](size_t i) { return (i * 7919) % 100; });
+
+    std::vector<size_t> order = CMessageSorter(messages, CMessageSorter::SORT_SIZE).sort();
+    CuAssertIntEquals(tc, 50000, order.size());
+
+    CMessageTable *table = CMessageTable::instance();
+    bool sorted = true;
+
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        uint64_t prev = table->size(messages[order[i - 1]]->row());
+        uint64_t cur  = table->size(messages[order[i]]->row());
+
+        if ((prev > cur) || ((prev == cur) && (order[i - 1] > order[i])))
+            sorted = false;
+    }
+
+    CuAssertTrue(tc, sorted);
+}
+
+
+
+CuSuite *
+message_sorter_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageSorterMethod);
+    SUITE_ADD_TEST(suite, TestMessageSorterSort);
+    SUITE_ADD_TEST(suite, TestMessageSorterLarge);
+    return suite;
+}
@@ -0,0 +1,787 @@
+/*
+ * message_table.cc - A compact table of the messages we know about.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <ctype.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "message_table.h"
+
+
+/*
+ * The names of our key headers, in the order of `CKeyHeader`.
+ */
+static const char *key_names[] =
+{
+    "from",
+    "to",
+    "cc",
+    "subject",
+    "date",
+    "message-id",
+    "in-reply-to",
+    "references",
+};
+
+
+/*
+ * We don't bother rebuilding the string-pool until it has at least
+ * this much garbage in it.
+ */
+#define MIN_GARBAGE (64 * 1024)
+
+
+/*
+ * The offset we use for a missing string.
+ */
+const uint32_t CMessageTable::NO_STRING;
+
+
+/*
+ * Return the given text in lower-case.
+ */
+static std::string lower_case(std::string text)
+{
+    for (char &c : text)
+    {
+        if ((c >= 'A') && (c <= 'Z'))
+            c += 'a' - 'A';
+    }
+
+    return (text);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageTable::CMessageTable()
+{
+    m_garbage = 0;
+}
+
+
+/*
+ * Add a row for the given message.
+ */
+uint32_t CMessageTable::insert(const std::string &path)
+{
+    uint32_t row = allocate();
+    set_path(row, path);
+
+    return (row);
+}
+
+
+/*
+ * Add a row for the given message, beneath an interned directory.
+ */
+uint32_t CMessageTable::insert(uint32_t dir, const std::string &name)
+{
+    uint32_t row = allocate();
+    set_path(row, dir, name);
+
+    return (row);
+}
+
+
+/*
+ * Allocate a row, with a reference count of one.
+ */
+uint32_t CMessageTable::allocate()
+{
+    uint32_t row;
+
+    if (! m_free.empty())
+    {
+        row = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        row = m_refs.size();
+
+        m_refs.push_back(0);
+        m_state.push_back(0);
+        m_dir.push_back(0);
+        m_name.push_back(NO_STRING);
+        m_flags.push_back(0);
+        m_mtime.push_back(0);
+        m_size.push_back(0);
+        m_date.push_back(0);
+        m_hints.push_back(0);
+
+        for (int i = 0; i < HEADER_COUNT; i++)
+            m_headers[i].push_back(NO_STRING);
+    }
+
+    m_refs[row]  = 1;
+    m_state[row] = 0;
+    m_date[row]  = 0;
+    m_hints[row] = 0;
+
+    return (row);
+}
+
+
+/*
+ * Increase the reference count of the given row.
+ */
+void CMessageTable::acquire(uint32_t row)
+{
+    m_refs.at(row) += 1;
+}
+
+
+/*
+ * Decrease the reference count of the given row.
+ */
+void CMessageTable::release(uint32_t row)
+{
+    if (m_refs.at(row) == 0)
+        return;
+
+    m_refs[row] -= 1;
+
+    if (m_refs[row] > 0)
+        return;
+
+    free_string(m_name[row]);
+    m_name[row] = NO_STRING;
+
+    for (int i = 0; i < HEADER_COUNT; i++)
+    {
+        free_string(m_headers[i][row]);
+        m_headers[i][row] = NO_STRING;
+    }
+
+    m_state[row] = 0;
+    m_free.push_back(row);
+
+    compact();
+}
+
+
+/*
+ * The number of rows which are in use.
+ */
+size_t CMessageTable::rows()
+{
+    return (m_refs.size() - m_free.size());
+}
+
+
+/*
+ * The path of the message in the given row.
+ */
+std::string CMessageTable::path(uint32_t row)
+{
+    std::string result = m_dirs.at(m_dir.at(row));
+
+    if (! result.empty())
+        result += "/";
+
+    result += name(row);
+    return (result);
+}
+
+
+/*
+ * Update the path of the message in the given row.
+ */
+void CMessageTable::set_path(uint32_t row, const std::string &path)
+{
+    std::string dir  = "";
+    std::string base = path;
+
+    size_t slash = path.rfind('/');
+
+    if (slash != std::string::npos)
+    {
+        dir  = path.substr(0, slash);
+        base = path.substr(slash + 1);
+    }
+
+    set_path(row, directory_id(dir), base);
+}
+
+
+/*
+ * Update the directory and name of the message in the given row.
+ */
+void CMessageTable::set_path(uint32_t row, uint32_t dir, const std::string &name)
+{
+    free_string(m_name.at(row));
+
+    m_dir[row]   = dir;
+    m_name[row]  = add_string(name);
+    m_flags[row] = name_to_mask(m_dirs.at(dir), name);
+}
+
+
+/*
+ * The interned directory of the given row.
+ */
+uint32_t CMessageTable::directory(uint32_t row)
+{
+    return (m_dir.at(row));
+}
+
+
+/*
+ * The path of an interned directory.
+ */
+std::string CMessageTable::directory_path(uint32_t id)
+{
+    return (m_dirs.at(id));
+}
+
+
+/*
+ * The basename of the given row.
+ */
+const char *CMessageTable::name(uint32_t row)
+{
+    uint32_t offset = m_name.at(row);
+
+    if (offset == NO_STRING)
+        return "";
+
+    return (&m_pool[offset]);
+}
+
+
+/*
+ * The flags of the given row.
+ */
+uint64_t CMessageTable::flags(uint32_t row)
+{
+    return (m_flags.at(row));
+}
+
+
+/*
+ * Replace the flags of the given row.
+ */
+void CMessageTable::set_flags(uint32_t row, uint64_t mask)
+{
+    m_flags.at(row) = mask;
+}
+
+
+/*
+ * Return the bit which represents the given flag.
+ */
+uint64_t CMessageTable::flag_bit(char flag)
+{
+    if ((flag >= 'A') && (flag <= 'Z'))
+        return ((uint64_t)1 << (flag - 'A'));
+
+    if ((flag >= 'a') && (flag <= 'z'))
+        return ((uint64_t)1 << (26 + flag - 'a'));
+
+    return 0;
+}
+
+
+/*
+ * Convert a string of flags to a bitmask.
+ */
+uint64_t CMessageTable::flags_to_mask(const std::string &flags)
+{
+    uint64_t mask = 0;
+
+    for (char c : flags)
+        mask |= flag_bit(c);
+
+    return (mask);
+}
+
+
+/*
+ * Convert a bitmask to a string of flags, which will be sorted.
+ */
+std::string CMessageTable::mask_to_flags(uint64_t mask)
+{
+    std::string flags;
+
+    for (int i = 0; i < 26; i++)
+    {
+        if (mask & ((uint64_t)1 << i))
+            flags += (char)('A' + i);
+    }
+
+    for (int i = 0; i < 26; i++)
+    {
+        if (mask & ((uint64_t)1 << (26 + i)))
+            flags += (char)('a' + i);
+    }
+
+    return (flags);
+}
+
+
+/*
+ * Get the flags of the message with the given path.
+ */
+uint64_t CMessageTable::path_to_mask(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+
+    if (slash == std::string::npos)
+        return (name_to_mask("", path));
+
+    return (name_to_mask(path.substr(0, slash), path.substr(slash + 1)));
+}
+
+
+/*
+ * Get the flags of a message from its directory and name.
+ */
+uint64_t CMessageTable::name_to_mask(const std::string &dir, const std::string &name)
+{
+    uint64_t mask = 0;
+
+    size_t offset = name.find(":2,");
+
+    if (offset != std::string::npos)
+        mask = flags_to_mask(name.substr(offset + 3));
+
+    /*
+     * Messages in `new/` haven't been seen by any client.
+     */
+    if ((dir == "new") ||
+            ((dir.size() >= 4) && (dir.compare(dir.size() - 4, 4, "/new") == 0)))
+        mask |= flag_bit('N');
+
+    return (mask);
+}
+
+
+/*
+ * Get the state of the given row.
+ */
+uint32_t CMessageTable::state(uint32_t row)
+{
+    return (m_state.at(row));
+}
+
+
+/*
+ * Forget the modification-time and size of the given row.
+ */
+void CMessageTable::forget_stat(uint32_t row)
+{
+    m_state.at(row) &= ~STATE_STAT;
+}
+
+
+/*
+ * Look up the modification-time and size of the given row.
+ */
+void CMessageTable::stat_row(uint32_t row)
+{
+    if (m_state.at(row) & STATE_STAT)
+        return;
+
+    struct stat sb;
+
+    /*
+     * A message we can't find has an mtime of one, as it always has.
+     */
+    if (stat(path(row).c_str(), &sb) < 0)
+    {
+        m_mtime[row] = 1;
+        m_size[row]  = 0;
+    }
+    else
+    {
+        m_mtime[row] = sb.st_mtime;
+        m_size[row]  = sb.st_size;
+    }
+
+    m_state[row] |= STATE_STAT;
+}
+
+
+/*
+ * The modification-time of the given row.
+ */
+time_t CMessageTable::mtime(uint32_t row)
+{
+    stat_row(row);
+    return (m_mtime[row]);
+}
+
+
+/*
+ * Set the modification-time of the given row.
+ */
+void CMessageTable::set_mtime(uint32_t row, time_t mtime)
+{
+    /*
+     * The size is left as it was, looking it up first if need be.
+     */
+    stat_row(row);
+    m_mtime.at(row) = mtime;
+}
+
+
+/*
+ * Set the modification-time and size of the given row.
+ */
+void CMessageTable::set_stat(uint32_t row, time_t mtime, uint64_t size)
+{
+    m_mtime.at(row)  = mtime;
+    m_size.at(row)   = size;
+    m_state.at(row) |= STATE_STAT;
+}
+
+
+/*
+ * The size of the given row.
+ */
+uint64_t CMessageTable::size(uint32_t row)
+{
+    stat_row(row);
+    return (m_size[row]);
+}
+
+
+/*
+ * The parsed `Date:` header of the given row.
+ */
+time_t CMessageTable::date(uint32_t row)
+{
+    return (m_date.at(row));
+}
+
+
+/*
+ * The time the message in the given row was delivered.
+ */
+time_t CMessageTable::delivered(uint32_t row)
+{
+    time_t when;
+
+    if (name_time(name(row), when))
+        return (when);
+
+    return (m_date.at(row));
+}
+
+
+/*
+ * Find the delivery-time at the start of a maildir filename, which has
+ * the form "seconds.unique".
+ */
+bool CMessageTable::name_time(const char *name, time_t &when)
+{
+    if ((name == NULL) || (! isdigit((unsigned char)*name)))
+        return false;
+
+    time_t value = 0;
+
+    while (isdigit((unsigned char)*name))
+        value = (value * 10) + (*name++ - '0');
+
+    if (*name != '.')
+        return false;
+
+    when = value;
+    return true;
+}
+
+
+/*
+ * Get a key header of the given row.
+ */
+std::string CMessageTable::header(uint32_t row, CKeyHeader key)
+{
+    uint32_t offset = m_headers[key].at(row);
+
+    if (offset == NO_STRING)
+        return "";
+
+    return (&m_pool[offset]);
+}
+
+
+/*
+ * Get a key header of the given row, without copying it.
+ */
+const char *CMessageTable::header_data(uint32_t row, CKeyHeader key)
+{
+    uint32_t offset = m_headers[key].at(row);
+
+    if (offset == NO_STRING)
+        return NULL;
+
+    return (&m_pool[offset]);
+}
+
+
+/*
+ * Does the given row have a value for the given key header?
+ */
+bool CMessageTable::has_header(uint32_t row, CKeyHeader key)
+{
+    return (m_headers[key].at(row) != NO_STRING);
+}
+
+
+/*
+ * Store the key headers of the given row.
+ */
+void CMessageTable::set_headers(uint32_t row, std::unordered_map<std::string, std::string> &headers, time_t date)
+{
+    for (int i = 0; i < HEADER_COUNT; i++)
+    {
+        free_string(m_headers[i].at(row));
+        m_headers[i][row] = NO_STRING;
+
+        auto it = headers.find(key_names[i]);
+
+        if (it != headers.end())
+        {
+            m_headers[i][row] = add_string(it->second);
+            headers.erase(it);
+        }
+    }
+
+    /*
+     * The content-type isn't a key header, so our caller keeps it.
+     */
+    auto type = headers.find("content-type");
+    auto disposition = headers.find("content-disposition");
+
+    m_hints.at(row)  = content_hints((type != headers.end()) ? type->second : "",
+                                     (disposition != headers.end()) ? disposition->second : "");
+    m_date.at(row)   = date;
+    m_state.at(row) |= STATE_HEADERS;
+}
+
+
+/*
+ * Store the key headers of the given row, as they were previously stored.
+ */
+void CMessageTable::set_headers(uint32_t row, const char *const values[HEADER_COUNT], time_t date, uint32_t hints)
+{
+    for (int i = 0; i < HEADER_COUNT; i++)
+    {
+        free_string(m_headers[i].at(row));
+        m_headers[i][row] = (values[i] != NULL) ? add_string(values[i], strlen(values[i])) : NO_STRING;
+    }
+
+    m_hints.at(row)  = hints;
+    m_date.at(row)   = date;
+    m_state.at(row) |= STATE_HEADERS;
+}
+
+
+/*
+ * The hints of the given row.
+ */
+uint32_t CMessageTable::hints(uint32_t row)
+{
+    return (m_hints.at(row));
+}
+
+
+/*
+ * Update the hints of the given row.
+ */
+void CMessageTable::set_hints(uint32_t row, uint32_t hints)
+{
+    m_hints.at(row) = hints;
+}
+
+
+/*
+ * Derive the hints of a message from its content-type and disposition,
+ * which are compared without regard to case.
+ *
+ * A part is an attachment if it has a filename, from either header, as
+ * `CMessage::part2obj()` finds it.  We can only tell that for a message
+ * which is a single part - otherwise its parts must be counted.
+ */
+uint32_t CMessageTable::content_hints(const std::string &type, const std::string &disposition)
+{
+    std::string lower = lower_case(type);
+    std::string disp  = lower_case(disposition);
+
+    size_t params = lower.find(';');
+    std::string main = lower.substr(0, params);
+
+    if (main.find("multipart/") != std::string::npos)
+    {
+        if (main.find("multipart/signed") != std::string::npos)
+            return (HINT_SIGNED | HINT_UNCOUNTED);
+
+        return (HINT_UNCOUNTED);
+    }
+
+    if ((disp.find("filename") != std::string::npos) ||
+            ((params != std::string::npos) && (lower.find("name", params) != std::string::npos)))
+        return (HINT_ATTACHMENT);
+
+    return 0;
+}
+
+
+/*
+ * Add the key headers of the given row to the map.
+ */
+void CMessageTable::get_headers(uint32_t row, std::unordered_map<std::string, std::string> &headers)
+{
+    for (int i = 0; i < HEADER_COUNT; i++)
+    {
+        if (m_headers[i].at(row) != NO_STRING)
+            headers[key_names[i]] = header(row, (CKeyHeader)i);
+    }
+}
+
+
+/*
+ * Lookup a key header by name.
+ */
+bool CMessageTable::key_header(const std::string &name, CKeyHeader &key)
+{
+    for (int i = 0; i < HEADER_COUNT; i++)
+    {
+        if (name == key_names[i])
+        {
+            key = (CKeyHeader)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * The name of a key header.
+ */
+const char *CMessageTable::key_name(CKeyHeader key)
+{
+    return (key_names[key]);
+}
+
+
+/*
+ * Add a string to the pool.
+ */
+uint32_t CMessageTable::add_string(const std::string &value)
+{
+    return (add_string(value.data(), value.size()));
+}
+
+
+/*
+ * Add a string to the pool, from a buffer.
+ */
+uint32_t CMessageTable::add_string(const char *value, size_t len)
+{
+    /*
+     * Our offsets are 32-bit, and the largest is reserved for NO_STRING.
+     */
+    if (len >= (size_t)NO_STRING - m_pool.size())
+        throw "Message-table string-pool overflow";
+
+    uint32_t offset = m_pool.size();
+
+    m_pool.insert(m_pool.end(), value, value + len);
+    m_pool.push_back('\0');
+
+    return (offset);
+}
+
+
+/*
+ * Record that the string at the given offset is no longer used.
+ */
+void CMessageTable::free_string(uint32_t offset)
+{
+    if (offset == NO_STRING)
+        return;
+
+    m_garbage += strlen(&m_pool[offset]) + 1;
+}
+
+
+/*
+ * Rebuild the pool, if at least half of it is unused.
+ *
+ * This copies the strings of each row which is in use into a new pool,
+ * in row-order.
+ */
+void CMessageTable::compact()
+{
+    if ((m_garbage < MIN_GARBAGE) || (m_garbage < m_pool.size() / 2))
+        return;
+
+    std::vector<char> pool;
+    pool.reserve(m_pool.size() - m_garbage);
+
+    for (uint32_t row = 0; row < m_refs.size(); row++)
+    {
+        if (m_refs[row] == 0)
+            continue;
+
+        std::vector<uint32_t *> offsets;
+        offsets.push_back(&m_name[row]);
+
+        for (int i = 0; i < HEADER_COUNT; i++)
+            offsets.push_back(&m_headers[i][row]);
+
+        for (uint32_t *offset : offsets)
+        {
+            if (*offset == NO_STRING)
+                continue;
+
+            const char *value = &m_pool[*offset];
+            size_t len = strlen(value) + 1;
+
+            *offset = pool.size();
+            pool.insert(pool.end(), value, value + len);
+        }
+    }
+
+    m_pool.swap(pool);
+    m_garbage = 0;
+}
+
+
+/*
+ * Intern the given directory.
+ */
+uint32_t CMessageTable::directory_id(const std::string &dir)
+{
+    auto it = m_dir_ids.find(dir);
+
+    if (it != m_dir_ids.end())
+        return (it->second);
+
+    uint32_t id = m_dirs.size();
+    m_dirs.push_back(dir);
+    m_dir_ids[dir] = id;
+
+    return (id);
+}
@@ -0,0 +1,455 @@
+/*
+ * message_table.h - A compact table of the messages we know about.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * The CMessageTable class is a singleton which stores the details of
+ * every message we know about, across all folders.
+ *
+ * Rather than each message being a heap-allocated object with its own
+ * strings, the details are stored as a set of parallel columns, indexed
+ * by row-number:
+ *
+ *  - The directory containing the message, interned.
+ *
+ *  - The basename of the message, and the values of a few key headers,
+ *    as offsets into a shared string-pool.
+ *
+ *  - The flags of the message, as a bitmask.
+ *
+ *  - The modification-time, size, and `Date:` of the message.
+ *
+ * A `CMessage` is a facade over a single row, but rows may exist without
+ * one - for example a maildir records each of its files as a row, and only
+ * creates message-objects for those which are displayed.  Sorting and
+ * filtering can then work through contiguous memory.
+ *
+ * Rows are reference-counted, via `acquire()` and `release()`, and the
+ * row-number of a released row will be reused.
+ *
+ * **NOTE**: This class is not thread-safe.
+ *
+ */
+class CMessageTable : public Singleton<CMessageTable>
+{
+public:
+
+    /**
+     * The headers we store in the table, rather than per-message.
+     */
+    enum CKeyHeader
+    {
+        HEADER_FROM,
+        HEADER_TO,
+        HEADER_CC,
+        HEADER_SUBJECT,
+        HEADER_DATE,
+        HEADER_MESSAGE_ID,
+        HEADER_IN_REPLY_TO,
+        HEADER_REFERENCES,
+        HEADER_COUNT
+    };
+
+    /**
+     * The state of a row.
+     */
+    enum CRowState
+    {
+        /**
+         * The headers of the message have been stored.
+         */
+        STATE_HEADERS = 1,
+
+        /**
+         * The modification-time and size of the message are known.
+         */
+        STATE_STAT = 2
+    };
+
+    /**
+     * Hints about the body of a message, which are derived from its
+     * `Content-Type:` and `Content-Disposition:` headers when the headers
+     * are stored.
+     */
+    enum CHint
+    {
+        /**
+         * The message has an attachment - a part with a filename.
+         */
+        HINT_ATTACHMENT = 1,
+
+        /**
+         * The message is `multipart/signed`.
+         */
+        HINT_SIGNED = 2,
+
+        /**
+         * The message is multipart, and its parts haven't been counted,
+         * so we don't know whether it has an attachment.
+         */
+        HINT_UNCOUNTED = 4
+    };
+
+    /**
+     * Constructor.
+     */
+    CMessageTable();
+
+public:
+
+    /**
+     * Add a row for the message with the given path, with a reference
+     * count of one, and return its row-number.
+     */
+    uint32_t insert(const std::string &path);
+
+    /**
+     * Add a row for the message with the given name, beneath the
+     * given interned directory.
+     */
+    uint32_t insert(uint32_t dir, const std::string &name);
+
+    /**
+     * Increase the reference count of the given row.
+     */
+    void acquire(uint32_t row);
+
+    /**
+     * Decrease the reference count of the given row, which is freed
+     * once nothing refers to it.
+     */
+    void release(uint32_t row);
+
+    /**
+     * The number of rows which are in use.
+     */
+    size_t rows();
+
+    /**
+     * The path of the message in the given row.
+     */
+    std::string path(uint32_t row);
+
+    /**
+     * Update the path of the message in the given row, along with its
+     * flags.
+     *
+     * The modification-time and size are kept, since renaming a file
+     * doesn't change them.
+     */
+    void set_path(uint32_t row, const std::string &path);
+    void set_path(uint32_t row, uint32_t dir, const std::string &name);
+
+    /**
+     * The interned directory of the message in the given row.
+     */
+    uint32_t directory(uint32_t row);
+
+    /**
+     * The path of an interned directory.
+     */
+    std::string directory_path(uint32_t id);
+
+    /**
+     * Intern the given directory, which has no trailing `/`.
+     */
+    uint32_t directory_id(const std::string &dir);
+
+    /**
+     * The basename of the message in the given row.
+     */
+    const char *name(uint32_t row);
+
+    /**
+     * The flags of the message in the given row.
+     */
+    uint64_t flags(uint32_t row);
+
+    /**
+     * Replace the flags of the message in the given row.
+     *
+     * This is used for IMAP messages, whose flags are not stored in
+     * their path.
+     */
+    void set_flags(uint32_t row, uint64_t mask);
+
+    /**
+     * Return the bit which represents the given flag, or zero.
+     */
+    static uint64_t flag_bit(char flag);
+
+    /**
+     * Convert a string of flags to a bitmask, and back.
+     *
+     * Each of the letters `A-Z` and `a-z` has its own bit, anything else
+     * is ignored.
+     */
+    static uint64_t flags_to_mask(const std::string &flags);
+    static std::string mask_to_flags(uint64_t mask);
+
+    /**
+     * Get the flags of the message with the given path, from its name
+     * and the directory it is in - a message in `new/` has the flag `N`.
+     */
+    static uint64_t path_to_mask(const std::string &path);
+
+    /**
+     * Get the state of the given row.
+     */
+    uint32_t state(uint32_t row);
+
+    /**
+     * Forget the modification-time and size of the given row, such
+     * that they will be looked up again.
+     */
+    void forget_stat(uint32_t row);
+
+    /**
+     * The modification-time of the message in the given row.
+     */
+    time_t mtime(uint32_t row);
+
+    /**
+     * Set the modification-time of the message in the given row,
+     * leaving its size alone.
+     *
+     * This is used for IMAP messages, which have no local file.
+     */
+    void set_mtime(uint32_t row, time_t mtime);
+
+    /**
+     * Set the modification-time and size of the message in the given
+     * row, which have been looked up already.
+     */
+    void set_stat(uint32_t row, time_t mtime, uint64_t size);
+
+    /**
+     * The size of the message in the given row.
+     */
+    uint64_t size(uint32_t row);
+
+    /**
+     * The parsed `Date:` header of the message in the given row, or
+     * zero if the headers haven't been stored.
+     */
+    time_t date(uint32_t row);
+
+    /**
+     * The time the message in the given row was delivered, from its
+     * name if that holds it, or else its `Date:` header.
+     */
+    time_t delivered(uint32_t row);
+
+    /**
+     * Find the delivery-time at the start of a maildir filename,
+     * returning false if it doesn't have one.
+     */
+    static bool name_time(const char *name, time_t &when);
+
+    /**
+     * Get a key header of the given row.
+     */
+    std::string header(uint32_t row, CKeyHeader key);
+
+    /**
+     * Get a key header of the given row without copying it, or NULL if
+     * the row has no value for it.  The value remains valid until the
+     * next string is added to the table, or a row is released - since
+     * either may move the pool - so it must be copied to be kept.
+     */
+    const char *header_data(uint32_t row, CKeyHeader key);
+
+    /**
+     * Does the given row have a value for the given key header?
+     */
+    bool has_header(uint32_t row, CKeyHeader key);
+
+    /**
+     * Store the key headers of the given row, from the complete set
+     * of the message's headers, each of which has a lower-case name.
+     *
+     * The headers we store are removed from the map, since the caller
+     * need not keep a copy.
+     */
+    void set_headers(uint32_t row, std::unordered_map<std::string, std::string> &headers, time_t date);
+
+    /**
+     * Store the key headers of the given row, and its hints, as they were
+     * previously stored - with NULL for any header the message lacks.
+     */
+    void set_headers(uint32_t row, const char *const values[HEADER_COUNT], time_t date, uint32_t hints);
+
+    /**
+     * The hints of the given row, which are zero unless the headers have
+     * been stored.
+     */
+    uint32_t hints(uint32_t row);
+
+    /**
+     * Update the hints of the given row, once its parts are known.
+     */
+    void set_hints(uint32_t row, uint32_t hints);
+
+    /**
+     * Add the key headers of the given row to the map.
+     */
+    void get_headers(uint32_t row, std::unordered_map<std::string, std::string> &headers);
+
+    /**
+     * Lookup a key header by its lower-case name, returning false if it
+     * isn't one.
+     */
+    static bool key_header(const std::string &name, CKeyHeader &key);
+
+    /**
+     * The lower-case name of the given key header.
+     */
+    static const char *key_name(CKeyHeader key);
+
+    /**
+     * Derive the hints of a message from its `Content-Type:` and
+     * `Content-Disposition:` headers, either of which may be empty.
+     */
+    static uint32_t content_hints(const std::string &type, const std::string &disposition);
+
+private:
+
+    /**
+     * Allocate a row.
+     */
+    uint32_t allocate();
+
+    /**
+     * Get the flags of a message from its directory and name.
+     */
+    static uint64_t name_to_mask(const std::string &dir, const std::string &name);
+
+    /**
+     * Look up the modification-time and size of the given row.
+     */
+    void stat_row(uint32_t row);
+
+    /**
+     * Add a string to the pool, returning its offset.
+     */
+    uint32_t add_string(const std::string &value);
+    uint32_t add_string(const char *value, size_t len);
+
+    /**
+     * Record that the string at the given offset is no longer used.
+     */
+    void free_string(uint32_t offset);
+
+    /**
+     * Rebuild the pool, if enough of it is unused.
+     */
+    void compact();
+
+private:
+
+    /**
+     * The offset we use for a missing string.
+     */
+    static const uint32_t NO_STRING = 0xFFFFFFFF;
+
+    /**
+     * The reference count of each row.
+     */
+    std::vector<uint32_t> m_refs;
+
+    /**
+     * The state of each row.
+     */
+    std::vector<uint8_t> m_state;
+
+    /**
+     * The interned directory of each row.
+     */
+    std::vector<uint32_t> m_dir;
+
+    /**
+     * The offset of the basename of each row.
+     */
+    std::vector<uint32_t> m_name;
+
+    /**
+     * The flags of each row.
+     */
+    std::vector<uint64_t> m_flags;
+
+    /**
+     * The modification-time of each row.
+     */
+    std::vector<time_t> m_mtime;
+
+    /**
+     * The size of each row.
+     */
+    std::vector<uint64_t> m_size;
+
+    /**
+     * The parsed `Date:` header of each row.
+     */
+    std::vector<time_t> m_date;
+
+    /**
+     * The hints of each row.
+     */
+    std::vector<uint8_t> m_hints;
+
+    /**
+     * The offsets of the key headers of each row.
+     */
+    std::vector<uint32_t> m_headers[HEADER_COUNT];
+
+    /**
+     * The rows which have been released, and may be reused.
+     */
+    std::vector<uint32_t> m_free;
+
+    /**
+     * The interned directories.
+     */
+    std::vector<std::string> m_dirs;
+
+    /**
+     * The ID of each interned directory.
+     */
+    std::unordered_map<std::string, uint32_t> m_dir_ids;
+
+    /**
+     * The string-pool, which contains NUL-terminated strings.
+     */
+    std::vector<char> m_pool;
+
+    /**
+     * The number of bytes in the pool which are no longer used.
+     */
+    size_t m_garbage;
+};
@@ -0,0 +1,238 @@
+/*
+ * message_table_test.cc - Test-cases for our message-table.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message_table.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test that rows remember their paths and flags.
+ */
+void TestMessageTablePaths(CuTest * tc)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    uint32_t one = table->insert("/tmp/Maildir/cur/1.one:2,SR");
+    uint32_t two = table->insert("/tmp/Maildir/new/2.two");
+
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/1.one:2,SR", table->path(one).c_str());
+    CuAssertStrEquals(tc, "/tmp/Maildir/new/2.two", table->path(two).c_str());
+    CuAssertStrEquals(tc, "1.one:2,SR", table->name(one));
+
+    /*
+     * Both messages share a maildir, but not a directory.
+     */
+    CuAssertTrue(tc, table->directory(one) != table->directory(two));
+
+    CuAssertStrEquals(tc, "RS", CMessageTable::mask_to_flags(table->flags(one)).c_str());
+    CuAssertStrEquals(tc, "N", CMessageTable::mask_to_flags(table->flags(two)).c_str());
+
+    /*
+     * Moving a message updates its flags.
+     */
+    table->set_path(two, "/tmp/Maildir/cur/2.two:2,S");
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/2.two:2,S", table->path(two).c_str());
+    CuAssertStrEquals(tc, "S", CMessageTable::mask_to_flags(table->flags(two)).c_str());
+    CuAssertIntEquals(tc, table->directory(one), table->directory(two));
+
+    table->release(one);
+    table->release(two);
+}
+
+
+/**
+ * Test the conversion of flags to bitmasks, and back.
+ */
+void TestMessageTableFlags(CuTest * tc)
+{
+    std::string tests[] = { "", "S", "DFPRST", "Sa", "az" };
+
+    for (std::string flags : tests)
+    {
+        uint64_t mask = CMessageTable::flags_to_mask(flags);
+        CuAssertStrEquals(tc, flags.c_str(), CMessageTable::mask_to_flags(mask).c_str());
+    }
+
+    /*
+     * Duplicates are removed, and the result sorted.
+     */
+    uint64_t mask = CMessageTable::flags_to_mask("TSST");
+    CuAssertStrEquals(tc, "ST", CMessageTable::mask_to_flags(mask).c_str());
+
+    /*
+     * Each flag has its own bit, and other characters have none.
+     */
+    CuAssertTrue(tc, CMessageTable::flag_bit('S') != CMessageTable::flag_bit('s'));
+    CuAssertTrue(tc, CMessageTable::flag_bit('S') & CMessageTable::flags_to_mask("RS"));
+    CuAssertIntEquals(tc, 0, CMessageTable::flag_bit(','));
+
+    /*
+     * Only the final directory counts as `new/`.
+     */
+    mask = CMessageTable::path_to_mask("/home/new/Maildir/cur/1.one:2,S");
+    CuAssertStrEquals(tc, "S", CMessageTable::mask_to_flags(mask).c_str());
+}
+
+
+/**
+ * Test that the hints of a message are derived from its headers.
+ */
+void TestMessageTableHints(CuTest * tc)
+{
+    CuAssertIntEquals(tc, 0, CMessageTable::content_hints("", ""));
+    CuAssertIntEquals(tc, 0, CMessageTable::content_hints("text/plain; charset=utf-8", "inline"));
+
+    /*
+     * A single part is an attachment if it has a filename.
+     */
+    CuAssertIntEquals(tc, CMessageTable::HINT_ATTACHMENT,
+                      CMessageTable::content_hints("application/pdf; NAME=\"a.pdf\"", ""));
+    CuAssertIntEquals(tc, CMessageTable::HINT_ATTACHMENT,
+                      CMessageTable::content_hints("text/plain", "attachment; filename=a.txt"));
+
+    /*
+     * The parts of a multipart message must be counted.
+     */
+    CuAssertIntEquals(tc, CMessageTable::HINT_UNCOUNTED,
+                      CMessageTable::content_hints("Multipart/Mixed; boundary=x", ""));
+    CuAssertIntEquals(tc, CMessageTable::HINT_UNCOUNTED,
+                      CMessageTable::content_hints("multipart/related; boundary=x", ""));
+    CuAssertIntEquals(tc, CMessageTable::HINT_SIGNED | CMessageTable::HINT_UNCOUNTED,
+                      CMessageTable::content_hints("multipart/signed; protocol=x", ""));
+}
+
+
+/**
+ * Test that setting the modification-time of a row keeps its size.
+ */
+void TestMessageTableStat(CuTest * tc)
+{
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t row = table->insert("/tmp/Maildir/cur/stat.test");
+
+    table->set_stat(row, 1000, 4096);
+    table->set_mtime(row, table->mtime(row) + 1);
+
+    CuAssertIntEquals(tc, 1001, table->mtime(row));
+    CuAssertIntEquals(tc, 4096, table->size(row));
+
+    /*
+     * A row which was never looked up has the size of its missing file.
+     */
+    uint32_t imap = table->insert("/tmp/Maildir/cur/stat.missing");
+    table->set_mtime(imap, 0);
+
+    CuAssertIntEquals(tc, 0, table->mtime(imap));
+    CuAssertIntEquals(tc, 0, table->size(imap));
+
+    table->release(row);
+    table->release(imap);
+}
+
+
+/**
+ * Test that released rows are reused, and that the string-pool is
+ * rebuilt without losing anything.
+ */
+void TestMessageTableRelease(CuTest * tc)
+{
+    CMessageTable *table = CMessageTable::instance();
+    size_t before = table->rows();
+
+    std::vector<uint32_t> rows;
+    std::string padding(100, 'x');
+
+    for (int i = 0; i < 5000; i++)
+        rows.push_back(table->insert("/tmp/Maildir/cur/" + std::to_string(i) + padding));
+
+    CuAssertIntEquals(tc, before + 5000, table->rows());
+
+    /*
+     * Give one message some headers.
+     */
+    std::unordered_map<std::string, std::string> headers;
+    headers["subject"] = "Hello, world";
+    headers["x-mailer"] = "lumail";
+    table->set_headers(rows.at(4999), headers, 1234);
+
+    CuAssertIntEquals(tc, 1, headers.size());
+    CuAssertTrue(tc, table->has_header(rows.at(4999), CMessageTable::HEADER_SUBJECT));
+    CuAssertTrue(tc, ! table->has_header(rows.at(4999), CMessageTable::HEADER_FROM));
+
+    /*
+     * Release all but every hundredth row, which is enough to have
+     * the pool rebuilt.
+     */
+    for (int i = 0; i < 5000; i++)
+    {
+        if ((i % 100) != 99)
+            table->release(rows.at(i));
+    }
+
+    CuAssertIntEquals(tc, before + 50, table->rows());
+
+    for (int i = 99; i < 5000; i += 100)
+    {
+        std::string expected = "/tmp/Maildir/cur/" + std::to_string(i) + padding;
+        CuAssertStrEquals(tc, expected.c_str(), table->path(rows.at(i)).c_str());
+    }
+
+    CuAssertStrEquals(tc, "Hello, world",
+                      table->header(rows.at(4999), CMessageTable::HEADER_SUBJECT).c_str());
+    CuAssertIntEquals(tc, 1234, table->date(rows.at(4999)));
+
+    table->get_headers(rows.at(4999), headers);
+    CuAssertIntEquals(tc, 2, headers.size());
+    CuAssertStrEquals(tc, "Hello, world", headers["subject"].c_str());
+
+    /*
+     * A new row reuses a released one, and has no headers.
+     */
+    uint32_t reused = table->insert("/tmp/Maildir/cur/new");
+    CuAssertTrue(tc, std::find(rows.begin(), rows.end(), reused) != rows.end());
+    CuAssertIntEquals(tc, 0, table->state(reused));
+
+    table->release(reused);
+
+    for (int i = 99; i < 5000; i += 100)
+        table->release(rows.at(i));
+
+    CuAssertIntEquals(tc, before, table->rows());
+}
+
+
+
+CuSuite *
+message_table_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageTablePaths);
+    SUITE_ADD_TEST(suite, TestMessageTableFlags);
+    SUITE_ADD_TEST(suite, TestMessageTableHints);
+    SUITE_ADD_TEST(suite, TestMessageTableStat);
+    SUITE_ADD_TEST(suite, TestMessageTableRelease);
+    return suite;
+}
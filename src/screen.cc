@@ -27,6 +27,8 @@
 #include "attachment_view.h"
 #include "config.h"
 #include "colour_string.h"
+#include "finder.h"
+#include "header_prefetch.h"
 #include "history.h"
 #include "index_view.h"
 #include "input_queue.h"
@@ -34,12 +36,20 @@
 #include "lua.h"
 #include "lua_view.h"
 #include "maildir_view.h"
+#include "maildir_watcher.h"
 #include "message_view.h"
 #include "screen.h"
 
 #include "statuspanel.h"
 
 
+/*
+ * How often, in milliseconds, we look for the results of a search which
+ * is running in the background.
+ */
+#define FIND_TIMEOUT 20
+
+
 
 /*
  * Constructor.
@@ -165,6 +175,11 @@ void CScreen::run_main_loop()
      */
     CInputQueue *input = CInputQueue::instance();
 
+    /*
+     * Searches which are running in the background.
+     */
+    CFinder *finder = CFinder::instance();
+
     /*
      * Get a single character.
      */
@@ -205,7 +220,7 @@ void CScreen::run_main_loop()
                 on_keypress(total);
                 total = "";
             }
-            else
+            else if (! finder->running())
             {
                 /*
                  * Call the Lua on_idle() function.
@@ -221,6 +236,11 @@ void CScreen::run_main_loop()
         }
         else
         {
+            /*
+             * Any keypress cancels a search.
+             */
+            finder->cancel();
+
             /*
              * Convert the key-press to a key-name, which means that
              * "down" will be "KEY_DOWN", for example.
@@ -248,6 +268,29 @@ void CScreen::run_main_loop()
         }
 
 
+        /*
+         * Apply any changes to our maildirs which have been reported
+         * since we last looked.
+         */
+        CMaildirWatcher *watcher = CMaildirWatcher::instance();
+        watcher->process_events();
+
+        /*
+         * Store any headers which have been parsed in the background,
+         * after telling the parser where the selection is now.
+         */
+        CHeaderPrefetch *prefetch = CHeaderPrefetch::instance();
+        prefetch->prioritise(config->get_integer("index.current", 0));
+        prefetch->publish();
+
+        /*
+         * Collect the results of any search, and while one is running
+         * wake often enough to show its matches promptly - rather than
+         * calling our idle functions.
+         */
+        finder->publish();
+        timeout(finder->running() ? FIND_TIMEOUT : config->get_integer("global.timeout", 500));
+
         /*
          * Check if the view has changed (after key handling).
          *
@@ -1395,6 +1438,62 @@ int CScreen::get_colour(std::string name)
 
 
 
+/*
+ * The number of rows, less one, upon which `draw_text_lines` may draw.
+ */
+int CScreen::text_height()
+{
+    int height = CScreen::height();
+
+    /*
+     * Take off the panel, if visible.
+     */
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (panel->hidden() == false)
+        height -= panel->height();
+
+    /*
+     * Add an extra line.
+     */
+    return (height + 1);
+}
+
+
+/*
+ * Find the lines which `draw_text_lines` will show.
+ *
+ * In simple-mode the selected line is at the top of the screen.  Otherwise
+ * the highlight stays at the top of the screen until it reaches the middle,
+ * and then remains there until the end of the lines comes into view.
+ */
+int CScreen::visible_lines(int selected, int max, bool simple, int &count)
+{
+    int height = text_height();
+    int middle = height / 2;
+
+    count = height + 1;
+
+    if (simple)
+        return (selected);
+
+    /*
+     * Default to the top if our list is shorter than the screen.
+     */
+    if ((selected < middle) || (max <= height))
+        return 0;
+
+    /*
+     * If the height is uneven we have to switch to the bottom one row
+     * earlier.
+     */
+    if ((max - selected <= middle) || ((height % 2 == 1) && (max - selected <= middle + 1)))
+        return (max - height + 1);
+
+    return (selected - middle);
+}
+
+
 /*
  * Draw an array of lines to the screen, highlighting the current line.
  *
@@ -1403,14 +1502,17 @@ int CScreen::get_colour(std::string name)
  * If `simple` is set to true then we display the lines in a  simplified
  * fashion - with no selection, and no smooth-scrolling.
  *
+ * `lines` need not contain every line, only those from offset `first`
+ * onwards which might be visible.
+ *
  */
-void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple)
+void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple, int first)
 {
     /*
      * Get the dimensions of the screen.
      */
     CScreen *screen = CScreen::instance();
-    int height      = CScreen::height();
+    int height      = text_height();
     int width       = CScreen::width();
 
     /*
@@ -1419,19 +1521,6 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
     CConfig *config = CConfig::instance();
     int wrap = config->get_integer("line.wrap", 0);
 
-    /*
-     * Take off the panel, if visible.
-     */
-    CStatusPanel *panel = CStatusPanel::instance();
-
-    if (panel->hidden() == false)
-        height -= panel->height();
-
-    /*
-     * Add an extra line.
-     */
-    height += 1;
-
     /*
      * If we're in simple-mode we can just draw the lines directly
      * and return - we don't need to worry about the selection-handler
@@ -1459,8 +1548,8 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
              * If we're still in the array of lines to draw
              * then pick the right one.
              */
-            if ((off + selected) < size)
-                buf = lines.at(off + selected);
+            if ((off + selected >= first) && (off + selected - first) < size)
+                buf = lines.at(off + selected - first);
 
             /*
              * Last two parameters are:
@@ -1495,69 +1584,22 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
      *
      * We'll draw a highlighted bar, and that'll move "nicely".
      */
-    int middle = (height) / 2;
-    int rowToHighlight = 0;
-    vectorPosition topBottomOrMiddle = NONE;
-
-    /*
-     * default to TOP if our list is shorter then the screen height
-     */
-    if (selected < middle || max <= height)
-    {
-        topBottomOrMiddle = TOP;
-        rowToHighlight = selected;
-
-        /*
-         * if height is uneven we have to switch to the BOTTOM case on row earlier
-         */
-    }
-    else if ((max - selected <= middle) || (height % 2 == 1 && max - selected <= middle + 1))
-    {
-        topBottomOrMiddle = BOTTOM;
-        rowToHighlight =  height - max + selected - 1 ;
-    }
-    else
-    {
-        topBottomOrMiddle = MIDDLE;
-        rowToHighlight = middle;
-    }
-
+    int rows = 0;
+    int top  = visible_lines(selected, max, false, rows);
+    int rowToHighlight = selected - top;
 
-    for (int row = 0; row <= height; row++)
+    for (int row = 0; row < rows; row++)
     {
         /*
          * The current object.
          */
-        int mailIndex = max;
+        int mailIndex = top + row;
         int size      = lines.size();
 
-
-        if (topBottomOrMiddle == TOP)
-        {
-            /*
-             * we start at the top of the list so just use row
-             */
-            mailIndex = row;
-        }
-        else if (topBottomOrMiddle == BOTTOM)
-        {
-            /*
-             * when we reached the end of the list mailIndex can maximally be
-             * count-1, that this is given can easily be shown
-             * row:=height-2 -> count-height+row+1 = count-height+height-2+1 = count-1
-             */
-            mailIndex = max - height + row + 1;
-        }
-        else if (topBottomOrMiddle == MIDDLE)
-        {
-            mailIndex = row + selected - middle;
-        }
-
-
         std::string buf;
 
-        if ((mailIndex < max) && (mailIndex < size))
-            buf = lines.at(mailIndex);
+        if ((mailIndex < max) && (mailIndex >= first) && (mailIndex - first < size))
+            buf = lines.at(mailIndex - first);
 
         if (buf.empty())
             continue;
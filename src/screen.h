@@ -220,8 +220,21 @@ public:
      *
      * If `simple` is set to true then we display the lines in a  simplified
      * fashion - with no selection, and no smooth-scrolling.
+     *
+     * The first entry in `lines` is line number `first`, which allows
+     * a view to supply only the lines which might be visible.
      */
-    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false);
+    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false, int first = 0);
+
+    /**
+     * Find the lines which `draw_text_lines` will show, given the same
+     * selection, count of lines, and mode.
+     *
+     * The offset of the first is returned, and the number of rows upon
+     * which lines might be drawn is stored in `count`.  This allows a view
+     * to fetch only those lines.
+     */
+    int visible_lines(int selected, int max, bool simple, int &count);
 
     /**
      * Draw a single text line, paying attention to our colour strings.
@@ -277,17 +290,10 @@ private:
 private:
 
     /**
-     * The segment of the screen the highlighted row is within.
-     *
-     * Used by `draw_text_lines`.
-     */
-    enum vectorPosition
-    {
-        TOP,
-        MIDDLE,
-        BOTTOM,
-        NONE
-    };
+     * The number of rows, less one, upon which `draw_text_lines` may draw
+     * - the height of the screen, less that of the panel if it is visible.
+     */
+    int text_height();
 
 };
 
@@ -0,0 +1,938 @@
+/*
+ * search_index.cc - A persistent, memory-mapped, full-text index of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <fcntl.h>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "logger.h"
+#include "header_arena.h"
+#include "message.h"
+#include "message_table.h"
+#include "search_index.h"
+#include "util.h"
+
+
+/*
+ * The header of an index-file.
+ *
+ * The sizes of a message and of a term are recorded so that a change to
+ * their layout makes existing files invalid, even if we forget to bump
+ * the version.
+ */
+struct CSearchHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t doc_size;
+    uint32_t term_size;
+    uint32_t unused;
+    uint64_t maildir;
+};
+
+
+/*
+ * The header of each segment, which is followed by its messages, its
+ * terms, its string-pool, and its postings.  The pool and the postings
+ * are padded to a multiple of eight bytes, so that the next segment is
+ * aligned.
+ */
+struct CSearchSegment
+{
+    uint32_t docs;
+    uint32_t terms;
+    uint32_t pool;
+    uint32_t postings;
+};
+
+
+#define SEARCH_MAGIC   "LUMAILFT"
+#define SEARCH_VERSION 1
+
+
+/*
+ * Terms outside this range of lengths, in bytes, aren't indexed.
+ */
+#define MIN_TERM_LENGTH 2
+#define MAX_TERM_LENGTH 40
+
+
+/*
+ * Each occurrence of a term in a header counts as this many occurrences
+ * in the body.
+ */
+#define HEADER_WEIGHT 4
+
+
+/*
+ * We index no more than this much of the text of each message.
+ */
+#define MAX_BODY_TEXT (256 * 1024)
+
+
+/*
+ * Once the index has this many segments they're merged, rather than
+ * another being appended.
+ */
+#define MAX_SEGMENTS 16
+
+
+/*
+ * Append a varint to the given string.
+ */
+static void put_varint(std::string &out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+
+    out += (char)value;
+}
+
+
+/*
+ * Read a varint, returning false if it runs past the given end.
+ */
+static bool get_varint(const uint8_t *&ptr, const uint8_t *end, uint32_t &value)
+{
+    value = 0;
+
+    for (int shift = 0; (shift < 35) && (ptr < end); shift += 7)
+    {
+        uint8_t byte = *ptr++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Constructor.
+ */
+CSearchIndex::CSearchIndex()
+{
+    m_map     = NULL;
+    m_size    = 0;
+    m_inode   = 0;
+    m_mtime   = 0;
+    m_docs    = 0;
+    m_length  = 0;
+    m_damaged = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CSearchIndex::~CSearchIndex()
+{
+    close();
+}
+
+
+/*
+ * The path of the index of the given maildir.
+ */
+std::string CSearchIndex::filename(const std::string &maildir)
+{
+    CConfig *config = CConfig::instance();
+    std::string prefix = config->get_string("cache.prefix");
+
+    if (prefix.empty())
+        return "";
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx",
+             (unsigned long long)hash_string(maildir.data(), maildir.size()));
+
+    return (prefix + "/search/" + name);
+}
+
+
+/*
+ * Split the given text into terms.
+ *
+ * Any byte of a multi-byte UTF-8 character is treated as a letter, so
+ * words in other scripts are indexed - although only ASCII is folded.
+ */
+std::vector<std::string> CSearchIndex::terms(const std::string &text)
+{
+    std::vector<std::string> out;
+    std::string current;
+
+    for (size_t i = 0; i <= text.size(); i++)
+    {
+        unsigned char c = (i < text.size()) ? text[i] : ' ';
+
+        if ((c >= 0x80) || isalnum(c))
+        {
+            current += (char)tolower(c);
+            continue;
+        }
+
+        if ((current.size() >= MIN_TERM_LENGTH) && (current.size() <= MAX_TERM_LENGTH))
+            out.push_back(current);
+
+        current.clear();
+    }
+
+    return (out);
+}
+
+
+/*
+ * Map the index of the given maildir.
+ */
+bool CSearchIndex::open(const std::string &maildir)
+{
+    std::string path = filename(maildir);
+
+    struct stat sb;
+
+    if (path.empty() || (stat(path.c_str(), &sb) != 0))
+    {
+        close();
+        return false;
+    }
+
+    /*
+     * If the file is unchanged so is our mapping.
+     */
+    if ((m_map != NULL) && (sb.st_ino == m_inode) &&
+            ((size_t)sb.st_size == m_size) && (CFile::mtime_ns(sb) == m_mtime))
+        return true;
+
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    if ((fstat(fd, &sb) != 0) || (sb.st_size < (off_t)sizeof(CSearchHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map   = map;
+    m_size  = sb.st_size;
+    m_inode = sb.st_ino;
+    m_mtime = CFile::mtime_ns(sb);
+
+    if (! load(maildir))
+    {
+        CLogger::instance()->log("search", "Ignoring invalid index %s", path.c_str());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Walk the segments of the mapped file.
+ *
+ * As with the summary-index every offset is checked before it is used,
+ * and later segments replace the messages of earlier ones.
+ */
+bool CSearchIndex::load(const std::string &maildir)
+{
+    const char *base = (const char *)m_map;
+    const CSearchHeader *header = (const CSearchHeader *)base;
+
+    if ((memcmp(header->magic, SEARCH_MAGIC, sizeof(header->magic)) != 0) ||
+            (header->version != SEARCH_VERSION) ||
+            (header->doc_size != sizeof(CSearchDoc)) ||
+            (header->term_size != sizeof(CSearchTerm)) ||
+            (header->maildir != hash_string(maildir.data(), maildir.size())))
+        return false;
+
+    size_t offset = sizeof(CSearchHeader);
+
+    while (offset < m_size)
+    {
+        if (m_size - offset < sizeof(CSearchSegment))
+        {
+            m_damaged = true;
+            break;
+        }
+
+        const CSearchSegment *segment = (const CSearchSegment *)(base + offset);
+        offset += sizeof(CSearchSegment);
+
+        uint64_t needed = (uint64_t)segment->docs * sizeof(CSearchDoc) +
+                          (uint64_t)segment->terms * sizeof(CSearchTerm) +
+                          segment->pool + segment->postings;
+
+        if ((needed > m_size - offset) || (segment->pool == 0) ||
+                ((segment->pool % 8) != 0) || ((segment->postings % 8) != 0))
+        {
+            m_damaged = true;
+            break;
+        }
+
+        CSearchRef ref;
+        ref.docs          = (const CSearchDoc *)(base + offset);
+        ref.doc_count     = segment->docs;
+        ref.terms         = (const CSearchTerm *)(ref.docs + segment->docs);
+        ref.term_count    = segment->terms;
+        ref.pool          = (const char *)(ref.terms + segment->terms);
+        ref.pool_size     = segment->pool;
+        ref.postings      = (const uint8_t *)(ref.pool + segment->pool);
+        ref.postings_size = segment->postings;
+
+        /*
+         * As the pool ends with a NUL every offset within it is a string,
+         * and each term's postings must lie within those of the segment.
+         */
+        bool valid = (ref.pool[ref.pool_size - 1] == '\0');
+
+        for (uint32_t i = 0; valid && (i < ref.doc_count); i++)
+            valid = (ref.docs[i].id < ref.pool_size);
+
+        for (uint32_t i = 0; valid && (i < ref.term_count); i++)
+        {
+            const CSearchTerm &term = ref.terms[i];
+            valid = ((term.name < ref.pool_size) && (term.offset <= ref.postings_size) &&
+                     (term.size <= ref.postings_size - term.offset));
+        }
+
+        if (! valid)
+        {
+            m_damaged = true;
+            break;
+        }
+
+        for (uint32_t i = 0; i < ref.doc_count; i++)
+        {
+            const char *id = ref.pool + ref.docs[i].id;
+            m_lookup[hash_string(id, strlen(id))] = &ref.docs[i];
+        }
+
+        m_docs += ref.doc_count;
+        m_segments.push_back(ref);
+
+        offset += needed;
+    }
+
+    for (auto it = m_lookup.begin(); it != m_lookup.end(); ++it)
+        m_length += it->second->length;
+
+    return true;
+}
+
+
+/*
+ * Unmap the index.
+ */
+void CSearchIndex::close()
+{
+    if (m_map != NULL)
+        munmap(m_map, m_size);
+
+    m_map     = NULL;
+    m_size    = 0;
+    m_docs    = 0;
+    m_length  = 0;
+    m_damaged = false;
+    m_segments.clear();
+    m_lookup.clear();
+}
+
+
+/*
+ * The number of messages in the mapped index.
+ */
+size_t CSearchIndex::rows()
+{
+    return (m_lookup.size());
+}
+
+
+/*
+ * The total number of terms in the messages of the mapped index.
+ */
+uint64_t CSearchIndex::length()
+{
+    return (m_length);
+}
+
+
+/*
+ * Find the given term in the given segment, by a binary search of its
+ * sorted terms.
+ */
+const CSearchIndex::CSearchTerm *CSearchIndex::find(const CSearchRef &segment, const std::string &term)
+{
+    uint32_t low  = 0;
+    uint32_t high = segment.term_count;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = strcmp(segment.pool + segment.terms[mid].name, term.c_str());
+
+        if (cmp == 0)
+            return (&segment.terms[mid]);
+
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return (NULL);
+}
+
+
+/*
+ * Decode the postings of the given term.
+ *
+ * The postings are pairs of varints: the difference between the offset
+ * of a message and that of the previous one, and the frequency of the
+ * term in the message.
+ */
+template<typename Fn>
+void CSearchIndex::each_posting(const CSearchRef &segment, const CSearchTerm &term, Fn fn)
+{
+    const uint8_t *ptr = segment.postings + term.offset;
+    const uint8_t *end = ptr + term.size;
+
+    uint32_t doc = 0;
+
+    for (uint32_t i = 0; i < term.count; i++)
+    {
+        uint32_t delta, frequency;
+
+        if ((! get_varint(ptr, end, delta)) || (! get_varint(ptr, end, frequency)))
+            return;
+
+        doc += delta;
+
+        if (doc >= segment.doc_count)
+            return;
+
+        fn(doc, frequency);
+    }
+}
+
+
+/*
+ * Is the given message the most recent entry for its file?
+ */
+bool CSearchIndex::is_live(const CSearchRef &segment, uint32_t doc)
+{
+    const char *id = segment.pool + segment.docs[doc].id;
+    auto it = m_lookup.find(hash_string(id, strlen(id)));
+
+    return ((it != m_lookup.end()) && (it->second == &segment.docs[doc]));
+}
+
+
+/*
+ * Find the messages which contain every one of the given terms.
+ *
+ * A message lives in a single segment, so each segment is searched by
+ * itself: the postings of its rarest term are the candidates, which are
+ * narrowed by those of each other term in turn.
+ */
+void CSearchIndex::search(const std::vector<std::string> &terms, std::vector<CSearchHit> &hits,
+                          std::vector<uint64_t> &documents)
+{
+    if (terms.empty())
+        return;
+
+    for (const CSearchRef &segment : m_segments)
+    {
+        std::vector<const CSearchTerm *> found(terms.size());
+        bool all = true;
+
+        for (size_t t = 0; t < terms.size(); t++)
+        {
+            found[t] = find(segment, terms[t]);
+
+            if (found[t] != NULL)
+                documents[t] += found[t]->count;
+            else
+                all = false;
+        }
+
+        if (! all)
+            continue;
+
+        /*
+         * The order in which we visit the terms, rarest first.
+         */
+        std::vector<size_t> order(terms.size());
+
+        for (size_t t = 0; t < order.size(); t++)
+            order[t] = t;
+
+        std::sort(order.begin(), order.end(), [&found](size_t a, size_t b)
+        {
+            return (found[a]->count < found[b]->count);
+        });
+
+        /*
+         * The candidate messages, and the frequency of each term in them.
+         */
+        std::vector<uint32_t> docs;
+        std::vector<std::vector<uint32_t>> frequency;
+
+        each_posting(segment, *found[order[0]], [&](uint32_t doc, uint32_t freq)
+        {
+            docs.push_back(doc);
+            frequency.push_back(std::vector<uint32_t>(terms.size(), 0));
+            frequency.back()[order[0]] = freq;
+        });
+
+        for (size_t i = 1; (i < order.size()) && (! docs.empty()); i++)
+        {
+            size_t t = order[i];
+            size_t pos = 0;
+            size_t kept = 0;
+
+            each_posting(segment, *found[t], [&](uint32_t doc, uint32_t freq)
+            {
+                while ((pos < docs.size()) && (docs[pos] < doc))
+                    pos++;
+
+                if ((pos < docs.size()) && (docs[pos] == doc))
+                {
+                    docs[kept] = doc;
+                    frequency[kept].swap(frequency[pos]);
+                    frequency[kept][t] = freq;
+                    kept++;
+                    pos++;
+                }
+            });
+
+            docs.resize(kept);
+            frequency.resize(kept);
+        }
+
+        for (size_t i = 0; i < docs.size(); i++)
+        {
+            if (! is_live(segment, docs[i]))
+                continue;
+
+            CSearchHit hit;
+            hit.id = segment.pool + segment.docs[docs[i]].id;
+            hit.frequency.swap(frequency[i]);
+            hit.length = segment.docs[docs[i]].length;
+            hits.push_back(hit);
+        }
+    }
+}
+
+
+/*
+ * Return the messages which aren't in the index.
+ */
+std::vector<CSearchEntry> CSearchIndex::unindexed(const std::string &maildir,
+        const std::vector<CSearchEntry> &entries)
+{
+    std::vector<CSearchEntry> result;
+
+    if (filename(maildir).empty())
+        return (result);
+
+    bool mapped = open(maildir);
+
+    for (const CSearchEntry &entry : entries)
+    {
+        if ((entry.inode == 0) || (mapped && is_indexed(entry.id, entry.inode)))
+            continue;
+
+        result.push_back(entry);
+    }
+
+    return (result);
+}
+
+
+/*
+ * Add messages to the index, reading them as we go.
+ */
+size_t CSearchIndex::update(const std::string &maildir, const std::vector<CSearchEntry> &entries, size_t limit)
+{
+    std::vector<CSearchEntry> added = unindexed(maildir, entries);
+
+    if ((limit > 0) && (added.size() > limit))
+        added.resize(limit);
+
+    CMessageTable *table = CMessageTable::instance();
+    std::vector<CSearchText> texts;
+
+    for (const CSearchEntry &entry : added)
+    {
+        CSearchText text;
+
+        if (read(table->path(entry.row), entry, text))
+            texts.push_back(std::move(text));
+    }
+
+    return (add(maildir, entries, texts));
+}
+
+
+/*
+ * Add the given texts to the index.
+ */
+size_t CSearchIndex::add(const std::string &maildir, const std::vector<CSearchEntry> &entries,
+                         const std::vector<CSearchText> &texts)
+{
+    if (filename(maildir).empty())
+        return 0;
+
+    bool mapped = open(maildir);
+
+    /*
+     * The number of messages which are in the index.
+     */
+    size_t live = 0;
+
+    for (const CSearchEntry &entry : entries)
+    {
+        if ((entry.inode != 0) && mapped && is_indexed(entry.id, entry.inode))
+            live += 1;
+    }
+
+    /*
+     * Texts which were read in the background might have been indexed
+     * since, or their messages removed.
+     */
+    std::unordered_map<std::string, uint64_t> present;
+
+    for (const CSearchEntry &entry : entries)
+        present[entry.id] = entry.inode;
+
+    std::vector<const CSearchText *> added;
+
+    for (const CSearchText &text : texts)
+    {
+        auto it = present.find(text.id);
+
+        if ((it == present.end()) || (it->second != text.inode))
+            continue;
+
+        if (mapped && is_indexed(text.id, text.inode))
+            continue;
+
+        added.push_back(&text);
+    }
+
+    /*
+     * Merge the segments if we can't append to them, if there are too
+     * many of them, or if most of their messages have gone.
+     */
+    bool merge = ((! mapped) || m_damaged || (m_segments.size() >= MAX_SEGMENTS) ||
+                  (m_docs > 2 * live));
+
+    if (added.empty() && ((! merge) || (! mapped)))
+        return 0;
+
+    CSearchBuilder builder;
+
+    if (merge)
+        add_existing(builder, entries);
+
+    for (const CSearchText *text : added)
+        add_text(builder, *text);
+
+    bool ok = merge ? rewrite(maildir, builder) : append(maildir, builder);
+
+    if (! ok)
+    {
+        CLogger::instance()->log("search", "Failed to write the index of %s", maildir.c_str());
+        return 0;
+    }
+
+    return (added.size());
+}
+
+
+/*
+ * Is the given message in the mapped index?
+ */
+bool CSearchIndex::is_indexed(const std::string &id, uint64_t inode)
+{
+    auto it = m_lookup.find(hash_string(id.data(), id.size()));
+
+    return ((it != m_lookup.end()) && (it->second->inode == inode));
+}
+
+
+/*
+ * Read the text of the given message, and count its terms.
+ */
+bool CSearchIndex::read(const std::string &path, const CSearchEntry &entry, CSearchText &text)
+{
+    std::string block;
+
+    if (! CMessage::read_header_block(path, block))
+        return false;
+
+    CHeaderArena headers;
+    CMessage::parse_headers(block, headers);
+
+    text.id     = entry.id;
+    text.inode  = entry.inode;
+    text.length = 0;
+    text.counts.clear();
+
+    const char *names[] = { "from", "to", "cc", "subject" };
+
+    for (const char *name : names)
+    {
+        size_t len = 0;
+        const char *value = headers.find(name, &len);
+
+        if (value == NULL)
+            continue;
+
+        for (const std::string &term : terms(std::string(value, len)))
+        {
+            text.counts[term] += HEADER_WEIGHT;
+            text.length += 1;
+        }
+    }
+
+    /*
+     * A message we can't parse is still indexed by its headers.
+     */
+    std::string body;
+    CMessage::read_text(path, body, MAX_BODY_TEXT);
+
+    for (const std::string &term : terms(body))
+    {
+        text.counts[term] += 1;
+        text.length += 1;
+    }
+
+    return true;
+}
+
+
+/*
+ * Add the terms of a message to the given builder.
+ */
+void CSearchIndex::add_text(CSearchBuilder &builder, const CSearchText &text)
+{
+    CSearchDoc doc;
+    memset(&doc, 0, sizeof(doc));
+    doc.inode  = text.inode;
+    doc.id     = builder.pool.size();
+    doc.length = text.length;
+
+    builder.pool.append(text.id.c_str(), text.id.size() + 1);
+
+    uint32_t offset = builder.docs.size();
+    builder.docs.push_back(doc);
+
+    for (auto it = text.counts.begin(); it != text.counts.end(); ++it)
+        builder.postings[it->first].push_back(std::make_pair(offset, it->second));
+}
+
+
+/*
+ * Add the messages of the mapped index which are still present.
+ *
+ * Their postings are copied, with the offsets of the messages changed,
+ * so merging the segments needn't read any message again.
+ */
+void CSearchIndex::add_existing(CSearchBuilder &builder, const std::vector<CSearchEntry> &entries)
+{
+    std::unordered_map<std::string, uint64_t> present;
+
+    for (const CSearchEntry &entry : entries)
+        present[entry.id] = entry.inode;
+
+    for (const CSearchRef &segment : m_segments)
+    {
+        /*
+         * The offset of each message of the segment in the builder, or -1
+         * for those we're dropping.
+         */
+        std::vector<int64_t> offsets(segment.doc_count, -1);
+
+        for (uint32_t i = 0; i < segment.doc_count; i++)
+        {
+            const char *id = segment.pool + segment.docs[i].id;
+            auto it = present.find(id);
+
+            if ((it == present.end()) || (it->second != segment.docs[i].inode) || (! is_live(segment, i)))
+                continue;
+
+            CSearchDoc doc = segment.docs[i];
+            doc.id = builder.pool.size();
+            builder.pool.append(id, strlen(id) + 1);
+
+            offsets[i] = builder.docs.size();
+            builder.docs.push_back(doc);
+        }
+
+        for (uint32_t i = 0; i < segment.term_count; i++)
+        {
+            std::vector<std::pair<uint32_t, uint32_t>> *postings = NULL;
+
+            each_posting(segment, segment.terms[i], [&](uint32_t doc, uint32_t freq)
+            {
+                if (offsets[doc] < 0)
+                    return;
+
+                if (postings == NULL)
+                    postings = &builder.postings[segment.pool + segment.terms[i].name];
+
+                postings->push_back(std::make_pair((uint32_t)offsets[doc], freq));
+            });
+        }
+    }
+}
+
+
+/*
+ * Write a segment containing the given messages.
+ */
+void CSearchIndex::write_segment(std::ostream &out, const CSearchBuilder &builder)
+{
+    std::string pool = builder.pool;
+    std::string postings;
+    std::vector<CSearchTerm> terms;
+    terms.reserve(builder.postings.size());
+
+    for (auto it = builder.postings.begin(); it != builder.postings.end(); ++it)
+    {
+        CSearchTerm term;
+        term.name   = pool.size();
+        term.count  = it->second.size();
+        term.offset = postings.size();
+
+        pool.append(it->first.c_str(), it->first.size() + 1);
+
+        uint32_t previous = 0;
+
+        for (const std::pair<uint32_t, uint32_t> &posting : it->second)
+        {
+            put_varint(postings, posting.first - previous);
+            put_varint(postings, posting.second);
+            previous = posting.first;
+        }
+
+        term.size = postings.size() - term.offset;
+        terms.push_back(term);
+    }
+
+    /*
+     * Pad the pool, which also ensures it isn't empty, and the postings.
+     */
+    pool.append(8 - (pool.size() % 8), '\0');
+    postings.append((8 - (postings.size() % 8)) % 8, '\0');
+
+    CSearchSegment segment;
+    segment.docs     = builder.docs.size();
+    segment.terms    = terms.size();
+    segment.pool     = pool.size();
+    segment.postings = postings.size();
+
+    out.write((const char *)&segment, sizeof(segment));
+    out.write((const char *)builder.docs.data(), builder.docs.size() * sizeof(CSearchDoc));
+    out.write((const char *)terms.data(), terms.size() * sizeof(CSearchTerm));
+    out.write(pool.data(), pool.size());
+    out.write(postings.data(), postings.size());
+}
+
+
+/*
+ * Rewrite the index from scratch, via a temporary file.
+ */
+bool CSearchIndex::rewrite(const std::string &maildir, const CSearchBuilder &builder)
+{
+    std::string path = filename(maildir);
+
+    CDirectory::mkdir_p(path.substr(0, path.rfind('/')));
+
+    CSearchHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEARCH_MAGIC, sizeof(header.magic));
+    header.version   = SEARCH_VERSION;
+    header.doc_size  = sizeof(CSearchDoc);
+    header.term_size = sizeof(CSearchTerm);
+    header.maildir   = hash_string(maildir.data(), maildir.size());
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    out.write((const char *)&header, sizeof(header));
+
+    if (! builder.docs.empty())
+        write_segment(out, builder);
+
+    out.close();
+
+    if ((! out.good()) || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    CLogger::instance()->log("search", "Wrote %d message(s) to the index of %s",
+                             (int)builder.docs.size(), maildir.c_str());
+    return true;
+}
+
+
+/*
+ * Append the given messages to the index.
+ */
+bool CSearchIndex::append(const std::string &maildir, const CSearchBuilder &builder)
+{
+    std::ofstream out(filename(maildir), std::ios::out | std::ios::binary | std::ios::app);
+
+    write_segment(out, builder);
+    out.close();
+
+    CLogger::instance()->log("search", "Added %d message(s) to the index of %s",
+                             (int)builder.docs.size(), maildir.c_str());
+
+    return (out.good());
+}
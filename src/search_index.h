@@ -0,0 +1,374 @@
+/*
+ * search_index.h - A persistent, memory-mapped, full-text index of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * A message to be recorded in a full-text index.
+ */
+struct CSearchEntry
+{
+    /**
+     * The unique-name of the message-file, which doesn't change when
+     * its flags do.
+     */
+    std::string id;
+
+    /**
+     * The inode-number of the message-file.
+     */
+    uint64_t inode;
+
+    /**
+     * The row of the message-table which describes the message.
+     */
+    uint32_t row;
+};
+
+
+/**
+ * The terms of a message, counted, ready to be added to an index.
+ */
+struct CSearchText
+{
+    /**
+     * The unique-name and inode-number of the message-file.
+     */
+    std::string id;
+    uint64_t inode;
+
+    /**
+     * The weighted number of times each term occurs, and the number of
+     * terms the message contains.
+     */
+    std::unordered_map<std::string, uint32_t> counts;
+    uint32_t length;
+};
+
+
+/**
+ * A message which contains every term of a search.
+ */
+struct CSearchHit
+{
+    /**
+     * The unique-name of the message-file.
+     */
+    std::string id;
+
+    /**
+     * The number of times each term of the search occurs in the message,
+     * and the number of terms the message contains.
+     */
+    std::vector<uint32_t> frequency;
+    uint32_t length;
+};
+
+
+/**
+ * The CSearchIndex class stores the words of the `From:`, `To:`, `Cc:`
+ * and `Subject:` headers of each message in a maildir, and of its text
+ * parts, such that the messages containing a word can be found without
+ * reading any of them.
+ *
+ * The index is a binary file beneath `cache.prefix`, which is mapped
+ * into memory rather than read.  After a small header it contains a
+ * series of segments, each describing a number of messages: an array
+ * of the messages, a sorted array of the words they contain, and for
+ * each word the list of messages containing it - compressed as varints.
+ * New messages are appended as a new segment, and the segments are only
+ * merged once most of the messages they describe are gone, or there
+ * are too many of them.
+ *
+ * As with the `CSummaryIndex` messages are keyed by the unique-name and
+ * inode of their file, so reading the maildir's directories tells us
+ * which messages are yet to be indexed.
+ *
+ */
+class CSearchIndex
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CSearchIndex();
+
+    /**
+     * Destructor.
+     */
+    ~CSearchIndex();
+
+public:
+
+    /**
+     * Map the index of the given maildir, returning false if it has no
+     * usable index.
+     *
+     * If the index is already mapped, and the file is unchanged, this
+     * costs a single `stat()`.
+     */
+    bool open(const std::string &maildir);
+
+    /**
+     * Return those of the given messages which aren't in the index of the
+     * given maildir.
+     */
+    std::vector<CSearchEntry> unindexed(const std::string &maildir,
+                                        const std::vector<CSearchEntry> &entries);
+
+    /**
+     * Add up to `limit` of the given messages which aren't in the index
+     * of the given maildir, reading the text of each, and return the
+     * number added.
+     *
+     * A limit of zero adds them all.
+     */
+    size_t update(const std::string &maildir, const std::vector<CSearchEntry> &entries, size_t limit = 0);
+
+    /**
+     * Add the given texts, read by `read()`, to the index of the given
+     * maildir - whose messages are now the given entries - returning the
+     * number added.
+     *
+     * Texts of messages which have been indexed, or removed, since they
+     * were read are skipped.
+     */
+    size_t add(const std::string &maildir, const std::vector<CSearchEntry> &entries,
+               const std::vector<CSearchText> &texts);
+
+    /**
+     * Read the message-file with the given path, described by the given
+     * entry, and count the terms it contains - returning false if the
+     * file cannot be read.
+     *
+     * This touches no shared state, so it may be called from any thread.
+     */
+    static bool read(const std::string &path, const CSearchEntry &entry, CSearchText &text);
+
+    /**
+     * Find the messages in the mapped index which contain every one of
+     * the given terms.
+     *
+     * The number of messages containing each term is added to
+     * `documents`, which must have an entry for each term.
+     */
+    void search(const std::vector<std::string> &terms, std::vector<CSearchHit> &hits,
+                std::vector<uint64_t> &documents);
+
+    /**
+     * Unmap the index, if it is mapped.
+     */
+    void close();
+
+    /**
+     * The number of messages in the mapped index, and the total number of
+     * terms they contain.
+     */
+    size_t rows();
+    uint64_t length();
+
+    /**
+     * The path of the index of the given maildir, or "" if `cache.prefix`
+     * is unset.
+     */
+    static std::string filename(const std::string &maildir);
+
+    /**
+     * Split the given text into the terms we index - runs of letters and
+     * digits, lower-cased.
+     */
+    static std::vector<std::string> terms(const std::string &text);
+
+private:
+
+    /**
+     * A message, as it is stored on disk.
+     */
+    struct CSearchDoc
+    {
+        uint64_t inode;
+
+        /**
+         * The offset of the unique-name in the string-pool of the segment.
+         */
+        uint32_t id;
+
+        /**
+         * The number of terms the message contains.
+         */
+        uint32_t length;
+    };
+
+    /**
+     * A term, as it is stored on disk.
+     */
+    struct CSearchTerm
+    {
+        /**
+         * The offset of the term in the string-pool of the segment.
+         */
+        uint32_t name;
+
+        /**
+         * The number of messages containing the term, and the range of
+         * the postings of the segment which lists them.
+         */
+        uint32_t count;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    /**
+     * A segment of the mapped index.
+     */
+    struct CSearchRef
+    {
+        const CSearchDoc *docs;
+        uint32_t doc_count;
+
+        const CSearchTerm *terms;
+        uint32_t term_count;
+
+        const char *pool;
+        uint32_t pool_size;
+
+        const uint8_t *postings;
+        uint32_t postings_size;
+    };
+
+    /**
+     * Messages, and the terms they contain, which are to be written as
+     * a segment.
+     */
+    struct CSearchBuilder
+    {
+        std::vector<CSearchDoc> docs;
+        std::string pool;
+
+        /**
+         * The messages containing each term, as pairs of their offset in
+         * `docs` and the number of times the term occurs.
+         */
+        std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> postings;
+    };
+
+    /**
+     * Find the given term in the given segment, or NULL.
+     */
+    const CSearchTerm *find(const CSearchRef &segment, const std::string &term);
+
+    /**
+     * Decode the postings of the given term, calling `fn` with the offset
+     * of each message and the frequency of the term.
+     */
+    template<typename Fn>
+    static void each_posting(const CSearchRef &segment, const CSearchTerm &term, Fn fn);
+
+    /**
+     * Is the given message of the given segment the most recent entry
+     * for its file?
+     */
+    bool is_live(const CSearchRef &segment, uint32_t doc);
+
+    /**
+     * Walk the segments of the mapped file, returning false if its header
+     * is invalid.
+     */
+    bool load(const std::string &maildir);
+
+    /**
+     * Is the message-file with the given unique-name and inode in the
+     * mapped index?
+     */
+    bool is_indexed(const std::string &id, uint64_t inode);
+
+    /**
+     * Add the terms of a message to the given builder.
+     */
+    static void add_text(CSearchBuilder &builder, const CSearchText &text);
+
+    /**
+     * Add the messages of the mapped index which are still present in
+     * the maildir to the given builder.
+     */
+    void add_existing(CSearchBuilder &builder, const std::vector<CSearchEntry> &entries);
+
+    /**
+     * Write the given builder to the end of the given stream, as a single
+     * segment.
+     */
+    static void write_segment(std::ostream &out, const CSearchBuilder &builder);
+
+    /**
+     * Rewrite the index from scratch, or append a segment to it.
+     */
+    bool rewrite(const std::string &maildir, const CSearchBuilder &builder);
+    bool append(const std::string &maildir, const CSearchBuilder &builder);
+
+private:
+
+    /**
+     * The mapped file, and its size.
+     */
+    void *m_map;
+    size_t m_size;
+
+    /**
+     * The identity of the mapped file.
+     */
+    ino_t m_inode;
+    int64_t m_mtime;
+
+    /**
+     * The segments of the mapped file.
+     */
+    std::vector<CSearchRef> m_segments;
+
+    /**
+     * The number of messages in the mapped file, including any which have
+     * been replaced by a later segment.
+     */
+    size_t m_docs;
+
+    /**
+     * The total number of terms in the messages which haven't been
+     * replaced.
+     */
+    uint64_t m_length;
+
+    /**
+     * Did the mapped file end with a partial segment?
+     */
+    bool m_damaged;
+
+    /**
+     * The most recent entry of each message, keyed by a hash of its
+     * unique-name.
+     */
+    std::unordered_map<uint64_t, const CSearchDoc *> m_lookup;
+};
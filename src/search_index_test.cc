@@ -0,0 +1,219 @@
+/*
+ * search_index_test.cc - Test-cases for our full-text index.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "message_table.h"
+#include "search_index.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Write a message to the given maildir, returning its entry.
+ */
+static CSearchEntry search_entry(const std::string &maildir, const std::string &id,
+                                 const std::string &subject, const std::string &body)
+{
+    std::string path = maildir + "/" + id + ":2,S";
+
+    std::ofstream out(path);
+    out << "From: Steve Kemp <steve@example.com>\n";
+    out << "Subject: " << subject << "\n";
+    out << "Content-Type: text/plain\n\n";
+    out << body << "\n";
+    out.close();
+
+    struct stat sb;
+    stat(path.c_str(), &sb);
+
+    CSearchEntry entry;
+    entry.id    = id;
+    entry.inode = sb.st_ino;
+    entry.row   = CMessageTable::instance()->insert(path);
+
+    return (entry);
+}
+
+
+/**
+ * Search the given index, returning the unique-names of the messages
+ * found - in order.
+ */
+static std::string search_ids(CSearchIndex &index, const std::string &query)
+{
+    std::vector<std::string> terms = CSearchIndex::terms(query);
+    std::vector<uint64_t> documents(terms.size(), 0);
+    std::vector<CSearchHit> hits;
+
+    index.search(terms, hits, documents);
+
+    std::string out;
+
+    for (CSearchHit &hit : hits)
+        out += (out.empty() ? "" : " ") + hit.id;
+
+    return (out);
+}
+
+
+/**
+ * Test that text is split into terms.
+ */
+void TestSearchIndexTerms(CuTest * tc)
+{
+    std::vector<std::string> terms = CSearchIndex::terms("Steve <STEVE@example.com>, a Café-1984!");
+
+    CuAssertIntEquals(tc, 6, terms.size());
+    CuAssertStrEquals(tc, "steve", terms[0].c_str());
+    CuAssertStrEquals(tc, "steve", terms[1].c_str());
+    CuAssertStrEquals(tc, "example", terms[2].c_str());
+    CuAssertStrEquals(tc, "com", terms[3].c_str());
+    CuAssertStrEquals(tc, "café", terms[4].c_str());
+    CuAssertStrEquals(tc, "1984", terms[5].c_str());
+
+    CuAssertIntEquals(tc, 0, CSearchIndex::terms(" - a b ").size());
+}
+
+
+/**
+ * Test that messages are indexed, appended, merged, and found.
+ */
+void TestSearchIndexUpdate(CuTest * tc)
+{
+    char tmpl[] = "/tmp/search.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    CConfig *config = CConfig::instance();
+    std::string previous = config->get_string("cache.prefix");
+    config->set("cache.prefix", std::string(tmpl), false);
+
+    CMessageTable *table = CMessageTable::instance();
+    std::string maildir(tmpl);
+    std::string file = CSearchIndex::filename(maildir);
+
+    std::vector<CSearchEntry> entries;
+    entries.push_back(search_entry(maildir, "1.one", "Lunch on Friday", "Shall we meet at noon?"));
+    entries.push_back(search_entry(maildir, "2.two", "Invoice", "The invoice for March is attached."));
+
+    CSearchIndex index;
+    CuAssertTrue(tc, ! index.open(maildir));
+    CuAssertIntEquals(tc, 2, index.update(maildir, entries));
+    CuAssertIntEquals(tc, 0, index.update(maildir, entries));
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 2, index.rows());
+
+    /*
+     * Every term must be present, in a header or the body.
+     */
+    CuAssertStrEquals(tc, "1.one", search_ids(index, "lunch").c_str());
+    CuAssertStrEquals(tc, "1.one", search_ids(index, "NOON friday").c_str());
+    CuAssertStrEquals(tc, "2.two", search_ids(index, "invoice march").c_str());
+    CuAssertStrEquals(tc, "1.one 2.two", search_ids(index, "steve").c_str());
+    CuAssertStrEquals(tc, "", search_ids(index, "lunch march").c_str());
+    CuAssertStrEquals(tc, "", search_ids(index, "nothing").c_str());
+
+    /*
+     * Headers count for more than the body.
+     */
+    std::vector<std::string> terms = CSearchIndex::terms("invoice");
+    std::vector<uint64_t> documents(1, 0);
+    std::vector<CSearchHit> hits;
+    index.search(terms, hits, documents);
+
+    CuAssertIntEquals(tc, 1, hits.size());
+    CuAssertIntEquals(tc, 5, hits[0].frequency[0]);
+    CuAssertIntEquals(tc, 1, documents[0]);
+
+    /*
+     * New messages are appended, a few at a time if we like.
+     */
+    struct stat before;
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &before));
+
+    entries.push_back(search_entry(maildir, "3.three", "Re: Lunch", "Noon is fine."));
+    entries.push_back(search_entry(maildir, "4.four", "Holiday", "Back on Monday."));
+    CuAssertIntEquals(tc, 1, index.update(maildir, entries, 1));
+    CuAssertIntEquals(tc, 1, index.update(maildir, entries, 1));
+
+    struct stat after;
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &after));
+    CuAssertTrue(tc, before.st_ino == after.st_ino);
+
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 4, index.rows());
+    CuAssertStrEquals(tc, "1.one 3.three", search_ids(index, "lunch").c_str());
+    CuAssertStrEquals(tc, "4.four", search_ids(index, "monday").c_str());
+
+    /*
+     * Once most of the messages have gone the segments are merged, and
+     * the remaining messages are found without being read again.
+     */
+    std::vector<CSearchEntry> remaining;
+    remaining.push_back(entries[2]);
+    CuAssertIntEquals(tc, 0, index.update(maildir, remaining));
+
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &after));
+    CuAssertTrue(tc, before.st_ino != after.st_ino);
+
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 1, index.rows());
+    CuAssertStrEquals(tc, "3.three", search_ids(index, "lunch noon").c_str());
+    CuAssertStrEquals(tc, "", search_ids(index, "monday").c_str());
+
+    /*
+     * The index of one maildir is no use to another.
+     */
+    CSearchIndex other;
+    rename(file.c_str(), CSearchIndex::filename(maildir + "2").c_str());
+    CuAssertTrue(tc, ! other.open(maildir + "2"));
+
+    index.close();
+    other.close();
+
+    for (CSearchEntry &entry : entries)
+    {
+        unlink(table->path(entry.row).c_str());
+        table->release(entry.row);
+    }
+
+    unlink(CSearchIndex::filename(maildir + "2").c_str());
+    rmdir((maildir + "/search").c_str());
+    rmdir(tmpl);
+
+    config->set("cache.prefix", previous, false);
+}
+
+
+
+CuSuite *
+search_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSearchIndexTerms);
+    SUITE_ADD_TEST(suite, TestSearchIndexUpdate);
+    return suite;
+}
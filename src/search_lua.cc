@@ -0,0 +1,121 @@
+/*
+ * search_lua.cc - Export our full-text search to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "global_state.h"
+#include "lua.h"
+#include "message_lua.h"
+
+
+/**
+ * @file search_lua.cc
+ *
+ * This file implements the exporting of our full-text index, which
+ * covers every local maildir, to Lua.  Usage looks like this:
+ *
+ *<code>
+ *   -- Index up to 1000 messages we've not indexed already, in the background<br />
+ *   Search:update(1000)<br />
+ * <br/>
+ *   -- Find the messages containing both words<br />
+ *   local msgs = Search:query( "invoice march" )<br />
+ *</code>
+ *
+ */
+
+
+/**
+ * The number of results `Search:query` returns, by default.
+ */
+#define DEFAULT_SEARCH_LIMIT 100
+
+
+/**
+ * Implementation of `Search:query`.
+ *
+ * Return a table of the messages containing every word of the query,
+ * the best matches first.
+ */
+int l_CSearch_query(lua_State * l)
+{
+    CLuaLog("l_CSearch_query");
+
+    const char *query = luaL_checkstring(l, 2);
+    int limit = luaL_optinteger(l, 3, DEFAULT_SEARCH_LIMIT);
+
+    CGlobalState *global = CGlobalState::instance();
+    CMessageList found = global->search(query, (limit > 0) ? limit : 0);
+
+    lua_createtable(l, found.size(), 0);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        push_cmessage(l, found[i]);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Search:update`.
+ *
+ * Queue up to the given number of messages to be added to the index in
+ * the background, returning the number queued.
+ */
+int l_CSearch_update(lua_State * l)
+{
+    CLuaLog("l_CSearch_update");
+
+    int limit = luaL_optinteger(l, 2, 0);
+
+    CGlobalState *global = CGlobalState::instance();
+    size_t queued = global->update_search((limit > 0) ? limit : 0);
+
+    lua_pushinteger(l, queued);
+    return 1;
+}
+
+
+/**
+ * Register the global `Search` object to the Lua environment, and
+ * setup our public methods upon which the user may operate.
+ */
+void InitSearch(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"query", l_CSearch_query},
+        {"update", l_CSearch_update},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CSearch");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Search");
+}
@@ -0,0 +1,494 @@
+/*
+ * summary_index.cc - A persistent, memory-mapped, summary of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "logger.h"
+#include "summary_index.h"
+#include "util.h"
+
+
+/*
+ * The header of an index-file.
+ *
+ * The size of a row is recorded so that a change to its layout makes
+ * existing files invalid, even if we forget to bump the version.
+ */
+struct CSummaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t row_size;
+    uint64_t maildir;
+};
+
+
+/*
+ * The header of each segment, which is followed by its rows and then
+ * its string-pool.  The pool is padded to a multiple of eight bytes,
+ * so that the next segment is aligned.
+ */
+struct CSummarySegment
+{
+    uint32_t rows;
+    uint32_t pool;
+};
+
+
+#define SUMMARY_MAGIC   "LUMAILSI"
+#define SUMMARY_VERSION 3
+
+
+/*
+ * The offset we use for a missing string.
+ */
+#define NO_STRING 0xFFFFFFFF
+
+
+/*
+ * Constructor.
+ */
+CSummaryIndex::CSummaryIndex()
+{
+    m_map     = NULL;
+    m_size    = 0;
+    m_inode   = 0;
+    m_mtime   = 0;
+    m_rows    = 0;
+    m_damaged = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CSummaryIndex::~CSummaryIndex()
+{
+    close();
+}
+
+
+/*
+ * The path of the index of the given maildir.
+ *
+ * This is named for a hash of the maildir's path, which is also stored
+ * in the file, since maildirs may be nested and their names contain
+ * anything at all.
+ */
+std::string CSummaryIndex::filename(const std::string &maildir)
+{
+    CConfig *config = CConfig::instance();
+    std::string prefix = config->get_string("cache.prefix");
+
+    if (prefix.empty())
+        return "";
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx",
+             (unsigned long long)hash_string(maildir.data(), maildir.size()));
+
+    return (prefix + "/summary/" + name);
+}
+
+
+/*
+ * Map the index of the given maildir.
+ */
+bool CSummaryIndex::open(const std::string &maildir)
+{
+    std::string path = filename(maildir);
+
+    struct stat sb;
+
+    if (path.empty() || (stat(path.c_str(), &sb) != 0))
+    {
+        close();
+        return false;
+    }
+
+    /*
+     * If the file is unchanged so is our mapping.
+     */
+    if ((m_map != NULL) && (sb.st_ino == m_inode) &&
+            ((size_t)sb.st_size == m_size) && (CFile::mtime_ns(sb) == m_mtime))
+        return true;
+
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    if ((fstat(fd, &sb) != 0) || (sb.st_size < (off_t)sizeof(CSummaryHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map   = map;
+    m_size  = sb.st_size;
+    m_inode = sb.st_ino;
+    m_mtime = CFile::mtime_ns(sb);
+
+    if (! load(maildir))
+    {
+        CLogger::instance()->log("summary", "Ignoring invalid index %s", path.c_str());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Walk the segments of the mapped file.
+ *
+ * The file might have been truncated by a crash, or damaged, so every
+ * offset is checked before it is used.  Later segments replace the rows
+ * of earlier ones.
+ */
+bool CSummaryIndex::load(const std::string &maildir)
+{
+    const char *base = (const char *)m_map;
+    const CSummaryHeader *header = (const CSummaryHeader *)base;
+
+    if ((memcmp(header->magic, SUMMARY_MAGIC, sizeof(header->magic)) != 0) ||
+            (header->version != SUMMARY_VERSION) ||
+            (header->row_size != sizeof(CSummaryRow)) ||
+            (header->maildir != hash_string(maildir.data(), maildir.size())))
+        return false;
+
+    size_t offset = sizeof(CSummaryHeader);
+
+    while (offset < m_size)
+    {
+        if (m_size - offset < sizeof(CSummarySegment))
+        {
+            m_damaged = true;
+            break;
+        }
+
+        const CSummarySegment *segment = (const CSummarySegment *)(base + offset);
+        offset += sizeof(CSummarySegment);
+
+        size_t available = m_size - offset;
+
+        if ((segment->rows > available / sizeof(CSummaryRow)) ||
+                (segment->pool > available - segment->rows * sizeof(CSummaryRow)) ||
+                (segment->pool == 0) || ((segment->pool % 8) != 0))
+        {
+            m_damaged = true;
+            break;
+        }
+
+        const CSummaryRow *rows = (const CSummaryRow *)(base + offset);
+        const char *pool = base + offset + segment->rows * sizeof(CSummaryRow);
+
+        /*
+         * As the pool ends with a NUL every offset within it is a string.
+         */
+        if (pool[segment->pool - 1] != '\0')
+        {
+            m_damaged = true;
+            break;
+        }
+
+        for (uint32_t i = 0; i < segment->rows; i++)
+        {
+            if (rows[i].id >= segment->pool)
+                continue;
+
+            const char *id = pool + rows[i].id;
+
+            CSummaryRef &ref = m_lookup[hash_string(id, strlen(id))];
+            ref.row       = &rows[i];
+            ref.pool      = pool;
+            ref.pool_size = segment->pool;
+
+            m_rows += 1;
+        }
+
+        offset += segment->rows * sizeof(CSummaryRow) + segment->pool;
+    }
+
+    return true;
+}
+
+
+/*
+ * Unmap the index.
+ */
+void CSummaryIndex::close()
+{
+    if (m_map != NULL)
+        munmap(m_map, m_size);
+
+    m_map     = NULL;
+    m_size    = 0;
+    m_rows    = 0;
+    m_damaged = false;
+    m_lookup.clear();
+}
+
+
+/*
+ * The number of rows in the mapped index.
+ */
+size_t CSummaryIndex::rows()
+{
+    return (m_lookup.size());
+}
+
+
+/*
+ * Find the row with the given unique-name.
+ */
+const CSummaryIndex::CSummaryRef *CSummaryIndex::find(const std::string &id)
+{
+    auto it = m_lookup.find(hash_string(id.data(), id.size()));
+
+    if (it == m_lookup.end())
+        return NULL;
+
+    /*
+     * Two names might share a hash.
+     */
+    if (strcmp(it->second.pool + it->second.row->id, id.c_str()) != 0)
+        return NULL;
+
+    return (&it->second);
+}
+
+
+/*
+ * Store the summary of the given message in the message-table.
+ */
+bool CSummaryIndex::apply(const std::string &id, uint64_t inode, uint32_t row)
+{
+    const CSummaryRef *ref = find(id);
+
+    /*
+     * A message delivered again, under the same name, is a new file.
+     */
+    if ((ref == NULL) || (ref->row->inode != inode))
+        return false;
+
+    const char *values[CMessageTable::HEADER_COUNT];
+
+    for (int i = 0; i < CMessageTable::HEADER_COUNT; i++)
+    {
+        uint32_t offset = ref->row->headers[i];
+        values[i] = (offset < ref->pool_size) ? ref->pool + offset : NULL;
+    }
+
+    CMessageTable *table = CMessageTable::instance();
+    table->set_headers(row, values, ref->row->date, ref->row->hints);
+    table->set_stat(row, ref->row->mtime, ref->row->size);
+
+    return true;
+}
+
+
+/*
+ * Bring the index up to date.
+ */
+bool CSummaryIndex::update(const std::string &maildir, const std::vector<CSummaryEntry> &entries)
+{
+    if (filename(maildir).empty())
+        return true;
+
+    bool mapped = open(maildir);
+
+    CMessageTable *table = CMessageTable::instance();
+
+    /*
+     * The messages we can summarise, and those of them which aren't
+     * in the index already.
+     */
+    std::vector<const CSummaryEntry *> all;
+    std::vector<const CSummaryEntry *> added;
+
+    for (const CSummaryEntry &entry : entries)
+    {
+        if ((entry.inode == 0) || !(table->state(entry.row) & CMessageTable::STATE_HEADERS))
+            continue;
+
+        all.push_back(&entry);
+
+        const CSummaryRef *ref = mapped ? find(entry.id) : NULL;
+
+        if ((ref == NULL) || (ref->row->inode != entry.inode))
+            added.push_back(&entry);
+    }
+
+    size_t live = all.size() - added.size();
+
+    /*
+     * Rewrite the index if we can't append to it, or if most of its rows
+     * are for messages which have gone.
+     */
+    if ((! mapped) || m_damaged || (m_rows > 2 * live))
+    {
+        if ((! mapped) && all.empty())
+            return true;
+
+        return (rewrite(maildir, all));
+    }
+
+    if (added.empty())
+        return true;
+
+    return (append(maildir, added));
+}
+
+
+/*
+ * Write a segment containing the given messages.
+ */
+void CSummaryIndex::write_segment(std::ostream &out, const std::vector<const CSummaryEntry *> &entries)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    std::vector<CSummaryRow> rows(entries.size());
+    std::string pool;
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const CSummaryEntry *entry = entries[i];
+        CSummaryRow &row = rows[i];
+
+        /*
+         * Clear any padding, so the file's contents are predictable.
+         */
+        memset(&row, 0, sizeof(row));
+
+        row.inode = entry->inode;
+        row.mtime = table->mtime(entry->row);
+        row.size  = table->size(entry->row);
+        row.date  = table->date(entry->row);
+        row.hints = table->hints(entry->row);
+
+        row.id = pool.size();
+        pool.append(entry->id.c_str(), entry->id.size() + 1);
+
+        for (int h = 0; h < CMessageTable::HEADER_COUNT; h++)
+        {
+            CMessageTable::CKeyHeader key = (CMessageTable::CKeyHeader)h;
+
+            if (! table->has_header(entry->row, key))
+            {
+                row.headers[h] = NO_STRING;
+                continue;
+            }
+
+            std::string value = table->header(entry->row, key);
+
+            row.headers[h] = pool.size();
+            pool.append(value.c_str(), value.size() + 1);
+        }
+    }
+
+    /*
+     * Pad the pool, which also ensures it isn't empty.
+     */
+    pool.append(8 - (pool.size() % 8), '\0');
+
+    CSummarySegment segment;
+    segment.rows = rows.size();
+    segment.pool = pool.size();
+
+    out.write((const char *)&segment, sizeof(segment));
+    out.write((const char *)rows.data(), rows.size() * sizeof(CSummaryRow));
+    out.write(pool.data(), pool.size());
+}
+
+
+/*
+ * Rewrite the index from scratch.
+ *
+ * We write to a temporary file, then rename into place, so that an
+ * interrupted save doesn't leave us with a truncated index.
+ */
+bool CSummaryIndex::rewrite(const std::string &maildir, const std::vector<const CSummaryEntry *> &entries)
+{
+    std::string path = filename(maildir);
+
+    CDirectory::mkdir_p(path.substr(0, path.rfind('/')));
+
+    CSummaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SUMMARY_MAGIC, sizeof(header.magic));
+    header.version  = SUMMARY_VERSION;
+    header.row_size = sizeof(CSummaryRow);
+    header.maildir  = hash_string(maildir.data(), maildir.size());
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    out.write((const char *)&header, sizeof(header));
+
+    if (! entries.empty())
+        write_segment(out, entries);
+
+    out.close();
+
+    if ((! out.good()) || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    CLogger::instance()->log("summary", "Wrote %d message(s) to the index of %s",
+                             (int)entries.size(), maildir.c_str());
+    return true;
+}
+
+
+/*
+ * Append the given messages to the index.
+ */
+bool CSummaryIndex::append(const std::string &maildir, const std::vector<const CSummaryEntry *> &entries)
+{
+    std::ofstream out(filename(maildir), std::ios::out | std::ios::binary | std::ios::app);
+
+    write_segment(out, entries);
+    out.close();
+
+    CLogger::instance()->log("summary", "Added %d message(s) to the index of %s",
+                             (int)entries.size(), maildir.c_str());
+
+    return (out.good());
+}
@@ -0,0 +1,220 @@
+/*
+ * summary_index.h - A persistent, memory-mapped, summary of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "message_table.h"
+
+
+/**
+ * A message to be recorded in a summary-index.
+ */
+struct CSummaryEntry
+{
+    /**
+     * The unique-name of the message-file, which doesn't change when
+     * its flags do.
+     */
+    std::string id;
+
+    /**
+     * The inode-number of the message-file.
+     */
+    uint64_t inode;
+
+    /**
+     * The row of the message-table which describes the message.
+     */
+    uint32_t row;
+};
+
+
+/**
+ * The CSummaryIndex class stores the key headers of each message in a
+ * maildir, along with its date, size, modification-time, and hints,
+ * such that they need not be parsed again when the folder is next
+ * opened.
+ *
+ * The index is a binary file beneath `cache.prefix`, which is mapped
+ * into memory rather than read.  After a small header it contains a
+ * series of segments, each holding a number of fixed-size rows and the
+ * strings they refer to.  New messages are appended as a new segment,
+ * and the file is only rewritten once most of its rows describe
+ * messages which no longer exist.
+ *
+ * A row is keyed by the unique-name and inode of its message-file,
+ * both of which we learn by reading the maildir's directories, so
+ * applying the index costs no `stat()` of any message.  The mapping
+ * itself is only replaced if the inode, size, or modification-time of
+ * the index-file change.
+ *
+ * Flags are not stored, since they are part of each filename.
+ *
+ */
+class CSummaryIndex
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CSummaryIndex();
+
+    /**
+     * Destructor.
+     */
+    ~CSummaryIndex();
+
+public:
+
+    /**
+     * Map the index of the given maildir, returning false if it has no
+     * usable index.
+     *
+     * If the index is already mapped, and the file is unchanged, this
+     * costs a single `stat()`.
+     */
+    bool open(const std::string &maildir);
+
+    /**
+     * Store the summary of the message with the given unique-name and
+     * inode in the given row of the message-table, returning false if
+     * the message isn't in the index.
+     */
+    bool apply(const std::string &id, uint64_t inode, uint32_t row);
+
+    /**
+     * Bring the index of the given maildir up to date with its messages,
+     * adding those whose headers have been stored in the message-table.
+     *
+     * Returns false if the index couldn't be written.
+     */
+    bool update(const std::string &maildir, const std::vector<CSummaryEntry> &entries);
+
+    /**
+     * Unmap the index, if it is mapped.
+     */
+    void close();
+
+    /**
+     * The number of rows in the mapped index.
+     */
+    size_t rows();
+
+    /**
+     * The path of the index of the given maildir, or "" if `cache.prefix`
+     * is unset.
+     */
+    static std::string filename(const std::string &maildir);
+
+private:
+
+    /**
+     * A row of the index, as it is stored on disk.
+     */
+    struct CSummaryRow
+    {
+        uint64_t inode;
+        int64_t  mtime;
+        uint64_t size;
+        int64_t  date;
+
+        /**
+         * The offsets of the unique-name, and of the key headers, in
+         * the string-pool of the segment.
+         */
+        uint32_t id;
+        uint32_t headers[CMessageTable::HEADER_COUNT];
+
+        uint32_t hints;
+    };
+
+    /**
+     * A row of the mapped index, and the string-pool it refers to.
+     */
+    struct CSummaryRef
+    {
+        const CSummaryRow *row;
+        const char *pool;
+        uint32_t pool_size;
+    };
+
+    /**
+     * Find the row with the given unique-name, or NULL.
+     */
+    const CSummaryRef *find(const std::string &id);
+
+    /**
+     * Walk the segments of the mapped file, returning false if its header
+     * is invalid.
+     */
+    bool load(const std::string &maildir);
+
+    /**
+     * Write the given messages to the end of the given stream, as a single
+     * segment.
+     */
+    static void write_segment(std::ostream &out, const std::vector<const CSummaryEntry *> &entries);
+
+    /**
+     * Rewrite the index from scratch.
+     */
+    bool rewrite(const std::string &maildir, const std::vector<const CSummaryEntry *> &entries);
+
+    /**
+     * Append a segment to the index.
+     */
+    bool append(const std::string &maildir, const std::vector<const CSummaryEntry *> &entries);
+
+private:
+
+    /**
+     * The mapped file, and its size.
+     */
+    void *m_map;
+    size_t m_size;
+
+    /**
+     * The identity of the mapped file.
+     */
+    ino_t m_inode;
+    int64_t m_mtime;
+
+    /**
+     * The number of rows in the mapped file, including any which have
+     * been replaced by a later segment.
+     */
+    size_t m_rows;
+
+    /**
+     * Did the mapped file end with a partial segment?
+     */
+    bool m_damaged;
+
+    /**
+     * The rows of the mapped file, keyed by a hash of their unique-name.
+     */
+    std::unordered_map<uint64_t, CSummaryRef> m_lookup;
+};
@@ -0,0 +1,197 @@
+/*
+ * summary_index_test.cc - Test-cases for our summary-index.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "config.h"
+#include "message_table.h"
+#include "summary_index.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Add a message to the table, returning its entry.
+ */
+static CSummaryEntry summary_entry(const std::string &maildir, const std::string &id, uint64_t inode)
+{
+    CSummaryEntry entry;
+    entry.id    = id;
+    entry.inode = inode;
+    entry.row   = CMessageTable::instance()->insert(maildir + "/cur/" + id + ":2,S");
+
+    return (entry);
+}
+
+
+/**
+ * Store some headers for the given entry.
+ */
+static void summary_headers(CSummaryEntry &entry, const std::string &subject, const std::string &type)
+{
+    std::unordered_map<std::string, std::string> headers;
+    headers["subject"]      = subject;
+    headers["from"]         = "steve@example.com";
+    headers["content-type"] = type;
+
+    CMessageTable *table = CMessageTable::instance();
+    table->set_headers(entry.row, headers, 1000 + entry.inode);
+    table->set_stat(entry.row, 2000 + entry.inode, 300 + entry.inode);
+}
+
+
+/**
+ * Test that summaries are written, appended to, and read back.
+ */
+void TestSummaryIndexUpdate(CuTest * tc)
+{
+    char tmpl[] = "/tmp/summary.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    CConfig *config = CConfig::instance();
+    std::string previous = config->get_string("cache.prefix");
+    config->set("cache.prefix", std::string(tmpl), false);
+
+    CMessageTable *table = CMessageTable::instance();
+    std::string maildir = "/tmp/Maildir/summary";
+    std::string file = CSummaryIndex::filename(maildir);
+
+    /*
+     * Only messages whose headers have been read are summarised.
+     */
+    std::vector<CSummaryEntry> entries;
+    entries.push_back(summary_entry(maildir, "1.one", 1));
+    entries.push_back(summary_entry(maildir, "2.two", 2));
+    entries.push_back(summary_entry(maildir, "3.three", 3));
+
+    summary_headers(entries[0], "First", "text/plain");
+    summary_headers(entries[1], "Second", "multipart/signed; protocol=x");
+
+    CSummaryIndex index;
+    CuAssertTrue(tc, ! index.open(maildir));
+    CuAssertTrue(tc, index.update(maildir, entries));
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 2, index.rows());
+
+    /*
+     * A fresh row is given the summary of its message.
+     */
+    uint32_t row = table->insert(maildir + "/cur/2.two:2,");
+    CuAssertTrue(tc, index.apply("2.two", 2, row));
+    CuAssertTrue(tc, table->state(row) & CMessageTable::STATE_HEADERS);
+    CuAssertStrEquals(tc, "Second", table->header(row, CMessageTable::HEADER_SUBJECT).c_str());
+    CuAssertTrue(tc, ! table->has_header(row, CMessageTable::HEADER_TO));
+    CuAssertIntEquals(tc, 1002, table->date(row));
+    CuAssertIntEquals(tc, 2002, table->mtime(row));
+    CuAssertIntEquals(tc, 302, table->size(row));
+    CuAssertIntEquals(tc, CMessageTable::HINT_SIGNED | CMessageTable::HINT_UNCOUNTED, table->hints(row));
+    table->release(row);
+
+    /*
+     * A different file, or a message we don't know, is not.
+     */
+    row = table->insert(maildir + "/cur/2.two:2,");
+    CuAssertTrue(tc, ! index.apply("2.two", 99, row));
+    CuAssertTrue(tc, ! index.apply("3.three", 3, row));
+    CuAssertIntEquals(tc, 0, table->state(row));
+    table->release(row);
+
+    /*
+     * Once another message has been read it is appended.
+     */
+    struct stat before;
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &before));
+
+    summary_headers(entries[2], "Third", "multipart/mixed");
+    CuAssertTrue(tc, index.update(maildir, entries));
+
+    struct stat after;
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &after));
+    CuAssertTrue(tc, before.st_ino == after.st_ino);
+    CuAssertTrue(tc, before.st_size < after.st_size);
+
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 3, index.rows());
+
+    /*
+     * A partial segment, as a crash might leave, is ignored - and the
+     * index is rewritten when it is next updated.
+     */
+    std::ofstream out(file, std::ios::out | std::ios::binary | std::ios::app);
+    out << "junk";
+    out.close();
+
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 3, index.rows());
+    CuAssertTrue(tc, index.update(maildir, entries));
+
+    CuAssertIntEquals(tc, 0, stat(file.c_str(), &before));
+    CuAssertTrue(tc, before.st_ino != after.st_ino);
+
+    /*
+     * Once most of the messages have gone the index is rewritten.
+     */
+    std::vector<CSummaryEntry> remaining;
+    remaining.push_back(entries[2]);
+    CuAssertTrue(tc, index.update(maildir, remaining));
+
+    CuAssertTrue(tc, index.open(maildir));
+    CuAssertIntEquals(tc, 1, index.rows());
+
+    row = table->insert(maildir + "/cur/3.three:2,");
+    CuAssertTrue(tc, index.apply("3.three", 3, row));
+    CuAssertIntEquals(tc, CMessageTable::HINT_UNCOUNTED, table->hints(row));
+    table->release(row);
+
+    /*
+     * The index of one maildir is no use to another.
+     */
+    CSummaryIndex other;
+    rename(file.c_str(), CSummaryIndex::filename(maildir + "2").c_str());
+    CuAssertTrue(tc, ! other.open(maildir + "2"));
+
+    index.close();
+    other.close();
+
+    for (CSummaryEntry &entry : entries)
+        table->release(entry.row);
+
+    unlink(CSummaryIndex::filename(maildir + "2").c_str());
+    rmdir((std::string(tmpl) + "/summary").c_str());
+    rmdir(tmpl);
+
+    config->set("cache.prefix", previous, false);
+}
+
+
+
+CuSuite *
+summary_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSummaryIndexUpdate);
+    return suite;
+}
@@ -0,0 +1,65 @@
+/*
+ * test_messages.cc - Messages shared by our test-cases.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "message_table.h"
+#include "test_messages.h"
+
+
+/*
+ * Create a message with the given filename, key headers, hints, and size.
+ */
+std::shared_ptr<CMessage> test_message(const std::string &name, const char *from,
+                                       const char *subject, time_t date,
+                                       uint32_t hints, uint64_t size)
+{
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t row = table->insert("/tmp/Maildir/cur/" + name);
+
+    const char *values[CMessageTable::HEADER_COUNT] = { NULL };
+    values[CMessageTable::HEADER_FROM]    = from;
+    values[CMessageTable::HEADER_SUBJECT] = subject;
+
+    table->set_headers(row, values, date, hints);
+    table->set_stat(row, date, size);
+
+    std::shared_ptr<CMessage> msg = std::make_shared<CMessage>(row);
+    table->release(row);
+    return (msg);
+}
+
+
+/*
+ * Create a list of messages named "large.N", with the given suffixes and
+ * sizes.
+ */
+CMessageList test_message_list(size_t count,
+                               std::function<std::string(size_t)> suffix,
+                               std::function<uint64_t(size_t)> size)
+{
+    CMessageList messages;
+    messages.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string name = "large." + std::to_string(i) + suffix(i);
+        messages.push_back(test_message(name, "From", "Subject", 0, 0, size(i)));
+    }
+
+    return (messages);
+}
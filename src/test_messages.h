@@ -0,0 +1,45 @@
+/*
+ * test_messages.h - Messages shared by our test-cases.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "message.h"
+
+
+/**
+ * Create a message in the message-table, with the given filename beneath
+ * /tmp/Maildir/cur, key headers, hints, and size.
+ */
+std::shared_ptr<CMessage> test_message(const std::string &name, const char *from,
+                                       const char *subject, time_t date,
+                                       uint32_t hints = 0, uint64_t size = 0);
+
+/**
+ * Create a list of messages large enough to be processed in parallel.
+ *
+ * The i'th message is named "large.i", followed by the given suffix, and
+ * has the given size.
+ */
+CMessageList test_message_list(size_t count,
+                               std::function<std::string(size_t)> suffix,
+                               std::function<uint64_t(size_t)> size);
@@ -33,6 +33,18 @@ CuSuite *directory_getsuite();
 /* defined in file_test.cc */
 CuSuite *file_getsuite();
 
+/* defined in finder_test.cc */
+CuSuite *finder_getsuite();
+
+/* defined in header_arena_test.cc */
+CuSuite *header_arena_getsuite();
+
+/* defined in header_prefetch_test.cc */
+CuSuite *header_prefetch_getsuite();
+
+/* defined in header_scanner_test.cc */
+CuSuite *header_scanner_getsuite();
+
 /* defined in history_test.cc */
 CuSuite *history_getsuite();
 
@@ -42,11 +54,38 @@ CuSuite *input_queue_getsuite();
 /* defined in lua_test.cc */
 CuSuite *lua_getsuite();
 
+/* defined in maildir_test.cc */
+CuSuite *maildir_getsuite();
+
+/* defined in message_filter_test.cc */
+CuSuite *message_filter_getsuite();
+
+/* defined in message_part_test.cc */
+CuSuite *message_part_getsuite();
+
+/* defined in message_sorter_test.cc */
+CuSuite *message_sorter_getsuite();
+
+/* defined in message_table_test.cc */
+CuSuite *message_table_getsuite();
+
 /* defined in logfile_test.cc */
 CuSuite *logfile_getsuite();
 
+/* defined in search_index_test.cc */
+CuSuite *search_index_getsuite();
+
 /* defined in statuspanel_test.cc */
 CuSuite *statuspanel_getsuite();
 
+/* defined in summary_index_test.cc */
+CuSuite *summary_index_getsuite();
+
+/* defined in threader_test.cc */
+CuSuite *threader_getsuite();
+
+/* defined in trigram_index_test.cc */
+CuSuite *trigram_index_getsuite();
+
 /* defined in util_test.cc */
 CuSuite *util_getsuite();
@@ -0,0 +1,1004 @@
+/*
+ * threader.cc - Group messages into threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "message_table.h"
+#include "threader.h"
+
+
+/*
+ * The header of a saved forest, and the longest message-ID we'll load.
+ */
+#define THREADS_MAGIC   "LUMAILTH"
+#define THREADS_VERSION 1
+#define THREADS_MAX_ID  4096
+
+
+/*
+ * The length of a "Re:", "Re[N]:" or - unless we only want replies -
+ * "Fwd:" prefix at the start of the string, and of any whitespace which
+ * follows it.  Zero if there is none.
+ */
+static size_t prefix_length(const char *s, bool replies)
+{
+    size_t n = 0;
+
+    if (strncasecmp(s, "re", 2) == 0)
+    {
+        n = 2;
+
+        if (s[n] == '[')
+        {
+            n++;
+
+            if (! isdigit((unsigned char)s[n]))
+                return 0;
+
+            while (isdigit((unsigned char)s[n]))
+                n++;
+
+            if (s[n] != ']')
+                return 0;
+
+            n++;
+        }
+    }
+    else if (! replies && strncasecmp(s, "fwd", 3) == 0)
+        n = 3;
+    else
+        return 0;
+
+    if (s[n] != ':')
+        return 0;
+
+    n++;
+
+    while (isspace((unsigned char)s[n]))
+        n++;
+
+    return (n);
+}
+
+
+/*
+ * Find the next message-id, between angle-brackets, at or after the given
+ * position.  Returns the position after it, or NULL if there is none.
+ */
+static const char *next_id(const char *value, std::string &id)
+{
+    while ((value = strchr(value, '<')) != NULL)
+    {
+        const char *end = strchr(value + 1, '>');
+
+        if (end == NULL)
+            return NULL;
+
+        if (end > value + 1)
+        {
+            id.assign(value + 1, end - value - 1);
+            return (end + 1);
+        }
+
+        value = end + 1;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Remove a node from the children of its parent.
+ */
+template <typename T>
+static void remove_child(std::vector<T> &nodes, int parent, int child)
+{
+    std::vector<int> &children = nodes[parent].children;
+    auto it = std::find(children.begin(), children.end(), child);
+
+    if (it != children.end())
+        children.erase(it);
+
+    nodes[child].parent = -1;
+}
+
+
+/*
+ * Make one node the last child of another.
+ */
+template <typename T>
+static void add_child(std::vector<T> &nodes, int parent, int child)
+{
+    if (nodes[child].parent >= 0)
+        remove_child(nodes, nodes[child].parent, child);
+
+    nodes[child].parent = parent;
+    nodes[parent].children.push_back(child);
+}
+
+
+/*
+ * Move the children of a node to another, in reverse order.
+ */
+template <typename T>
+static void transfer_children(std::vector<T> &nodes, int from, int to)
+{
+    std::vector<int> &children = nodes[from].children;
+
+    for (auto it = children.rbegin(); it != children.rend(); ++it)
+    {
+        nodes[*it].parent = to;
+        nodes[to].children.push_back(*it);
+    }
+
+    children.clear();
+}
+
+
+/*
+ * Is the second node the first, or beneath it?
+ *
+ * We never link a loop, so we can walk up from the second node rather
+ * than search beneath the first.
+ */
+template <typename T>
+static bool has_descendant(const std::vector<T> &nodes, int node, int other)
+{
+    while (other >= 0)
+    {
+        if (other == node)
+            return true;
+
+        other = nodes[other].parent;
+    }
+
+    return false;
+}
+
+
+/*
+ * Constructor.
+ */
+CThreader::CThreader()
+{
+    m_dirty = false;
+}
+
+
+/*
+ * Add the message in the given row to our forest.
+ */
+bool CThreader::insert(uint32_t row)
+{
+    if (contains(row))
+        return true;
+
+    CMessageTable *table = CMessageTable::instance();
+
+    if (!(table->state(row) & CMessageTable::STATE_HEADERS))
+        return false;
+
+    std::string id;
+    int self = -1;
+
+    if (message_id(table->header_data(row, CMessageTable::HEADER_MESSAGE_ID), id))
+    {
+        auto it = m_ids.find(id);
+
+        if (it == m_ids.end())
+        {
+            self = create_node(id);
+            m_ids[id] = self;
+        }
+        else if (m_nodes[it->second].row < 0)
+            self = it->second;
+    }
+
+    m_dirty = true;
+
+    /*
+     * A message without an ID, or whose ID another message has, cannot
+     * be threaded - so it stands alone.
+     */
+    if (self < 0)
+    {
+        self = create_node("");
+        m_nodes[self].row = row;
+        m_messages[row] = self;
+        return true;
+    }
+
+    m_nodes[self].row = row;
+    m_messages[row] = self;
+
+    /*
+     * If the message has been here before, or we've loaded its links,
+     * we're done.
+     */
+    if (m_nodes[self].linked)
+        return true;
+
+    m_nodes[self].linked = true;
+
+    std::vector<std::string> refs;
+    references(table->header_data(row, CMessageTable::HEADER_REFERENCES),
+               table->header_data(row, CMessageTable::HEADER_IN_REPLY_TO),
+               refs);
+
+    int prev = -1;
+
+    for (const std::string &ref : refs)
+    {
+        int cur;
+        auto found = m_ids.find(ref);
+
+        if (found == m_ids.end())
+        {
+            cur = create_node(ref);
+            m_ids[ref] = cur;
+        }
+        else
+            cur = found->second;
+
+        /*
+         * Don't link nodes which are already linked, or which would
+         * introduce a loop.
+         */
+        if (prev >= 0 && m_nodes[cur].parent < 0 && ! has_descendant(m_nodes, cur, prev))
+            add_child(m_nodes, prev, cur);
+
+        prev = cur;
+    }
+
+    if (prev >= 0 && ! has_descendant(m_nodes, self, prev))
+        add_child(m_nodes, prev, self);
+
+    return true;
+}
+
+
+/*
+ * Remove the message in the given row from our forest.
+ */
+void CThreader::remove(uint32_t row)
+{
+    auto it = m_messages.find(row);
+
+    if (it == m_messages.end())
+        return;
+
+    int node = it->second;
+    m_messages.erase(it);
+
+    /*
+     * The node remains while other messages refer to it, so that they
+     * stay in the same thread.
+     */
+    m_nodes[node].row = -1;
+    collect(node);
+
+    m_dirty = true;
+}
+
+
+/*
+ * Is the message in the given row in our forest?
+ */
+bool CThreader::contains(uint32_t row)
+{
+    return (m_messages.find(row) != m_messages.end());
+}
+
+
+/*
+ * The number of messages in our forest.
+ */
+size_t CThreader::size()
+{
+    return (m_messages.size());
+}
+
+
+/*
+ * Create a node of the forest, returning its index.
+ */
+int CThreader::create_node(const std::string &id)
+{
+    int node;
+
+    if (m_free.empty())
+    {
+        node = m_nodes.size();
+        m_nodes.push_back(CNode());
+    }
+    else
+    {
+        node = m_free.back();
+        m_free.pop_back();
+    }
+
+    m_nodes[node].id     = id;
+    m_nodes[node].row    = -1;
+    m_nodes[node].parent = -1;
+    m_nodes[node].linked = false;
+    m_nodes[node].children.clear();
+
+    return (node);
+}
+
+
+/*
+ * Free the given node, and any of its parents which are left holding
+ * nothing.
+ */
+void CThreader::collect(int node)
+{
+    while (node >= 0 && m_nodes[node].row < 0 && m_nodes[node].children.empty())
+    {
+        int parent = m_nodes[node].parent;
+
+        if (parent >= 0)
+            remove_child(m_nodes, parent, node);
+
+        if (! m_nodes[node].id.empty())
+            m_ids.erase(m_nodes[node].id);
+
+        m_nodes[node].id.clear();
+        m_nodes[node].linked = false;
+        m_free.push_back(node);
+
+        node = parent;
+    }
+}
+
+
+/*
+ * Remove all the nodes of our forest.
+ */
+void CThreader::clear()
+{
+    m_nodes.clear();
+    m_free.clear();
+    m_ids.clear();
+    m_messages.clear();
+}
+
+
+/*
+ * Replace our forest with the one saved to the given file.
+ */
+bool CThreader::load(const std::string &path)
+{
+    clear();
+    m_dirty = false;
+
+    if (path.empty())
+        return false;
+
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+
+    if (! in.is_open())
+        return false;
+
+    char magic[8];
+    uint32_t version = 0;
+    uint32_t count   = 0;
+
+    in.read(magic, sizeof(magic));
+    in.read((char *)&version, sizeof(version));
+    in.read((char *)&count, sizeof(count));
+
+    if ((! in.good()) || (memcmp(magic, THREADS_MAGIC, sizeof(magic)) != 0) ||
+            (version != THREADS_VERSION))
+        return false;
+
+    std::vector<int32_t> parents;
+
+    for (uint32_t i = 0; i < count && in.good(); i++)
+    {
+        uint32_t len    = 0;
+        int32_t  parent = -1;
+        uint8_t  linked = 0;
+
+        in.read((char *)&len, sizeof(len));
+
+        if ((! in.good()) || (len == 0) || (len > THREADS_MAX_ID))
+            break;
+
+        std::string id(len, '\0');
+        in.read(&id[0], len);
+        in.read((char *)&parent, sizeof(parent));
+        in.read((char *)&linked, sizeof(linked));
+
+        if ((! in.good()) || (m_ids.find(id) != m_ids.end()))
+            break;
+
+        int node = create_node(id);
+        m_nodes[node].linked = (linked != 0);
+        m_ids[id] = node;
+
+        parents.push_back(parent);
+    }
+
+    if (parents.size() != count)
+    {
+        clear();
+        return false;
+    }
+
+    for (size_t node = 0; node < parents.size(); node++)
+    {
+        int32_t parent = parents[node];
+
+        if ((parent < 0) || ((uint32_t)parent >= count) ||
+                has_descendant(m_nodes, node, parent))
+            continue;
+
+        add_child(m_nodes, parent, node);
+    }
+
+    return true;
+}
+
+
+/*
+ * Save our forest to the given file, if it has changed.
+ */
+bool CThreader::save(const std::string &path)
+{
+    if (path.empty())
+        return false;
+
+    if (! m_dirty)
+        return true;
+
+    /*
+     * We save the nodes which lead to a message, and renumber them.
+     * Messages without an ID are found again when they're inserted.
+     */
+    std::vector<bool> keep(m_nodes.size(), false);
+
+    for (auto it = m_messages.begin(); it != m_messages.end(); ++it)
+    {
+        int node = it->second;
+
+        while (node >= 0 && ! keep[node])
+        {
+            keep[node] = true;
+            node = m_nodes[node].parent;
+        }
+    }
+
+    std::vector<int32_t> number(m_nodes.size(), -1);
+    uint32_t count = 0;
+
+    for (size_t node = 0; node < m_nodes.size(); node++)
+    {
+        if (keep[node] && ! m_nodes[node].id.empty())
+            number[node] = count++;
+    }
+
+    CDirectory::mkdir_p(path.substr(0, path.rfind('/')));
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    char magic[8];
+    memcpy(magic, THREADS_MAGIC, sizeof(magic));
+
+    uint32_t version = THREADS_VERSION;
+
+    out.write(magic, sizeof(magic));
+    out.write((const char *)&version, sizeof(version));
+    out.write((const char *)&count, sizeof(count));
+
+    for (size_t node = 0; node < m_nodes.size(); node++)
+    {
+        if (number[node] < 0)
+            continue;
+
+        const CNode &n  = m_nodes[node];
+        uint32_t len    = n.id.size();
+        int32_t  parent = (n.parent >= 0) ? number[n.parent] : -1;
+        uint8_t  linked = n.linked ? 1 : 0;
+
+        out.write((const char *)&len, sizeof(len));
+        out.write(n.id.data(), len);
+        out.write((const char *)&parent, sizeof(parent));
+        out.write((const char *)&linked, sizeof(linked));
+    }
+
+    out.close();
+
+    if ((! out.good()) || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+
+/*
+ * Thread the messages in the given rows.
+ */
+std::vector<CThreader::CThreadEntry> CThreader::thread(const std::vector<uint32_t> &rows, CCompare compare)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    m_rows = rows;
+
+    /*
+     * 1. Add the messages we've not seen to our forest, then copy it to
+     *    build the threads from - with only the messages we were given.
+     */
+    std::unordered_map<uint32_t, int> position;
+    position.reserve(m_rows.size());
+
+    for (size_t i = 0; i < m_rows.size(); i++)
+        position.insert(std::make_pair(m_rows[i], (int)i));
+
+    std::vector<int> loose;
+
+    for (size_t i = 0; i < m_rows.size(); i++)
+    {
+        if (! insert(m_rows[i]))
+            loose.push_back(i);
+    }
+
+    m_containers.clear();
+    m_containers.resize(m_nodes.size());
+
+    for (size_t node = 0; node < m_nodes.size(); node++)
+    {
+        const CNode &n = m_nodes[node];
+        CContainer &c  = m_containers[node];
+
+        c.message  = -1;
+        c.parent   = n.parent;
+        c.children = n.children;
+
+        if (n.row >= 0)
+        {
+            auto it = position.find(n.row);
+
+            if (it != position.end())
+                c.message = it->second;
+        }
+    }
+
+    /*
+     * A message whose headers we lack stands alone.
+     */
+    for (int i : loose)
+        create(i);
+
+    /*
+     * 2. Find the roots, and 3. prune the empty containers beneath them.
+     *
+     * An empty root which is left with no children has nothing to show.
+     */
+    std::vector<int> found;
+
+    for (size_t c = 0; c < m_containers.size(); c++)
+    {
+        if (m_containers[c].parent < 0)
+            found.push_back(c);
+    }
+
+    std::vector<int> roots;
+
+    for (int root : found)
+    {
+        prune_empty(root);
+
+        if (m_containers[root].message >= 0 || ! m_containers[root].children.empty())
+            roots.push_back(root);
+    }
+
+    /*
+     * 4. Group the roots by their subjects, preferring an empty container
+     *    to represent each subject.
+     */
+    std::unordered_map<std::string, int> subjects;
+    std::vector<std::string> order;
+    std::vector<std::string> normalized(roots.size());
+    std::vector<int> without_subject;
+
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        int root = roots[i];
+        normalized[i] = normalize_subject(subject(root));
+
+        if (normalized[i].empty())
+        {
+            without_subject.push_back(root);
+            continue;
+        }
+
+        auto it = subjects.find(normalized[i]);
+
+        if (it == subjects.end())
+        {
+            subjects[normalized[i]] = root;
+            order.push_back(normalized[i]);
+        }
+        else if (m_containers[it->second].message >= 0 && m_containers[root].message < 0)
+            it->second = root;
+    }
+
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        if (normalized[i].empty())
+            continue;
+
+        int root   = roots[i];
+        int target = subjects[normalized[i]];
+
+        if (target == root)
+            continue;
+
+        bool root_empty   = m_containers[root].message < 0;
+        bool target_empty = m_containers[target].message < 0;
+
+        if (root_empty && target_empty)
+        {
+            transfer_children(m_containers, root, target);
+        }
+        else if (target_empty)
+        {
+            add_child(m_containers, target, root);
+        }
+        else if (root_empty)
+        {
+            add_child(m_containers, root, target);
+            subjects[normalized[i]] = root;
+        }
+        else
+        {
+            /*
+             * Make a reply the child of a non-reply, otherwise make both
+             * the children of a new container.
+             */
+            bool root_reply   = is_reply(subject(root));
+            bool target_reply = is_reply(subject(target));
+
+            if (root_reply && ! target_reply)
+            {
+                add_child(m_containers, target, root);
+            }
+            else if (! root_reply && target_reply)
+            {
+                add_child(m_containers, root, target);
+                subjects[normalized[i]] = root;
+            }
+            else
+            {
+                int parent = create(-1);
+                add_child(m_containers, parent, root);
+                add_child(m_containers, parent, target);
+                subjects[normalized[i]] = parent;
+            }
+        }
+    }
+
+    /*
+     * 5. Replace each empty root with its oldest child, if that isn't
+     *    a reply, so that the results don't depend upon our input order.
+     */
+    for (const std::string &s : order)
+    {
+        int root = subjects[s];
+
+        if (m_containers[root].message >= 0)
+            continue;
+
+        int oldest = -1;
+
+        for (int child : m_containers[root].children)
+        {
+            if (m_containers[child].message < 0)
+                continue;
+
+            if (oldest < 0 ||
+                    table->date(m_rows[m_containers[child].message]) <
+                    table->date(m_rows[m_containers[oldest].message]))
+                oldest = child;
+        }
+
+        if (oldest >= 0 && ! is_reply(subject(oldest)))
+        {
+            remove_child(m_containers, root, oldest);
+            transfer_children(m_containers, root, oldest);
+            subjects[s] = oldest;
+        }
+    }
+
+    roots.swap(without_subject);
+
+    for (const std::string &s : order)
+        roots.push_back(subjects[s]);
+
+    /*
+     * Sort the threads, by their greatest message.
+     */
+    if (compare)
+    {
+        std::vector<int> greatest_of(m_containers.size(), -1);
+
+        for (int root : roots)
+        {
+            sort_children(root, compare);
+            greatest_of[root] = greatest(root, compare);
+        }
+
+        std::stable_sort(roots.begin(), roots.end(), [&](int a, int b)
+        {
+            if (greatest_of[a] < 0 || greatest_of[b] < 0)
+                return false;
+
+            return (compare(m_containers[greatest_of[a]].message,
+                            m_containers[greatest_of[b]].message));
+        });
+    }
+
+    std::vector<CThreadEntry> out;
+    out.reserve(m_rows.size());
+
+    for (int root : roots)
+        walk(root, out);
+
+    m_containers.clear();
+    return (out);
+}
+
+
+/*
+ * Strip any leading "Re:", "Re[N]:", or "Fwd:" from a subject.
+ */
+std::string CThreader::normalize_subject(const char *subject)
+{
+    if (subject == NULL)
+        return "";
+
+    while (isspace((unsigned char)*subject))
+        subject++;
+
+    size_t n;
+
+    while ((n = prefix_length(subject, false)) > 0)
+        subject += n;
+
+    return (subject);
+}
+
+
+/*
+ * Does the subject start with "Re:", or "Re[N]:"?
+ */
+bool CThreader::is_reply(const char *subject)
+{
+    if (subject == NULL)
+        return false;
+
+    while (isspace((unsigned char)*subject))
+        subject++;
+
+    return (prefix_length(subject, true) > 0);
+}
+
+
+/*
+ * Find the first message-id in the given header-value.
+ */
+bool CThreader::message_id(const char *value, std::string &id)
+{
+    if (value == NULL)
+        return false;
+
+    return (next_id(value, id) != NULL);
+}
+
+
+/*
+ * Find the message-ids a message refers to.
+ */
+void CThreader::references(const char *refs, const char *reply_to, std::vector<std::string> &ids)
+{
+    ids.clear();
+
+    std::string id;
+
+    if (refs != NULL)
+    {
+        while ((refs = next_id(refs, id)) != NULL)
+            ids.push_back(id);
+    }
+
+    if (reply_to != NULL)
+    {
+        std::string last;
+
+        while ((reply_to = next_id(reply_to, id)) != NULL)
+            last = id;
+
+        if (! last.empty() && (ids.empty() || ids.back() != last))
+            ids.push_back(last);
+    }
+}
+
+
+/*
+ * Create a container, returning its index.
+ */
+int CThreader::create(int message)
+{
+    CContainer c;
+    c.message = message;
+    c.parent  = -1;
+
+    m_containers.push_back(c);
+    return (m_containers.size() - 1);
+}
+
+
+/*
+ * Remove the empty containers beneath the given one.
+ */
+void CThreader::prune_empty(int container)
+{
+    /*
+     * Pruning a child only changes the children from its own position
+     * onwards, so we walk them in reverse.
+     */
+    for (int i = (int)m_containers[container].children.size() - 1; i >= 0; i--)
+        prune_empty(m_containers[container].children[i]);
+
+    CContainer &self = m_containers[container];
+
+    if (self.message >= 0)
+        return;
+
+    if (self.parent >= 0)
+    {
+        /*
+         * An empty container is replaced by its children.
+         */
+        int parent = self.parent;
+
+        transfer_children(m_containers, container, parent);
+        remove_child(m_containers, parent, container);
+    }
+    else if (self.children.size() == 1)
+    {
+        /*
+         * An empty root with a single child is replaced by that child.
+         */
+        int child = self.children[0];
+
+        remove_child(m_containers, container, child);
+        transfer_children(m_containers, child, container);
+        self.message = m_containers[child].message;
+    }
+}
+
+
+/*
+ * The subject of a container, or of its first child if it is empty.
+ */
+const char *CThreader::subject(int container)
+{
+    while (m_containers[container].message < 0)
+    {
+        if (m_containers[container].children.empty())
+            return "";
+
+        container = m_containers[container].children[0];
+    }
+
+    const char *s = CMessageTable::instance()->header_data(m_rows[m_containers[container].message],
+                    CMessageTable::HEADER_SUBJECT);
+
+    return (s ? s : "");
+}
+
+
+/*
+ * Sort the children of the given container, recursively.
+ */
+void CThreader::sort_children(int container, CCompare &compare)
+{
+    std::vector<int> &children = m_containers[container].children;
+
+    for (int child : children)
+        sort_children(child, compare);
+
+    std::stable_sort(children.begin(), children.end(), [&](int a, int b)
+    {
+        if (m_containers[a].message < 0 || m_containers[b].message < 0)
+            return false;
+
+        return (compare(m_containers[a].message, m_containers[b].message));
+    });
+}
+
+
+/*
+ * Find the greatest message beneath the given container.
+ */
+int CThreader::greatest(int container, CCompare &compare)
+{
+    int best = (m_containers[container].message >= 0) ? container : -1;
+
+    for (int child : m_containers[container].children)
+    {
+        int g = greatest(child, compare);
+
+        if (g < 0)
+            continue;
+
+        if (best < 0 || compare(m_containers[best].message, m_containers[g].message))
+            best = g;
+    }
+
+    return (best);
+}
+
+
+/*
+ * Append the messages beneath the given container to the output.
+ */
+void CThreader::walk(int container, std::vector<CThreadEntry> &out)
+{
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back(std::make_pair(container, 0));
+
+    bool start = true;
+
+    while (! stack.empty())
+    {
+        int c     = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        if (m_containers[c].message >= 0)
+        {
+            CThreadEntry entry;
+            entry.message = m_containers[c].message;
+            entry.depth   = depth;
+            entry.start   = start;
+            out.push_back(entry);
+
+            start = false;
+        }
+
+        const std::vector<int> &children = m_containers[c].children;
+
+        for (auto it = children.rbegin(); it != children.rend(); ++it)
+            stack.push_back(std::make_pair(*it, depth + 1));
+    }
+}
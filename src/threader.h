@@ -0,0 +1,270 @@
+/*
+ * threader.h - Group messages into threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * The CThreader class groups a set of messages into threads, using the
+ * algorithm described by Jamie Zawinski:
+ *
+ *    https://www.jwz.org/doc/threading.html
+ *
+ * The messages are given as rows of the message-table, and their key
+ * headers must have been stored there before they are threaded.
+ *
+ * The first step of the algorithm - linking each message-ID to those it
+ * refers to - is kept from one call to the next, as a forest to which
+ * messages are inserted, and from which they're removed, as they come
+ * and go.  A message costs a few hash-lookups to add, and the forest can
+ * be saved such that the links needn't be made again.  The later steps,
+ * which prune and group that forest, are cheap and run upon each call.
+ *
+ * As with the Lua implementation this replaces, we differ from the
+ * original in one way: a thread whose root is an empty container is
+ * started by its oldest message instead, if that is not a reply.
+ *
+ */
+class CThreader
+{
+public:
+
+    /**
+     * A function which returns true if the first message, given by its
+     * index in our input, should be sorted before the second.
+     */
+    typedef std::function<bool(size_t a, size_t b)> CCompare;
+
+    /**
+     * A message in the threaded output.
+     */
+    struct CThreadEntry
+    {
+        /**
+         * The index of the message in our input.
+         */
+        size_t message;
+
+        /**
+         * The depth of the message within its thread.
+         *
+         * A thread which has no single root starts with its messages at
+         * depth one, rather than zero.
+         */
+        int depth;
+
+        /**
+         * Is this the first message of a thread?
+         */
+        bool start;
+    };
+
+public:
+
+    /**
+     * Constructor.
+     */
+    CThreader();
+
+    /**
+     * Add the message in the given row to our forest, returning false
+     * if its headers haven't been stored.
+     *
+     * A message whose ID we hold already is kept apart from the message
+     * which has it.
+     */
+    bool insert(uint32_t row);
+
+    /**
+     * Remove the message in the given row from our forest.  This must
+     * be done before the row is released.
+     */
+    void remove(uint32_t row);
+
+    /**
+     * Is the message in the given row in our forest?
+     */
+    bool contains(uint32_t row);
+
+    /**
+     * The number of messages in our forest.
+     */
+    size_t size();
+
+    /**
+     * Thread the messages in the given rows, returning them in the order
+     * they should be displayed.  Any which aren't in our forest are added
+     * to it, and those in the forest but not given are ignored.
+     *
+     * If a comparison function is given the messages beneath each parent
+     * are sorted with it, and the threads are sorted by their greatest
+     * message.
+     */
+    std::vector<CThreadEntry> thread(const std::vector<uint32_t> &rows, CCompare compare = nullptr);
+
+    /**
+     * Replace our forest with the one saved to the given file, returning
+     * false if it can't be read.
+     *
+     * The file records the links between message-IDs, rather than rows,
+     * so the messages must be inserted again.
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Save our forest to the given file, if it has changed since it was
+     * loaded or last saved.
+     */
+    bool save(const std::string &path);
+
+public:
+
+    /**
+     * Strip any leading "Re:", "Re[N]:", or "Fwd:" from a subject.
+     */
+    static std::string normalize_subject(const char *subject);
+
+    /**
+     * Does the subject start with "Re:", or "Re[N]:"?
+     */
+    static bool is_reply(const char *subject);
+
+    /**
+     * Find the first message-id, between angle-brackets, in the given
+     * header-value.
+     */
+    static bool message_id(const char *value, std::string &id);
+
+    /**
+     * Find the message-ids a message refers to - those in its
+     * `References:` header, followed by the last of its `In-Reply-To:`
+     * header, if that is not the last reference already.
+     */
+    static void references(const char *refs, const char *reply_to, std::vector<std::string> &ids);
+
+private:
+
+    /**
+     * A node of our forest, which holds a message-ID and the message
+     * which has it, if we've seen that message.
+     */
+    struct CNode
+    {
+        std::string id;
+        int64_t row;
+        int parent;
+        std::vector<int> children;
+
+        /**
+         * Have the references of this ID's message been linked?
+         */
+        bool linked;
+    };
+
+    /**
+     * A node of the thread-tree we build from the forest, which holds
+     * the index of a message in our input unless it is a placeholder.
+     */
+    struct CContainer
+    {
+        int message;
+        int parent;
+        std::vector<int> children;
+    };
+
+private:
+
+    /**
+     * Create a node of the forest, returning its index.
+     */
+    int create_node(const std::string &id);
+
+    /**
+     * Free the given node, and any of its parents which are left holding
+     * nothing.
+     */
+    void collect(int node);
+
+    /**
+     * Remove all the nodes of our forest.
+     */
+    void clear();
+
+    /**
+     * Create a container, returning its index.
+     */
+    int create(int message);
+
+    /**
+     * Remove the empty containers beneath the given one.
+     */
+    void prune_empty(int container);
+
+    /**
+     * The subject of a container, or of its first child if it is empty.
+     */
+    const char *subject(int container);
+
+    /**
+     * Sort the children of the given container, recursively.
+     */
+    void sort_children(int container, CCompare &compare);
+
+    /**
+     * Find the greatest message beneath the given container.
+     */
+    int greatest(int container, CCompare &compare);
+
+    /**
+     * Append the messages beneath the given container to the output.
+     */
+    void walk(int container, std::vector<CThreadEntry> &out);
+
+private:
+
+    /**
+     * Our forest, and the nodes of it which are free for reuse.
+     */
+    std::vector<CNode> m_nodes;
+    std::vector<int> m_free;
+
+    /**
+     * The node of each message-ID, and of each row, we hold.
+     */
+    std::unordered_map<std::string, int> m_ids;
+    std::unordered_map<uint32_t, int> m_messages;
+
+    /**
+     * Has the forest changed since it was loaded or saved?
+     */
+    bool m_dirty;
+
+    /**
+     * The rows we're threading, and the tree we build from them.
+     */
+    std::vector<uint32_t> m_rows;
+    std::vector<CContainer> m_containers;
+};
@@ -0,0 +1,202 @@
+/*
+ * threader_lua.cc - Export our message-threading to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "global_state.h"
+#include "lua.h"
+#include "maildir.h"
+#include "message_lua.h"
+#include "message_sorter.h"
+#include "threader.h"
+
+
+/**
+ * @file threader_lua.cc
+ *
+ * This file implements the exporting of our CThreader class to Lua,
+ * where it is wrapped by `lib/threader.lua`.  Lua-usage looks something
+ * like this:
+ *
+ *<code>
+ * local msgs, depths, roots = Threads:thread( messages, compare_by_date )<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Implementation of Threads:thread().
+ *
+ * Given a table of messages, and optionally a function to compare two
+ * of them - or the name of a built-in sort-method - return three tables:
+ *
+ * * The messages, in the order they should be displayed.
+ * * The depth of each of those messages within its thread.
+ * * The first message of each thread.
+ */
+int l_CThreader_thread(lua_State * l)
+{
+    CLuaLog("l_CThreader_thread");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+    bool sorted = lua_isfunction(l, 3);
+
+    /*
+     * We need the key headers of every message, which we read now so
+     * that the table isn't changed as we thread.
+     */
+    std::vector<uint32_t> rows;
+    CMessageList messages;
+
+    for (int i = 1; ; i++)
+    {
+        lua_rawgeti(l, 2, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        std::shared_ptr<CMessage> msg = l_CheckCMessage(l, -1);
+        msg->find_header("message-id");
+        rows.push_back(msg->row());
+        messages.push_back(msg);
+
+        lua_pop(l, 1);
+    }
+
+    /*
+     * A built-in sort-method is compared natively.  Otherwise the
+     * comparison is made by the Lua function, upon the messages as
+     * they're held in the table we were given.
+     */
+    bool failed = false;
+    std::string error;
+
+    CThreader::CCompare compare = nullptr;
+    std::unique_ptr<CMessageSorter> sorter;
+    CMessageSorter::CSortMethod method;
+
+    if (lua_type(l, 3) == LUA_TSTRING && CMessageSorter::method(lua_tostring(l, 3), method))
+    {
+        sorter.reset(new CMessageSorter(messages, method));
+
+        compare = [&](size_t a, size_t b)
+        {
+            return (sorter->less(a, b));
+        };
+    }
+    else if (sorted)
+    {
+        compare = [&](size_t a, size_t b)
+        {
+            if (failed)
+                return false;
+
+            lua_pushvalue(l, 3);
+            lua_rawgeti(l, 2, a + 1);
+            lua_rawgeti(l, 2, b + 1);
+
+            if (lua_pcall(l, 2, 1, 0) != 0)
+            {
+                failed = true;
+                error  = lua_tostring(l, -1) ? lua_tostring(l, -1) : "";
+                lua_pop(l, 1);
+                return false;
+            }
+
+            bool ret = lua_toboolean(l, -1);
+            lua_pop(l, 1);
+            return (ret);
+        };
+    }
+
+    /*
+     * The messages of the selected maildir are threaded via the forest
+     * it keeps, which is updated as they come and go.
+     */
+    std::vector<CThreader::CThreadEntry> entries;
+    std::shared_ptr<CMaildir> folder = CGlobalState::instance()->current_maildir();
+
+    if (folder)
+        entries = folder->thread(rows, compare);
+    else
+    {
+        CThreader threader;
+        entries = threader.thread(rows, compare);
+    }
+
+    if (failed)
+        return luaL_error(l, "Error comparing messages: %s", error.c_str());
+
+    lua_createtable(l, entries.size(), 0);
+    lua_createtable(l, entries.size(), 0);
+    lua_newtable(l);
+
+    int roots = 0;
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        lua_rawgeti(l, 2, entries[i].message + 1);
+        lua_rawseti(l, -4, i + 1);
+
+        lua_pushinteger(l, entries[i].depth);
+        lua_rawseti(l, -3, i + 1);
+
+        if (entries[i].start)
+        {
+            lua_rawgeti(l, 2, entries[i].message + 1);
+            lua_rawseti(l, -2, ++roots);
+        }
+    }
+
+    return 3;
+}
+
+
+/**
+ * Export the `Threads` object to Lua.
+ *
+ * Bind the appropriate methods to that object.
+ */
+void InitThreads(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"thread", l_CThreader_thread},
+        {NULL,     NULL}
+    };
+    luaL_newmetatable(l, "luaL_CThreader");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Threads");
+}
@@ -0,0 +1,251 @@
+/*
+ * threader_test.cc - Test-cases for our message-threading.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "message_table.h"
+#include "threader.h"
+#include "CuTest.h"
+
+
+/**
+ * Add a message to the table with the given key headers.
+ */
+static uint32_t add_message(const char *id, const char *refs, const char *reply_to,
+                            const char *subject, time_t date)
+{
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t row = table->insert(std::string("/tmp/Maildir/cur/thread.") + subject);
+
+    const char *values[CMessageTable::HEADER_COUNT] = { NULL };
+    values[CMessageTable::HEADER_MESSAGE_ID]  = id;
+    values[CMessageTable::HEADER_REFERENCES]  = refs;
+    values[CMessageTable::HEADER_IN_REPLY_TO] = reply_to;
+    values[CMessageTable::HEADER_SUBJECT]     = subject;
+
+    table->set_headers(row, values, date, 0);
+    return (row);
+}
+
+
+/**
+ * Test the parsing of subjects and message-ids.
+ */
+void TestThreaderHeaders(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "Hello", CThreader::normalize_subject("Re: Hello").c_str());
+    CuAssertStrEquals(tc, "Hello", CThreader::normalize_subject("RE[2]: fwd: Hello").c_str());
+    CuAssertStrEquals(tc, "Reply", CThreader::normalize_subject("Reply").c_str());
+    CuAssertStrEquals(tc, "", CThreader::normalize_subject(NULL).c_str());
+
+    CuAssertTrue(tc, CThreader::is_reply(" re: Hello"));
+    CuAssertTrue(tc, CThreader::is_reply("Re[3]: Hello"));
+    CuAssertTrue(tc, ! CThreader::is_reply("Fwd: Hello"));
+    CuAssertTrue(tc, ! CThreader::is_reply("Re[]: Hello"));
+
+    std::string id;
+    CuAssertTrue(tc, CThreader::message_id("  <> <one@example.com> <two>", id));
+    CuAssertStrEquals(tc, "one@example.com", id.c_str());
+    CuAssertTrue(tc, ! CThreader::message_id("none", id));
+
+    std::vector<std::string> ids;
+    CThreader::references("<a> <b>", "<x> <b>", ids);
+    CuAssertIntEquals(tc, 2, ids.size());
+    CuAssertStrEquals(tc, "b", ids[1].c_str());
+
+    CThreader::references(NULL, "<c>", ids);
+    CuAssertIntEquals(tc, 1, ids.size());
+    CuAssertStrEquals(tc, "c", ids[0].c_str());
+}
+
+
+/**
+ * Test that messages are threaded, and sorted.
+ */
+void TestThreaderThread(CuTest * tc)
+{
+    std::vector<uint32_t> rows;
+    rows.push_back(add_message("<a>", NULL, NULL, "Hello", 100));
+    rows.push_back(add_message("<b>", NULL, "<a>", "Re: Hello", 200));
+    rows.push_back(add_message("<c>", "<a> <b>", NULL, "Re: Hello", 300));
+    rows.push_back(add_message("<d>", NULL, NULL, "Other", 400));
+    rows.push_back(add_message("<e>", "<missing>", NULL, "Re: Lost", 500));
+    rows.push_back(add_message("<f>", "<missing>", NULL, "Re: Lost", 600));
+
+    CThreader threader;
+    std::vector<CThreader::CThreadEntry> out = threader.thread(rows);
+
+    size_t messages[] = { 0, 1, 2, 3, 4, 5 };
+    int depths[]      = { 0, 1, 2, 0, 1, 1 };
+    bool starts[]     = { true, false, false, true, true, false };
+
+    CuAssertIntEquals(tc, 6, out.size());
+
+    for (int i = 0; i < 6; i++)
+    {
+        CuAssertIntEquals(tc, messages[i], out[i].message);
+        CuAssertIntEquals(tc, depths[i], out[i].depth);
+        CuAssertIntEquals(tc, starts[i], out[i].start);
+    }
+
+    /*
+     * Sorting by descending position reverses the children, and orders
+     * the threads by their last message.
+     */
+    out = threader.thread(rows, [](size_t a, size_t b)
+    {
+        return (a > b);
+    });
+
+    size_t sorted[]       = { 5, 4, 3, 0, 1, 2 };
+    int sorted_depths[]   = { 1, 1, 0, 0, 1, 2 };
+    bool sorted_starts[]  = { true, false, true, true, false, false };
+
+    CuAssertIntEquals(tc, 6, out.size());
+
+    for (int i = 0; i < 6; i++)
+    {
+        CuAssertIntEquals(tc, sorted[i], out[i].message);
+        CuAssertIntEquals(tc, sorted_depths[i], out[i].depth);
+        CuAssertIntEquals(tc, sorted_starts[i], out[i].start);
+    }
+
+    for (uint32_t row : rows)
+        CMessageTable::instance()->release(row);
+}
+
+
+/**
+ * Test that messages which refer to each other don't make a loop.
+ */
+void TestThreaderLoop(CuTest * tc)
+{
+    std::vector<uint32_t> rows;
+    rows.push_back(add_message("<x>", "<y>", NULL, "Loop", 100));
+    rows.push_back(add_message("<y>", "<x>", NULL, "Loop", 200));
+
+    CThreader threader;
+    std::vector<CThreader::CThreadEntry> out = threader.thread(rows);
+
+    CuAssertIntEquals(tc, 2, out.size());
+    CuAssertIntEquals(tc, 1, out[0].message);
+    CuAssertIntEquals(tc, 0, out[0].depth);
+    CuAssertIntEquals(tc, 0, out[1].message);
+    CuAssertIntEquals(tc, 1, out[1].depth);
+
+    for (uint32_t row : rows)
+        CMessageTable::instance()->release(row);
+}
+
+
+/**
+ * Test that messages can be added to, and removed from, the threads we
+ * hold - and that those threads can be saved and loaded.
+ */
+void TestThreaderIncremental(CuTest * tc)
+{
+    std::vector<uint32_t> rows;
+    rows.push_back(add_message("<inc-a>", NULL, NULL, "Incremental", 100));
+    rows.push_back(add_message("<inc-b>", "<inc-a>", NULL, "Re: Incremental", 200));
+    rows.push_back(add_message("<inc-c>", "<inc-a> <inc-b>", NULL, "Re: Incremental", 300));
+
+    CThreader threader;
+    std::vector<CThreader::CThreadEntry> out = threader.thread(rows);
+
+    CuAssertIntEquals(tc, 3, threader.size());
+    CuAssertIntEquals(tc, 3, out.size());
+    CuAssertIntEquals(tc, 2, out[2].depth);
+
+    /*
+     * Removing a message leaves its replies in the thread.
+     */
+    threader.remove(rows[1]);
+    CuAssertTrue(tc, ! threader.contains(rows[1]));
+    CuAssertIntEquals(tc, 2, threader.size());
+
+    std::vector<uint32_t> left;
+    left.push_back(rows[0]);
+    left.push_back(rows[2]);
+
+    out = threader.thread(left);
+    CuAssertIntEquals(tc, 2, out.size());
+    CuAssertIntEquals(tc, 1, out[1].message);
+    CuAssertIntEquals(tc, 1, out[1].depth);
+
+    /*
+     * A new message joins the thread it refers to.
+     */
+    rows.push_back(add_message("<inc-d>", "<inc-a> <inc-b> <inc-c>", NULL, "Re: Incremental", 400));
+    CuAssertTrue(tc, threader.insert(rows[3]));
+    CuAssertTrue(tc, threader.insert(rows[1]));
+
+    out = threader.thread(rows);
+    CuAssertIntEquals(tc, 4, out.size());
+
+    for (int i = 0; i < 4; i++)
+    {
+        CuAssertIntEquals(tc, i, out[i].message);
+        CuAssertIntEquals(tc, i, out[i].depth);
+    }
+
+    /*
+     * The threads survive being saved, and loaded again.
+     */
+    char tmpl[] = "/tmp/threads.XXXXXX";
+    int fd = mkstemp(tmpl);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    CuAssertTrue(tc, threader.save(tmpl));
+
+    CThreader loaded;
+    CuAssertTrue(tc, loaded.load(tmpl));
+    CuAssertIntEquals(tc, 0, loaded.size());
+
+    out = loaded.thread(rows);
+    CuAssertIntEquals(tc, 4, out.size());
+    CuAssertIntEquals(tc, 4, loaded.size());
+
+    for (int i = 0; i < 4; i++)
+    {
+        CuAssertIntEquals(tc, i, out[i].message);
+        CuAssertIntEquals(tc, i, out[i].depth);
+    }
+
+    unlink(tmpl);
+
+    for (uint32_t row : rows)
+        CMessageTable::instance()->release(row);
+}
+
+
+
+CuSuite *
+threader_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreaderHeaders);
+    SUITE_ADD_TEST(suite, TestThreaderThread);
+    SUITE_ADD_TEST(suite, TestThreaderLoop);
+    SUITE_ADD_TEST(suite, TestThreaderIncremental);
+    return suite;
+}
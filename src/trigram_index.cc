@@ -0,0 +1,424 @@
+/*
+ * trigram_index.cc - Narrow searches of the key headers of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+
+#include "message_table.h"
+#include "trigram_index.h"
+
+
+/*
+ * The headers we index.
+ */
+static const CMessageTable::CKeyHeader indexed_headers[] =
+{
+    CMessageTable::HEADER_FROM,
+    CMessageTable::HEADER_TO,
+    CMessageTable::HEADER_CC,
+    CMessageTable::HEADER_SUBJECT
+};
+
+
+/*
+ * Constructor.
+ */
+CTrigramIndex::CTrigramIndex()
+{
+    m_entries = 0;
+    m_stale   = 0;
+}
+
+
+/*
+ * Add the given row.
+ *
+ * The trigrams are found when we're next searched, rather than now, so
+ * a folder which is never searched costs nothing.
+ */
+void CTrigramIndex::add(uint32_t row)
+{
+    if (m_indexed.find(row) == m_indexed.end())
+        m_pending.insert(row);
+}
+
+
+/*
+ * Remove the given row.
+ */
+void CTrigramIndex::remove(uint32_t row)
+{
+    m_pending.erase(row);
+
+    auto it = m_indexed.find(row);
+
+    if (it == m_indexed.end())
+        return;
+
+    m_stale += it->second;
+    m_indexed.erase(it);
+}
+
+
+/*
+ * Forget every row.
+ */
+void CTrigramIndex::clear()
+{
+    m_postings.clear();
+    m_unsorted.clear();
+    m_indexed.clear();
+    m_pending.clear();
+
+    m_entries = 0;
+    m_stale   = 0;
+}
+
+
+/*
+ * Is the given row indexed?
+ */
+bool CTrigramIndex::covers(uint32_t row) const
+{
+    return (m_indexed.find(row) != m_indexed.end());
+}
+
+
+/*
+ * Add the trigrams of the given text, lower-cased.
+ */
+void CTrigramIndex::trigrams(const char *text, std::vector<uint32_t> &out)
+{
+    if (text == NULL)
+        return;
+
+    uint32_t gram = 0;
+    size_t len = 0;
+
+    for (const char *p = text; *p; p++)
+    {
+        gram = ((gram << 8) | (unsigned char)tolower((unsigned char)*p)) & 0xFFFFFF;
+
+        if (++len >= 3)
+            out.push_back(gram);
+    }
+}
+
+
+/*
+ * Index the headers of the given row.
+ */
+void CTrigramIndex::index(uint32_t row)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    std::vector<uint32_t> grams;
+
+    for (CMessageTable::CKeyHeader key : indexed_headers)
+        trigrams(table->header_data(row, key), grams);
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+    for (uint32_t gram : grams)
+    {
+        std::vector<uint32_t> &list = m_postings[gram];
+
+        if ((! list.empty()) && (list.back() >= row))
+            m_unsorted.insert(gram);
+
+        list.push_back(row);
+    }
+
+    m_indexed[row] = grams.size();
+    m_entries += grams.size();
+}
+
+
+/*
+ * Index the rows whose headers have been read.
+ */
+void CTrigramIndex::catch_up()
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    for (auto it = m_pending.begin(); it != m_pending.end();)
+    {
+        if (table->state(*it) & CMessageTable::STATE_HEADERS)
+        {
+            index(*it);
+            it = m_pending.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    /*
+     * Once most of the entries of our lists are for rows which have
+     * gone it is cheaper to start again.
+     */
+    if ((m_stale > 0) && (m_stale * 2 > m_entries))
+        compact();
+}
+
+
+/*
+ * Rebuild our lists from the rows which remain.
+ */
+void CTrigramIndex::compact()
+{
+    std::vector<uint32_t> rows;
+    rows.reserve(m_indexed.size());
+
+    for (auto it = m_indexed.begin(); it != m_indexed.end(); ++it)
+        rows.push_back(it->first);
+
+    std::sort(rows.begin(), rows.end());
+
+    m_postings.clear();
+    m_unsorted.clear();
+    m_indexed.clear();
+    m_entries = 0;
+    m_stale   = 0;
+
+    for (uint32_t row : rows)
+        index(row);
+}
+
+
+/*
+ * Find the rows which might match the given regular expression.
+ */
+bool CTrigramIndex::candidates(const std::string &pattern, std::vector<uint32_t> &rows)
+{
+    rows.clear();
+
+    std::vector<uint32_t> grams;
+
+    for (const std::string &literal : literals(pattern))
+        trigrams(literal.c_str(), grams);
+
+    if (grams.empty())
+        return false;
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+    catch_up();
+
+    /*
+     * The lists we need, shortest first.
+     */
+    std::vector<std::vector<uint32_t> *> lists;
+
+    for (uint32_t gram : grams)
+    {
+        auto it = m_postings.find(gram);
+
+        if (it == m_postings.end())
+            return true;
+
+        /*
+         * A row whose number was reused might appear twice.
+         */
+        if (m_unsorted.erase(gram))
+        {
+            std::vector<uint32_t> &list = it->second;
+            std::sort(list.begin(), list.end());
+            list.erase(std::unique(list.begin(), list.end()), list.end());
+        }
+
+        lists.push_back(&it->second);
+    }
+
+    std::sort(lists.begin(), lists.end(), [](std::vector<uint32_t> *a, std::vector<uint32_t> *b)
+    {
+        return (a->size() < b->size());
+    });
+
+    rows = *lists[0];
+
+    for (size_t i = 1; (i < lists.size()) && (! rows.empty()); i++)
+    {
+        std::vector<uint32_t> both;
+        std::set_intersection(rows.begin(), rows.end(), lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(both));
+        rows.swap(both);
+    }
+
+    /*
+     * Drop the rows which have been removed.
+     */
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [this](uint32_t row)
+    {
+        return (! covers(row));
+    }), rows.end());
+
+    return true;
+}
+
+
+/*
+ * Return the literal text a regular expression requires.
+ *
+ * We only need to be conservative: text inside a group, a class, or
+ * followed by a quantifier which allows it to be absent, is ignored.
+ */
+std::vector<std::string> CTrigramIndex::literals(const std::string &pattern)
+{
+    std::vector<std::string> runs;
+    std::string current;
+    int depth = 0;
+
+    auto flush = [&runs, &current]()
+    {
+        if (current.size() >= 3)
+            runs.push_back(current);
+
+        current.clear();
+    };
+
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        unsigned char c = pattern[i];
+
+        switch (c)
+        {
+        case '\\':
+        {
+            if (i + 1 >= pattern.size())
+                break;
+
+            unsigned char next = pattern[++i];
+
+            /*
+             * `\Q...\E` quotes text we'd have to parse specially, while
+             * `\d`, `\w`, `\b` and friends aren't literals at all.
+             */
+            if (next == 'Q')
+                return (std::vector<std::string>());
+
+            if (isalnum(next))
+                flush();
+            else if (depth == 0)
+                current += (char)next;
+
+            break;
+        }
+
+        case '|':
+            if (depth == 0)
+                return (std::vector<std::string>());
+
+            break;
+
+        case '(':
+            flush();
+            depth += 1;
+            break;
+
+        case ')':
+            flush();
+
+            if (depth > 0)
+                depth -= 1;
+
+            break;
+
+        case '[':
+            flush();
+
+            /*
+             * Skip the class, in which `]` may come first, and which may
+             * contain POSIX classes such as `[:alpha:]` - along with the
+             * collating elements `[.x.]` and `[=x=]` - which have their
+             * own closing `]`.
+             */
+            i += 1;
+
+            if ((i < pattern.size()) && (pattern[i] == '^'))
+                i += 1;
+
+            if ((i < pattern.size()) && (pattern[i] == ']'))
+                i += 1;
+
+            while ((i < pattern.size()) && (pattern[i] != ']'))
+            {
+                if (pattern[i] == '\\')
+                {
+                    i += 2;
+                    continue;
+                }
+
+                if ((pattern[i] == '[') && (i + 1 < pattern.size()) &&
+                        ((pattern[i + 1] == ':') || (pattern[i + 1] == '.') || (pattern[i + 1] == '=')))
+                {
+                    const char close[] = { pattern[i + 1], ']', '\0' };
+                    size_t end = pattern.find(close, i + 2);
+
+                    if (end != std::string::npos)
+                    {
+                        i = end + 2;
+                        continue;
+                    }
+                }
+
+                i += 1;
+            }
+
+            break;
+
+        case '*':
+        case '?':
+        case '{':
+            /*
+             * The character before might not be present at all.
+             */
+            if (! current.empty())
+                current.erase(current.size() - 1);
+
+            flush();
+
+            if (c == '{')
+            {
+                while ((i < pattern.size()) && (pattern[i] != '}'))
+                    i += 1;
+            }
+
+            break;
+
+        case '+':
+        case '.':
+        case '^':
+        case '$':
+            flush();
+            break;
+
+        default:
+            if (depth == 0)
+                current += (char)tolower(c);
+        }
+    }
+
+    flush();
+
+    return (runs);
+}
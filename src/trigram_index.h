@@ -0,0 +1,151 @@
+/*
+ * trigram_index.h - Narrow searches of the key headers of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * The CTrigramIndex class records which rows of the message-table have
+ * each sequence of three bytes - a trigram - in their `From:`, `To:`,
+ * `Cc:`, or `Subject:` headers, lower-cased.
+ *
+ * A regular expression can only match a header which contains every
+ * trigram of the literal text it requires, so the rows which might
+ * match are found without looking at the rest - and only those need be
+ * given to the real matcher.
+ *
+ * Rows are added as the maildir finds them, but are only indexed once
+ * their headers have been read, which is checked each time we're asked
+ * for candidates.  The rows of removed messages are dropped from our
+ * lists lazily, once there are enough of them.
+ *
+ */
+class CTrigramIndex
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CTrigramIndex();
+
+public:
+
+    /**
+     * Add the given row, which is indexed once its headers are known.
+     */
+    void add(uint32_t row);
+
+    /**
+     * Remove the given row - before it is released.
+     */
+    void remove(uint32_t row);
+
+    /**
+     * Forget every row.
+     */
+    void clear();
+
+    /**
+     * Find the rows which might match the given regular expression,
+     * which is matched without regard to case, in sorted order.
+     *
+     * A row whose number was reused since our lists were compacted
+     * might be returned for the text of the message it replaced, so
+     * each must still be given to the real matcher.
+     *
+     * Returns false if the expression requires no literal text long
+     * enough to narrow the search, in which case every row might match.
+     */
+    bool candidates(const std::string &pattern, std::vector<uint32_t> &rows);
+
+    /**
+     * Is the given row indexed?  Rows which aren't are not returned as
+     * candidates, but might still match.
+     */
+    bool covers(uint32_t row) const;
+
+    /**
+     * Return the runs of literal text, lower-cased, which any string
+     * matching the given regular expression must contain.
+     *
+     * Nothing is returned for an expression with alternatives, since
+     * none of its text is required.
+     */
+    static std::vector<std::string> literals(const std::string &pattern);
+
+private:
+
+    /**
+     * Index the headers of the given row.
+     */
+    void index(uint32_t row);
+
+    /**
+     * Index the rows whose headers have been read since they were added.
+     */
+    void catch_up();
+
+    /**
+     * Rebuild our lists, without the rows which have been removed.
+     */
+    void compact();
+
+    /**
+     * Add the trigrams of the given text to the given list.
+     */
+    static void trigrams(const char *text, std::vector<uint32_t> &out);
+
+private:
+
+    /**
+     * The rows with each trigram, in the order they were added - which
+     * might include rows which have since been removed.
+     */
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_postings;
+
+    /**
+     * The trigrams whose lists have been added to since they were last
+     * sorted.
+     */
+    std::unordered_set<uint32_t> m_unsorted;
+
+    /**
+     * The rows we've indexed, and the number of trigrams of each.
+     */
+    std::unordered_map<uint32_t, uint32_t> m_indexed;
+
+    /**
+     * The rows whose headers have not yet been read.
+     */
+    std::unordered_set<uint32_t> m_pending;
+
+    /**
+     * The number of entries in our lists, and the number of those which
+     * are for rows that have been removed.
+     */
+    size_t m_entries;
+    size_t m_stale;
+};
@@ -0,0 +1,216 @@
+/*
+ * trigram_index_test.cc - Test-cases for our trigram index.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "message_table.h"
+#include "trigram_index.h"
+#include "CuTest.h"
+
+
+/**
+ * Add a row with the given key headers to the table.
+ */
+static uint32_t trigram_row(const char *from, const char *cc, const char *subject)
+{
+    CMessageTable *table = CMessageTable::instance();
+    uint32_t row = table->insert("/tmp/Maildir/cur/trigram.test");
+
+    const char *values[CMessageTable::HEADER_COUNT] = { NULL };
+    values[CMessageTable::HEADER_FROM]    = from;
+    values[CMessageTable::HEADER_CC]      = cc;
+    values[CMessageTable::HEADER_SUBJECT] = subject;
+
+    table->set_headers(row, values, 0, 0);
+    return (row);
+}
+
+
+/**
+ * Join the literals of the given expression.
+ */
+static std::string trigram_literals(const char *pattern)
+{
+    std::string out;
+
+    for (const std::string &literal : CTrigramIndex::literals(pattern))
+        out += (out.empty() ? "" : ",") + literal;
+
+    return (out);
+}
+
+
+/**
+ * Test that the literal text an expression requires is found.
+ */
+void TestTrigramIndexLiterals(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "steve", trigram_literals("Steve").c_str());
+    CuAssertStrEquals(tc, "hello,world", trigram_literals("hello.*world").c_str());
+    CuAssertStrEquals(tc, "re:", trigram_literals("^re: ?").c_str());
+    CuAssertStrEquals(tc, "examp,e.com", trigram_literals("exampl?e\\.com").c_str());
+    CuAssertStrEquals(tc, "bar", trigram_literals("(foo)?bar[abc]+\\d").c_str());
+    CuAssertStrEquals(tc, "abc,xyz", trigram_literals("abcd{2,3}xyz").c_str());
+    CuAssertStrEquals(tc, "", trigram_literals("ab").c_str());
+    CuAssertStrEquals(tc, "", trigram_literals("foo|bar").c_str());
+    CuAssertStrEquals(tc, "", trigram_literals("\\Qa.b\\E").c_str());
+
+    /*
+     * POSIX classes, and collating elements, close their own brackets.
+     */
+    CuAssertStrEquals(tc, "bob", trigram_literals("[[:alpha:]]bob").c_str());
+    CuAssertStrEquals(tc, "foo,bar", trigram_literals("foo[[:space:]]bar").c_str());
+    CuAssertStrEquals(tc, "xyz", trigram_literals("[^[.-.][=e=]]xyz").c_str());
+}
+
+
+/**
+ * Test that candidates are found, and that removed rows aren't.
+ */
+void TestTrigramIndexCandidates(CuTest * tc)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    std::vector<uint32_t> rows;
+    rows.push_back(trigram_row("Steve Kemp <steve@example.com>", NULL, "Hello World"));
+    rows.push_back(trigram_row("Bob <bob@example.org>", "steve@example.com", "Lunch"));
+    rows.push_back(trigram_row("Alice <alice@example.net>", NULL, "Re: Hello"));
+
+    /*
+     * A row whose headers haven't been read isn't indexed until they
+     * have been.
+     */
+    uint32_t unread = table->insert("/tmp/Maildir/cur/trigram.unread");
+
+    CTrigramIndex index;
+
+    for (uint32_t row : rows)
+        index.add(row);
+
+    index.add(unread);
+
+    std::vector<uint32_t> found;
+
+    CuAssertTrue(tc, index.candidates("STEVE", found));
+    CuAssertIntEquals(tc, 2, found.size());
+    CuAssertTrue(tc, std::find(found.begin(), found.end(), rows[0]) != found.end());
+    CuAssertTrue(tc, std::find(found.begin(), found.end(), rows[1]) != found.end());
+
+    CuAssertTrue(tc, index.candidates("^re: hel+o", found));
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, rows[2], found[0]);
+
+    CuAssertTrue(tc, index.candidates("example\\.(org|net)", found));
+    CuAssertIntEquals(tc, 3, found.size());
+
+    CuAssertTrue(tc, index.candidates("nobody", found));
+    CuAssertIntEquals(tc, 0, found.size());
+
+    CuAssertTrue(tc, ! index.candidates("a|b", found));
+    CuAssertTrue(tc, ! index.covers(unread));
+
+    const char *values[CMessageTable::HEADER_COUNT] = { NULL };
+    values[CMessageTable::HEADER_SUBJECT] = "Steve's lunch";
+    table->set_headers(unread, values, 0, 0);
+
+    CuAssertTrue(tc, index.candidates("lunch", found));
+    CuAssertIntEquals(tc, 2, found.size());
+    CuAssertTrue(tc, index.covers(unread));
+
+    /*
+     * Removed rows are no longer candidates, and their numbers may be
+     * reused.
+     */
+    index.remove(rows[1]);
+    table->release(rows[1]);
+
+    CuAssertTrue(tc, index.candidates("lunch", found));
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, unread, found[0]);
+
+    rows[1] = trigram_row("Carol", NULL, "Dinner");
+    index.add(rows[1]);
+
+    CuAssertTrue(tc, index.candidates("dinner", found));
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, rows[1], found[0]);
+
+    for (uint32_t row : rows)
+        table->release(row);
+
+    table->release(unread);
+}
+
+
+/**
+ * Test that the regular expressions find() makes from Lua patterns are
+ * narrowed correctly.
+ */
+void TestTrigramIndexLuaPatterns(CuTest * tc)
+{
+    CMessageTable *table = CMessageTable::instance();
+
+    std::vector<uint32_t> rows;
+    rows.push_back(trigram_row("Steve Kemp <steve@example.com>", NULL, "Hello World"));
+    rows.push_back(trigram_row("Alice <alice@example.net>", NULL, "Re: Hello"));
+
+    CTrigramIndex index;
+
+    for (uint32_t row : rows)
+        index.add(row);
+
+    std::vector<uint32_t> found;
+
+    /*
+     * "hello%sworld"
+     */
+    CuAssertTrue(tc, index.candidates("hello[[:space:]]world", found));
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, rows[0], found[0]);
+
+    /*
+     * "^re%: h.-o"
+     */
+    CuAssertTrue(tc, index.candidates("^re\\: h.*?o", found));
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, rows[1], found[0]);
+
+    /*
+     * "%a+@example%.%a%a%a"
+     */
+    CuAssertTrue(tc, index.candidates("[[:alpha:]]+@example\\.[[:alpha:]][[:alpha:]][[:alpha:]]", found));
+    CuAssertIntEquals(tc, 2, found.size());
+
+    for (uint32_t row : rows)
+        table->release(row);
+}
+
+
+
+CuSuite *
+trigram_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestTrigramIndexLiterals);
+    SUITE_ADD_TEST(suite, TestTrigramIndexCandidates);
+    SUITE_ADD_TEST(suite, TestTrigramIndexLuaPatterns);
+    return suite;
+}
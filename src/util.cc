@@ -62,6 +62,23 @@ std::string escape_filename(std::string path)
 }
 
 
+/*
+ * Hash the given bytes, with 64-bit FNV-1a.
+ */
+uint64_t hash_string(const char *str, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return (hash);
+}
+
+
 
 /*
  * Returns length indicated by first byte.
@@ -21,6 +21,8 @@
 
 #include <algorithm>
 #include <sstream>
+#include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
 
@@ -64,6 +66,13 @@ std::vector<std::string> split(const std::string &text, char sep);
  */
 std::string escape_filename(std::string path);
 
+/**
+ * Hash the given bytes, with 64-bit FNV-1a.
+ *
+ * The result is stored in our index-files, so it must never change.
+ */
+uint64_t hash_string(const char *str, size_t len);
+
 /**
  * Return the number of bytes the given character-prefix contains
  * in a UTF-8 string.
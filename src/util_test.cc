@@ -120,6 +120,17 @@ void TestEscape(CuTest * tc)
 }
 
 
+/**
+ * Test our hash function, whose results are stored in our indexes.
+ */
+void TestHashString(CuTest * tc)
+{
+    CuAssertTrue(tc, hash_string("", 0) == 0xcbf29ce484222325ULL);
+    CuAssertTrue(tc, hash_string("a", 1) == 0xaf63dc4c8601ec8cULL);
+    CuAssertTrue(tc, hash_string("foobar", 6) == 0x85944171f73967e8ULL);
+}
+
+
 
 CuSuite *
 util_getsuite()
@@ -127,5 +138,6 @@ util_getsuite()
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestSplit);
     SUITE_ADD_TEST(suite, TestEscape);
+    SUITE_ADD_TEST(suite, TestHashString);
     return suite;
 }